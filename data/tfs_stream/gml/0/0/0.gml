@@ -0,0 +1,27 @@
+<?xml version="1.0" encoding="UTF-8"?>
+<wfs:FeatureCollection xmlns:wfs="http://www.opengis.net/wfs" xmlns:gml="http://www.opengis.net/gml" xmlns:osgearth="http://osgearth.org">
+  <gml:featureMember>
+    <osgearth:parks fid="parks.1">
+      <osgearth:name>Public Garden</osgearth:name>
+      <osgearth:the_geom>
+        <gml:Polygon srsName="EPSG:4326">
+          <gml:outerBoundaryIs>
+            <gml:LinearRing>
+              <gml:coordinates>-71.0733,42.3547 -71.0693,42.3560 -71.0684,42.3537 -71.0721,42.3525 -71.0733,42.3547</gml:coordinates>
+            </gml:LinearRing>
+          </gml:outerBoundaryIs>
+        </gml:Polygon>
+      </osgearth:the_geom>
+    </osgearth:parks>
+  </gml:featureMember>
+  <gml:featureMember>
+    <osgearth:parks fid="parks.2">
+      <osgearth:name>Charles River Esplanade</osgearth:name>
+      <osgearth:the_geom>
+        <gml:LineString srsName="EPSG:4326">
+          <gml:coordinates>-71.0920,42.3528 -71.0830,42.3552 -71.0740,42.3590</gml:coordinates>
+        </gml:LineString>
+      </osgearth:the_geom>
+    </osgearth:parks>
+  </gml:featureMember>
+</wfs:FeatureCollection>
@@ -0,0 +1,916 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2013 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <osg/ArgumentParser>
+#include <osg/AnimationPath>
+#include <osg/Timer>
+#include <osgDB/ReadFile>
+#include <OpenThreads/Thread>
+#include <OpenThreads/Atomic>
+
+#include <osgEarth/Common>
+#include <osgEarth/Map>
+#include <osgEarth/MapFrame>
+#include <osgEarth/MapNode>
+#include <osgEarth/Cache>
+#include <osgEarth/CacheBin>
+#include <osgEarth/ImageUtils>
+#include <osgEarth/Instrumentation>
+#include <osgEarth/Registry>
+#include <osgEarth/TerrainEngineNode>
+#include <osgEarth/TileSource>
+#include <osgEarthFeatures/FeatureModelSource>
+#include <osgEarthFeatures/FeatureCursor>
+#include <osgEarthUtil/TilePrefetcher>
+#include <osgEarthDrivers/feature_ogr/OGRFeatureOptions>
+
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <set>
+
+using namespace osgEarth;
+using namespace osgEarth::Features;
+using namespace osgEarth::Util;
+using namespace osgEarth::Drivers;
+
+#define LC "[osgearth_bench] "
+
+/**
+ * Headless benchmark for the tile generation paths. Loads an earth file,
+ * builds a fixed set of tile keys, and drives each "suite" over that key
+ * set with a pool of worker threads, timing every operation. Results
+ * (throughput and latency percentiles per suite, plus the per-stage
+ * breakdown from Registry::instrumentation()) are written as JSON so runs
+ * can be diffed for regressions.
+ *
+ * Everything runs locally: use earth files with GDAL files, the noise
+ * driver, and local feature data (see tests/bench.earth).
+ */
+
+int
+usage( const std::string& msg )
+{
+    if ( !msg.empty() )
+    {
+        std::cout << msg << std::endl;
+    }
+
+    std::cout
+        << std::endl
+        << "USAGE: osgearth_bench file.earth" << std::endl
+        << std::endl
+        << "    [--suite name]*                     ; Suite to run: tiles, images, elevation, features, cache (default=all)" << std::endl
+        << "    [--min-level level]                 ; Lowest LOD in the key set (default=0)" << std::endl
+        << "    [--max-level level]                 ; Highest LOD in the key set (default=4)" << std::endl
+        << "    [--bounds xmin ymin xmax ymax]      ; Restrict the key set to a box (in map coordinates; default=entire map)" << std::endl
+        << "    [--max-keys n]                      ; Caps the size of the key set (default=no limit)" << std::endl
+        << "    [--threads n]                       ; Number of worker threads (default=1)" << std::endl
+        << "    [--passes n]                        ; Times to run each suite over the key set (default=1)" << std::endl
+        << "    [--replay file.path]                ; Also replay a recorded camera path through the tile prefetcher" << std::endl
+        << "    [--out file.json]                   ; Write the report to a file instead of stdout" << std::endl
+        << std::endl
+        << "   osgearth_bench --ogr-scaling file.shp" << std::endl
+        << std::endl
+        << "    [--threads n]                       ; Highest thread count to measure; runs 1, 2, 4 ... n (default=8)" << std::endl
+        << "    [--grid n]                          ; Splits the layer extent into n x n queries (default=16)" << std::endl
+        << "    [--passes n]                        ; Times to read the whole grid at each thread count (default=1)" << std::endl
+        << "    [--out file.json]                   ; Write the report to a file instead of stdout" << std::endl
+        << std::endl
+        << "   osgearth_bench --data-extents n" << std::endl
+        << std::endl
+        << "    [--queries n]                       ; Number of random tile keys to look up (default=100000)" << std::endl
+        << "    [--passes n]                        ; Times to look up the whole key set (default=1)" << std::endl
+        << "    [--out file.json]                   ; Write the report to a file instead of stdout" << std::endl
+        << std::endl;
+
+    return -1;
+}
+
+namespace
+{
+    std::string jsonString( const std::string& in )
+    {
+        std::string out = "\"";
+        for( std::string::const_iterator c = in.begin(); c != in.end(); ++c )
+        {
+            if ( *c == '"' || *c == '\\' )
+                out += '\\';
+            if ( (unsigned char)*c >= 0x20 )
+                out += *c;
+        }
+        return out + "\"";
+    }
+
+    /** One benchmarked operation over a single key; returns false on failure. */
+    struct Operation : public osg::Referenced
+    {
+        virtual bool run( const TileKey& key ) =0;
+    };
+
+    struct CreateTileOperation : public Operation
+    {
+        CreateTileOperation( TerrainEngineNode* engine ) : _engine(engine) { }
+        bool run( const TileKey& key )
+        {
+            osg::ref_ptr<osg::Node> node = _engine->createTile( key );
+            return node.valid();
+        }
+        osg::ref_ptr<TerrainEngineNode> _engine;
+    };
+
+    struct CreateImageOperation : public Operation
+    {
+        CreateImageOperation( const ImageLayerVector& layers ) : _layers(layers) { }
+        bool run( const TileKey& key )
+        {
+            bool ok = true;
+            for( ImageLayerVector::const_iterator i = _layers.begin(); i != _layers.end(); ++i )
+            {
+                if ( i->get()->isKeyValid(key) )
+                    ok = i->get()->createImage( key ).valid() && ok;
+            }
+            return ok;
+        }
+        ImageLayerVector _layers;
+    };
+
+    struct CreateHeightFieldOperation : public Operation
+    {
+        CreateHeightFieldOperation( const ElevationLayerVector& layers ) : _layers(layers) { }
+        bool run( const TileKey& key )
+        {
+            bool ok = true;
+            for( ElevationLayerVector::const_iterator i = _layers.begin(); i != _layers.end(); ++i )
+            {
+                if ( i->get()->isKeyValid(key) )
+                    ok = i->get()->createHeightField( key ).valid() && ok;
+            }
+            return ok;
+        }
+        ElevationLayerVector _layers;
+    };
+
+    /** Queries each feature source for the features under a tile and reads them. */
+    struct FeatureQueryOperation : public Operation
+    {
+        FeatureQueryOperation( const std::vector< osg::ref_ptr<FeatureSource> >& sources ) : _sources(sources) { }
+        bool run( const TileKey& key )
+        {
+            for( unsigned i=0; i<_sources.size(); ++i )
+            {
+                const FeatureProfile* profile = _sources[i]->getFeatureProfile();
+                if ( !profile )
+                    return false;
+
+                GeoExtent extent = key.getExtent().transform( profile->getSRS() );
+                if ( !extent.isValid() )
+                    continue;
+
+                Symbology::Query query;
+                query.bounds() = extent.bounds();
+
+                osg::ref_ptr<FeatureCursor> cursor = _sources[i]->createFeatureCursor( query );
+                while( cursor.valid() && cursor->hasMore() )
+                {
+                    osg::ref_ptr<Feature> feature = cursor->nextFeature();
+                }
+            }
+            return true;
+        }
+        std::vector< osg::ref_ptr<FeatureSource> > _sources;
+    };
+
+    /** Writes a synthetic tile into a scratch cache bin and reads it back. */
+    struct CacheOperation : public Operation
+    {
+        CacheOperation( CacheBin* bin ) : _bin(bin)
+        {
+            _image = ImageUtils::createEmptyImage( 256, 256 );
+            unsigned char* data = _image->data();
+            for( unsigned i=0; i<_image->getTotalSizeInBytes(); ++i )
+                data[i] = (unsigned char)((i * 2654435761u) >> 24);
+        }
+        bool run( const TileKey& key )
+        {
+            std::string name = key.str();
+            if ( !_bin->write(name, _image.get()) )
+                return false;
+            ReadResult r = _bin->readImage( name, 0 );
+            return r.succeeded();
+        }
+        osg::ref_ptr<CacheBin>   _bin;
+        osg::ref_ptr<osg::Image> _image;
+    };
+
+    /** Runs an operation over the shared key list until it's exhausted. */
+    struct Worker : public OpenThreads::Thread
+    {
+        Worker( Operation*                  op,
+                const std::vector<TileKey>& keys,
+                OpenThreads::Atomic&        next,
+                LatencyHistogram*           latency,
+                InstrumentationCounter*     failures )
+            : _op(op), _keys(keys), _next(next), _latency(latency), _failures(failures) { }
+
+        void run()
+        {
+            for( unsigned i = (++_next)-1; i < _keys.size(); i = (++_next)-1 )
+            {
+                osg::Timer_t start = osg::Timer::instance()->tick();
+                bool ok = _op->run( _keys[i] );
+                _latency->recordSince( start );
+                if ( !ok )
+                    _failures->increment();
+            }
+        }
+
+        Operation*                  _op;
+        const std::vector<TileKey>& _keys;
+        OpenThreads::Atomic&        _next;
+        LatencyHistogram*           _latency;
+        InstrumentationCounter*     _failures;
+    };
+
+    struct SuiteResult
+    {
+        std::string _name;
+        unsigned    _ops;
+        unsigned    _failures;
+        double      _seconds;
+        double      _mean, _p50, _p90, _p99, _max;
+    };
+
+    SuiteResult
+    runSuite( const std::string&          name,
+              Operation*                  op,
+              const std::vector<TileKey>& keys,
+              unsigned                    numThreads,
+              unsigned                    passes,
+              Instrumentation*            results )
+    {
+        LatencyHistogram*       latency  = results->getHistogram( name );
+        InstrumentationCounter* failures = results->getCounter( name + ".failures" );
+
+        OE_NOTICE << LC << "Running \"" << name << "\" over " << keys.size() << " keys..." << std::endl;
+
+        osg::Timer_t start = osg::Timer::instance()->tick();
+
+        for( unsigned p=0; p<passes; ++p )
+        {
+            OpenThreads::Atomic next;
+            std::vector<Worker*> workers;
+            for( unsigned t=0; t<numThreads; ++t )
+            {
+                workers.push_back( new Worker(op, keys, next, latency, failures) );
+                workers.back()->start();
+            }
+            for( unsigned t=0; t<workers.size(); ++t )
+            {
+                workers[t]->join();
+                delete workers[t];
+            }
+        }
+
+        SuiteResult r;
+        r._name     = name;
+        r._seconds  = osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+        r._ops      = latency->getCount();
+        r._failures = failures->get();
+
+        std::vector<unsigned> buckets;
+        latency->getBuckets( buckets );
+        r._mean = LatencyHistogram::getMean( buckets );
+        r._p50  = LatencyHistogram::getPercentile( buckets, 50.0 );
+        r._p90  = LatencyHistogram::getPercentile( buckets, 90.0 );
+        r._p99  = LatencyHistogram::getPercentile( buckets, 99.0 );
+        r._max  = LatencyHistogram::getMax( buckets );
+        return r;
+    }
+
+    /** Reads the features under a shared list of query bounds until it's exhausted. */
+    struct FeatureScanWorker : public OpenThreads::Thread
+    {
+        FeatureScanWorker( FeatureSource*             source,
+                           const std::vector<Bounds>& cells,
+                           OpenThreads::Atomic&       next,
+                           OpenThreads::Atomic&       features )
+            : _source(source), _cells(cells), _next(next), _features(features) { }
+
+        void run()
+        {
+            for( unsigned i = (++_next)-1; i < _cells.size(); i = (++_next)-1 )
+            {
+                Symbology::Query query;
+                query.bounds() = _cells[i];
+
+                osg::ref_ptr<FeatureCursor> cursor = _source->createFeatureCursor( query );
+                while( cursor.valid() && cursor->hasMore() )
+                {
+                    cursor->nextFeature();
+                    ++_features;
+                }
+            }
+        }
+
+        FeatureSource*             _source;
+        const std::vector<Bounds>& _cells;
+        OpenThreads::Atomic&       _next;
+        OpenThreads::Atomic&       _features;
+    };
+
+    /**
+     * Reads a local shapefile through the OGR driver with 1, 2, 4 ... maxThreads
+     * threads and reports how the feature read rate scales with the thread count.
+     */
+    int
+    runOGRScaling( const std::string& file,
+                   unsigned           maxThreads,
+                   unsigned           grid,
+                   unsigned           passes,
+                   const std::string& outFile )
+    {
+        OGRFeatureOptions ogr;
+        ogr.url() = file;
+
+        osg::ref_ptr<FeatureSource> source = FeatureSourceFactory::create( ogr );
+        if ( !source.valid() )
+            return usage( "Failed to load the OGR feature driver." );
+
+        source->initialize( 0L );
+        const FeatureProfile* profile = source->getFeatureProfile();
+        if ( !profile || !profile->getExtent().isValid() )
+            return usage( "Failed to open " + file );
+
+        // split the layer's extent into a grid of queries, like tiles would.
+        const GeoExtent& ex = profile->getExtent();
+        std::vector<Bounds> cells;
+        double dx = ex.width() / (double)grid, dy = ex.height() / (double)grid;
+        for( unsigned y=0; y<grid; ++y )
+            for( unsigned x=0; x<grid; ++x )
+                cells.push_back( Bounds(
+                    ex.xMin() + dx*(double)x,     ex.yMin() + dy*(double)y,
+                    ex.xMin() + dx*(double)(x+1), ex.yMin() + dy*(double)(y+1) ) );
+
+        std::stringstream buf;
+        buf << std::fixed << std::setprecision(3);
+        buf << "{\n"
+            << "  \"file\": " << jsonString(file) << ",\n"
+            << "  \"queries\": " << cells.size() << ",\n"
+            << "  \"passes\": " << passes << ",\n"
+            << "  \"runs\": [";
+
+        double baseRate = 0.0;
+        for( unsigned numThreads = 1; numThreads <= maxThreads; numThreads *= 2 )
+        {
+            OE_NOTICE << LC << "Reading " << file << " with " << numThreads << " thread(s)..." << std::endl;
+
+            OpenThreads::Atomic features;
+            osg::Timer_t start = osg::Timer::instance()->tick();
+
+            for( unsigned p=0; p<passes; ++p )
+            {
+                OpenThreads::Atomic next;
+                std::vector<FeatureScanWorker*> workers;
+                for( unsigned t=0; t<numThreads; ++t )
+                {
+                    workers.push_back( new FeatureScanWorker(source.get(), cells, next, features) );
+                    workers.back()->start();
+                }
+                for( unsigned t=0; t<workers.size(); ++t )
+                {
+                    workers[t]->join();
+                    delete workers[t];
+                }
+            }
+
+            double seconds = osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+            double rate    = seconds > 0.0 ? (double)(unsigned)features / seconds : 0.0;
+            if ( numThreads == 1 )
+                baseRate = rate;
+
+            buf << (numThreads > 1 ? "," : "") << "\n    { "
+                << "\"threads\": "          << numThreads << ", "
+                << "\"features\": "         << (unsigned)features << ", "
+                << "\"seconds\": "          << seconds << ", "
+                << "\"features_per_sec\": " << rate << ", "
+                << "\"speedup\": "          << (baseRate > 0.0 ? rate/baseRate : 0.0) << " }";
+        }
+        buf << "\n  ]\n}\n";
+
+        if ( outFile.empty() )
+        {
+            std::cout << buf.str();
+        }
+        else
+        {
+            std::ofstream out( outFile.c_str() );
+            out << buf.str();
+            if ( !out.good() )
+            {
+                OE_WARN << LC << "Failed to write report to " << outFile << std::endl;
+                return -1;
+            }
+            OE_NOTICE << LC << "Wrote report to " << outFile << std::endl;
+        }
+        return 0;
+    }
+
+    /** Cheap repeatable pseudo-random number in [0..1). */
+    double nextRandom( unsigned& seed )
+    {
+        seed = seed * 1664525u + 1013904223u;
+        return (double)(seed >> 8) / (double)(1u << 24);
+    }
+
+    /** A tile source with nothing in it but a list of synthetic data extents. */
+    class DataExtentsTileSource : public TileSource
+    {
+    public:
+        DataExtentsTileSource( unsigned numExtents ) : _numExtents(numExtents) { }
+
+        Status initialize( const osgDB::Options* dbOptions )
+        {
+            setProfile( Registry::instance()->getGlobalGeodeticProfile() );
+            const SpatialReference* srs = getProfile()->getSRS();
+
+            // small scattered patches of up to a degree or so, each
+            // with its own LOD range, like a large tile index would have.
+            unsigned seed = 1u;
+            for( unsigned i=0; i<_numExtents; ++i )
+            {
+                double w = 0.01 + nextRandom(seed);
+                double h = 0.01 + nextRandom(seed);
+                double x = -180.0 + (360.0 - w) * nextRandom(seed);
+                double y =  -90.0 + (180.0 - h) * nextRandom(seed);
+                unsigned minLevel = (unsigned)(nextRandom(seed) * 8.0);
+                unsigned maxLevel = minLevel + 2 + (unsigned)(nextRandom(seed) * 12.0);
+                getDataExtents().push_back( DataExtent(GeoExtent(srs, x, y, x+w, y+h), minLevel, maxLevel) );
+            }
+            return STATUS_OK;
+        }
+
+        osg::Image* createImage( const TileKey& key, ProgressCallback* progress )
+        {
+            return 0L;
+        }
+
+        unsigned _numExtents;
+    };
+
+    /** The linear scan that TileSource::hasData used before its extents were indexed. */
+    bool scanDataExtents( const DataExtentList& extents, const TileKey& key )
+    {
+        unsigned lod = key.getLOD();
+        const GeoExtent& keyExtent = key.getExtent();
+        for( DataExtentList::const_iterator i = extents.begin(); i != extents.end(); ++i )
+        {
+            if ((!i->minLevel().isSet() || i->minLevel() <= lod) &&
+                (!i->maxLevel().isSet() || i->maxLevel() >= lod) &&
+                keyExtent.intersects(*i) )
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Times TileSource::hasData over a large list of data extents against
+     * the plain linear scan, and checks that both give the same answers.
+     */
+    int
+    runDataExtents( unsigned           numExtents,
+                    unsigned           numQueries,
+                    unsigned           passes,
+                    const std::string& outFile )
+    {
+        osg::ref_ptr<DataExtentsTileSource> source = new DataExtentsTileSource( numExtents );
+        osg::Timer_t start = osg::Timer::instance()->tick();
+        if ( source->startup(0L).isError() )
+            return usage( "Failed to start the data extents tile source." );
+        double indexSeconds = osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+
+        // random small tiles, the way the pager asks for them.
+        std::vector<TileKey> keys;
+        const Profile* profile = source->getProfile();
+        unsigned seed = 2u;
+        for( unsigned i=0; i<numQueries; ++i )
+        {
+            double x = -180.0 + 360.0 * nextRandom(seed);
+            double y =  -90.0 + 180.0 * nextRandom(seed);
+            unsigned lod = 4 + (unsigned)(nextRandom(seed) * 14.0);
+            keys.push_back( profile->createTileKey(x, y, lod) );
+        }
+
+        OE_NOTICE << LC << "Querying " << numExtents << " data extents with " << keys.size() << " keys..." << std::endl;
+
+        std::vector<bool> indexed( keys.size() );
+        start = osg::Timer::instance()->tick();
+        for( unsigned p=0; p<passes; ++p )
+            for( unsigned i=0; i<keys.size(); ++i )
+                indexed[i] = source->hasData( keys[i] );
+        double indexedSeconds = osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+
+        std::vector<bool> scanned( keys.size() );
+        const DataExtentList& extents = source->getDataExtents();
+        start = osg::Timer::instance()->tick();
+        for( unsigned p=0; p<passes; ++p )
+            for( unsigned i=0; i<keys.size(); ++i )
+                scanned[i] = scanDataExtents( extents, keys[i] );
+        double scannedSeconds = osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+
+        unsigned hits = 0, mismatches = 0;
+        for( unsigned i=0; i<keys.size(); ++i )
+        {
+            if ( indexed[i] ) ++hits;
+            if ( indexed[i] != scanned[i] ) ++mismatches;
+        }
+
+        if ( mismatches > 0 )
+        {
+            OE_WARN << LC << mismatches << " of " << keys.size() << " queries disagree with the linear scan" << std::endl;
+        }
+
+        double queries = (double)keys.size() * (double)passes;
+
+        std::stringstream buf;
+        buf << std::fixed << std::setprecision(3);
+        buf << "{\n"
+            << "  \"extents\": "       << numExtents << ",\n"
+            << "  \"queries\": "       << keys.size() << ",\n"
+            << "  \"passes\": "        << passes << ",\n"
+            << "  \"hits\": "          << hits << ",\n"
+            << "  \"mismatches\": "    << mismatches << ",\n"
+            << "  \"index_seconds\": " << indexSeconds << ",\n"
+            << "  \"runs\": [\n"
+            << "    { \"name\": \"indexed\", "
+            << "\"seconds\": "       << indexedSeconds << ", "
+            << "\"ns_per_query\": "  << indexedSeconds * 1.0e9 / queries << " },\n"
+            << "    { \"name\": \"linear\", "
+            << "\"seconds\": "       << scannedSeconds << ", "
+            << "\"ns_per_query\": "  << scannedSeconds * 1.0e9 / queries << " }\n"
+            << "  ],\n"
+            << "  \"speedup\": "       << (indexedSeconds > 0.0 ? scannedSeconds/indexedSeconds : 0.0) << "\n"
+            << "}\n";
+
+        if ( outFile.empty() )
+        {
+            std::cout << buf.str();
+        }
+        else
+        {
+            std::ofstream out( outFile.c_str() );
+            out << buf.str();
+            if ( !out.good() )
+            {
+                OE_WARN << LC << "Failed to write report to " << outFile << std::endl;
+                return -1;
+            }
+            OE_NOTICE << LC << "Wrote report to " << outFile << std::endl;
+        }
+        return mismatches > 0 ? -1 : 0;
+    }
+
+    struct CoarserKey
+    {
+        bool operator()( const TileKey& lhs, const TileKey& rhs ) const {
+            return lhs.getLevelOfDetail() < rhs.getLevelOfDetail(); }
+    };
+
+    void
+    collectKeys( const TileKey&        key,
+                 const GeoExtent&      bounds,
+                 unsigned              minLevel,
+                 unsigned              maxLevel,
+                 std::vector<TileKey>& out )
+    {
+        if ( bounds.isValid() && !bounds.intersects(key.getExtent()) )
+            return;
+
+        if ( key.getLevelOfDetail() >= minLevel )
+            out.push_back( key );
+
+        if ( key.getLevelOfDetail() < maxLevel )
+        {
+            for( unsigned q=0; q<4; ++q )
+                collectKeys( key.createChildKey(q), bounds, minLevel, maxLevel, out );
+        }
+    }
+}
+
+
+int
+main(int argc, char** argv)
+{
+    osg::ArgumentParser args(&argc,argv);
+
+    if ( args.read("--help") || argc < 2 )
+        return usage("");
+
+    std::string ogrFile;
+    if ( args.read("--ogr-scaling", ogrFile) )
+    {
+        unsigned maxThreads = 8;
+        while( args.read("--threads", maxThreads) );
+
+        unsigned grid = 16;
+        while( args.read("--grid", grid) );
+
+        unsigned passes = 1;
+        while( args.read("--passes", passes) );
+
+        std::string outFile;
+        while( args.read("--out", outFile) );
+
+        return runOGRScaling(
+            ogrFile, osg::maximum(maxThreads, 1u), osg::maximum(grid, 1u), osg::maximum(passes, 1u), outFile );
+    }
+
+    unsigned numExtents;
+    if ( args.read("--data-extents", numExtents) )
+    {
+        unsigned numQueries = 100000;
+        while( args.read("--queries", numQueries) );
+
+        unsigned passes = 1;
+        while( args.read("--passes", passes) );
+
+        std::string outFile;
+        while( args.read("--out", outFile) );
+
+        return runDataExtents(
+            osg::maximum(numExtents, 1u), osg::maximum(numQueries, 1u), osg::maximum(passes, 1u), outFile );
+    }
+
+    std::set<std::string> suites;
+    std::string suite;
+    while( args.read("--suite", suite) )
+        suites.insert( suite );
+    if ( suites.empty() )
+    {
+        suites.insert("tiles");
+        suites.insert("images");
+        suites.insert("elevation");
+        suites.insert("features");
+        suites.insert("cache");
+    }
+
+    unsigned minLevel = 0;
+    while( args.read("--min-level", minLevel) );
+
+    unsigned maxLevel = 4;
+    while( args.read("--max-level", maxLevel) );
+
+    bool haveBounds = false;
+    double xmin, ymin, xmax, ymax;
+    while( args.read("--bounds", xmin, ymin, xmax, ymax) )
+        haveBounds = true;
+
+    unsigned maxKeys = 0;
+    while( args.read("--max-keys", maxKeys) );
+
+    unsigned numThreads = 1;
+    while( args.read("--threads", numThreads) );
+    numThreads = osg::maximum( numThreads, 1u );
+
+    unsigned passes = 1;
+    while( args.read("--passes", passes) );
+    passes = osg::maximum( passes, 1u );
+
+    std::string replayFile;
+    while( args.read("--replay", replayFile) );
+
+    std::string outFile;
+    while( args.read("--out", outFile) );
+
+    osg::ref_ptr<osg::Node> node = osgDB::readNodeFiles( args );
+    if ( !node.valid() )
+        return usage( "Failed to read .earth file." );
+
+    MapNode* mapNode = MapNode::findMapNode( node.get() );
+    if ( !mapNode )
+        return usage( "Input file was not a .earth file" );
+
+    Map* map = mapNode->getMap();
+    MapFrame mapf( map, Map::ENTIRE_MODEL );
+    const Profile* profile = mapf.getProfile();
+
+    // build the key set, coarsest levels first.
+    GeoExtent bounds;
+    if ( haveBounds )
+        bounds = GeoExtent( map->getSRS(), xmin, ymin, xmax, ymax );
+
+    std::vector<TileKey> rootKeys, keys;
+    profile->getRootKeys( rootKeys );
+    for( unsigned i=0; i<rootKeys.size(); ++i )
+        collectKeys( rootKeys[i], bounds, minLevel, maxLevel, keys );
+    std::stable_sort( keys.begin(), keys.end(), CoarserKey() );
+    if ( maxKeys > 0 && keys.size() > maxKeys )
+        keys.resize( maxKeys );
+
+    if ( keys.empty() )
+        return usage( "No tile keys to process; check --bounds and the level range." );
+
+    // start the stage breakdown from zero so it only covers the benchmark.
+    Instrumentation* stages = Registry::instrumentation();
+    stages->setEnabled( true );
+    stages->reset();
+
+    osg::ref_ptr<Instrumentation> results = new Instrumentation();
+    results->setEnabled( true );
+
+    std::vector<SuiteResult> report;
+    std::vector<std::string> skipped;
+
+    if ( suites.count("tiles") )
+    {
+        if ( mapNode->getTerrainEngine() )
+        {
+            osg::ref_ptr<Operation> op = new CreateTileOperation( mapNode->getTerrainEngine() );
+            report.push_back( runSuite("tiles", op.get(), keys, numThreads, passes, results.get()) );
+        }
+        else skipped.push_back( "tiles" );
+    }
+
+    if ( suites.count("images") )
+    {
+        if ( !mapf.imageLayers().empty() )
+        {
+            osg::ref_ptr<Operation> op = new CreateImageOperation( mapf.imageLayers() );
+            report.push_back( runSuite("images", op.get(), keys, numThreads, passes, results.get()) );
+        }
+        else skipped.push_back( "images" );
+    }
+
+    if ( suites.count("elevation") )
+    {
+        if ( !mapf.elevationLayers().empty() )
+        {
+            osg::ref_ptr<Operation> op = new CreateHeightFieldOperation( mapf.elevationLayers() );
+            report.push_back( runSuite("elevation", op.get(), keys, numThreads, passes, results.get()) );
+        }
+        else skipped.push_back( "elevation" );
+    }
+
+    if ( suites.count("features") )
+    {
+        std::vector< osg::ref_ptr<FeatureSource> > sources;
+        for( ModelLayerVector::const_iterator i = mapf.modelLayers().begin(); i != mapf.modelLayers().end(); ++i )
+        {
+            FeatureModelSource* fms = dynamic_cast<FeatureModelSource*>( i->get()->getModelSource() );
+            if ( fms && fms->getFeatureSource() )
+                sources.push_back( fms->getFeatureSource() );
+        }
+
+        if ( !sources.empty() )
+        {
+            osg::ref_ptr<Operation> op = new FeatureQueryOperation( sources );
+            report.push_back( runSuite("features", op.get(), keys, numThreads, passes, results.get()) );
+
+            // building each model layer's scene graph covers the rest of the
+            // feature pipeline (filters, styling and compilation).
+            LatencyHistogram* buildLatency = results->getHistogram( "features.build" );
+            osg::Timer_t start = osg::Timer::instance()->tick();
+            for( ModelLayerVector::const_iterator i = mapf.modelLayers().begin(); i != mapf.modelLayers().end(); ++i )
+            {
+                osg::Timer_t layerStart = osg::Timer::instance()->tick();
+                osg::ref_ptr<osg::Node> graph = i->get()->createSceneGraph( map, map->getDBOptions(), 0L );
+                buildLatency->recordSince( layerStart );
+            }
+
+            SuiteResult r;
+            r._name     = "features.build";
+            r._seconds  = osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+            r._ops      = buildLatency->getCount();
+            r._failures = 0;
+            std::vector<unsigned> buckets;
+            buildLatency->getBuckets( buckets );
+            r._mean = LatencyHistogram::getMean( buckets );
+            r._p50  = LatencyHistogram::getPercentile( buckets, 50.0 );
+            r._p90  = LatencyHistogram::getPercentile( buckets, 90.0 );
+            r._p99  = LatencyHistogram::getPercentile( buckets, 99.0 );
+            r._max  = LatencyHistogram::getMax( buckets );
+            report.push_back( r );
+        }
+        else skipped.push_back( "features" );
+    }
+
+    if ( suites.count("cache") )
+    {
+        Cache* cache = map->getCache();
+        osg::ref_ptr<CacheBin> bin = cache ? cache->addBin( "_osgearth_bench" ) : 0L;
+        if ( bin.valid() )
+        {
+            osg::ref_ptr<Operation> op = new CacheOperation( bin.get() );
+            report.push_back( runSuite("cache", op.get(), keys, numThreads, passes, results.get()) );
+            bin->purge();
+            cache->removeBin( bin.get() );
+        }
+        else skipped.push_back( "cache" );
+    }
+
+    // optional: measure the prefetcher's cache hit rate along a recorded path.
+    TilePrefetcher::Stats prefetch;
+    bool replayed = false;
+    if ( !replayFile.empty() )
+    {
+        std::ifstream in( replayFile.c_str() );
+        osg::ref_ptr<osg::AnimationPath> path = new osg::AnimationPath();
+        path->read( in );
+        if ( !path->empty() )
+        {
+            osg::ref_ptr<TilePrefetcher> prefetcher = new TilePrefetcher( map );
+            prefetcher->setMaxLevel( maxLevel );
+            prefetcher->setNumThreads( numThreads );
+            prefetcher->replay( path.get(), 30.0, true );
+            prefetcher->getStats( prefetch );
+            replayed = true;
+        }
+        else
+        {
+            OE_WARN << LC << "Failed to read camera path from " << replayFile << std::endl;
+        }
+    }
+
+    // assemble the report.
+    std::stringstream buf;
+    buf << std::fixed << std::setprecision(3);
+    buf << "{\n"
+        << "  \"earth_file\": " << jsonString(args.argc() > 1 ? args[1] : "") << ",\n"
+        << "  \"keys\": " << keys.size() << ",\n"
+        << "  \"min_level\": " << minLevel << ",\n"
+        << "  \"max_level\": " << maxLevel << ",\n"
+        << "  \"threads\": " << numThreads << ",\n"
+        << "  \"passes\": " << passes << ",\n"
+        << "  \"suites\": [";
+
+    for( unsigned i=0; i<report.size(); ++i )
+    {
+        const SuiteResult& r = report[i];
+        buf << (i > 0 ? "," : "") << "\n    { "
+            << "\"name\": "        << jsonString(r._name) << ", "
+            << "\"ops\": "         << r._ops << ", "
+            << "\"failures\": "    << r._failures << ", "
+            << "\"seconds\": "     << r._seconds << ", "
+            << "\"ops_per_sec\": " << (r._seconds > 0.0 ? (double)r._ops/r._seconds : 0.0) << ", "
+            << "\"mean_ms\": "     << r._mean*1000.0 << ", "
+            << "\"p50_ms\": "      << r._p50*1000.0 << ", "
+            << "\"p90_ms\": "      << r._p90*1000.0 << ", "
+            << "\"p99_ms\": "      << r._p99*1000.0 << ", "
+            << "\"max_ms\": "      << r._max*1000.0 << " }";
+    }
+    buf << "\n  ],\n  \"skipped\": [";
+    for( unsigned i=0; i<skipped.size(); ++i )
+        buf << (i > 0 ? ", " : "") << jsonString(skipped[i]);
+    buf << "]";
+
+    if ( replayed )
+    {
+        buf << ",\n  \"prefetch\": { "
+            << "\"predicted\": " << prefetch._predicted << ", "
+            << "\"fetched\": "   << prefetch._fetched << ", "
+            << "\"canceled\": "  << prefetch._canceled << ", "
+            << "\"demanded\": "  << prefetch._demanded << ", "
+            << "\"hits\": "      << prefetch._hits << ", "
+            << "\"hit_rate\": "  << prefetch.getHitRate() << " }";
+    }
+
+    buf << ",\n  \"stages\": " << stages->toJSON() << "}\n";
+
+    if ( outFile.empty() )
+    {
+        std::cout << buf.str();
+    }
+    else
+    {
+        std::ofstream out( outFile.c_str() );
+        out << buf.str();
+        if ( !out.good() )
+        {
+            OE_WARN << LC << "Failed to write report to " << outFile << std::endl;
+            return -1;
+        }
+        OE_NOTICE << LC << "Wrote report to " << outFile << std::endl;
+    }
+
+    return 0;
+}
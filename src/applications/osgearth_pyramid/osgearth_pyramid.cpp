@@ -0,0 +1,140 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2013 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <osg/ArgumentParser>
+#include <osg/Timer>
+#include <osgDB/ReadFile>
+
+#include <osgEarth/Common>
+#include <osgEarth/Map>
+#include <osgEarth/MapFrame>
+#include <osgEarth/MapNode>
+#include <osgEarth/ElevationPyramid>
+#include <osgEarth/Progress>
+
+#include <iostream>
+
+using namespace osgEarth;
+
+#define LC "[osgearth_pyramid] "
+
+/**
+ * Builds an elevation pyramid (min/max/mean overviews) for an elevation
+ * layer in an earth file. Point the layer's "pyramid" option at the output
+ * and it will serve its low levels of detail from it.
+ */
+
+int
+usage( const std::string& msg )
+{
+    if ( !msg.empty() )
+    {
+        std::cout << msg << std::endl;
+    }
+
+    std::cout
+        << std::endl
+        << "USAGE: osgearth_pyramid file.earth --out file.oep" << std::endl
+        << std::endl
+        << "    [--layer name]                      ; Elevation layer to build from (default=the first one)" << std::endl
+        << "    [--max-level level]                 ; Deepest level to build; best near the source's native resolution (default=10)" << std::endl
+        << "    [--tile-size n]                     ; Posts per tile side (default=17)" << std::endl
+        << "    [--bounds xmin ymin xmax ymax]      ; Limit to a box (in map coordinates; default=the layer's data extents)" << std::endl
+        << "    [--threads n]                       ; Threads to read the source with (default=1)" << std::endl
+        << "    [--verbose]                         ; Print progress" << std::endl
+        << std::endl
+        << "Then add pyramid=\"file.oep\" to the elevation layer in the earth file." << std::endl
+        << std::endl;
+
+    return -1;
+}
+
+int
+main(int argc, char** argv)
+{
+    osg::ArgumentParser args(&argc,argv);
+
+    std::string outFile;
+    if ( !args.read("--out", outFile) )
+        return usage( "Missing --out" );
+
+    std::string layerName;
+    while( args.read("--layer", layerName) );
+
+    ElevationPyramidBuilder builder;
+
+    unsigned maxLevel;
+    while( args.read("--max-level", maxLevel) )
+        builder.setMaxLevel( maxLevel );
+
+    unsigned tileSize;
+    while( args.read("--tile-size", tileSize) )
+        builder.setTileSize( tileSize );
+
+    unsigned threads;
+    while( args.read("--threads", threads) )
+        builder.setNumThreads( threads );
+
+    bool haveBounds = false;
+    double xmin, ymin, xmax, ymax;
+    while( args.read("--bounds", xmin, ymin, xmax, ymax) )
+        haveBounds = true;
+
+    if ( args.read("--verbose") )
+        builder.setProgressCallback( new ConsoleProgressCallback() );
+
+    osg::ref_ptr<osg::Node> node = osgDB::readNodeFiles( args );
+    if ( !node.valid() )
+        return usage( "Failed to read .earth file." );
+
+    MapNode* mapNode = MapNode::findMapNode( node.get() );
+    if ( !mapNode )
+        return usage( "Input file was not a .earth file" );
+
+    Map* map = mapNode->getMap();
+    MapFrame mapf( map, Map::ELEVATION_LAYERS );
+
+    ElevationLayer* layer = 0L;
+    if ( !layerName.empty() )
+        layer = mapf.getElevationLayerByName( layerName );
+    else if ( !mapf.elevationLayers().empty() )
+        layer = mapf.elevationLayers().front().get();
+
+    if ( !layer )
+        return usage( "No such elevation layer." );
+
+    if ( haveBounds )
+        builder.setExtent( GeoExtent(map->getSRS(), xmin, ymin, xmax, ymax) );
+
+    OE_NOTICE << LC << "Building levels 0-" << builder.getMaxLevel() << " of \"" << layer->getName()
+        << "\" into " << outFile << std::endl;
+
+    osg::Timer_t start = osg::Timer::instance()->tick();
+
+    if ( !builder.build(layer, map->getProfile(), outFile) )
+    {
+        OE_WARN << LC << "Build failed." << std::endl;
+        return -1;
+    }
+
+    OE_NOTICE << LC << "Completed in "
+        << osg::Timer::instance()->delta_s(start, osg::Timer::instance()->tick()) << "s" << std::endl;
+
+    return 0;
+}
@@ -30,13 +30,17 @@
 #include <osgEarthUtil/Controls>
 #include <osgEarthUtil/AnnotationEvents>
 #include <osgEarthUtil/HTM>
+#include <osgEarthUtil/SpatialData>
 #include <osgEarthAnnotation/TrackNode>
+#include <osgEarthAnnotation/TrackBatchNode>
 #include <osgEarthAnnotation/AnnotationData>
 #include <osgEarthSymbology/Color>
 
 #include <osgViewer/Viewer>
 #include <osgViewer/ViewerEventHandlers>
 #include <osgGA/StateSetManipulator>
+#include <osg/Timer>
+#include <iostream>
 
 using namespace osgEarth;
 using namespace osgEarth::Util;
@@ -48,6 +52,11 @@ using namespace osgEarth::Symbology;
 
 /**
  * Demonstrates use of the TrackNode to display entity track symbols.
+ *
+ * With --batch, draws the tracks with a single TrackBatchNode instead.
+ * With --bench, times the batched update and culling without opening a
+ * window. With --index-bench, times the HTMGroup and GeoGraph spatial
+ * indexes as the tracks move (100,000 of them unless you give --count).
  */
 
 // field names for the track labels
@@ -207,6 +216,281 @@ createTrackNodes( MapNode* mapNode, osg::Group* parent, const TrackNodeFieldSche
 }
 
 
+/**
+ * Simulator for the batched tracks: the same great circle interpolation as
+ * TrackSim, but over arrays, feeding the TrackBatchNode in bulk.
+ */
+struct BatchSim : public osg::Referenced
+{
+    TrackBatchNode*     _batch;
+    std::vector<double> _lat0, _lon0, _lat1, _lon1;  // radians
+    std::vector<double> _lon, _lat, _alt;            // degrees, meters
+    std::vector<float>  _heading;                    // degrees
+
+    BatchSim( TrackBatchNode* batch, unsigned count ) : _batch(batch)
+    {
+        Random prng;
+        for( unsigned i=0; i<count; ++i )
+        {
+            _lon0.push_back( osg::DegreesToRadians(-180.0 + prng.next() * 360.0) );
+            _lat0.push_back( osg::DegreesToRadians( -80.0 + prng.next() * 160.0) );
+            _lon1.push_back( osg::DegreesToRadians(-180.0 + prng.next() * 360.0) );
+            _lat1.push_back( osg::DegreesToRadians( -80.0 + prng.next() * 160.0) );
+        }
+        _lon.resize( count );
+        _lat.resize( count );
+        _alt.resize( count, 10000.0 );
+        _heading.resize( count );
+
+        unsigned first = _batch->addTracks( count );
+        for( unsigned i=0; i<count; ++i )
+            _batch->setLabel( first+i, Stringify() << "Track:" << i );
+    }
+
+    // computes the new positions.
+    void simulate( double t )
+    {
+        for( unsigned i=0; i<_lon.size(); ++i )
+        {
+            double lat, lon;
+            GeoMath::interpolate( _lat0[i], _lon0[i], _lat1[i], _lon1[i], t, lat, lon );
+            _heading[i] = (float)osg::RadiansToDegrees( GeoMath::bearing(lat, lon, _lat1[i], _lon1[i]) );
+            _lat[i] = osg::RadiansToDegrees( lat );
+            _lon[i] = osg::RadiansToDegrees( lon );
+        }
+    }
+
+    // pushes them to the batch.
+    void apply()
+    {
+        unsigned n = _lon.size();
+        _batch->setPositions( 0, n, &_lon[0], &_lat[0], &_alt[0] );
+        _batch->setHeadings ( 0, n, &_heading[0] );
+    }
+};
+
+
+/** Update operation that runs the batched simulator. */
+struct BatchSimUpdate : public osg::Operation
+{
+    BatchSimUpdate(BatchSim* sim) : osg::Operation( "batchsim", true ), _sim(sim) { }
+
+    void operator()( osg::Object* obj ) {
+        osg::View* view = dynamic_cast<osg::View*>(obj);
+        double t = fmod(view->getFrameStamp()->getSimulationTime(), (double)g_duration.get()) / (double)g_duration.get();
+        _sim->simulate( t );
+        _sim->apply();
+    }
+
+    osg::ref_ptr<BatchSim> _sim;
+};
+
+
+/** Creates a track batch using the same icon and name label as the TrackNodes. */
+TrackBatchNode*
+createTrackBatch( MapNode* mapNode )
+{
+    Style style;
+
+    osg::ref_ptr<osg::Image> srcImage = osgDB::readImageFile( ICON_URL );
+    osg::ref_ptr<osg::Image> image;
+    if ( srcImage.valid() && ImageUtils::resizeImage( srcImage.get(), ICON_SIZE, ICON_SIZE, image ) )
+        style.getOrCreate<IconSymbol>()->setImage( image.get() );
+
+    TextSymbol* nameSymbol = style.getOrCreate<TextSymbol>();
+    nameSymbol->pixelOffset()->set( 0, 2+ICON_SIZE/2 );
+    nameSymbol->alignment() = TextSymbol::ALIGN_CENTER_BOTTOM;
+    nameSymbol->halo()->color() = Color::Black;
+
+    return new TrackBatchNode( mapNode, style );
+}
+
+
+/**
+ * Headless benchmark of the batched tracks: times the simulation, the bulk
+ * update, the geometry sync and the bucket culling from a ring of cameras.
+ */
+int
+runBenchmark( MapNode* mapNode, unsigned frames )
+{
+    osg::ref_ptr<TrackBatchNode> batch = createTrackBatch( mapNode );
+    osg::ref_ptr<BatchSim>       sim   = new BatchSim( batch.get(), g_numTracks );
+    batch->sync();
+
+    // cameras 10,000km up, looking at the center of the earth.
+    const unsigned numCameras = 8;
+    std::vector<osg::Polytope> frustums( numCameras );
+    std::vector<osg::Vec3d>    eyes( numCameras );
+    for( unsigned c=0; c<numCameras; ++c )
+    {
+        double lon = osg::DegreesToRadians( 360.0 * (double)c / (double)numCameras );
+        eyes[c].set( 1.6e7*cos(lon), 1.6e7*sin(lon), 0.0 );
+        osg::Matrix view = osg::Matrix::lookAt( eyes[c], osg::Vec3d(0,0,0), osg::Vec3d(0,0,1) );
+        osg::Matrix proj = osg::Matrix::perspective( 30.0, 1.33, 1.0, 1e8 );
+        frustums[c].setToUnitFrustum( false, false );
+        frustums[c].transformProvidingInverse( view * proj );
+    }
+
+    osg::Timer* timer = osg::Timer::instance();
+    double simTime = 0.0, updateTime = 0.0, syncTime = 0.0, cullTime = 0.0;
+    unsigned visibleBuckets = 0, visibleTracks = 0;
+
+    for( unsigned f=0; f<frames; ++f )
+    {
+        double t = (double)f / (double)frames;
+
+        osg::Timer_t t0 = timer->tick();
+        sim->simulate( t );
+        osg::Timer_t t1 = timer->tick();
+        sim->apply();
+        osg::Timer_t t2 = timer->tick();
+        batch->sync();
+        osg::Timer_t t3 = timer->tick();
+
+        std::vector<unsigned> visible;
+        for( unsigned c=0; c<numCameras; ++c )
+        {
+            visible.clear();
+            batch->getVisibleBuckets( frustums[c], eyes[c], visible );
+            visibleBuckets += visible.size();
+            for( unsigned b=0; b<visible.size(); ++b )
+                visibleTracks += batch->getNumTracksInBucket( visible[b] );
+        }
+        osg::Timer_t t4 = timer->tick();
+
+        simTime    += timer->delta_m( t0, t1 );
+        updateTime += timer->delta_m( t1, t2 );
+        syncTime   += timer->delta_m( t2, t3 );
+        cullTime   += timer->delta_m( t3, t4 );
+    }
+
+    double n = (double)std::max( frames, 1u );
+    double cullCount = n * (double)numCameras;
+    std::cout
+        << "Tracks:              " << batch->getNumTracks() << std::endl
+        << "Frames:              " << frames << std::endl
+        << "Active buckets:      " << batch->getNumActiveBuckets() << std::endl
+        << "Simulate (ms/frame): " << simTime/n << std::endl
+        << "Update (ms/frame):   " << updateTime/n << std::endl
+        << "Sync (ms/frame):     " << syncTime/n << std::endl
+        << "Cull (ms/camera):    " << cullTime/cullCount << std::endl
+        << "Visible buckets:     " << (double)visibleBuckets/cullCount << " per camera" << std::endl
+        << "Visible tracks:      " << (double)visibleTracks/cullCount << " per camera" << std::endl;
+
+    return 0;
+}
+
+
+/** A moving point for the spatial index benchmark. */
+struct IndexedObject : public GeoObject
+{
+    double _lon, _lat;  // degrees
+    osg::ref_ptr<osg::Node> _node;
+
+    IndexedObject() : _lon(0.0), _lat(0.0), _node(new osg::Node()) { }
+
+    bool getLocation( osg::Vec3d& output ) const {
+        output.set( _lon, _lat, 0.0 );
+        return true;
+    }
+
+    osg::Node* getNode() const { return _node.get(); }
+
+    // moves the object and sets its node's bound to the new location.
+    void moveTo( double lon, double lat, const osg::EllipsoidModel* em ) {
+        _lon = lon;
+        _lat = lat;
+        osg::Vec3d xyz;
+        em->convertLatLongHeightToXYZ( osg::DegreesToRadians(lat), osg::DegreesToRadians(lon), 0.0, xyz.x(), xyz.y(), xyz.z() );
+        _node->setInitialBound( osg::BoundingSphere(xyz, 1.0f) );
+        _node->dirtyBound();
+    }
+};
+
+
+/**
+ * Headless benchmark of the spatial indexes: bulk-loads the tracks into an
+ * HTMGroup and a GeoGraph, then moves all of them every frame and times
+ * the batched re-indexing.
+ */
+int
+runIndexBenchmark( unsigned count, unsigned frames )
+{
+    osg::ref_ptr<const SpatialReference> srs = SpatialReference::create( "wgs84" );
+    const osg::EllipsoidModel* em = srs->getEllipsoid();
+
+    Random prng;
+    std::vector<double> lat0( count ), lon0( count ), lat1( count ), lon1( count );
+    GeoObjectVector objects( count );
+    std::vector< osg::ref_ptr<osg::Node> > nodes( count );
+    std::vector< osg::Node* > rawNodes( count );
+
+    for( unsigned i=0; i<count; ++i )
+    {
+        lon0[i] = osg::DegreesToRadians(-180.0 + prng.next() * 360.0);
+        lat0[i] = osg::DegreesToRadians( -80.0 + prng.next() * 160.0);
+        lon1[i] = osg::DegreesToRadians(-180.0 + prng.next() * 360.0);
+        lat1[i] = osg::DegreesToRadians( -80.0 + prng.next() * 160.0);
+
+        IndexedObject* obj = new IndexedObject();
+        obj->moveTo( osg::RadiansToDegrees(lon0[i]), osg::RadiansToDegrees(lat0[i]), em );
+        objects[i]  = obj;
+        nodes[i]    = obj->getNode();
+        rawNodes[i] = obj->getNode();
+    }
+
+    osg::Timer* timer = osg::Timer::instance();
+
+    osg::ref_ptr<HTMGroup> htm = new HTMGroup();
+    osg::Timer_t t0 = timer->tick();
+    htm->addChildren( nodes );
+    double htmLoadTime = timer->delta_m( t0, timer->tick() );
+
+    osg::ref_ptr<GeoGraph> graph = new GeoGraph( GeoExtent(srs.get(), -180.0, -90.0, 180.0, 90.0), 1e10f, 500, 2, 0.5f, 4, 2 );
+    t0 = timer->tick();
+    graph->insertObjects( objects );
+    double graphLoadTime = timer->delta_m( t0, timer->tick() );
+
+    double moveTime = 0.0, htmTime = 0.0, graphTime = 0.0;
+    unsigned htmMoved = 0, graphMoved = 0;
+
+    for( unsigned f=0; f<frames; ++f )
+    {
+        // a few minutes of flight per frame
+        double t = 0.01 * (double)(f+1) / (double)std::max( frames, 1u );
+
+        osg::Timer_t t1 = timer->tick();
+        for( unsigned i=0; i<count; ++i )
+        {
+            double lat, lon;
+            GeoMath::interpolate( lat0[i], lon0[i], lat1[i], lon1[i], t, lat, lon );
+            static_cast<IndexedObject*>(objects[i].get())->moveTo( osg::RadiansToDegrees(lon), osg::RadiansToDegrees(lat), em );
+        }
+        osg::Timer_t t2 = timer->tick();
+        htmMoved += htm->refresh( rawNodes );
+        osg::Timer_t t3 = timer->tick();
+        graphMoved += graph->reindexObjects( objects );
+        osg::Timer_t t4 = timer->tick();
+
+        moveTime  += timer->delta_m( t1, t2 );
+        htmTime   += timer->delta_m( t2, t3 );
+        graphTime += timer->delta_m( t3, t4 );
+    }
+
+    double n = (double)std::max( frames, 1u );
+    std::cout
+        << "Objects:                     " << count << std::endl
+        << "Frames:                      " << frames << std::endl
+        << "Move (ms/frame):             " << moveTime/n << std::endl
+        << "HTMGroup load (ms):          " << htmLoadTime << std::endl
+        << "HTMGroup refresh (ms/frame): " << htmTime/n << " (" << (double)htmMoved/n << " changed cells)" << std::endl
+        << "GeoGraph load (ms):          " << graphLoadTime << std::endl
+        << "GeoGraph reindex (ms/frame): " << graphTime/n << " (" << (double)graphMoved/n << " changed cells)" << std::endl;
+
+    return 0;
+}
+
+
 /** creates some UI controls for adjusting the decluttering parameters. */
 void
 createControls( osgViewer::View* view )
@@ -295,6 +579,26 @@ main(int argc, char** argv)
 {
     osg::ArgumentParser arguments(&argc,argv);
 
+    // count on the cmd line?
+    bool countSet = arguments.read("--count", g_numTracks);
+
+    // headless benchmark of the spatial indexes?
+    unsigned indexFrames = 0;
+    if ( arguments.read("--index-bench", indexFrames) )
+    {
+        return runIndexBenchmark( countSet ? g_numTracks : 100000, indexFrames );
+    }
+
+    // headless benchmark of the batched renderer?
+    unsigned benchFrames = 0;
+    if ( arguments.read("--bench", benchFrames) )
+    {
+        osg::ref_ptr<osg::Node> node = osgDB::readNodeFiles( arguments );
+        return runBenchmark( MapNode::findMapNode(node.get()), benchFrames );
+    }
+
+    bool batched = arguments.read("--batch");
+
     // initialize a viewer.
     osgViewer::Viewer viewer( arguments );
     viewer.setCameraManipulator( new EarthManipulator );
@@ -305,9 +609,6 @@ main(int argc, char** argv)
     if ( !mapNode )
         return usage("Missing required .earth file" );
 
-    // count on the cmd line?
-    arguments.read("--count", g_numTracks);
-    
     osg::Group* root = new osg::Group();
     root->addChild( earth );
     viewer.setSceneData( root );
@@ -320,7 +621,17 @@ main(int argc, char** argv)
     TrackSims trackSims;
     osg::Group* tracks = new osg::Group();
     //HTMGroup* tracks = new HTMGroup();
-    createTrackNodes( mapNode, tracks, schema, trackSims );
+    if ( batched )
+    {
+        // not decluttered, so it doesn't go under the tracks group.
+        TrackBatchNode* batch = createTrackBatch( mapNode );
+        root->addChild( batch );
+        viewer.addUpdateOperation( new BatchSimUpdate(new BatchSim(batch, g_numTracks)) );
+    }
+    else
+    {
+        createTrackNodes( mapNode, tracks, schema, trackSims );
+    }
     root->addChild( tracks );
 
     // Set up the automatic decluttering. setEnabled() activates decluttering for
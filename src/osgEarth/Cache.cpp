@@ -18,6 +18,7 @@
  */
 #include <osgEarth/Cache>
 #include <osgEarth/Registry>
+#include <osgEarth/TieredCache>
 #include <osgEarth/ThreadingUtils>
 
 #include <osgDB/FileNameUtils>
@@ -79,6 +80,10 @@ CacheFactory::create( const CacheOptions& options )
     {
         OE_WARN << LC << "Sorry, but TMS caching is no longer supported; try \"filesystem\" instead" << std::endl;
     }
+    else if ( options.getDriver() == "tiered" )
+    {
+        result = new TieredCache( options );
+    }
 //    else if ( options.getDriver() == "tilecache" )
 //    {
 ////        result = new DiskCache( options );
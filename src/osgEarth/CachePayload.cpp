@@ -0,0 +1,628 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2013 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarth/CachePayload>
+#include <osgEarth/Notify>
+#include <string.h>
+#include <vector>
+
+using namespace osgEarth;
+
+#define LC "[CachePayload] "
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    // Header layout (all values little-endian):
+    //   0  u32  magic
+    //   4  u16  version
+    //   6  u8   type
+    //   7  u8   flags
+    //   8  u32  size of the decoded data block
+    //   12 u32  size of the stored data block
+    //   16 ...  type-specific header, then the data block
+    const unsigned       MAGIC        = 0x5043454f; // "OECP"
+    const unsigned short VERSION      = 1;
+    const unsigned char  TYPE_HEIGHTFIELD = 1;
+    const unsigned char  TYPE_IMAGE       = 2;
+    const unsigned char  FLAG_LZ      = 0x01;
+    const unsigned       HEADER_SIZE  = 16;
+
+    // Limits on decoded dimensions, so that a corrupt header can neither
+    // overflow a size computation nor ask for a huge buffer.
+    const unsigned       MAX_DIMENSION = 16384;
+    const unsigned       MAX_SAMPLES   = 1u << 26;  // heightfield posts or image pixels
+
+    // Appends little-endian values to a buffer.
+    struct Writer
+    {
+        Writer( std::string& buf ) : _buf(buf) { }
+
+        void u8( unsigned char v ) { _buf.push_back( (char)v ); }
+        void u16( unsigned short v ) { u8(v & 0xff); u8((v >> 8) & 0xff); }
+        void u32( unsigned v ) { u16(v & 0xffff); u16((v >> 16) & 0xffff); }
+        void f32( float v ) { unsigned u; ::memcpy(&u, &v, 4); u32(u); }
+        void bytes( const void* data, unsigned size ) { _buf.append( (const char*)data, size ); }
+
+        // patches a u32 written earlier
+        void set32( unsigned offset, unsigned v )
+        {
+            for( unsigned i=0; i<4; ++i, v >>= 8 )
+                _buf[offset+i] = (char)(v & 0xff);
+        }
+
+        std::string& _buf;
+    };
+
+    // Reads little-endian values from a buffer, failing softly at the end.
+    struct Reader
+    {
+        Reader( const char* data, unsigned size ) : _p((const unsigned char*)data), _size(size), _pos(0), _ok(true) { }
+
+        bool has( unsigned n ) { if ( _pos + n > _size ) _ok = false; return _ok; }
+        unsigned char  u8()  { if ( !has(1) ) return 0; return _p[_pos++]; }
+        unsigned short u16() { unsigned short lo = u8(); return lo | (u8() << 8); }
+        unsigned       u32() { unsigned lo = u16(); return lo | ((unsigned)u16() << 16); }
+        float          f32() { unsigned u = u32(); float v; ::memcpy(&v, &u, 4); return v; }
+        const unsigned char* bytes( unsigned n ) { if ( !has(n) ) return 0L; const unsigned char* r = _p+_pos; _pos += n; return r; }
+
+        const unsigned char* _p;
+        unsigned             _size;
+        unsigned             _pos;
+        bool                 _ok;
+    };
+
+    //--------------------------------------------------------------------
+    // A small LZ77 codec in the style of LZ4: a sequence is a token byte
+    // (literal length in the high nibble, match length - 4 in the low
+    // nibble), extended lengths in runs of 255, the literals, and a 16-bit
+    // match offset. The last sequence has literals only.
+
+    const unsigned LZ_MIN_MATCH = 4;
+    const unsigned LZ_HASH_BITS = 14;
+    const unsigned LZ_MAX_OFFSET = 65535;
+
+    inline unsigned read32( const unsigned char* p )
+    {
+        unsigned v;
+        ::memcpy( &v, p, 4 );
+        return v;
+    }
+
+    inline unsigned lzHash( unsigned v )
+    {
+        return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+    }
+
+    void lzLength( std::string& out, unsigned len )
+    {
+        for( ; len >= 255; len -= 255 )
+            out.push_back( (char)255 );
+        out.push_back( (char)len );
+    }
+
+    void lzSequence( std::string& out, const unsigned char* literals, unsigned numLiterals, unsigned matchLen, unsigned offset )
+    {
+        unsigned litCode   = numLiterals < 15 ? numLiterals : 15;
+        unsigned matchCode = 0;
+        if ( matchLen > 0 )
+            matchCode = (matchLen - LZ_MIN_MATCH) < 15 ? (matchLen - LZ_MIN_MATCH) : 15;
+
+        out.push_back( (char)((litCode << 4) | matchCode) );
+        if ( litCode == 15 )
+            lzLength( out, numLiterals - 15 );
+
+        out.append( (const char*)literals, numLiterals );
+
+        if ( matchLen > 0 )
+        {
+            out.push_back( (char)(offset & 0xff) );
+            out.push_back( (char)((offset >> 8) & 0xff) );
+            if ( matchCode == 15 )
+                lzLength( out, matchLen - LZ_MIN_MATCH - 15 );
+        }
+    }
+
+    void lzCompress( const unsigned char* src, unsigned size, std::string& out )
+    {
+        std::vector<int> table( 1u << LZ_HASH_BITS, -1 );
+
+        unsigned anchor = 0;
+        unsigned ip     = 0;
+
+        while( ip + LZ_MIN_MATCH <= size )
+        {
+            unsigned seq = read32( src+ip );
+            unsigned h   = lzHash( seq );
+            int      ref = table[h];
+            table[h] = (int)ip;
+
+            if ( ref >= 0 && ip - (unsigned)ref <= LZ_MAX_OFFSET && read32(src+ref) == seq )
+            {
+                unsigned len = LZ_MIN_MATCH;
+                while( ip + len < size && src[ref+len] == src[ip+len] )
+                    ++len;
+
+                lzSequence( out, src+anchor, ip-anchor, len, ip-(unsigned)ref );
+                ip    += len;
+                anchor = ip;
+            }
+            else
+            {
+                // skip faster through data that isn't compressing.
+                ip += 1 + ((ip - anchor) >> 6);
+            }
+        }
+
+        lzSequence( out, src+anchor, size-anchor, 0, 0 );
+    }
+
+    bool lzDecompress( const unsigned char* src, unsigned srcSize, unsigned char* dst, unsigned dstSize )
+    {
+        unsigned ip = 0, op = 0;
+
+        while( ip < srcSize )
+        {
+            unsigned token = src[ip++];
+
+            unsigned numLiterals = token >> 4;
+            if ( numLiterals == 15 )
+            {
+                unsigned char b;
+                do {
+                    if ( ip >= srcSize ) return false;
+                    b = src[ip++];
+                    numLiterals += b;
+                } while( b == 255 );
+            }
+
+            if ( ip + numLiterals > srcSize || op + numLiterals > dstSize )
+                return false;
+            ::memcpy( dst+op, src+ip, numLiterals );
+            ip += numLiterals;
+            op += numLiterals;
+
+            if ( ip == srcSize )
+                break; // last sequence
+
+            if ( ip + 2 > srcSize )
+                return false;
+            unsigned offset = src[ip] | (src[ip+1] << 8);
+            ip += 2;
+
+            unsigned matchLen = (token & 0x0f) + LZ_MIN_MATCH;
+            if ( (token & 0x0f) == 15 )
+            {
+                unsigned char b;
+                do {
+                    if ( ip >= srcSize ) return false;
+                    b = src[ip++];
+                    matchLen += b;
+                } while( b == 255 );
+            }
+
+            if ( offset == 0 || offset > op || op + matchLen > dstSize )
+                return false;
+
+            // byte copy; the match may overlap the output.
+            const unsigned char* m = dst + op - offset;
+            for( unsigned i=0; i<matchLen; ++i )
+                dst[op+i] = m[i];
+            op += matchLen;
+        }
+
+        return op == dstSize;
+    }
+
+    //--------------------------------------------------------------------
+
+    void writeHeader( Writer& w, unsigned char type, unsigned char flags )
+    {
+        w.u32( MAGIC );
+        w.u16( VERSION );
+        w.u8 ( type );
+        w.u8 ( flags );
+        w.u32( 0 ); // decoded size, patched later
+        w.u32( 0 ); // stored size, patched later
+    }
+
+    // Appends the data block, compressed if requested and worthwhile.
+    void writeBlock( Writer& w, const unsigned char* data, unsigned size, bool compress )
+    {
+        unsigned start = w._buf.size();
+        if ( compress )
+        {
+            lzCompress( data, size, w._buf );
+            if ( w._buf.size() - start >= size )
+            {
+                // didn't help; store raw.
+                w._buf.resize( start );
+                compress = false;
+            }
+        }
+
+        if ( !compress )
+        {
+            w.bytes( data, size );
+            w._buf[7] = (char)(w._buf[7] & ~FLAG_LZ);
+        }
+        else
+        {
+            w._buf[7] = (char)(w._buf[7] | FLAG_LZ);
+        }
+
+        w.set32( 8,  size );
+        w.set32( 12, w._buf.size() - start );
+    }
+
+    // Reads the data block into dst, which must hold exactly "size" bytes.
+    bool readBlock( Reader& r, unsigned char flags, unsigned size, unsigned storedSize, unsigned char* dst )
+    {
+        const unsigned char* block = r.bytes( storedSize );
+        if ( !block )
+            return false;
+
+        if ( flags & FLAG_LZ )
+            return lzDecompress( block, storedSize, dst, size );
+
+        if ( storedSize != size )
+            return false;
+
+        ::memcpy( dst, block, size );
+        return true;
+    }
+
+    struct Header
+    {
+        unsigned char type, flags;
+        unsigned      size, storedSize;
+    };
+
+    // Sanity check before allocating anything, so a corrupt record can't
+    // ask for a huge buffer. An LZ sequence can't expand by more than 255x.
+    bool blockFits( const Reader& r, const Header& h )
+    {
+        if ( !r._ok || h.storedSize > r._size - r._pos )
+            return false;
+        if ( h.flags & FLAG_LZ )
+            return h.size / 255u <= h.storedSize;
+        return h.size == h.storedSize;
+    }
+
+    bool readHeader( Reader& r, Header& h )
+    {
+        if ( r.u32() != MAGIC || r.u16() != VERSION )
+            return false;
+        h.type       = r.u8();
+        h.flags      = r.u8();
+        h.size       = r.u32();
+        h.storedSize = r.u32();
+        return r._ok;
+    }
+
+    //--------------------------------------------------------------------
+    // Heightfields
+
+    bool encodeHeightField( const osg::HeightField* hf, std::string& out )
+    {
+        const osg::FloatArray* floats = hf->getFloatArray();
+        unsigned cols = hf->getNumColumns();
+        unsigned rows = hf->getNumRows();
+        unsigned n    = cols * rows;
+        if ( !floats || floats->size() < n || n == 0 )
+            return false;
+
+        Writer w( out );
+        writeHeader( w, TYPE_HEIGHTFIELD, 0 );
+        w.u32( cols );
+        w.u32( rows );
+        w.f32( hf->getOrigin().x() );
+        w.f32( hf->getOrigin().y() );
+        w.f32( hf->getOrigin().z() );
+        w.f32( hf->getXInterval() );
+        w.f32( hf->getYInterval() );
+        w.f32( hf->getSkirtHeight() );
+        w.u32( hf->getBorderWidth() );
+
+        // XOR each sample with the one to its left (or above, for the first
+        // column), then split the residuals into byte planes.
+        std::vector<unsigned char> planes( n*4 );
+        const float* samples = &floats->front();
+        unsigned prev = 0u;
+        for( unsigned row=0; row<rows; ++row )
+        {
+            for( unsigned col=0; col<cols; ++col )
+            {
+                unsigned i = row*cols + col;
+                unsigned bits;
+                ::memcpy( &bits, &samples[i], 4 );
+
+                unsigned predictor = col == 0 ? prev : 0u;
+                if ( col > 0 )
+                    ::memcpy( &predictor, &samples[i-1], 4 );
+                else
+                    prev = bits;
+
+                unsigned residual = bits ^ predictor;
+                planes[i]       = (unsigned char)(residual >> 24);
+                planes[n+i]     = (unsigned char)(residual >> 16);
+                planes[2*n+i]   = (unsigned char)(residual >> 8);
+                planes[3*n+i]   = (unsigned char)(residual);
+            }
+        }
+
+        writeBlock( w, &planes[0], n*4, true );
+        return true;
+    }
+
+    bool decodeHeightField( Reader& r, const Header& h, osg::HeightField* hf )
+    {
+        unsigned cols  = r.u32();
+        unsigned rows  = r.u32();
+        float    ox    = r.f32();
+        float    oy    = r.f32();
+        float    oz    = r.f32();
+        float    dx    = r.f32();
+        float    dy    = r.f32();
+        float    skirt = r.f32();
+        unsigned border = r.u32();
+
+        if ( cols == 0 || rows == 0 || cols > MAX_DIMENSION || rows > MAX_DIMENSION )
+            return false;
+
+        unsigned long long n64 = (unsigned long long)cols * (unsigned long long)rows;
+        if ( n64 > MAX_SAMPLES || (unsigned long long)(h.size/4) != n64 || h.size % 4 != 0 || !blockFits(r, h) )
+            return false;
+
+        unsigned n = (unsigned)n64;
+
+        std::vector<unsigned char> planes( n*4 );
+        if ( !readBlock(r, h.flags, h.size, h.storedSize, &planes[0]) )
+            return false;
+
+        // allocate() keeps the existing array when the dimensions match.
+        hf->allocate( cols, rows );
+        hf->setOrigin( osg::Vec3(ox, oy, oz) );
+        hf->setXInterval( dx );
+        hf->setYInterval( dy );
+        hf->setSkirtHeight( skirt );
+        hf->setBorderWidth( border );
+
+        float* samples = &hf->getFloatArray()->front();
+        unsigned prev = 0u, left = 0u;
+        for( unsigned row=0; row<rows; ++row )
+        {
+            for( unsigned col=0; col<cols; ++col )
+            {
+                unsigned i = row*cols + col;
+                unsigned residual =
+                    ((unsigned)planes[i] << 24) |
+                    ((unsigned)planes[n+i] << 16) |
+                    ((unsigned)planes[2*n+i] << 8) |
+                    ((unsigned)planes[3*n+i]);
+
+                unsigned bits = residual ^ (col == 0 ? prev : left);
+                if ( col == 0 )
+                    prev = bits;
+                left = bits;
+                ::memcpy( &samples[i], &bits, 4 );
+            }
+        }
+        return true;
+    }
+
+    //--------------------------------------------------------------------
+    // Images
+
+    bool encodeImage( const osg::Image* image, std::string& out, bool compress )
+    {
+        if ( !image->data() )
+            return false;
+
+        unsigned size = image->getTotalSizeInBytesIncludingMipmaps();
+
+        Writer w( out );
+        writeHeader( w, TYPE_IMAGE, 0 );
+        w.u32( image->s() );
+        w.u32( image->t() );
+        w.u32( image->r() );
+        w.u32( image->getInternalTextureFormat() );
+        w.u32( image->getPixelFormat() );
+        w.u32( image->getDataType() );
+        w.u32( image->getPacking() );
+        w.u32( image->getOrigin() );
+
+        const osg::Image::MipmapDataType& mipmaps = image->getMipmapLevels();
+        w.u32( mipmaps.size() );
+        for( unsigned i=0; i<mipmaps.size(); ++i )
+            w.u32( mipmaps[i] );
+
+        // compressed (DXT etc) data won't shrink any further.
+        writeBlock( w, image->data(), size, compress && !image->isCompressed() );
+        return true;
+    }
+
+    // Size of the data block that an image header describes, checking that
+    // every mipmap level lies within it; 0 if the header is not sane.
+    unsigned imageDataSize( int s, int t, int r, GLenum pixelFormat, GLenum dataType, unsigned packing,
+                            const osg::Image::MipmapDataType& mipmaps )
+    {
+        if ( s <= 0 || t <= 0 || r <= 0 ||
+             s > (int)MAX_DIMENSION || t > (int)MAX_DIMENSION || r > (int)MAX_DIMENSION ||
+             (unsigned long long)s * (unsigned long long)t * (unsigned long long)r > MAX_SAMPLES ||
+             packing == 0 || packing > 8 )
+        {
+            return 0;
+        }
+
+        // the same sum as osg::Image::getTotalSizeInBytesIncludingMipmaps.
+        std::vector<unsigned long long> levelSizes;
+        unsigned long long total = 0;
+        for( unsigned i=0; i<=mipmaps.size(); ++i )
+        {
+            unsigned long long size = osg::Image::computeImageSizeInBytes( s, t, r, pixelFormat, dataType, packing );
+            if ( size == 0 )
+                return 0;
+            levelSizes.push_back( size );
+            total += size;
+            s = osg::maximum( s >> 1, 1 );
+            t = osg::maximum( t >> 1, 1 );
+            r = osg::maximum( r >> 1, 1 );
+        }
+
+        // mipmap i holds level i+1.
+        for( unsigned i=0; i<mipmaps.size(); ++i )
+        {
+            if ( (unsigned long long)mipmaps[i] + levelSizes[i+1] > total )
+                return 0;
+        }
+
+        return total <= (unsigned long long)0xffffffffu ? (unsigned)total : 0u;
+    }
+
+    bool decodeImage( Reader& r, const Header& h, osg::Image* image )
+    {
+        int      s       = (int)r.u32();
+        int      t       = (int)r.u32();
+        int      rr      = (int)r.u32();
+        GLint    internalFormat = (GLint)r.u32();
+        GLenum   pixelFormat    = (GLenum)r.u32();
+        GLenum   dataType       = (GLenum)r.u32();
+        unsigned packing = r.u32();
+        unsigned origin  = r.u32();
+        unsigned numMipmaps = r.u32();
+
+        if ( !r._ok || numMipmaps > 32 || h.size == 0 )
+            return false;
+
+        osg::Image::MipmapDataType mipmaps( numMipmaps );
+        for( unsigned i=0; i<numMipmaps; ++i )
+            mipmaps[i] = r.u32();
+        if ( !blockFits(r, h) )
+            return false;
+
+        if ( imageDataSize(s, t, rr, pixelFormat, dataType, packing, mipmaps) != h.size )
+        {
+            OE_DEBUG << LC << "Image size does not match its header" << std::endl;
+            return false;
+        }
+
+        // reuse the image's buffer when it is the same shape.
+        bool reuse =
+            image->data() &&
+            image->s() == s && image->t() == t && image->r() == rr &&
+            image->getPixelFormat() == pixelFormat &&
+            image->getDataType() == dataType &&
+            image->getPacking() == packing &&
+            image->getTotalSizeInBytesIncludingMipmaps() == h.size;
+
+        if ( reuse )
+        {
+            if ( !readBlock(r, h.flags, h.size, h.storedSize, image->data()) )
+                return false;
+            image->setInternalTextureFormat( internalFormat );
+            image->setMipmapLevels( mipmaps );
+            image->dirty();
+        }
+        else
+        {
+            unsigned char* data = new unsigned char[h.size];
+            if ( !readBlock(r, h.flags, h.size, h.storedSize, data) )
+            {
+                delete [] data;
+                return false;
+            }
+            image->setImage( s, t, rr, internalFormat, pixelFormat, dataType, data, osg::Image::USE_NEW_DELETE, packing );
+            image->setMipmapLevels( mipmaps );
+        }
+
+        image->setOrigin( (osg::Image::Origin)origin );
+        return true;
+    }
+}
+
+//------------------------------------------------------------------------
+
+bool
+CachePayload::canEncode( const osg::Object* object )
+{
+    return
+        dynamic_cast<const osg::HeightField*>(object) != 0L ||
+        dynamic_cast<const osg::Image*>(object) != 0L;
+}
+
+bool
+CachePayload::encode( const osg::Object* object, std::string& out, bool compressImages )
+{
+    out.clear();
+
+    if ( const osg::HeightField* hf = dynamic_cast<const osg::HeightField*>(object) )
+        return encodeHeightField( hf, out );
+
+    if ( const osg::Image* image = dynamic_cast<const osg::Image*>(object) )
+        return encodeImage( image, out, compressImages );
+
+    return false;
+}
+
+bool
+CachePayload::isPayload( const char* data, unsigned size )
+{
+    Reader r( data, size );
+    return size >= HEADER_SIZE && r.u32() == MAGIC;
+}
+
+osg::Object*
+CachePayload::decode( const char* data, unsigned size )
+{
+    Reader r( data, size );
+    Header h;
+    if ( !readHeader(r, h) )
+        return 0L;
+
+    if ( h.type == TYPE_HEIGHTFIELD )
+    {
+        osg::ref_ptr<osg::HeightField> hf = new osg::HeightField();
+        return decodeHeightField(r, h, hf.get()) ? hf.release() : 0L;
+    }
+    else if ( h.type == TYPE_IMAGE )
+    {
+        osg::ref_ptr<osg::Image> image = new osg::Image();
+        return decodeImage(r, h, image.get()) ? image.release() : 0L;
+    }
+
+    OE_WARN << LC << "Unsupported payload type " << (int)h.type << std::endl;
+    return 0L;
+}
+
+bool
+CachePayload::decode( const char* data, unsigned size, osg::HeightField* hf )
+{
+    Reader r( data, size );
+    Header h;
+    return hf && readHeader(r, h) && h.type == TYPE_HEIGHTFIELD && decodeHeightField(r, h, hf);
+}
+
+bool
+CachePayload::decode( const char* data, unsigned size, osg::Image* image )
+{
+    Reader r( data, size );
+    Header h;
+    return image && readHeader(r, h) && h.type == TYPE_IMAGE && decodeImage(r, h, image);
+}
@@ -22,6 +22,8 @@
 #include <osgEarth/Registry>
 #include <osgEarth/Progress>
 #include <osgDB/FileNameUtils>
+#include <osg/Timer>
+#include <climits>
 
 #define LC "[CompositeTileSource] "
 
@@ -92,18 +94,17 @@ namespace
             image = 0;
             opacity = 1;
             dataInExtents = false;
-        }
-
-        ImageInfo(osg::Image* image, float opacity, bool dataInExtents)
-        {
-            this->image = image;
-            this->opacity = opacity;
-            this->dataInExtents = dataInExtents;
+            requested = false;
+            skipped = false;
+            time = 0.0;
         }
 
         bool dataInExtents;
         float opacity;
         osg::ref_ptr< osg::Image> image;
+        bool requested;
+        bool skipped;
+        double time;
     };
 
     // some helper types.    
@@ -119,6 +120,167 @@ namespace
 
         ImageLayerTileProcessor _processor;
     };
+
+    // Whether an image completely hides anything composited beneath it.
+    bool isOpaque( const osg::Image* image )
+    {
+        if ( !ImageUtils::hasAlphaChannel(image) )
+            return true;
+
+        if ( ImageUtils::isCompressed(image) )
+            return false;
+
+        return !ImageUtils::hasTransparency(image);
+    }
+
+    // State shared by the component fetches for a single createImage call.
+    // Components composite bottom (first) to top (last); once an opaque
+    // image arrives, every component below it is unnecessary.
+    struct FetchState
+    {
+        FetchState( ProgressCallback* progress ) : _progress(progress), _cutoff(-1) { }
+
+        bool isCanceled( unsigned index )
+        {
+            if ( _progress && _progress->isCanceled() )
+                return true;
+            Threading::ScopedMutexLock lock( _mutex );
+            return (int)index < _cutoff;
+        }
+
+        void setOpaque( unsigned index )
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            if ( (int)index > _cutoff )
+                _cutoff = (int)index;
+        }
+
+        int getCutoff()
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            return _cutoff;
+        }
+
+        ProgressCallback* _progress;
+        Threading::Mutex  _mutex;
+        int               _cutoff;
+    };
+
+    // Cancels a component's fetch when the request is canceled or when an
+    // opaque component above it makes it unnecessary.
+    struct ComponentProgress : public ProgressCallback
+    {
+        ComponentProgress( FetchState& state, unsigned index ) : _state(state), _index(index) { }
+
+        virtual bool isCanceled() const
+        {
+            return _canceled || _state.isCanceled( _index );
+        }
+
+        FetchState& _state;
+        unsigned    _index;
+    };
+
+    void fetchImage(TileSource*                        source,
+                    const optional<ImageLayerOptions>& layerOptions,
+                    TileSource::ImageOperation*        preCacheOp,
+                    const TileKey&                     key,
+                    FetchState&                        state,
+                    unsigned                           index,
+                    ImageInfo&                         info )
+    {
+        if ( !source )
+            return;
+
+        osg::ref_ptr<ComponentProgress> progress = new ComponentProgress( state, index );
+        if ( progress->isCanceled() )
+        {
+            info.skipped = true;
+            return;
+        }
+
+        //TODO:  This duplicates code in ImageLayer::isKeyValid.  Maybe should move that to TileSource::isKeyValid instead
+        int minLevel = 0;
+        int maxLevel = INT_MAX;
+        if (layerOptions->minLevel().isSet())
+        {
+            minLevel = layerOptions->minLevel().value();
+        }
+        else if (layerOptions->minResolution().isSet())
+        {
+            minLevel = source->getProfile()->getLevelOfDetailForHorizResolution( 
+                layerOptions->minResolution().value(), 
+                source->getPixelsPerTile());
+        }
+
+        if (layerOptions->maxLevel().isSet())
+        {
+            maxLevel = layerOptions->maxLevel().value();
+        }
+        else if (layerOptions->maxResolution().isSet())
+        {
+            maxLevel = source->getProfile()->getLevelOfDetailForHorizResolution( 
+                layerOptions->maxResolution().value(), 
+                source->getPixelsPerTile());
+        }
+
+        // check that this source is within the level bounds:
+        if (minLevel > (int)key.getLevelOfDetail() ||
+            maxLevel < (int)key.getLevelOfDetail() )
+        {
+            return;
+        }
+
+        //Only try to get data if the source actually has data                
+        if ( !source->hasDataInExtent( key.getExtent() ) )
+        {
+            OE_DEBUG << LC << "Source has no data at " << key.str() << std::endl;
+            return;
+        }
+
+        //We have data within these extents
+        info.dataInExtents = true;
+
+        if ( source->getBlacklist()->contains( key.getTileId() ) )
+            return;
+
+        osg::Timer_t start = osg::Timer::instance()->tick();
+        info.image = source->createImage( key, preCacheOp, progress.get() );
+        info.time = osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+        info.requested = true;
+
+        //If the image is not valid and the progress was not cancelled, blacklist
+        if (!info.image.valid() && !progress->isCanceled())
+        {
+            //Add the tile to the blacklist
+            OE_DEBUG << LC << "Adding tile " << key.str() << " to the blacklist" << std::endl;
+            source->getBlacklist()->add( key.getTileId() );
+        }
+
+        info.opacity = layerOptions.isSet() ? layerOptions->opacity().value() : 1.0f;
+
+        if ( info.image.valid() && info.opacity >= 1.0f && isOpaque(info.image.get()) )
+        {
+            state.setOpaque( index );
+        }
+    }
+
+    // Fetches one component on a TaskService thread.
+    struct FetchImageTask
+    {
+        void execute()
+        {
+            fetchImage( _source.get(), *_layerOptions, _preCacheOp.get(), _key, *_state, _index, *_info );
+        }
+
+        osg::ref_ptr<TileSource>                 _source;
+        const optional<ImageLayerOptions>*       _layerOptions;
+        osg::ref_ptr<TileSource::ImageOperation> _preCacheOp;
+        TileKey                                  _key;
+        FetchState*                              _state;
+        unsigned                                 _index;
+        ImageInfo*                               _info;
+    };
 }
 
 //-----------------------------------------------------------------------
@@ -165,92 +327,85 @@ osg::Image*
 CompositeTileSource::createImage(const TileKey&    key,
                                  ProgressCallback* progress )
 {
-    ImageMixVector images;
-    images.reserve( _options._components.size() );
+    unsigned numComponents = _options._components.size();
+    if ( _preCacheOps.size() != numComponents )
+        return 0L; // not initialized
 
-    for(CompositeTileSourceOptions::ComponentVector::const_iterator i = _options._components.begin();
-        i != _options._components.end();
-        ++i )
-    {
-        if ( progress && progress->isCanceled() )
-            return 0L;
+    ImageMixVector images( numComponents );
+    FetchState     state( progress );
 
-        ImageInfo imageInfo;
-        imageInfo.dataInExtents = false;
+    if ( _service.valid() && numComponents > 1 )
+    {
+        // Fetch the components concurrently. The top-most component is fetched
+        // in this thread while the others run on the task service.
+        Threading::MultiEvent semaphore( numComponents-1 );
 
+        for( unsigned i=0; i<numComponents-1; ++i )
+        {
+            const CompositeTileSourceOptions::Component& comp = _options._components[i];
+
+            ParallelTask<FetchImageTask>* task = new ParallelTask<FetchImageTask>( &semaphore );
+            task->_source       = comp._tileSourceInstance.get();
+            task->_layerOptions = &comp._imageLayerOptions;
+            task->_preCacheOp   = _preCacheOps[i].get();
+            task->_key          = key;
+            task->_state        = &state;
+            task->_index        = i;
+            task->_info         = &images[i];
+            task->setPriority( -(float)key.getLevelOfDetail() );
+            _service->add( task );
+        }
 
+        unsigned top = numComponents-1;
+        fetchImage(
+            _options._components[top]._tileSourceInstance.get(),
+            _options._components[top]._imageLayerOptions,
+            _preCacheOps[top].get(),
+            key, state, top, images[top] );
 
-        TileSource* source = i->_tileSourceInstance.get();
-        if ( source )
+        semaphore.wait();
+    }
+    else
+    {
+        // Fetch serially from the top down, so that an opaque component
+        // eliminates the need to fetch anything beneath it.
+        for( int i=(int)numComponents-1; i>=0; --i )
         {
-            //TODO:  This duplicates code in ImageLayer::isKeyValid.  Maybe should move that to TileSource::isKeyValid instead
-            int minLevel = 0;
-            int maxLevel = INT_MAX;
-            if (i->_imageLayerOptions->minLevel().isSet())
-            {
-                minLevel = i->_imageLayerOptions->minLevel().value();
-            }
-            else if (i->_imageLayerOptions->minResolution().isSet())
-            {
-                minLevel = source->getProfile()->getLevelOfDetailForHorizResolution( 
-                    i->_imageLayerOptions->minResolution().value(), 
-                    source->getPixelsPerTile());
-            }
+            fetchImage(
+                _options._components[i]._tileSourceInstance.get(),
+                _options._components[i]._imageLayerOptions,
+                _preCacheOps[i].get(),
+                key, state, i, images[i] );
+        }
+    }
 
-            if (i->_imageLayerOptions->maxLevel().isSet())
-            {
-                maxLevel = i->_imageLayerOptions->maxLevel().value();
-            }
-            else if (i->_imageLayerOptions->maxResolution().isSet())
+    // record the timing for each component:
+    {
+        Threading::ScopedMutexLock lock( _statsMutex );
+        for( unsigned i=0; i<images.size() && i<_stats.size(); ++i )
+        {
+            if ( images[i].skipped )
             {
-                maxLevel = source->getProfile()->getLevelOfDetailForHorizResolution( 
-                    i->_imageLayerOptions->maxResolution().value(), 
-                    source->getPixelsPerTile());
+                _stats[i]._skipped++;
             }
-
-            // check that this source is within the level bounds:
-            if (minLevel > (int)key.getLevelOfDetail() ||
-                maxLevel < (int)key.getLevelOfDetail() )
+            else if ( images[i].requested )
             {
-                continue;
+                _stats[i]._requests++;
+                _stats[i]._totalTime += images[i].time;
+                _stats[i]._maxTime = osg::maximum( _stats[i]._maxTime, images[i].time );
             }
-            
-                //Only try to get data if the source actually has data                
-                if (source->hasDataInExtent( key.getExtent() ) )
-                {
-                    //We have data within these extents
-                    imageInfo.dataInExtents = true;
-
-                    if ( !source->getBlacklist()->contains( key.getTileId() ) )
-                    {                        
-                        osg::ref_ptr< ImageLayerPreCacheOperation > preCacheOp;
-                        if ( i->_imageLayerOptions.isSet() )
-                        {
-                            preCacheOp = new ImageLayerPreCacheOperation();
-                            preCacheOp->_processor.init( i->_imageLayerOptions.value(), _dbOptions.get(), true );                        
-                        }
-
-                        imageInfo.image = source->createImage( key, preCacheOp.get(), progress );
-                        imageInfo.opacity = 1.0f;
-
-                        //If the image is not valid and the progress was not cancelled, blacklist
-                        if (!imageInfo.image.valid() && (!progress || !progress->isCanceled()))
-                        {
-                            //Add the tile to the blacklist
-                            OE_DEBUG << LC << "Adding tile " << key.str() << " to the blacklist" << std::endl;
-                            source->getBlacklist()->add( key.getTileId() );
-                        }
-                        imageInfo.opacity = i->_imageLayerOptions.isSet() ? i->_imageLayerOptions->opacity().value() : 1.0f;
-                    }
-                }
-                else
-                {
-                    OE_DEBUG << LC << "Source has no data at " << key.str() << std::endl;
-                }
         }
+    }
+
+    if ( progress && progress->isCanceled() )
+        return 0L;
 
-        //Add the ImageInfo to the list
-        images.push_back( imageInfo );
+    // anything beneath an opaque component is hidden; discard it.
+    int cutoff = state.getCutoff();
+    for( int i=0; i<cutoff; ++i )
+    {
+        images[i].image = 0L;
+        images[i].dataInExtents = false;
     }
 
     unsigned numValidImages = 0;
@@ -281,17 +436,10 @@ CompositeTileSource::createImage(const TileKey&    key,
                 TileSource* source = _options._components[i]._tileSourceInstance;
                 if (source)
                 {                 
-                    osg::ref_ptr< ImageLayerPreCacheOperation > preCacheOp;
-                    if ( _options._components[i]._imageLayerOptions.isSet() )
-                    {
-                        preCacheOp = new ImageLayerPreCacheOperation();
-                        preCacheOp->_processor.init( _options._components[i]._imageLayerOptions.value(), _dbOptions.get(), true );                        
-                    }                
-
                     osg::ref_ptr< osg::Image > image;
                     while (!image.valid() && parentKey.valid())
                     {                        
-                        image = source->createImage( parentKey, preCacheOp.get(), progress );
+                        image = source->createImage( parentKey, _preCacheOps[i].get(), progress );
                         if (image.valid())
                         {                     
                             break;
@@ -365,6 +513,20 @@ CompositeTileSource::createImage(const TileKey&    key,
     }
 }
 
+void
+CompositeTileSource::getComponentStats( std::vector<ComponentStats>& out_stats ) const
+{
+    Threading::ScopedMutexLock lock( _statsMutex );
+    out_stats = _stats;
+}
+
+void
+CompositeTileSource::resetComponentStats()
+{
+    Threading::ScopedMutexLock lock( _statsMutex );
+    _stats.assign( _stats.size(), ComponentStats() );
+}
+
 bool
 CompositeTileSource::add( TileSource* ts )
 {
@@ -486,6 +648,29 @@ CompositeTileSource::initialize(const osgDB::Options* dbOptions)
     // set the new profile that was derived from the components
     setProfile( profile.get() );
 
+    // the pre-cache operations are the same for every tile, so set them up once:
+    _preCacheOps.clear();
+    for(CompositeTileSourceOptions::ComponentVector::const_iterator i = _options._components.begin();
+        i != _options._components.end();
+        ++i )
+    {
+        osg::ref_ptr< ImageLayerPreCacheOperation > preCacheOp;
+        if ( i->_imageLayerOptions.isSet() )
+        {
+            preCacheOp = new ImageLayerPreCacheOperation();
+            preCacheOp->_processor.init( i->_imageLayerOptions.value(), _dbOptions.get(), true );
+        }
+        _preCacheOps.push_back( preCacheOp.get() );
+    }
+
+    _stats.assign( _options._components.size(), ComponentStats() );
+
+    // fetch from multiple components in parallel:
+    if ( _options._components.size() > 1 )
+    {
+        _service = new TaskService( "CompositeTileSource", (int)_options._components.size()-1 );
+    }
+
     _initialized = true;
     return STATUS_OK;
 }
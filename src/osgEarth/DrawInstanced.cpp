@@ -21,14 +21,19 @@
 #include <osgEarth/ShaderUtils>
 #include <osgEarth/Registry>
 #include <osgEarth/Capabilities>
+#include <osgEarth/ShaderGenerator>
 
 #include <osg/ComputeBoundsVisitor>
 #include <osg/MatrixTransform>
-#include <osg/BufferIndexBinding>
+#include <osg/Texture2D>
 #include <osgUtil/MeshOptimizers>
+#include <OpenThreads/Atomic>
 
-#define MAX_COUNT_UBO   (Registry::capabilities().getMaxUniformBlockSize()/64)
-#define MAX_COUNT_ARRAY 128 // max size of a mat4 uniform array...how to query?
+// Layout of an instance texture. Each instance takes three RGBA32F texels, so
+// a row is 1536 texels wide; 2048 rows hold 1M instances per draw call. Both
+// dimensions stay within the 2048 maximum texture size of older GPUs.
+#define INSTANCES_PER_ROW 512
+#define MAX_ROWS          2048
 
 using namespace osgEarth;
 using namespace osgEarth::DrawInstanced;
@@ -39,6 +44,9 @@ using namespace osgEarth::DrawInstanced;
 namespace
 {
     typedef std::map< osg::ref_ptr<osg::Node>, std::vector<osg::Matrix> > ModelNodeMatrices;
+
+    // reserved texture image unit, plus one (zero means none is reserved).
+    OpenThreads::Atomic s_reservedUnitPlusOne;
     
     /**
      * Simple bbox callback to return a static bbox.
@@ -109,27 +117,19 @@ DrawInstanced::install(osg::StateSet* stateset)
 
     std::stringstream buf;
 
+    // fetch the first three columns of the instance's matrix; the last one is
+    // always (0,0,0,1).
     buf << "#version 120 \n"
-        << "#extension GL_EXT_gpu_shader4 : enable \n";
-        //<< "#extension GL_EXT_draw_instanced : enable\n";
-
-    if ( Registry::capabilities().supportsUniformBufferObjects() )
-    {
-        // note: no newlines in the layout() line, please
-        buf << "#extension GL_ARB_uniform_buffer_object : enable\n"
-            << "layout(std140) uniform oe_di_modelData { "
-            <<     "mat4 oe_di_modelMatrix[" << MAX_COUNT_UBO << "]; } ;\n";
-
-        vp->getTemplate()->addBindUniformBlock( "oe_di_modelData", 0 );
-    }
-    else
-    {
-        buf << "uniform mat4 oe_di_modelMatrix[" << MAX_COUNT_ARRAY << "];\n";
-    }
-
-    buf << "void oe_di_setPosition(inout vec4 VertexModel)\n"
+        << "#extension GL_EXT_gpu_shader4 : enable \n"
+        << "uniform sampler2D oe_di_transforms;\n"
+        << "void oe_di_setPosition(inout vec4 VertexModel)\n"
         << "{\n"
-        << "    VertexModel = oe_di_modelMatrix[gl_InstanceID] * VertexModel; \n"
+        << "    int x = 3 * (gl_InstanceID % " << INSTANCES_PER_ROW << "); \n"
+        << "    int y = gl_InstanceID / " << INSTANCES_PER_ROW << "; \n"
+        << "    vec4 c0 = texelFetch2D(oe_di_transforms, ivec2(x,   y), 0); \n"
+        << "    vec4 c1 = texelFetch2D(oe_di_transforms, ivec2(x+1, y), 0); \n"
+        << "    vec4 c2 = texelFetch2D(oe_di_transforms, ivec2(x+2, y), 0); \n"
+        << "    VertexModel = vec4(dot(VertexModel, c0), dot(VertexModel, c1), dot(VertexModel, c2), VertexModel.w); \n"
         << "}\n";
 
     std::string src;
@@ -139,6 +139,8 @@ DrawInstanced::install(osg::StateSet* stateset)
         "oe_di_setPosition",
         src,
         ShaderComp::LOCATION_VERTEX_MODEL );
+
+    stateset->getOrCreateUniform( "oe_di_transforms", osg::Uniform::SAMPLER_2D )->set( getTextureImageUnit() );
 }
 
 
@@ -153,7 +155,169 @@ DrawInstanced::remove(osg::StateSet* stateset)
         return;
 
     vp->removeShader( "oe_di_setPosition" );
-    vp->getTemplate()->removeBindUniformBlock( "oe_di_modelData" );
+    stateset->removeUniform( "oe_di_transforms" );
+}
+
+
+void
+DrawInstanced::setTextureImageUnit(int unit)
+{
+    s_reservedUnitPlusOne.exchange( unit >= 0 ? (unsigned)(unit + 1) : 0u );
+}
+
+
+int
+DrawInstanced::getTextureImageUnit()
+{
+    unsigned unitPlusOne = s_reservedUnitPlusOne;
+    if ( unitPlusOne > 0 )
+        return (int)unitPlusOne - 1;
+
+    return osg::maximum( Registry::capabilities().getMaxGPUTextureUnits() - 1, 0 );
+}
+
+
+unsigned
+DrawInstanced::getMaxInstancesPerBatch()
+{
+    return INSTANCES_PER_ROW * MAX_ROWS;
+}
+
+
+osg::Image*
+DrawInstanced::createInstanceImage(const osg::Matrix* matrices,
+                                   unsigned           count)
+{
+    if ( count == 0 || count > getMaxInstancesPerBatch() )
+        return 0L;
+
+    unsigned perRow = std::min( count, (unsigned)INSTANCES_PER_ROW );
+    unsigned rows   = (count + INSTANCES_PER_ROW - 1) / INSTANCES_PER_ROW;
+
+    osg::Image* image = new osg::Image();
+    image->allocateImage( 3*perRow, rows, 1, GL_RGBA, GL_FLOAT );
+    image->setInternalTextureFormat( GL_RGBA32F_ARB );
+
+    // pack the columns row by row; the texels of a row are contiguous.
+    float* ptr = reinterpret_cast<float*>( image->data() );
+    for( unsigned i=0; i<count; ++i )
+    {
+        const osg::Matrix& m = matrices[i];
+        for( unsigned c=0; c<3; ++c )
+        {
+            *ptr++ = m(0,c);
+            *ptr++ = m(1,c);
+            *ptr++ = m(2,c);
+            *ptr++ = m(3,c);
+        }
+    }
+
+    // zero the unused tail of the last row.
+    float* end = reinterpret_cast<float*>( image->data() ) + 12*perRow*rows;
+    while( ptr < end )
+        *ptr++ = 0.0f;
+
+    return image;
+}
+
+
+bool
+DrawInstanced::getInstanceMatrix(const osg::Image* image,
+                                 unsigned          index,
+                                 osg::Matrix&      output)
+{
+    if ( !image || image->getDataType() != GL_FLOAT || image->s() % 3 != 0 )
+        return false;
+
+    unsigned perRow = image->s() / 3;
+    unsigned x = index % INSTANCES_PER_ROW;
+    unsigned y = index / INSTANCES_PER_ROW;
+    if ( x >= perRow || (int)y >= image->t() )
+        return false;
+
+    const float* ptr = reinterpret_cast<const float*>( image->data(3*x, y) );
+    output.makeIdentity();
+    for( unsigned c=0; c<3; ++c )
+    {
+        output(0,c) = *ptr++;
+        output(1,c) = *ptr++;
+        output(2,c) = *ptr++;
+        output(3,c) = *ptr++;
+    }
+    return true;
+}
+
+
+void
+DrawInstanced::addInstances(osg::Group*                     parent,
+                            osg::Node*                      model,
+                            const std::vector<osg::Matrix>& matrices)
+{
+    if ( !parent || !model || matrices.empty() )
+        return;
+
+    // calculate the overall bounding box for the instances:
+    osg::ComputeBoundsVisitor cbv;
+    model->accept( cbv );
+    const osg::BoundingBox& nodeBox = cbv.getBoundingBox();
+
+    osg::BoundingBox bbox;
+    for( std::vector<osg::Matrix>::const_iterator m = matrices.begin(); m != matrices.end(); ++m )
+    {
+        for( unsigned c=0; c<8; ++c )
+            bbox.expandBy( nodeBox.corner(c) * (*m) );
+    }
+
+    unsigned batchSize  = std::min( (unsigned)matrices.size(), getMaxInstancesPerBatch() );
+    unsigned numBatches = (matrices.size() + batchSize - 1) / batchSize;
+    osg::ref_ptr<osg::Node> batchNode;
+
+    for( unsigned batch = 0; batch < numBatches; ++batch )
+    {
+        unsigned offset = batch * batchSize;
+        unsigned count  = std::min( batchSize, (unsigned)matrices.size() - offset );
+
+        // Convert a copy of the model's primitive sets to use "draw-instanced" rendering;
+        // at the same time, assign our computed bounding box as the static bounds for all
+        // geometries. (As DI's they cannot report bounds naturally.) Only the last
+        // batch can have a different size, so the copy is reused until then.
+        if ( !batchNode.valid() || count != batchSize )
+        {
+            // clone, but only make copies of necessary things; the mesh only
+            // needs optimizing the first time. Optimizing rewrites the vertex
+            // arrays in place, and the model may be shared (e.g. through a
+            // ResourceCache), so that first copy takes its own arrays and
+            // state sets. Later copies share them with the first one.
+            bool optimize = !batchNode.valid();
+            unsigned copyOp = osg::CopyOp::DEEP_COPY_NODES | osg::CopyOp::DEEP_COPY_DRAWABLES | osg::CopyOp::DEEP_COPY_PRIMITIVES;
+            if ( optimize )
+                copyOp |= osg::CopyOp::DEEP_COPY_ARRAYS | osg::CopyOp::DEEP_COPY_STATESETS;
+
+            batchNode = osg::clone(
+                optimize ? model : batchNode.get(),
+                osg::CopyOp(copyOp) );
+
+            ConvertToDrawInstanced cdi( count, bbox, optimize );
+            batchNode->accept( cdi );
+        }
+
+        osg::Texture2D* tex = new osg::Texture2D( createInstanceImage(&matrices[offset], count) );
+        tex->setFilter( osg::Texture::MIN_FILTER, osg::Texture::NEAREST );
+        tex->setFilter( osg::Texture::MAG_FILTER, osg::Texture::NEAREST );
+        tex->setResizeNonPowerOfTwoHint( false );
+        tex->setUnRefImageDataAfterApply( false );
+
+        // the texture holds data for the install() shader, so keep the shader
+        // generator from treating it as a color layer:
+        ShaderGenerator::setIgnoreHint( tex, true );
+
+        // this group is simply a container for the instance texture:
+        osg::Group* batchGroup = new osg::Group();
+        batchGroup->getOrCreateStateSet()->setTextureAttribute( getTextureImageUnit(), tex, osg::StateAttribute::ON );
+        batchGroup->addChild( batchNode.get() );
+
+        parent->addChild( batchGroup );
+    }
 }
 
 
@@ -184,111 +348,8 @@ DrawInstanced::convertGraphToUseDrawInstanced( osg::Group* parent )
     // get rid of the old matrix transforms.
     parent->removeChildren(0, parent->getNumChildren());
 
-    // whether to use UBOs.
-    bool useUBO = Registry::capabilities().supportsUniformBufferObjects();
-
-    // maximum size of a slice.
-    // for UBOs, assume 64K / sizeof(mat4) = 1024.
-    // for uniform array, assume 8K / sizeof(mat4) = 128.
-    unsigned maxSliceSize = useUBO ? MAX_COUNT_UBO : MAX_COUNT_ARRAY;
-
-    // For each model:
     for( ModelNodeMatrices::iterator i = models.begin(); i != models.end(); ++i )
     {
-        osg::Node*                node     = i->first.get();
-        std::vector<osg::Matrix>& matrices = i->second;
-
-        // calculate the overall bounding box for the model:
-        osg::ComputeBoundsVisitor cbv;
-        node->accept( cbv );
-        const osg::BoundingBox& nodeBox = cbv.getBoundingBox();
-
-        osg::BoundingBox bbox;
-        for( std::vector<osg::Matrix>::iterator m = matrices.begin(); m != matrices.end(); ++m )
-        {
-            osg::Matrix& matrix = *m;
-            bbox.expandBy(nodeBox.corner(0) * matrix);
-            bbox.expandBy(nodeBox.corner(1) * matrix);
-            bbox.expandBy(nodeBox.corner(2) * matrix);
-            bbox.expandBy(nodeBox.corner(3) * matrix);
-            bbox.expandBy(nodeBox.corner(4) * matrix);
-            bbox.expandBy(nodeBox.corner(5) * matrix);
-            bbox.expandBy(nodeBox.corner(6) * matrix);
-            bbox.expandBy(nodeBox.corner(7) * matrix);
-        }
-
-        // calculate slice count and sizes:
-        unsigned sliceSize = std::min(matrices.size(), (size_t)maxSliceSize);
-        unsigned numSlices = matrices.size() / maxSliceSize;
-        unsigned lastSliceSize = matrices.size() % maxSliceSize;
-        if ( lastSliceSize == 0 )
-            lastSliceSize = sliceSize;
-        else
-            ++numSlices;
-
-        // Convert the node's primitive sets to use "draw-instanced" rendering; at the
-        // same time, assign our computed bounding box as the static bounds for all
-        // geometries. (As DI's they cannot report bounds naturally.)
-        ConvertToDrawInstanced cdi(sliceSize, bbox, true);
-        node->accept( cdi );
-
-        // If we don't have an even number of instance groups, make a smaller last one.
-        osg::Node* lastNode = node;
-        if ( numSlices > 1 && lastSliceSize < sliceSize )
-        {
-            // clone, but only make copies of necessary things
-            lastNode = osg::clone( 
-                node, 
-                osg::CopyOp::DEEP_COPY_NODES | osg::CopyOp::DEEP_COPY_DRAWABLES | osg::CopyOp::DEEP_COPY_PRIMITIVES );
-
-            ConvertToDrawInstanced cdi(lastSliceSize, bbox, false);
-            lastNode->accept( cdi );
-        }
-
-        // Next, break the rendering down into "slices". GLSL will only support a limited
-        // amount of pre-instance uniform data, so we have to portion the graph out into
-        // slices of no more than this chunk size.
-        for( unsigned slice = 0; slice < numSlices; ++slice )
-        {
-            unsigned   offset      = slice * sliceSize;
-            unsigned   currentSize = slice == numSlices-1 ? lastSliceSize : sliceSize;
-            osg::Node* currentNode = slice == numSlices-1 ? lastNode      : node;
-
-            // this group is simply a container for the uniform:
-            osg::Group* sliceGroup = new osg::Group();
-
-            if ( useUBO ) // uniform buffer object:
-            {
-                osg::MatrixfArray* mats = new osg::MatrixfArray();
-                mats->setBufferObject( new osg::UniformBufferObject() );
-                // 64 = sizeof(mat4)
-                osg::UniformBufferBinding* ubb = new osg::UniformBufferBinding( 0, mats->getBufferObject(), 0, currentSize * 64 );
-                sliceGroup->getOrCreateStateSet()->setAttribute( ubb, osg::StateAttribute::ON );
-                for( unsigned m=0; m < currentSize; ++m )
-                {
-                    mats->push_back( matrices[offset + m] );
-                }
-                ubb->setDataVariance( osg::Object::DYNAMIC );
-            }
-            else // just use a uniform array
-            {
-                // assign the matrices to the uniform array:
-                ArrayUniform uniform(
-                    "oe_di_modelMatrix", 
-                    osg::Uniform::FLOAT_MAT4,
-                    sliceGroup->getOrCreateStateSet(),
-                    currentSize );
-
-                for( unsigned m=0; m < currentSize; ++m )
-                {
-                    uniform.setElement( m, matrices[offset + m] );
-                }
-            }
-
-            // add the node as a child:
-            sliceGroup->addChild( currentNode );
-
-            parent->addChild( sliceGroup );
-        }
+        addInstances( parent, i->first.get(), i->second );
     }
 }
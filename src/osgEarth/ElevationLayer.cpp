@@ -54,6 +54,7 @@ ElevationLayerOptions::getConfig( bool isolate ) const
 {
     Config conf = TerrainLayerOptions::getConfig( isolate );
     conf.updateIfSet("offset", _offset);
+    conf.updateIfSet("pyramid", _pyramid);
     return conf;
 }
 
@@ -61,6 +62,7 @@ void
 ElevationLayerOptions::fromConfig( const Config& conf )
 {
     conf.getIfSet( "offset", _offset );
+    conf.getIfSet( "pyramid", _pyramid );
 }
 
 void
@@ -124,6 +126,13 @@ ElevationLayer::init()
 {
     _tileSize = 15;
     //_tileSize = 32;
+
+    initInstrumentation( Instrumentation::STAGE_CREATE_HEIGHTFIELD );
+
+    if ( _runtimeOptions.pyramid().isSet() && !_runtimeOptions.pyramid()->empty() )
+    {
+        _pyramid = ElevationPyramid::open( _runtimeOptions.pyramid()->full() );
+    }
 }
 
 std::string
@@ -392,6 +401,8 @@ GeoHeightField
 ElevationLayer::createHeightField(const TileKey&    key, 
                                   ProgressCallback* progress )
 {
+    ScopedLatency timer( _createLatency );
+
     osg::HeightField* result = 0L;
 
     // If the layer is disabled, bail out.
@@ -420,16 +431,24 @@ ElevationLayer::createHeightField(const TileKey&    key,
 
     // First, attempt to read from the cache. Since the cached data is stored in the
     // map profile, we can try this first.
-    bool fromCache = false;
+    bool fromCache   = false;
+    bool fromPyramid = false;
     if ( cacheBin && getCachePolicy().isCacheReadable() )
     {
-        ReadResult r = cacheBin->readObject( key.str(), getCachePolicy().getMinAcceptTime() );
+        ReadResult r;
+        {
+            ScopedLatency timer( _cacheReadLatency );
+            r = cacheBin->readObject( key.str(), getCachePolicy().getMinAcceptTime() );
+        }
         if ( r.succeeded() )
         {
             result = r.release<osg::HeightField>();
             if ( result )
                 fromCache = true;
         }
+
+        InstrumentationCounter* counter = fromCache ? _cacheHits : _cacheMisses;
+        if ( counter ) counter->increment();
     }
 
     // if we're cache-only, but didn't get data from the cache, fail silently.
@@ -447,16 +466,31 @@ ElevationLayer::createHeightField(const TileKey&    key,
         if ( !isKeyValid(key) )
             return GeoHeightField::INVALID;
 
+        // Low LODs come from the precomputed pyramid when there is one; that
+        // spares the source a huge window read. It stands in for the source,
+        // so it only serves keys the source would.
+        if ( _pyramid.valid() && key.getLOD() <= _pyramid->getMaxLevel() &&
+             (!key.getProfile()->isHorizEquivalentTo(getProfile()) || getTileSource()->hasData(key)) )
+        {
+            result = _pyramid->createHeightField( key );
+            fromPyramid = result != 0L;
+        }
+
         // build a HF from the TileSource.
-        result = createHeightFieldFromTileSource( key, progress );
+        if ( !result )
+        {
+            result = createHeightFieldFromTileSource( key, progress );
+        }
     }
 
     // cache if necessary
     if ( result        && 
          cacheBin      && 
          !fromCache    &&
+         !fromPyramid  &&
          getCachePolicy().isCacheWriteable() )
     {
+        ScopedLatency timer( _cacheWriteLatency );
         cacheBin->write( key.str(), result );
     }
 
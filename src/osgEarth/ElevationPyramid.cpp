@@ -0,0 +1,842 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2013 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarth/ElevationPyramid>
+#include <osgEarth/ElevationLayer>
+#include <osgEarth/GeoCommon>
+#include <OpenThreads/Thread>
+#include <OpenThreads/Atomic>
+#include <sstream>
+#include <float.h>
+#include <string.h>
+#include <math.h>
+
+#ifdef _WIN32
+#  include <windows.h>
+#else
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
+#define LC "[ElevationPyramid] "
+
+using namespace osgEarth;
+
+//------------------------------------------------------------------------
+
+// File layout (all values in host byte order, checked by BYTE_ORDER_MARK):
+//
+//   "OEEP", version, byte order mark, tile size, number of levels,
+//   tiles wide/high at LOD 0, profile extent (4 doubles), data extent
+//   (4 doubles), horizontal SRS, vertical SRS (length-prefixed strings),
+//   then for each level its tile range (4 x uint32) and file offset (uint64).
+//
+// Each level is a dense row-major array of fixed-size tile slots covering
+// its tile range: a uint32 flag (1 = has data) followed by the min, max and
+// mean grids (tileSize^2 floats each, row 0 = south).
+
+namespace
+{
+    const char     MAGIC[4]         = { 'O', 'E', 'E', 'P' };
+    const unsigned VERSION          = 1;
+    const unsigned BYTE_ORDER_MARK  = 0x01020304;
+    const unsigned MAX_TILE_SIZE    = 1025;
+    const unsigned MAX_LEVELS       = 32;
+    const unsigned BOUNDS_MAX_TILES = 16; // tiles read per getBounds() call, at most
+
+    template<typename T>
+    void write( std::ostream& out, const T& value ) {
+        out.write( reinterpret_cast<const char*>(&value), sizeof(T) ); }
+
+    void writeString( std::ostream& out, const std::string& value ) {
+        write( out, (unsigned)value.size() );
+        out.write( value.data(), value.size() ); }
+
+    template<typename T>
+    bool read( std::istream& in, T& value ) {
+        in.read( reinterpret_cast<char*>(&value), sizeof(T) );
+        return in.good(); }
+
+    bool readString( std::istream& in, std::string& value ) {
+        unsigned len;
+        if ( !read(in, len) || len > 65536 ) return false;
+        value.resize( len );
+        if ( len > 0 ) in.read( &value[0], len );
+        return in.good(); }
+
+    /** Tile range of a level that covers an extent (in the profile's SRS) */
+    bool getTileRange( const Profile* profile, unsigned lod, const GeoExtent& ex,
+                       unsigned& x0, unsigned& y0, unsigned& x1, unsigned& y1 )
+    {
+        const GeoExtent& pe = profile->getExtent();
+        double xmin = osg::maximum( ex.xMin(), pe.xMin() );
+        double xmax = osg::minimum( ex.xMax(), pe.xMax() );
+        double ymin = osg::maximum( ex.yMin(), pe.yMin() );
+        double ymax = osg::minimum( ex.yMax(), pe.yMax() );
+        if ( xmin > xmax || ymin > ymax )
+            return false;
+
+        unsigned tw, th;
+        double   w, h;
+        profile->getNumTiles( lod, tw, th );
+        profile->getTileDimensions( lod, w, h );
+
+        // tile rows count down from the top of the profile.
+        x0 = (unsigned)osg::clampBetween( floor((xmin - pe.xMin())/w),       0.0, (double)(tw-1) );
+        x1 = (unsigned)osg::clampBetween( ceil ((xmax - pe.xMin())/w) - 1.0, 0.0, (double)(tw-1) );
+        y0 = (unsigned)osg::clampBetween( floor((pe.yMax() - ymax)/h),       0.0, (double)(th-1) );
+        y1 = (unsigned)osg::clampBetween( ceil ((pe.yMax() - ymin)/h) - 1.0, 0.0, (double)(th-1) );
+        if ( x1 < x0 ) x1 = x0;
+        if ( y1 < y0 ) y1 = y0;
+        return true;
+    }
+
+    bool isValid( float h ) { return h != NO_DATA_VALUE; }
+
+    /**
+     * Reduces a source heightfield (any size, same extent) to a tile. Each
+     * posting takes the min/max/mean of the source samples within half a
+     * posting interval of it, or the nearest sample if the source is coarser.
+     */
+    bool reduceSource( const osg::HeightField* hf, unsigned n, float* mins, float* maxs, float* means )
+    {
+        const unsigned cols = hf->getNumColumns(), rows = hf->getNumRows();
+        if ( cols < 2 || rows < 2 )
+            return false;
+
+        bool any = false;
+        double half = 0.5 / (double)(n-1);
+
+        for( unsigned j=0; j<n; ++j )
+        {
+            double v = (double)j/(double)(n-1);
+            int r0 = (int)ceil ( (v-half)*(rows-1) ), r1 = (int)floor( (v+half)*(rows-1) );
+            int rn = (int)floor( v*(rows-1) + 0.5 );
+            r0 = osg::clampBetween( osg::minimum(r0, rn), 0, (int)rows-1 );
+            r1 = osg::clampBetween( osg::maximum(r1, rn), 0, (int)rows-1 );
+
+            for( unsigned i=0; i<n; ++i )
+            {
+                double u = (double)i/(double)(n-1);
+                int c0 = (int)ceil ( (u-half)*(cols-1) ), c1 = (int)floor( (u+half)*(cols-1) );
+                int cn = (int)floor( u*(cols-1) + 0.5 );
+                c0 = osg::clampBetween( osg::minimum(c0, cn), 0, (int)cols-1 );
+                c1 = osg::clampBetween( osg::maximum(c1, cn), 0, (int)cols-1 );
+
+                float  lo = FLT_MAX, hi = -FLT_MAX;
+                double sum = 0.0;
+                unsigned count = 0;
+                for( int r=r0; r<=r1; ++r )
+                {
+                    for( int c=c0; c<=c1; ++c )
+                    {
+                        float h = hf->getHeight( c, r );
+                        if ( isValid(h) )
+                        {
+                            lo = osg::minimum( lo, h );
+                            hi = osg::maximum( hi, h );
+                            sum += h;
+                            ++count;
+                        }
+                    }
+                }
+
+                unsigned k = j*n + i;
+                if ( count > 0 )
+                {
+                    mins[k]  = lo;
+                    maxs[k]  = hi;
+                    means[k] = (float)(sum / (double)count);
+                    any = true;
+                }
+                else
+                {
+                    mins[k] = maxs[k] = means[k] = NO_DATA_VALUE;
+                }
+            }
+        }
+        return any;
+    }
+
+    /**
+     * Reduces four child tiles to their parent. The children are laid into
+     * a (2n-1)^2 grid (they share edge postings); each parent posting takes
+     * the min/max of the 3x3 child postings around it and a tent-weighted
+     * mean, which integrates the same area as the parent posting's cell.
+     */
+    bool reduceChildren( unsigned n, const std::vector<float>* childMin, const std::vector<float>* childMax,
+                         const std::vector<float>* childMean, const bool* present,
+                         float* mins, float* maxs, float* means )
+    {
+        const unsigned m = 2*n - 1;
+        std::vector<float> cmin( m*m, NO_DATA_VALUE ), cmax( m*m, NO_DATA_VALUE ), cmean( m*m, NO_DATA_VALUE );
+
+        for( unsigned q=0; q<4; ++q )
+        {
+            if ( !present[q] )
+                continue;
+
+            // quadrants 0,1 are the northern children (upper rows of the grid).
+            unsigned col0 = (q & 1) ? n-1 : 0;
+            unsigned row0 = (q < 2) ? n-1 : 0;
+            for( unsigned r=0; r<n; ++r )
+            {
+                for( unsigned c=0; c<n; ++c )
+                {
+                    unsigned src = r*n + c, dst = (row0+r)*m + (col0+c);
+                    if ( isValid(childMean[q][src]) )
+                    {
+                        cmin [dst] = childMin [q][src];
+                        cmax [dst] = childMax [q][src];
+                        cmean[dst] = childMean[q][src];
+                    }
+                }
+            }
+        }
+
+        static const double weights[3] = { 0.25, 0.5, 0.25 };
+
+        bool any = false;
+        for( unsigned j=0; j<n; ++j )
+        {
+            for( unsigned i=0; i<n; ++i )
+            {
+                float  lo = FLT_MAX, hi = -FLT_MAX;
+                double sum = 0.0, weight = 0.0;
+
+                for( int dr=-1; dr<=1; ++dr )
+                {
+                    int r = (int)(2*j) + dr;
+                    if ( r < 0 || r >= (int)m ) continue;
+                    for( int dc=-1; dc<=1; ++dc )
+                    {
+                        int c = (int)(2*i) + dc;
+                        if ( c < 0 || c >= (int)m ) continue;
+
+                        unsigned k = r*m + c;
+                        if ( isValid(cmean[k]) )
+                        {
+                            lo = osg::minimum( lo, cmin[k] );
+                            hi = osg::maximum( hi, cmax[k] );
+                            double w = weights[dr+1] * weights[dc+1];
+                            sum    += w * cmean[k];
+                            weight += w;
+                        }
+                    }
+                }
+
+                unsigned k = j*n + i;
+                if ( weight > 0.0 )
+                {
+                    mins[k]  = lo;
+                    maxs[k]  = hi;
+                    means[k] = (float)(sum / weight);
+                    any = true;
+                }
+                else
+                {
+                    mins[k] = maxs[k] = means[k] = NO_DATA_VALUE;
+                }
+            }
+        }
+        return any;
+    }
+}
+
+//------------------------------------------------------------------------
+
+ElevationPyramid::ElevationPyramid() :
+_tileSize ( 0 ),
+_map      ( 0L ),
+_mapSize  ( 0 ),
+_mapHandle( 0L )
+{
+    //nop
+}
+
+ElevationPyramid::~ElevationPyramid()
+{
+    if ( _map )
+    {
+#ifdef _WIN32
+        ::UnmapViewOfFile( _map );
+        ::CloseHandle( (HANDLE)_mapHandle );
+#else
+        ::munmap( (void*)_map, (size_t)_mapSize );
+#endif
+    }
+}
+
+ElevationPyramid*
+ElevationPyramid::open( const std::string& path )
+{
+    osg::ref_ptr<ElevationPyramid> pyramid = new ElevationPyramid();
+    pyramid->_in.open( path.c_str(), std::ios::in | std::ios::binary );
+    if ( !pyramid->_in.is_open() )
+    {
+        OE_WARN << LC << "Cannot open " << path << std::endl;
+        return 0L;
+    }
+
+    if ( !pyramid->readHeader(pyramid->_in) )
+    {
+        OE_WARN << LC << path << " is not a valid elevation pyramid" << std::endl;
+        return 0L;
+    }
+
+    // make sure the file really holds every level.
+    pyramid->_in.seekg( 0, std::ios::end );
+    unsigned long long fileSize = (unsigned long long)pyramid->_in.tellg();
+    for( unsigned i=0; i<pyramid->_levels.size(); ++i )
+    {
+        const Level& level = pyramid->_levels[i];
+        if ( level._x1 < level._x0 )
+            continue;
+        unsigned long long count = (unsigned long long)(level._x1-level._x0+1) * (level._y1-level._y0+1);
+        if ( level._offset + count*pyramid->getSlotSize() > fileSize )
+        {
+            OE_WARN << LC << path << " is truncated" << std::endl;
+            return 0L;
+        }
+    }
+
+    // map the file so reads are just pointer arithmetic. If that doesn't
+    // work (e.g. a huge file on a 32-bit system) fall back on the stream.
+    if ( fileSize > 0 && fileSize <= (unsigned long long)(size_t)-1 )
+    {
+#ifdef _WIN32
+        HANDLE file = ::CreateFileA( path.c_str(), GENERIC_READ, FILE_SHARE_READ, 0L, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0L );
+        if ( file != INVALID_HANDLE_VALUE )
+        {
+            HANDLE mapping = ::CreateFileMappingA( file, 0L, PAGE_READONLY, 0, 0, 0L );
+            if ( mapping )
+            {
+                void* view = ::MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+                if ( view )
+                {
+                    pyramid->_map       = (const unsigned char*)view;
+                    pyramid->_mapHandle = mapping;
+                }
+                else
+                {
+                    ::CloseHandle( mapping );
+                }
+            }
+            ::CloseHandle( file );
+        }
+#else
+        int fd = ::open( path.c_str(), O_RDONLY );
+        if ( fd >= 0 )
+        {
+            void* view = ::mmap( 0L, (size_t)fileSize, PROT_READ, MAP_SHARED, fd, 0 );
+            if ( view != MAP_FAILED )
+                pyramid->_map = (const unsigned char*)view;
+            ::close( fd );
+        }
+#endif
+    }
+
+    if ( pyramid->_map )
+    {
+        pyramid->_mapSize = fileSize;
+        pyramid->_in.close();
+    }
+    else
+    {
+        OE_INFO << LC << "Cannot memory-map " << path << "; reading through a stream" << std::endl;
+    }
+
+    OE_INFO << LC << "Opened " << path << ": levels 0-" << pyramid->getMaxLevel()
+        << ", " << pyramid->_tileSize << "x" << pyramid->_tileSize << " tiles" << std::endl;
+
+    return pyramid.release();
+}
+
+bool
+ElevationPyramid::readHeader( std::istream& in )
+{
+    char magic[4];
+    in.read( magic, 4 );
+    if ( !in.good() || memcmp(magic, MAGIC, 4) != 0 )
+        return false;
+
+    unsigned version, byteOrder, numLevels, tilesWide, tilesHigh;
+    if ( !read(in, version) || version != VERSION )
+        return false;
+    if ( !read(in, byteOrder) || byteOrder != BYTE_ORDER_MARK )
+        return false;
+    if ( !read(in, _tileSize) || _tileSize < 2 || _tileSize > MAX_TILE_SIZE )
+        return false;
+    if ( !read(in, numLevels) || numLevels == 0 || numLevels > MAX_LEVELS )
+        return false;
+    if ( !read(in, tilesWide) || !read(in, tilesHigh) )
+        return false;
+
+    double pex[4], dex[4];
+    for( unsigned i=0; i<4; ++i ) if ( !read(in, pex[i]) ) return false;
+    for( unsigned i=0; i<4; ++i ) if ( !read(in, dex[i]) ) return false;
+
+    std::string hsrs, vsrs;
+    if ( !readString(in, hsrs) || !readString(in, vsrs) )
+        return false;
+
+    _profile = Profile::create( hsrs, pex[0], pex[1], pex[2], pex[3], vsrs, tilesWide, tilesHigh );
+    if ( !_profile.valid() )
+        return false;
+
+    _dataExtent = GeoExtent( _profile->getSRS(), dex[0], dex[1], dex[2], dex[3] );
+
+    _levels.resize( numLevels );
+    for( unsigned i=0; i<numLevels; ++i )
+    {
+        Level& level = _levels[i];
+        if ( !read(in, level._x0) || !read(in, level._y0) || !read(in, level._x1) || !read(in, level._y1) || !read(in, level._offset) )
+            return false;
+    }
+
+    return true;
+}
+
+const unsigned char*
+ElevationPyramid::getSlot( unsigned lod, unsigned x, unsigned y, std::vector<unsigned char>& buf ) const
+{
+    if ( lod >= _levels.size() || !_levels[lod].contains(x, y) )
+        return 0L;
+
+    const Level& level = _levels[lod];
+    unsigned long long index  = (unsigned long long)(y - level._y0) * (level._x1 - level._x0 + 1) + (x - level._x0);
+    unsigned long long offset = level._offset + index * getSlotSize();
+
+    if ( _map )
+        return _map + offset;
+
+    Threading::ScopedMutexLock lock( _inMutex );
+    buf.resize( getSlotSize() );
+    _in.clear();
+    _in.seekg( (std::streamoff)offset );
+    _in.read( (char*)&buf[0], buf.size() );
+    return _in.good() ? &buf[0] : 0L;
+}
+
+bool
+ElevationPyramid::readTile( unsigned lod, unsigned x, unsigned y, float* mins, float* maxs, float* means ) const
+{
+    std::vector<unsigned char> buf;
+    const unsigned char* slot = getSlot( lod, x, y, buf );
+    if ( !slot )
+        return false;
+
+    unsigned flags;
+    memcpy( &flags, slot, 4 );
+    if ( (flags & 1) == 0 )
+        return false;
+
+    const unsigned bytes = getGridSize() * sizeof(float);
+    if ( mins )  memcpy( mins,  slot + 4,           bytes );
+    if ( maxs )  memcpy( maxs,  slot + 4 + bytes,   bytes );
+    if ( means ) memcpy( means, slot + 4 + 2*bytes, bytes );
+    return true;
+}
+
+bool
+ElevationPyramid::hasTile( const TileKey& key ) const
+{
+    if ( key.getLOD() > getMaxLevel() || !key.getProfile()->isEquivalentTo(_profile.get()) )
+        return false;
+
+    unsigned x, y;
+    key.getTileXY( x, y );
+    return readTile( key.getLOD(), x, y, 0L, 0L, 0L );
+}
+
+osg::HeightField*
+ElevationPyramid::createHeightField( const TileKey& key ) const
+{
+    if ( key.getLOD() > getMaxLevel() || !key.getProfile()->isEquivalentTo(_profile.get()) )
+        return 0L;
+
+    unsigned x, y;
+    key.getTileXY( x, y );
+
+    osg::ref_ptr<osg::HeightField> hf = new osg::HeightField();
+    hf->allocate( _tileSize, _tileSize );
+    if ( !readTile(key.getLOD(), x, y, 0L, 0L, &hf->getFloatArray()->front()) )
+        return 0L;
+
+    return hf.release();
+}
+
+bool
+ElevationPyramid::getBounds( const GeoExtent& extent, float& out_min, float& out_max ) const
+{
+    GeoExtent ex = extent;
+    if ( !ex.getSRS()->isHorizEquivalentTo(_profile->getSRS()) )
+        ex = extent.transform( _profile->getSRS() );
+
+    if ( !ex.isValid() || !_dataExtent.intersects(ex) )
+        return false;
+
+    // deepest level at which the extent spans only a few tiles.
+    unsigned lod = 0, x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+    if ( !getTileRange(_profile.get(), 0, ex, x0, y0, x1, y1) )
+        return false;
+
+    for( unsigned i=1; i<=getMaxLevel(); ++i )
+    {
+        unsigned a0, b0, a1, b1;
+        if ( !getTileRange(_profile.get(), i, ex, a0, b0, a1, b1) )
+            break;
+        if ( (a1-a0+1)*(b1-b0+1) > BOUNDS_MAX_TILES )
+            break;
+        lod = i, x0 = a0, y0 = b0, x1 = a1, y1 = b1;
+    }
+
+    const unsigned n = _tileSize;
+    std::vector<float> mins( n*n ), maxs( n*n );
+
+    float lo = FLT_MAX, hi = -FLT_MAX;
+    bool found = false;
+
+    for( unsigned ty=y0; ty<=y1; ++ty )
+    {
+        for( unsigned tx=x0; tx<=x1; ++tx )
+        {
+            if ( !readTile(lod, tx, ty, &mins[0], &maxs[0], 0L) )
+                continue;
+
+            const GeoExtent& te = TileKey(lod, tx, ty, _profile.get()).getExtent();
+            double dx = te.width() / (double)(n-1), dy = te.height() / (double)(n-1);
+
+            // postings whose cell (half an interval each way) touches the extent.
+            int c0 = osg::maximum( 0,        (int)ceil ((ex.xMin() - te.xMin())/dx - 0.5) );
+            int c1 = osg::minimum( (int)n-1, (int)floor((ex.xMax() - te.xMin())/dx + 0.5) );
+            int r0 = osg::maximum( 0,        (int)ceil ((ex.yMin() - te.yMin())/dy - 0.5) );
+            int r1 = osg::minimum( (int)n-1, (int)floor((ex.yMax() - te.yMin())/dy + 0.5) );
+
+            for( int r=r0; r<=r1; ++r )
+            {
+                for( int c=c0; c<=c1; ++c )
+                {
+                    unsigned k = r*n + c;
+                    if ( isValid(mins[k]) )
+                    {
+                        lo = osg::minimum( lo, mins[k] );
+                        hi = osg::maximum( hi, maxs[k] );
+                        found = true;
+                    }
+                }
+            }
+        }
+    }
+
+    if ( found )
+    {
+        out_min = lo;
+        out_max = hi;
+    }
+    return found;
+}
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    /** The output file while it's being built; all access is serialized. */
+    struct BuildFile
+    {
+        std::fstream                         _file;
+        std::vector<ElevationPyramid::Level> _levels;
+        unsigned                             _tileSize;
+        Threading::Mutex                     _mutex;
+
+        unsigned slotSize() const { return 4u + 12u*_tileSize*_tileSize; }
+
+        unsigned long long slotOffset( unsigned lod, unsigned x, unsigned y ) const {
+            const ElevationPyramid::Level& level = _levels[lod];
+            return level._offset + ((unsigned long long)(y-level._y0)*(level._x1-level._x0+1) + (x-level._x0)) * slotSize(); }
+
+        bool writeTile( unsigned lod, unsigned x, unsigned y, const float* mins, const float* maxs, const float* means )
+        {
+            const unsigned grid = _tileSize*_tileSize;
+            unsigned flags = 1;
+            Threading::ScopedMutexLock lock( _mutex );
+            _file.seekp( (std::streamoff)slotOffset(lod, x, y) );
+            write( _file, flags );
+            _file.write( (const char*)mins,  grid*sizeof(float) );
+            _file.write( (const char*)maxs,  grid*sizeof(float) );
+            _file.write( (const char*)means, grid*sizeof(float) );
+            return _file.good();
+        }
+
+        bool readTile( unsigned lod, unsigned x, unsigned y, float* mins, float* maxs, float* means )
+        {
+            if ( !_levels[lod].contains(x, y) )
+                return false;
+
+            const unsigned grid = _tileSize*_tileSize;
+            unsigned flags = 0;
+            Threading::ScopedMutexLock lock( _mutex );
+            _file.seekg( (std::streamoff)slotOffset(lod, x, y) );
+            if ( !read(_file, flags) || (flags & 1) == 0 )
+            {
+                _file.clear();
+                return false;
+            }
+            _file.read( (char*)mins,  grid*sizeof(float) );
+            _file.read( (char*)maxs,  grid*sizeof(float) );
+            _file.read( (char*)means, grid*sizeof(float) );
+            return _file.good();
+        }
+    };
+
+    /** Reads the deepest level from the source layer. */
+    struct SourceWorker : public OpenThreads::Thread
+    {
+        SourceWorker( ElevationLayer* layer, const std::vector<TileKey>& keys, OpenThreads::Atomic& next,
+                      OpenThreads::Atomic& done, BuildFile& file, ProgressCallback* progress )
+            : _layer(layer), _keys(keys), _next(next), _done(done), _file(file), _progress(progress), _ok(true) { }
+
+        void run()
+        {
+            const unsigned n = _file._tileSize;
+            std::vector<float> mins( n*n ), maxs( n*n ), means( n*n );
+
+            for( unsigned i = (++_next)-1; i < _keys.size(); i = (++_next)-1 )
+            {
+                if ( _progress && _progress->isCanceled() )
+                    return;
+
+                const TileKey& key = _keys[i];
+                GeoHeightField hf = _layer->createHeightField( key, _progress );
+                if ( hf.valid() && reduceSource(hf.getHeightField(), n, &mins[0], &maxs[0], &means[0]) )
+                {
+                    unsigned x, y;
+                    key.getTileXY( x, y );
+                    if ( !_file.writeTile(key.getLOD(), x, y, &mins[0], &maxs[0], &means[0]) )
+                    {
+                        _ok = false;
+                        return;
+                    }
+                }
+
+                unsigned done = ++_done;
+                if ( _progress )
+                {
+                    Threading::ScopedMutexLock lock( _file._mutex );
+                    _progress->reportProgress( (double)done, (double)_keys.size(), 0, 1, "Reading source" );
+                }
+            }
+        }
+
+        ElevationLayer*             _layer;
+        const std::vector<TileKey>& _keys;
+        OpenThreads::Atomic&        _next;
+        OpenThreads::Atomic&        _done;
+        BuildFile&                  _file;
+        ProgressCallback*           _progress;
+        bool                        _ok;
+    };
+}
+
+ElevationPyramidBuilder::ElevationPyramidBuilder() :
+_maxLevel  ( 10 ),
+_tileSize  ( 17 ),
+_numThreads( 1 )
+{
+    //nop
+}
+
+bool
+ElevationPyramidBuilder::build( ElevationLayer* layer, const Profile* profile, const std::string& path )
+{
+    if ( !layer || !profile || !layer->getTileSource() )
+    {
+        OE_WARN << LC << "Build requires an elevation layer with a tile source and a profile" << std::endl;
+        return false;
+    }
+
+    if ( _tileSize < 2 || _tileSize > MAX_TILE_SIZE || _maxLevel >= MAX_LEVELS )
+    {
+        OE_WARN << LC << "Illegal tile size or max level" << std::endl;
+        return false;
+    }
+
+    // never read back through an existing pyramid (and release its file,
+    // which may be the one we're about to overwrite).
+    layer->setPyramid( 0L );
+
+    // extent of the data, in the target profile.
+    GeoExtent dataExtent;
+    if ( _extent.isValid() )
+    {
+        dataExtent = _extent.transform( profile->getSRS() );
+    }
+    else
+    {
+        const DataExtentList& dataExtents = layer->getTileSource()->getDataExtents();
+        for( DataExtentList::const_iterator i = dataExtents.begin(); i != dataExtents.end(); ++i )
+        {
+            GeoExtent e = i->transform( profile->getSRS() );
+            if ( !e.isValid() )
+                continue;
+            if ( dataExtent.isValid() )
+                dataExtent.expandToInclude( e );
+            else
+                dataExtent = e;
+        }
+        if ( !dataExtent.isValid() && layer->getProfile() )
+            dataExtent = layer->getProfile()->getExtent().transform( profile->getSRS() );
+    }
+    if ( !dataExtent.isValid() )
+        dataExtent = profile->getExtent();
+
+    BuildFile out;
+    out._tileSize = _tileSize;
+    out._levels.resize( _maxLevel+1 );
+
+    // header, so we know where the first level starts.
+    std::stringstream header;
+    header.write( MAGIC, 4 );
+    write( header, VERSION );
+    write( header, BYTE_ORDER_MARK );
+    write( header, _tileSize );
+    write( header, (unsigned)out._levels.size() );
+    unsigned tw, th;
+    profile->getNumTiles( 0, tw, th );
+    write( header, tw );
+    write( header, th );
+    const GeoExtent& pe = profile->getExtent();
+    write( header, pe.xMin() ); write( header, pe.yMin() ); write( header, pe.xMax() ); write( header, pe.yMax() );
+    write( header, dataExtent.xMin() ); write( header, dataExtent.yMin() ); write( header, dataExtent.xMax() ); write( header, dataExtent.yMax() );
+    writeString( header, profile->getSRS()->getHorizInitString() );
+    writeString( header, profile->getSRS()->getVertInitString() );
+
+    unsigned long long offset = header.str().size() + out._levels.size() * (4*sizeof(unsigned) + sizeof(unsigned long long));
+    offset = (offset + 7) & ~7ull;
+
+    for( unsigned lod=0; lod<out._levels.size(); ++lod )
+    {
+        ElevationPyramid::Level& level = out._levels[lod];
+        level._offset = offset;
+        if ( getTileRange(profile, lod, dataExtent, level._x0, level._y0, level._x1, level._y1) )
+            offset += (unsigned long long)(level._x1-level._x0+1) * (level._y1-level._y0+1) * out.slotSize();
+    }
+
+    out._file.open( path.c_str(), std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc );
+    if ( !out._file.is_open() )
+    {
+        OE_WARN << LC << "Cannot write to " << path << std::endl;
+        return false;
+    }
+
+    out._file << header.str();
+    for( unsigned lod=0; lod<out._levels.size(); ++lod )
+    {
+        const ElevationPyramid::Level& level = out._levels[lod];
+        write( out._file, level._x0 ); write( out._file, level._y0 );
+        write( out._file, level._x1 ); write( out._file, level._y1 );
+        write( out._file, level._offset );
+    }
+
+    // size the file up front; unwritten slots read back as "no data".
+    out._file.seekp( (std::streamoff)(offset-1) );
+    out._file.put( 0 );
+    if ( !out._file.good() )
+    {
+        OE_WARN << LC << "Cannot allocate " << offset << " bytes for " << path << std::endl;
+        return false;
+    }
+
+    // the deepest level comes from the source.
+    const ElevationPyramid::Level& bottom = out._levels[_maxLevel];
+    std::vector<TileKey> keys;
+    for( unsigned y=bottom._y0; bottom._x1 >= bottom._x0 && y<=bottom._y1; ++y )
+        for( unsigned x=bottom._x0; x<=bottom._x1; ++x )
+            keys.push_back( TileKey(_maxLevel, x, y, profile) );
+
+    OE_INFO << LC << "Reading " << keys.size() << " tiles at level " << _maxLevel << " from \"" << layer->getName() << "\"" << std::endl;
+
+    OpenThreads::Atomic next, done;
+    std::vector<SourceWorker*> workers;
+    for( unsigned i=0; i<osg::maximum(_numThreads, 1u); ++i )
+    {
+        workers.push_back( new SourceWorker(layer, keys, next, done, out, _progress.get()) );
+        workers.back()->start();
+    }
+
+    bool ok = true;
+    for( unsigned i=0; i<workers.size(); ++i )
+    {
+        workers[i]->join();
+        ok = ok && workers[i]->_ok;
+        delete workers[i];
+    }
+
+    if ( !ok || (_progress.valid() && _progress->isCanceled()) )
+    {
+        OE_WARN << LC << "Build of " << path << " failed or was canceled" << std::endl;
+        return false;
+    }
+
+    // every level above is reduced from the one below it.
+    const unsigned grid = _tileSize*_tileSize;
+    std::vector<float> childMin[4], childMax[4], childMean[4];
+    for( unsigned q=0; q<4; ++q )
+    {
+        childMin[q].resize( grid );
+        childMax[q].resize( grid );
+        childMean[q].resize( grid );
+    }
+    std::vector<float> mins( grid ), maxs( grid ), means( grid );
+
+    for( int lod=(int)_maxLevel-1; lod >= 0; --lod )
+    {
+        const ElevationPyramid::Level& level = out._levels[lod];
+        for( unsigned y=level._y0; level._x1 >= level._x0 && y<=level._y1; ++y )
+        {
+            for( unsigned x=level._x0; x<=level._x1; ++x )
+            {
+                bool present[4], any = false;
+                for( unsigned q=0; q<4; ++q )
+                {
+                    unsigned cx = x*2 + (q & 1), cy = y*2 + (q >> 1);
+                    present[q] = out.readTile( lod+1, cx, cy, &childMin[q][0], &childMax[q][0], &childMean[q][0] );
+                    any = any || present[q];
+                }
+
+                if ( any && reduceChildren(_tileSize, childMin, childMax, childMean, present, &mins[0], &maxs[0], &means[0]) )
+                {
+                    if ( !out.writeTile(lod, x, y, &mins[0], &maxs[0], &means[0]) )
+                    {
+                        OE_WARN << LC << "Failed writing to " << path << std::endl;
+                        return false;
+                    }
+                }
+            }
+        }
+
+        if ( _progress.valid() && _progress->reportProgress(_maxLevel-lod, _maxLevel, 0, 1, "Reducing levels") )
+            return false;
+    }
+
+    out._file.close();
+    OE_INFO << LC << "Wrote " << path << std::endl;
+    return true;
+}
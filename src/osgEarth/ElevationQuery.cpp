@@ -1,6 +1,7 @@
 #include <osgEarth/ElevationQuery>
 #include <osgEarth/Locators>
 #include <osgEarth/HeightFieldUtils>
+#include <float.h>
 #include <osgUtil/IntersectionVisitor>
 #include <osgUtil/LineSegmentIntersector>
 
@@ -208,6 +209,49 @@ ElevationQuery::getElevations(const std::vector<osg::Vec3d>& points,
     return true;
 }
 
+bool
+ElevationQuery::getElevationBounds(const GeoExtent& extent,
+                                   double&          out_min,
+                                   double&          out_max )
+{
+    sync();
+
+    bool   found = false;
+    double lo = DBL_MAX, hi = -DBL_MAX;
+    double offsetLo = 0.0, offsetHi = 0.0;
+
+    for( ElevationLayerVector::const_iterator i = _mapf.elevationLayers().begin(); i != _mapf.elevationLayers().end(); ++i )
+    {
+        ElevationLayer* layer = i->get();
+        if ( !layer->getEnabled() || !layer->getPyramid() )
+            continue;
+
+        float layerMin, layerMax;
+        if ( !layer->getPyramid()->getBounds(extent, layerMin, layerMax) )
+            continue;
+
+        // offset layers add to whatever is under them, so they widen the range.
+        if ( *layer->getElevationLayerOptions().offset() )
+        {
+            offsetLo += osg::minimum( 0.0, (double)layerMin );
+            offsetHi += osg::maximum( 0.0, (double)layerMax );
+        }
+        else
+        {
+            lo = osg::minimum( lo, (double)layerMin );
+            hi = osg::maximum( hi, (double)layerMax );
+            found = true;
+        }
+    }
+
+    if ( found )
+    {
+        out_min = lo + offsetLo;
+        out_max = hi + offsetHi;
+    }
+    return found;
+}
+
 bool
 ElevationQuery::getElevationImpl(const GeoPoint& point,
                                  double&         out_elevation,
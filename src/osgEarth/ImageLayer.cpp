@@ -249,6 +249,8 @@ ImageLayer::init()
 {
     _emptyImage = ImageUtils::createEmptyImage();
     //*((unsigned*)_emptyImage->data()) = 0x7F0000FF;
+
+    initInstrumentation( Instrumentation::STAGE_CREATE_IMAGE );
 }
 
 void
@@ -385,6 +387,8 @@ ImageLayer::getCacheBin( const Profile* profile )
 GeoImage
 ImageLayer::createImage( const TileKey& key, ProgressCallback* progress, bool forceFallback )
 {
+    ScopedLatency timer( _createLatency );
+
     bool isFallback;
     return createImageInKeyProfile( key, progress, forceFallback, isFallback);
 }
@@ -555,9 +559,14 @@ ImageLayer::createImageInKeyProfile( const TileKey& key, ProgressCallback* progr
     // map profile, we can try this first.
     if ( cacheBin && getCachePolicy().isCacheReadable() )
     {
-        ReadResult r = cacheBin->readImage( key.str(), getCachePolicy().getMinAcceptTime() );
+        ReadResult r;
+        {
+            ScopedLatency timer( _cacheReadLatency );
+            r = cacheBin->readImage( key.str(), getCachePolicy().getMinAcceptTime() );
+        }
         if ( r.succeeded() )
         {
+            if ( _cacheHits ) _cacheHits->increment();
             ImageUtils::normalizeImage( r.getImage() );
             return GeoImage( r.releaseImage(), key.getExtent() );
         }
@@ -565,6 +574,7 @@ ImageLayer::createImageInKeyProfile( const TileKey& key, ProgressCallback* progr
         //{
         //    OE_INFO << LC << getName() << " : " << key.str() << " record expired!" << std::endl;
         //}
+        if ( _cacheMisses ) _cacheMisses->increment();
     }
     
     // The data was not in the cache. If we are cache-only, fail sliently
@@ -596,6 +606,7 @@ ImageLayer::createImageInKeyProfile( const TileKey& key, ProgressCallback* progr
             OE_INFO << LC << "WARNING! mismatched extents." << std::endl;
         }
 
+        ScopedLatency timer( _cacheWriteLatency );
         cacheBin->write( key.str(), result.getImage() );
         //OE_INFO << LC << "WRITING " << key.str() << " to the cache." << std::endl;
     }
@@ -329,6 +329,42 @@ namespace
     };
 }
 
+namespace
+{
+    // Integer version of MixImage for 8-bit RGB(A) images. The inner loop is
+    // branch-free over contiguous bytes so the compiler can vectorize it.
+    // Alpha follows MixImage as ImageUtils::mix sets it up: an RGBA source
+    // keeps the larger of its weighted alpha and the destination's; an RGB
+    // source is treated as opaque, so the result is opaque.
+    void mixRGBA8(osg::Image* dest, const osg::Image* src, float a)
+    {
+        const bool     srcAlpha  = src->getPixelFormat() == GL_RGBA;
+        const unsigned srcStride = srcAlpha ? 4 : 3;
+        const unsigned a255      = (unsigned)(osg::clampBetween(a, 0.0f, 1.0f) * 255.0f + 0.5f);
+        const unsigned minAlpha  = srcAlpha ? 0u : 255u;
+        const int      width     = dest->s();
+
+        for( int r=0; r<dest->r(); ++r )
+        {
+            for( int t=0; t<dest->t(); ++t )
+            {
+                const unsigned char* s = src->data(0, t, r);
+                unsigned char*       d = dest->data(0, t, r);
+
+                for( int i=0; i<width; ++i, s += srcStride, d += 4 )
+                {
+                    unsigned sa = srcStride == 4 ? (a255 * s[3] + 127) / 255 : a255;
+                    unsigned ia = 255 - sa;
+                    d[0] = (unsigned char)((d[0] * ia + s[0] * sa + 127) / 255);
+                    d[1] = (unsigned char)((d[1] * ia + s[1] * sa + 127) / 255);
+                    d[2] = (unsigned char)((d[2] * ia + s[2] * sa + 127) / 255);
+                    d[3] = (unsigned char)osg::maximum( osg::maximum(sa, minAlpha), (unsigned)d[3] );
+                }
+            }
+        }
+    }
+}
+
 bool
 ImageUtils::mix(osg::Image* dest, const osg::Image* src, float a)
 {
@@ -338,6 +374,17 @@ ImageUtils::mix(osg::Image* dest, const osg::Image* src, float a)
     {
         return false;
     }
+
+    // fast path for the common case of 8-bit color:
+    if (dest->getPixelFormat() == GL_RGBA &&
+        dest->getDataType()    == GL_UNSIGNED_BYTE &&
+        (src->getPixelFormat() == GL_RGBA || src->getPixelFormat() == GL_RGB) &&
+        src->getDataType()     == GL_UNSIGNED_BYTE &&
+        src->r()               == dest->r() )
+    {
+        mixRGBA8( dest, src, a );
+        return true;
+    }
     
     PixelVisitor<MixImage> mixer;
     mixer._a = osg::clampBetween( a, 0.0f, 1.0f );
@@ -640,6 +687,23 @@ ImageUtils::hasTransparency(const osg::Image* image, float threshold)
     if ( !image || !PixelReader::supports(image) )
         return false;
 
+    // fast path: scan the alpha bytes of an 8-bit RGBA image directly.
+    if ( image->getPixelFormat() == GL_RGBA && image->getDataType() == GL_UNSIGNED_BYTE )
+    {
+        unsigned char minAlpha = (unsigned char)osg::clampBetween( (int)ceilf(threshold * 255.0f), 0, 255 );
+        for( int r=0; r<image->r(); ++r )
+        {
+            for( int t=0; t<image->t(); ++t )
+            {
+                const unsigned char* p = image->data(0, t, r);
+                for( int s=0; s<image->s(); ++s, p += 4 )
+                    if ( p[3] < minAlpha )
+                        return true;
+            }
+        }
+        return false;
+    }
+
     PixelReader read(image);
     for( int t=0; t<image->t(); ++t )
         for( int s=0; s<image->s(); ++s )
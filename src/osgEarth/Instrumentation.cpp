@@ -0,0 +1,362 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2013 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarth/Instrumentation>
+#include <osg/Math>
+#include <sstream>
+#include <iomanip>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace osgEarth;
+
+//------------------------------------------------------------------------
+
+const char* Instrumentation::STAGE_CREATE_TILE_MODEL  = "tile.create_model";
+const char* Instrumentation::STAGE_COMPILE_TILE_MODEL = "tile.compile";
+const char* Instrumentation::STAGE_CREATE_TILE_NODE   = "tile.create_node";
+const char* Instrumentation::STAGE_PAGER_MERGE        = "pager.merge";
+const char* Instrumentation::STAGE_CREATE_IMAGE       = "layer.create_image";
+const char* Instrumentation::STAGE_CREATE_HEIGHTFIELD = "layer.create_heightfield";
+const char* Instrumentation::STAGE_CACHE_READ         = "cache.read";
+const char* Instrumentation::STAGE_CACHE_WRITE        = "cache.write";
+
+const char* Instrumentation::COUNTER_CACHE_HIT        = "cache.hit";
+const char* Instrumentation::COUNTER_CACHE_MISS       = "cache.miss";
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    inline unsigned shard()
+    {
+        return Threading::getCurrentThreadId() % LatencyHistogram::NUM_SHARDS;
+    }
+
+    // Bucket 0 holds everything under a microsecond. After that there are
+    // four buckets per power of two.
+    inline unsigned bucketIndex( double seconds )
+    {
+        double us = seconds * 1.0e6;
+        if ( !(us >= 1.0) ) // also catches NaN
+            return 0;
+
+        int exp;
+        double m = frexp( us, &exp ); // us = m * 2^exp, m in [0.5, 1)
+        unsigned sub = (unsigned)((m*2.0 - 1.0) * 4.0);
+        unsigned index = 1 + (unsigned)(exp-1)*4 + (sub > 3 ? 3 : sub);
+        return index < LatencyHistogram::NUM_BUCKETS ? index : LatencyHistogram::NUM_BUCKETS-1;
+    }
+
+    // Lower bound of a bucket, in seconds
+    inline double bucketLow( unsigned index )
+    {
+        if ( index == 0 )
+            return 0.0;
+        unsigned e   = (index-1) / 4;
+        unsigned sub = (index-1) % 4;
+        return ldexp( 1.0 + 0.25*(double)sub, (int)e ) * 1.0e-6;
+    }
+
+    inline double bucketHigh( unsigned index )
+    {
+        if ( index == 0 )
+            return 1.0e-6;
+        return bucketLow(index) + ldexp( 0.25, (int)((index-1)/4) ) * 1.0e-6;
+    }
+
+    std::string jsonString( const std::string& in )
+    {
+        std::string out = "\"";
+        for( std::string::const_iterator c = in.begin(); c != in.end(); ++c )
+        {
+            switch( *c )
+            {
+            case '"':  out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n";  break;
+            case '\r': out += "\\r";  break;
+            case '\t': out += "\\t";  break;
+            default:
+                if ( (unsigned char)*c < 0x20 )
+                {
+                    char buf[8];
+                    sprintf( buf, "\\u%04x", (unsigned)(unsigned char)*c );
+                    out += buf;
+                }
+                else
+                {
+                    out += *c;
+                }
+            }
+        }
+        return out + "\"";
+    }
+}
+
+//------------------------------------------------------------------------
+
+LatencyHistogram::LatencyHistogram( const volatile bool* enabled ) :
+_enabled( enabled )
+{
+    //nop
+}
+
+void
+LatencyHistogram::record( double seconds )
+{
+    if ( *_enabled )
+        ++_counts[shard()][bucketIndex(seconds)];
+}
+
+unsigned
+LatencyHistogram::getCount() const
+{
+    unsigned count = 0;
+    for( unsigned s=0; s<NUM_SHARDS; ++s )
+        for( unsigned b=0; b<NUM_BUCKETS; ++b )
+            count += _counts[s][b];
+    return count;
+}
+
+void
+LatencyHistogram::getBuckets( std::vector<unsigned>& out ) const
+{
+    out.assign( NUM_BUCKETS, 0u );
+    for( unsigned s=0; s<NUM_SHARDS; ++s )
+        for( unsigned b=0; b<NUM_BUCKETS; ++b )
+            out[b] += _counts[s][b];
+}
+
+void
+LatencyHistogram::reset()
+{
+    for( unsigned s=0; s<NUM_SHARDS; ++s )
+        for( unsigned b=0; b<NUM_BUCKETS; ++b )
+            _counts[s][b].exchange( 0 );
+}
+
+double
+LatencyHistogram::getPercentile( const std::vector<unsigned>& buckets, double percentile )
+{
+    double total = 0.0;
+    for( unsigned b=0; b<buckets.size(); ++b )
+        total += buckets[b];
+    if ( total == 0.0 )
+        return 0.0;
+
+    // interpolate within the bucket that holds the target rank.
+    double rank = osg::clampBetween(percentile, 0.0, 100.0) * 0.01 * total;
+    double seen = 0.0;
+    for( unsigned b=0; b<buckets.size(); ++b )
+    {
+        if ( buckets[b] == 0 )
+            continue;
+
+        if ( seen + buckets[b] >= rank )
+        {
+            double t = (rank - seen) / (double)buckets[b];
+            return bucketLow(b) + t * (bucketHigh(b) - bucketLow(b));
+        }
+        seen += buckets[b];
+    }
+    return getMax( buckets );
+}
+
+double
+LatencyHistogram::getMean( const std::vector<unsigned>& buckets )
+{
+    double total = 0.0, sum = 0.0;
+    for( unsigned b=0; b<buckets.size(); ++b )
+    {
+        total += buckets[b];
+        sum   += buckets[b] * 0.5 * (bucketLow(b) + bucketHigh(b));
+    }
+    return total > 0.0 ? sum/total : 0.0;
+}
+
+double
+LatencyHistogram::getMax( const std::vector<unsigned>& buckets )
+{
+    for( int b=(int)buckets.size()-1; b >= 0; --b )
+        if ( buckets[b] > 0 )
+            return bucketHigh( b );
+    return 0.0;
+}
+
+//------------------------------------------------------------------------
+
+InstrumentationCounter::InstrumentationCounter( const volatile bool* enabled ) :
+_enabled( enabled )
+{
+    //nop
+}
+
+void
+InstrumentationCounter::increment()
+{
+    if ( *_enabled )
+        ++_counts[shard()];
+}
+
+unsigned
+InstrumentationCounter::get() const
+{
+    unsigned total = 0;
+    for( unsigned s=0; s<LatencyHistogram::NUM_SHARDS; ++s )
+        total += _counts[s];
+    return total;
+}
+
+void
+InstrumentationCounter::reset()
+{
+    for( unsigned s=0; s<LatencyHistogram::NUM_SHARDS; ++s )
+        _counts[s].exchange( 0 );
+}
+
+//------------------------------------------------------------------------
+
+Instrumentation::Instrumentation() :
+_enabled( true )
+{
+    const char* env = ::getenv( "OSGEARTH_INSTRUMENTATION" );
+    if ( env && (std::string(env) == "0" || std::string(env) == "off" || std::string(env) == "false") )
+    {
+        _enabled = false;
+    }
+}
+
+LatencyHistogram*
+Instrumentation::getHistogram( const std::string& stage, const std::string& layer )
+{
+    Key key( stage, layer );
+    {
+        Threading::ScopedReadLock shared( _mutex );
+        HistogramMap::const_iterator i = _histograms.find( key );
+        if ( i != _histograms.end() )
+            return i->second.get();
+    }
+
+    Threading::ScopedWriteLock exclusive( _mutex );
+    osg::ref_ptr<LatencyHistogram>& h = _histograms[key];
+    if ( !h.valid() )
+        h = new LatencyHistogram( &_enabled );
+    return h.get();
+}
+
+InstrumentationCounter*
+Instrumentation::getCounter( const std::string& name, const std::string& layer )
+{
+    Key key( name, layer );
+    {
+        Threading::ScopedReadLock shared( _mutex );
+        CounterMap::const_iterator i = _counters.find( key );
+        if ( i != _counters.end() )
+            return i->second.get();
+    }
+
+    Threading::ScopedWriteLock exclusive( _mutex );
+    osg::ref_ptr<InstrumentationCounter>& c = _counters[key];
+    if ( !c.valid() )
+        c = new InstrumentationCounter( &_enabled );
+    return c.get();
+}
+
+void
+Instrumentation::getStats( std::vector<StageStats>& out ) const
+{
+    Threading::ScopedReadLock shared( _mutex );
+
+    std::vector<unsigned> buckets;
+    for( HistogramMap::const_iterator i = _histograms.begin(); i != _histograms.end(); ++i )
+    {
+        i->second->getBuckets( buckets );
+
+        StageStats stats;
+        stats._count = 0;
+        for( unsigned b=0; b<buckets.size(); ++b )
+            stats._count += buckets[b];
+        if ( stats._count == 0 )
+            continue;
+
+        stats._stage = i->first.first;
+        stats._layer = i->first.second;
+        stats._mean  = LatencyHistogram::getMean( buckets );
+        stats._p50   = LatencyHistogram::getPercentile( buckets, 50.0 );
+        stats._p90   = LatencyHistogram::getPercentile( buckets, 90.0 );
+        stats._p99   = LatencyHistogram::getPercentile( buckets, 99.0 );
+        stats._max   = LatencyHistogram::getMax( buckets );
+        out.push_back( stats );
+    }
+}
+
+std::string
+Instrumentation::toJSON() const
+{
+    std::vector<StageStats> stats;
+    getStats( stats );
+
+    std::stringstream buf;
+    buf << std::fixed << std::setprecision(3);
+    buf << "{\n  \"enabled\": " << (_enabled ? "true" : "false") << ",\n  \"stages\": [";
+
+    for( unsigned i=0; i<stats.size(); ++i )
+    {
+        const StageStats& s = stats[i];
+        buf << (i > 0 ? "," : "") << "\n    { "
+            << "\"stage\": "   << jsonString(s._stage) << ", "
+            << "\"layer\": "   << jsonString(s._layer) << ", "
+            << "\"count\": "   << s._count << ", "
+            << "\"mean_ms\": " << s._mean*1000.0 << ", "
+            << "\"p50_ms\": "  << s._p50*1000.0 << ", "
+            << "\"p90_ms\": "  << s._p90*1000.0 << ", "
+            << "\"p99_ms\": "  << s._p99*1000.0 << ", "
+            << "\"max_ms\": "  << s._max*1000.0 << " }";
+    }
+    buf << "\n  ],\n  \"counters\": [";
+
+    {
+        Threading::ScopedReadLock shared( _mutex );
+        bool first = true;
+        for( CounterMap::const_iterator i = _counters.begin(); i != _counters.end(); ++i )
+        {
+            buf << (first ? "" : ",") << "\n    { "
+                << "\"name\": "  << jsonString(i->first.first) << ", "
+                << "\"layer\": " << jsonString(i->first.second) << ", "
+                << "\"value\": " << i->second->get() << " }";
+            first = false;
+        }
+    }
+    buf << "\n  ]\n}\n";
+
+    return buf.str();
+}
+
+void
+Instrumentation::reset()
+{
+    Threading::ScopedReadLock shared( _mutex );
+
+    for( HistogramMap::iterator i = _histograms.begin(); i != _histograms.end(); ++i )
+        i->second->reset();
+
+    for( CounterMap::iterator i = _counters.begin(); i != _counters.end(); ++i )
+        i->second->reset();
+}
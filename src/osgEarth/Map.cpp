@@ -35,7 +35,8 @@ Map::Map( const MapOptions& options ) :
 osg::Referenced      ( true ),
 _mapOptions          ( options ),
 _initMapOptions      ( options ),
-_dataModelRevision   ( 0 )
+_dataModelRevision   ( 0 ),
+_snapshotRevision    ( 0u )
 {
     if (_mapOptions.cachePolicy().isSet() &&
         _mapOptions.cachePolicy()->usage() == CachePolicy::USAGE_CACHE_ONLY )
@@ -89,6 +90,8 @@ _dataModelRevision   ( 0 )
     {
         _elevationLayers.setExpressTileSize( *_mapOptions.elevationTileSize() );
     }
+
+    publishSnapshot();
 }
 
 Map::~Map()
@@ -415,6 +418,7 @@ Map::addImageLayer( ImageLayer* layer )
             _imageLayers.push_back( layer );
             index = _imageLayers.size() - 1;
             newRevision = ++_dataModelRevision;
+            publishSnapshot();
         }
 
         // a separate block b/c we don't need the mutex   
@@ -455,6 +459,7 @@ Map::insertImageLayer( ImageLayer* layer, unsigned int index )
                 _imageLayers.insert( _imageLayers.begin() + index, layer );
 
             newRevision = ++_dataModelRevision;
+            publishSnapshot();
         }
 
         // a separate block b/c we don't need the mutex   
@@ -492,6 +497,7 @@ Map::addElevationLayer( ElevationLayer* layer )
             _elevationLayers.push_back( layer );
             index = _elevationLayers.size() - 1;
             newRevision = ++_dataModelRevision;
+            publishSnapshot();
         }
 
         // a separate block b/c we don't need the mutex   
@@ -522,6 +528,7 @@ Map::removeImageLayer( ImageLayer* layer )
             {
                 _imageLayers.erase( i );
                 newRevision = ++_dataModelRevision;
+                publishSnapshot();
                 break;
             }
         }
@@ -558,6 +565,7 @@ Map::removeElevationLayer( ElevationLayer* layer )
             {
                 _elevationLayers.erase( i );
                 newRevision = ++_dataModelRevision;
+                publishSnapshot();
                 break;
             }
         }
@@ -608,6 +616,7 @@ Map::moveImageLayer( ImageLayer* layer, unsigned int newIndex )
         _imageLayers.insert( _imageLayers.begin() + newIndex, layerToMove.get() );
 
         newRevision = ++_dataModelRevision;
+        publishSnapshot();
     }
 
     // a separate block b/c we don't need the mutex
@@ -655,6 +664,7 @@ Map::moveElevationLayer( ElevationLayer* layer, unsigned int newIndex )
         _elevationLayers.insert( _elevationLayers.begin() + newIndex, layerToMove.get() );
 
         newRevision = ++_dataModelRevision;
+        publishSnapshot();
     }
 
     // a separate block b/c we don't need the mutex
@@ -681,6 +691,7 @@ Map::addModelLayer( ModelLayer* layer )
             _modelLayers.push_back( layer );
             index = _modelLayers.size() - 1;
             newRevision = ++_dataModelRevision;
+            publishSnapshot();
         }
 
         // initialize the model layer
@@ -705,6 +716,7 @@ Map::insertModelLayer( ModelLayer* layer, unsigned int index )
             Threading::ScopedWriteLock lock( _mapDataMutex );
             _modelLayers.insert( _modelLayers.begin() + index, layer );
             newRevision = ++_dataModelRevision;
+            publishSnapshot();
         }
 
         // initialize the model layer
@@ -736,6 +748,7 @@ Map::removeModelLayer( ModelLayer* layer )
                 {
                     _modelLayers.erase( i );
                     newRevision = ++_dataModelRevision;
+                    publishSnapshot();
                     break;
                 }
             }
@@ -783,6 +796,7 @@ Map::moveModelLayer( ModelLayer* layer, unsigned int newIndex )
         _modelLayers.insert( _modelLayers.begin() + newIndex, layerToMove.get() );
 
         newRevision = ++_dataModelRevision;
+        publishSnapshot();
     }
 
     // a separate block b/c we don't need the mutex
@@ -806,6 +820,7 @@ Map::addTerrainMaskLayer( MaskLayer* layer )
             Threading::ScopedWriteLock lock( _mapDataMutex );
             _terrainMaskLayers.push_back(layer);
             newRevision = ++_dataModelRevision;
+            publishSnapshot();
         }
 
         layer->initialize( _dbOptions.get(), this );
@@ -835,6 +850,7 @@ Map::removeTerrainMaskLayer( MaskLayer* layer )
                 {
                     _terrainMaskLayers.erase( i );
                     newRevision = ++_dataModelRevision;
+                    publishSnapshot();
                     break;
                 }
             }
@@ -871,6 +887,7 @@ Map::clear()
 
         // calculate a new revision.
         newRevision = ++_dataModelRevision;
+        publishSnapshot();
     }
     
     // a separate block b/c we don't need the mutex   
@@ -1076,56 +1093,47 @@ Map::getWorldSRS() const
     return isGeocentric() ? getSRS()->getECEF() : getSRS();
 }
 
+void
+Map::publishSnapshot()
+{
+    MapSnapshot* snapshot = new MapSnapshot();
+    snapshot->_revision        = _dataModelRevision;
+    snapshot->_imageLayers     = _imageLayers;
+    snapshot->_elevationLayers = _elevationLayers;
+    snapshot->_modelLayers     = _modelLayers;
+    snapshot->_maskLayers      = _terrainMaskLayers;
+
+    if ( _mapOptions.elevationTileSize().isSet() )
+        snapshot->_elevationLayers.setExpressTileSize( *_mapOptions.elevationTileSize() );
+
+    _snapshot = snapshot;
+
+    // publish the revision after the snapshot; sync() reads it without a lock.
+    _snapshotRevision.exchange( (unsigned)(int)snapshot->_revision );
+}
+
 bool
 Map::sync( MapFrame& frame ) const
 {
-    bool result = false;
+    // Fast path: the frame already has the current revision. This is the
+    // steady state, and requires no lock since each snapshot has its own
+    // revision and never changes once published.
+    if ( frame._initialized && frame._snapshot.valid() &&
+         (unsigned)(int)frame._snapshot->_revision == (unsigned)_snapshotRevision )
+    {
+        return false;
+    }
 
-    if ( frame._mapDataModelRevision != _dataModelRevision || !frame._initialized )
+    osg::ref_ptr<const MapSnapshot> snapshot;
     {
-        // hold the read lock while copying the layer lists.
+        // only hold the read lock long enough to take a reference.
         Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex );
+        snapshot = _snapshot.get();
+    }
 
-        if ( frame._parts & IMAGE_LAYERS )
-        {
-            if ( !frame._initialized )
-                frame._imageLayers.reserve( _imageLayers.size() );
-            frame._imageLayers.clear();
-            std::copy( _imageLayers.begin(), _imageLayers.end(), std::back_inserter(frame._imageLayers) );
-        }
-
-        if ( frame._parts & ELEVATION_LAYERS )
-        {
-            frame._elevationLayers = _elevationLayers;
-            //if ( !frame._initialized )
-            //    frame._elevationLayers.reserve( _elevationLayers.size() );
-            //frame._elevationLayers.clear();
-            //std::copy( _elevationLayers.begin(), _elevationLayers.end(), std::back_inserter(frame._elevationLayers) );
-            if ( _mapOptions.elevationTileSize().isSet() )
-                frame._elevationLayers.setExpressTileSize( *_mapOptions.elevationTileSize() );
-        }
-
-        if ( frame._parts & MODEL_LAYERS )
-        {
-            if ( !frame._initialized )
-                frame._modelLayers.reserve( _modelLayers.size() );
-            frame._modelLayers.clear();
-            std::copy( _modelLayers.begin(), _modelLayers.end(), std::back_inserter(frame._modelLayers) );
-        }
-
-        if ( frame._parts & MASK_LAYERS )
-        {
-          if ( !frame._initialized )
-              frame._maskLayers.reserve( _terrainMaskLayers.size() );
-          frame._maskLayers.clear();
-          std::copy( _terrainMaskLayers.begin(), _terrainMaskLayers.end(), std::back_inserter(frame._maskLayers) );
-        }
+    if ( frame._initialized && frame._snapshot.get() == snapshot.get() )
+        return false;
 
-        // sync the revision numbers.
-        frame._initialized = true;
-        frame._mapDataModelRevision = _dataModelRevision;
-            
-        result = true;
-    }    
-    return result;
+    frame.setSnapshot( snapshot.get() );
+    return true;
 }
@@ -22,6 +22,18 @@ using namespace osgEarth;
 
 #define LC "[MapFrame] "
 
+namespace
+{
+    // stands in for the map's snapshot when the map goes away, and for
+    // the parts of the model that a frame does not track.
+    osg::ref_ptr<const MapSnapshot> s_emptySnapshot = new MapSnapshot();
+
+    inline const MapSnapshot* getEmptySnapshot()
+    {
+        return s_emptySnapshot.get();
+    }
+}
+
 
 MapFrame::MapFrame( const Map* map, Map::ModelParts parts, const std::string& name ) :
 _initialized( false ),
@@ -30,6 +42,9 @@ _name       ( name ),
 _mapInfo    ( map ),
 _parts      ( parts )
 {
+    // start out empty; the sync below picks up the map's current snapshot.
+    setSnapshot( getEmptySnapshot() );
+    _initialized = false;
     sync();
 }
 
@@ -41,12 +56,13 @@ _name                ( name ),
 _mapInfo             ( src._mapInfo ),
 _parts               ( src._parts ),
 _mapDataModelRevision( src._mapDataModelRevision ),
+_snapshot            ( src._snapshot.get() ),
 _imageLayers         ( src._imageLayers ),
 _elevationLayers     ( src._elevationLayers ),
 _modelLayers         ( src._modelLayers ),
 _maskLayers          ( src._maskLayers )
 {
-    //no sync required here; we copied the arrays etc
+    //no sync required here; we share the source frame's snapshot
 }
 
 
@@ -59,18 +75,31 @@ MapFrame::sync()
     {
         changed = _map->sync( *this );        
     }
-    else
+    else if ( _snapshot.get() != getEmptySnapshot() )
     {
-        _imageLayers.clear();
-        _elevationLayers.clear();
-        _modelLayers.clear();
-        _maskLayers.clear();        
+        setSnapshot( getEmptySnapshot() );
     }
 
     return changed;
 }
 
 
+void
+MapFrame::setSnapshot( const MapSnapshot* snapshot )
+{
+    const MapSnapshot* empty = getEmptySnapshot();
+
+    _snapshot        = snapshot;
+    _imageLayers     = &(_parts & Map::IMAGE_LAYERS     ? snapshot : empty)->_imageLayers;
+    _elevationLayers = &(_parts & Map::ELEVATION_LAYERS ? snapshot : empty)->_elevationLayers;
+    _modelLayers     = &(_parts & Map::MODEL_LAYERS     ? snapshot : empty)->_modelLayers;
+    _maskLayers      = &(_parts & Map::MASK_LAYERS      ? snapshot : empty)->_maskLayers;
+
+    _mapDataModelRevision = snapshot->_revision;
+    _initialized          = true;
+}
+
+
 bool
 MapFrame::needsSync() const
 {
@@ -94,7 +123,7 @@ MapFrame::getHeightField(const TileKey&                  key,
     
 
 
-    return _elevationLayers.createHeightField(
+    return _elevationLayers->createHeightField(
         key,
         fallback, 
         convertToHAE ? _map->getProfileNoVDatum() : 0L,
@@ -109,31 +138,31 @@ MapFrame::getHeightField(const TileKey&                  key,
 int
 MapFrame::indexOf( ImageLayer* layer ) const
 {
-    ImageLayerVector::const_iterator i = std::find( _imageLayers.begin(), _imageLayers.end(), layer );
-    return i != _imageLayers.end() ? i - _imageLayers.begin() : -1;
+    ImageLayerVector::const_iterator i = std::find( _imageLayers->begin(), _imageLayers->end(), layer );
+    return i != _imageLayers->end() ? i - _imageLayers->begin() : -1;
 }
 
 
 int
 MapFrame::indexOf( ElevationLayer* layer ) const
 {
-    ElevationLayerVector::const_iterator i = std::find( _elevationLayers.begin(), _elevationLayers.end(), layer );
-    return i != _elevationLayers.end() ? i - _elevationLayers.begin() : -1;
+    ElevationLayerVector::const_iterator i = std::find( _elevationLayers->begin(), _elevationLayers->end(), layer );
+    return i != _elevationLayers->end() ? i - _elevationLayers->begin() : -1;
 }
 
 
 int
 MapFrame::indexOf( ModelLayer* layer ) const
 {
-    ModelLayerVector::const_iterator i = std::find( _modelLayers.begin(), _modelLayers.end(), layer );
-    return i != _modelLayers.end() ? i - _modelLayers.begin() : -1;
+    ModelLayerVector::const_iterator i = std::find( _modelLayers->begin(), _modelLayers->end(), layer );
+    return i != _modelLayers->end() ? i - _modelLayers->begin() : -1;
 }
 
 
 ImageLayer*
 MapFrame::getImageLayerByUID( UID uid ) const
 {
-    for(ImageLayerVector::const_iterator i = _imageLayers.begin(); i != _imageLayers.end(); ++i )
+    for(ImageLayerVector::const_iterator i = _imageLayers->begin(); i != _imageLayers->end(); ++i )
         if ( i->get()->getUID() == uid )
             return i->get();
     return 0L;
@@ -143,7 +172,7 @@ MapFrame::getImageLayerByUID( UID uid ) const
 ImageLayer*
 MapFrame::getImageLayerByName( const std::string& name ) const
 {
-    for(ImageLayerVector::const_iterator i = _imageLayers.begin(); i != _imageLayers.end(); ++i )
+    for(ImageLayerVector::const_iterator i = _imageLayers->begin(); i != _imageLayers->end(); ++i )
         if ( i->get()->getName() == name )
             return i->get();
     return 0L;
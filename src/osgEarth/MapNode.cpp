@@ -23,6 +23,7 @@
 #include <osgEarth/CullingUtils>
 #include <osgEarth/DrapeableNode>
 #include <osgEarth/DrapingTechnique>
+#include <osgEarth/DrawInstanced>
 #include <osgEarth/MapNodeObserver>
 #include <osgEarth/MaskNode>
 #include <osgEarth/NodeUtils>
@@ -301,6 +302,18 @@ MapNode::init()
         // initialization.
         _terrainEngine->preInitialize( _map.get(), terrainOptions );
         _terrainEngineContainer->addChild( _terrainEngine );
+
+        // reserve the image unit that draw-instanced models read their transforms
+        // from, before any model layers compile:
+        if ( Registry::capabilities().supportsDrawInstanced() && _terrainEngine->getTextureCompositor() )
+        {
+            int unit;
+            if ( _terrainEngine->getTextureCompositor()->reserveTextureImageUnit(unit) )
+            {
+                _drawInstancedUnit = unit;
+                DrawInstanced::setTextureImageUnit( unit );
+            }
+        }
     }
     else
     {
@@ -387,6 +400,13 @@ MapNode::~MapNode()
 {
     _map->removeMapCallback( _mapCallback.get() );
 
+    if ( _drawInstancedUnit.isSet() )
+    {
+        _terrainEngine->getTextureCompositor()->releaseTextureImageUnit( *_drawInstancedUnit );
+        if ( DrawInstanced::getTextureImageUnit() == *_drawInstancedUnit )
+            DrawInstanced::setTextureImageUnit( -1 );
+    }
+
     ModelLayerVector modelLayers;
     _map->getModelLayers( modelLayers );
     //Remove our model callback from any of the model layers in the map    
@@ -25,6 +25,7 @@
 #include <osgEarth/IOTypes>
 #include <osgEarth/ColorFilter>
 #include <osgEarth/StateSetCache>
+#include <osgEarth/Instrumentation>
 #include <osgEarth/HTTPClient>
 #include <osgEarthDrivers/cache_filesystem/FileSystemCache>
 #include <osg/Notify>
@@ -34,6 +35,7 @@
 #include <ogr_api.h>
 #include <stdlib.h>
 #include <locale>
+#include <fstream>
 
 using namespace osgEarth;
 using namespace osgEarth::Drivers;
@@ -76,6 +78,9 @@ _terrainEngineDriver( "mp" )
     // performance boost
     _stateSetCache = new StateSetCache();
 
+    // tile pipeline latency histograms and counters
+    _instrumentation = new Instrumentation();
+
     // activate KMZ support
     osgDB::Registry::instance()->addArchiveExtension  ( "kmz" );
     osgDB::Registry::instance()->addFileExtensionAlias( "kmz", "kml" );
@@ -168,7 +173,14 @@ _terrainEngineDriver( "mp" )
 
 Registry::~Registry()
 {
-    //nop
+    // write out the instrumentation report if requested
+    const char* reportPath = ::getenv("OSGEARTH_INSTRUMENTATION_FILE");
+    if ( reportPath && _instrumentation.valid() )
+    {
+        std::ofstream out( reportPath );
+        if ( out.is_open() )
+            out << _instrumentation->toJSON();
+    }
 }
 
 Registry* 
@@ -124,6 +124,28 @@ REGISTER_OSGPLUGIN(SHADERGEN_PL_EXTENSION, OSGEarthShaderGenPseudoLoader)
 
 namespace
 {
+    /**
+     * User data that tags an object for the generator to skip.
+     */
+    struct IgnoreHint : public osg::Referenced { };
+
+    /**
+     * Whether a stateset sets any texture attributes the generator should process.
+     */
+    bool hasTextureAttributes( const osg::StateSet* ss )
+    {
+        const osg::StateSet::TextureAttributeList& units = ss->getTextureAttributeList();
+        for( unsigned u=0; u<units.size(); ++u )
+        {
+            for( osg::StateSet::AttributeList::const_iterator i = units[u].begin(); i != units[u].end(); ++i )
+            {
+                if ( !ShaderGenerator::ignore(i->second.first.get()) )
+                    return true;
+            }
+        }
+        return false;
+    }
+
     /**
      * The OSG State extended with mode/attribute accessors.
      */
@@ -218,6 +240,25 @@ osg::NodeVisitor( osg::NodeVisitor::TRAVERSE_ALL_CHILDREN )
 }
 
 
+void
+ShaderGenerator::setIgnoreHint( osg::Object* object, bool ignore )
+{
+    if ( !object )
+        return;
+
+    if ( ignore )
+        object->setUserData( new IgnoreHint() );
+    else if ( dynamic_cast<IgnoreHint*>(object->getUserData()) )
+        object->setUserData( 0L );
+}
+
+bool
+ShaderGenerator::ignore( const osg::Object* object )
+{
+    return object && dynamic_cast<const IgnoreHint*>(object->getUserData()) != 0L;
+}
+
+
 void 
 ShaderGenerator::apply( osg::Node& node )
 {
@@ -465,7 +506,7 @@ ShaderGenerator::processGeometry( osg::StateSet* ss, osg::ref_ptr<osg::StateSet>
     }
 
     // if the stateset changes any texture attributes, we need a new virtual program:
-    if (ss->getTextureAttributeList().size() > 0)
+    if (hasTextureAttributes(ss))
     {
         if ( !replacement.valid() )
             replacement = osg::clone(ss, osg::CopyOp::SHALLOW_COPY);
@@ -501,7 +542,7 @@ ShaderGenerator::processGeometry( osg::StateSet* ss, osg::ref_ptr<osg::StateSet>
             }
 
             osg::StateAttribute* tex = state->getTextureAttribute( t, osg::StateAttribute::TEXTURE );
-            if ( tex )
+            if ( tex && !ignore(tex) )
             {
                 // see if we have a texenv; if so get its blending mode.
                 osg::TexEnv::Mode blendingMode = osg::TexEnv::MODULATE;
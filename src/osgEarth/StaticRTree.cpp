@@ -0,0 +1,188 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2013 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarth/StaticRTree>
+#include <algorithm>
+#include <cmath>
+
+using namespace osgEarth;
+
+#define LC "[StaticRTree] "
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    template<typename T>
+    struct LessCenterX
+    {
+        bool operator()( const T& lhs, const T& rhs ) const {
+            return (lhs._xmin + lhs._xmax) < (rhs._xmin + rhs._xmax);
+        }
+    };
+
+    template<typename T>
+    struct LessCenterY
+    {
+        bool operator()( const T& lhs, const T& rhs ) const {
+            return (lhs._ymin + lhs._ymax) < (rhs._ymin + rhs._ymax);
+        }
+    };
+
+    // Sort-Tile-Recursive ordering: sorts the items into vertical slices by x,
+    // and each slice by y, so that consecutive runs of "fanout" items are
+    // spatially compact.
+    template<typename T>
+    void sortSTR( typename std::vector<T>::iterator begin, typename std::vector<T>::iterator end, unsigned fanout )
+    {
+        unsigned count     = end - begin;
+        unsigned numGroups = (count + fanout - 1) / fanout;
+        unsigned numSlices = (unsigned)ceil( sqrt( (double)numGroups ) );
+        unsigned sliceSize = numSlices * fanout;
+
+        std::sort( begin, end, LessCenterX<T>() );
+
+        for( unsigned s = 0; s < count; s += sliceSize )
+        {
+            std::sort( begin + s, begin + std::min(s + sliceSize, count), LessCenterY<T>() );
+        }
+    }
+
+    // expands "out" to cover each of the boxes in [begin, end).
+    template<typename OUT, typename T>
+    void computeBounds( OUT& out, typename std::vector<T>::const_iterator begin, typename std::vector<T>::const_iterator end )
+    {
+        out._xmin = begin->_xmin; out._ymin = begin->_ymin;
+        out._xmax = begin->_xmax; out._ymax = begin->_ymax;
+        out._minLOD = begin->_minLOD; out._maxLOD = begin->_maxLOD;
+
+        for( typename std::vector<T>::const_iterator i = begin+1; i != end; ++i )
+        {
+            out._xmin = std::min( out._xmin, i->_xmin );
+            out._ymin = std::min( out._ymin, i->_ymin );
+            out._xmax = std::max( out._xmax, i->_xmax );
+            out._ymax = std::max( out._ymax, i->_ymax );
+            out._minLOD = std::min( out._minLOD, i->_minLOD );
+            out._maxLOD = std::max( out._maxLOD, i->_maxLOD );
+        }
+    }
+}
+
+//------------------------------------------------------------------------
+
+StaticRTree::StaticRTree()
+{
+    //nop
+}
+
+void
+StaticRTree::insert(double   xmin,
+                    double   ymin,
+                    double   xmax,
+                    double   ymax,
+                    unsigned id,
+                    unsigned minLOD,
+                    unsigned maxLOD)
+{
+    Entry entry;
+    entry._xmin   = std::min(xmin, xmax);
+    entry._ymin   = std::min(ymin, ymax);
+    entry._xmax   = std::max(xmin, xmax);
+    entry._ymax   = std::max(ymin, ymax);
+    entry._minLOD = minLOD;
+    entry._maxLOD = maxLOD;
+    entry._id     = id;
+    _entries.push_back( entry );
+}
+
+void
+StaticRTree::clear()
+{
+    _entries.clear();
+    _nodes.clear();
+}
+
+void
+StaticRTree::build()
+{
+    _nodes.clear();
+
+    if ( _entries.empty() )
+        return;
+
+    // pack the entries into leaf nodes:
+    sortSTR<Entry>( _entries.begin(), _entries.end(), MAX_CHILDREN );
+
+    for( unsigned i = 0; i < _entries.size(); i += MAX_CHILDREN )
+    {
+        Node node;
+        node._first = i;
+        node._count = std::min( (unsigned)MAX_CHILDREN, (unsigned)_entries.size() - i );
+        node._leaf  = true;
+        computeBounds<Node, Entry>( node, _entries.begin() + i, _entries.begin() + i + node._count );
+        _nodes.push_back( node );
+    }
+
+    // then pack each level of nodes into parent nodes, until there's only one.
+    unsigned levelStart = 0;
+    unsigned levelEnd   = _nodes.size();
+
+    while( levelEnd - levelStart > 1 )
+    {
+        // children must be contiguous, so sort this level in place. Nothing
+        // refers to these nodes yet, so we're free to move them around.
+        sortSTR<Node>( _nodes.begin() + levelStart, _nodes.begin() + levelEnd, MAX_CHILDREN );
+
+        for( unsigned i = levelStart; i < levelEnd; i += MAX_CHILDREN )
+        {
+            Node node;
+            node._first = i;
+            node._count = std::min( (unsigned)MAX_CHILDREN, levelEnd - i );
+            node._leaf  = false;
+            computeBounds<Node, Node>( node, _nodes.begin() + i, _nodes.begin() + i + node._count );
+            _nodes.push_back( node );
+        }
+
+        levelStart = levelEnd;
+        levelEnd   = _nodes.size();
+    }
+}
+
+namespace
+{
+    struct CollectIDs
+    {
+        CollectIDs( std::vector<unsigned>& ids ) : _ids(ids) { }
+        bool operator()( unsigned id ) { _ids.push_back(id); return false; }
+        std::vector<unsigned>& _ids;
+    };
+}
+
+unsigned
+StaticRTree::query(double                 xmin,
+                   double                 ymin,
+                   double                 xmax,
+                   double                 ymax,
+                   std::vector<unsigned>& out_ids,
+                   unsigned               lod) const
+{
+    unsigned before = out_ids.size();
+    CollectIDs collect( out_ids );
+    findFirst( xmin, ymin, xmax, ymax, lod, collect );
+    return out_ids.size() - before;
+}
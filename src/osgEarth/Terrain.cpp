@@ -19,6 +19,8 @@
 
 #include <osgEarth/Terrain>
 #include <osgEarth/DPLineSegmentIntersector>
+#include <osgEarth/HeightFieldUtils>
+#include <osgEarth/VerticalDatum>
 #include <osgUtil/IntersectionVisitor>
 #include <osgUtil/LineSegmentIntersector>
 #include <osgViewer/View>
@@ -81,15 +83,191 @@ namespace
 
 //---------------------------------------------------------------------------
 
+namespace
+{
+    // finds the tile elevation for a tile node. The engine may wrap the tile
+    // in a group (to page in its subtiles), so check the direct children too;
+    // but go no deeper, lest we pick up some unrelated tile.
+    TerrainTileElevation* findTileElevation( osg::Node* node )
+    {
+        TerrainTileElevation* result = dynamic_cast<TerrainTileElevation*>( node );
+        if ( !result )
+        {
+            osg::Group* group = node->asGroup();
+            for( unsigned i=0; group && i<group->getNumChildren() && !result; ++i )
+            {
+                result = dynamic_cast<TerrainTileElevation*>( group->getChild(i) );
+            }
+        }
+        return result;
+    }
+}
+
+TerrainTileSampler::TerrainTileSampler() :
+_scale( 1.0f ),
+_xMin ( 0.0 ),
+_yMin ( 0.0 ),
+_xMax ( 0.0 ),
+_yMax ( 0.0 ),
+_dx   ( 0.0 ),
+_dy   ( 0.0 )
+{
+    //nop
+}
+
+bool
+TerrainTileSampler::setTile( osg::Node* tile )
+{
+    _hf = 0L;
+
+    TerrainTileElevation* elevation = tile ? findTileElevation( tile ) : 0L;
+    if ( !elevation || !elevation->getElevationGrid(_hf, _extent, _scale) || !_hf.valid() )
+    {
+        _hf = 0L;
+        return false;
+    }
+
+    if ( _hf->getNumColumns() < 2 || _hf->getNumRows() < 2 || !_extent.isValid() )
+    {
+        _hf = 0L;
+        return false;
+    }
+
+    // cache the grid geometry so each sample is just arithmetic.
+    _xMin = _extent.xMin();
+    _yMin = _extent.yMin();
+    _xMax = _extent.xMax();
+    _yMax = _extent.yMax();
+    _dx   = _extent.width()  / (double)(_hf->getNumColumns()-1);
+    _dy   = _extent.height() / (double)(_hf->getNumRows()-1);
+    return true;
+}
+
+bool
+TerrainTileSampler::getHeight( double x, double y, double& out_hae ) const
+{
+    if ( !_hf.valid() || x < _xMin || x > _xMax || y < _yMin || y > _yMax )
+        return false;
+
+    float h = HeightFieldUtils::getHeightAtLocation(
+        _hf.get(), x, y, _xMin, _yMin, _dx, _dy, INTERP_BILINEAR );
+
+    if ( h == NO_DATA_VALUE )
+        return false;
+
+    out_hae = (double)h * (double)_scale;
+    return true;
+}
+
+unsigned
+TerrainTileSampler::getHeights( std::vector<osg::Vec3d>& points, std::vector<bool>& out_sampled ) const
+{
+    unsigned count = 0;
+    out_sampled.assign( points.size(), false );
+
+    for( unsigned i=0; i<points.size(); ++i )
+    {
+        osg::Vec3d& p = points[i];
+        double hae;
+        if ( getHeight(p.x(), p.y(), hae) )
+        {
+            p.z() = hae;
+            out_sampled[i] = true;
+            ++count;
+        }
+    }
+    return count;
+}
+
+//---------------------------------------------------------------------------
+
 Terrain::Terrain(osg::Node* graph, const Profile* mapProfile, bool geocentric, const TerrainOptions& terrainOptions ) :
 _graph         ( graph ),
 _profile       ( mapProfile ),
 _geocentric    ( geocentric ),
-_terrainOptions( terrainOptions )
+_terrainOptions( terrainOptions ),
+_tileIndexMaxLOD ( 0 ),
+_tileIndexInserts( 0 )
 {
     //nop
 }
 
+void
+Terrain::indexTile( const TileKey& key, osg::Node* tile )
+{
+    // only tiles that expose their elevation grid are useful here.
+    if ( !findTileElevation(tile) )
+        return;
+
+    Threading::ScopedWriteLock exclusive( _tileIndexMutex );
+
+    _tileIndex[key] = tile;
+    _tileIndexMaxLOD = std::max( _tileIndexMaxLOD, key.getLOD() );
+
+    // every so often, purge entries for tiles that no longer exist.
+    if ( ++_tileIndexInserts % 256 == 0 )
+    {
+        for( TileIndex::iterator i = _tileIndex.begin(); i != _tileIndex.end(); )
+        {
+            if ( !i->second.valid() )
+                _tileIndex.erase( i++ );
+            else
+                ++i;
+        }
+    }
+}
+
+bool
+Terrain::getHeightFromTiles( double x, double y, double& out_hae ) const
+{
+    Threading::ScopedReadLock shared( _tileIndexMutex );
+
+    if ( _tileIndex.empty() )
+        return false;
+
+    // look for the highest-resolution tile that is in the scene graph:
+    for( int lod = (int)_tileIndexMaxLOD; lod >= 0; --lod )
+    {
+        TileKey key = getProfile()->createTileKey( x, y, (unsigned)lod );
+        if ( !key.valid() )
+            continue;
+
+        TileIndex::const_iterator i = _tileIndex.find( key );
+        if ( i == _tileIndex.end() )
+            continue;
+
+        osg::ref_ptr<osg::Node> tile;
+        if ( i->second.lock(tile) && tile->getNumParents() > 0 )
+        {
+            TerrainTileSampler sampler;
+            if ( sampler.setTile(tile.get()) && sampler.getHeight(x, y, out_hae) )
+                return true;
+        }
+    }
+    return false;
+}
+
+void
+Terrain::computeHeights( double x, double y, double hae, double* out_hamsl, double* out_hae ) const
+{
+    if ( out_hae )
+        *out_hae = hae;
+
+    if ( out_hamsl )
+    {
+        double z = hae;
+        const VerticalDatum* vdatum = getSRS()->getVerticalDatum();
+        if ( vdatum )
+        {
+            osg::Vec3d geo(x, y, 0.0);
+            if ( !getSRS()->isGeographic() )
+                getSRS()->transform( geo, getSRS()->getGeographicSRS(), geo );
+            VerticalDatum::transform( 0L, vdatum, geo.y(), geo.x(), z );
+        }
+        *out_hamsl = z;
+    }
+}
+
 bool
 Terrain::getHeight(osg::Node*              patch,
                    const SpatialReference* srs,
@@ -111,6 +289,30 @@ Terrain::getHeight(osg::Node*              patch,
     if ( !getProfile()->getExtent().contains(x, y) )
         return 0L;
 
+    // if we can, sample the elevation grid of a tile instead of intersecting:
+    if ( patch )
+    {
+        TerrainTileSampler sampler;
+        if ( sampler.setTile(patch) )
+        {
+            double hae;
+            if ( !sampler.getHeight(x, y, hae) )
+                return false;
+
+            computeHeights( x, y, hae, out_hamsl, out_hae );
+            return true;
+        }
+    }
+    else
+    {
+        double hae;
+        if ( getHeightFromTiles(x, y, hae) )
+        {
+            computeHeights( x, y, hae, out_hamsl, out_hae );
+            return true;
+        }
+    }
+
     const osg::EllipsoidModel* em = getSRS()->getEllipsoid();
     double r = std::min( em->getRadiusEquator(), em->getRadiusPolar() );
 
@@ -318,6 +520,11 @@ Terrain::notifyTileAdded( const TileKey& key, osg::Node* node )
         OE_WARN << LC << "notify with a null node!" << std::endl;
     }
 
+    else
+    {
+        indexTile( key, node );
+    }
+
     if ( _updateOperationQueue.valid() )
     {
         _updateOperationQueue->add( new OnTileAddedOperation(key, node, this) );
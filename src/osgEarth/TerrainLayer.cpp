@@ -163,6 +163,12 @@ _tileSource    ( tileSource )
 
 TerrainLayer::~TerrainLayer()
 {
+    // persist the blacklist so a restart doesn't request known missing tiles again.
+    if ( _blacklistCacheBin.valid() && _tileSource.valid() && getCachePolicy().isCacheWriteable() )
+    {
+        _tileSource->getBlacklist()->save( _blacklistCacheBin.get() );
+    }
+
     if ( _cache.valid() )
     {
         Threading::ScopedWriteLock exclusive( _cacheBinsMutex );
@@ -184,11 +190,27 @@ TerrainLayer::init()
     _tileSourceInitFailed    = false;
     _tileSize                = 256;
     _dbOptions               = Registry::instance()->cloneOrCreateOptions();
+    _createLatency           = 0L;
+    _cacheReadLatency        = 0L;
+    _cacheWriteLatency       = 0L;
+    _cacheHits               = 0L;
+    _cacheMisses             = 0L;
     
     initializeCachePolicy( _dbOptions.get() );
     storeProxySettings( _dbOptions.get() );
 }
 
+void
+TerrainLayer::initInstrumentation( const char* createStage )
+{
+    Instrumentation* inst = Registry::instrumentation();
+    _createLatency     = inst->getHistogram( createStage, getName() );
+    _cacheReadLatency  = inst->getHistogram( Instrumentation::STAGE_CACHE_READ, getName() );
+    _cacheWriteLatency = inst->getHistogram( Instrumentation::STAGE_CACHE_WRITE, getName() );
+    _cacheHits         = inst->getCounter( Instrumentation::COUNTER_CACHE_HIT, getName() );
+    _cacheMisses       = inst->getCounter( Instrumentation::COUNTER_CACHE_MISS, getName() );
+}
+
 void
 TerrainLayer::setCache( Cache* cache )
 {
@@ -297,6 +319,20 @@ TerrainLayer::getTileSource() const
                 cp.minTime() = _tileSource->getLastModifiedTime();
             }
 
+            // Blacklist entries expire under the same policy as cached tiles, and
+            // persist in the cache bin of the layer's native profile.
+            if ( _tileSource.valid() )
+            {
+                _tileSource->getBlacklist()->setCachePolicy( getCachePolicy() );
+
+                if ( getCachePolicy().isCacheReadable() && _profile.valid() )
+                {
+                    TerrainLayer* self = const_cast<TerrainLayer*>(this);
+                    self->_blacklistCacheBin = self->getCacheBin( _profile.get() );
+                    _tileSource->getBlacklist()->load( _blacklistCacheBin.get() );
+                }
+            }
+
             OE_INFO << LC << "cache policy = " << getCachePolicy().usageString() << std::endl;
         }
     }
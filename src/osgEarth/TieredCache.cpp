@@ -0,0 +1,682 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2013 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarth/TieredCache>
+#include <osgEarth/StringUtils>
+#include <osgEarth/ThreadingUtils>
+#include <osg/Image>
+#include <osg/Shape>
+#include <osg/Timer>
+#include <OpenThreads/Atomic>
+#include <OpenThreads/Thread>
+#include <list>
+#include <map>
+
+using namespace osgEarth;
+
+#define LC "[TieredCache] "
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    // default budget for a memory tier that doesn't specify one.
+    const unsigned DEFAULT_MEMORY_TIER_MB = 64u;
+
+    // beyond this many queued write-behind operations, writes happen in the
+    // caller's thread so that a slow tier can't consume unbounded memory.
+    const unsigned MAX_PENDING_WRITES = 1024u;
+
+    // Estimated size of a cached object, for budgeting.
+    double estimateSize( const osg::Object* object )
+    {
+        if ( const osg::Image* image = dynamic_cast<const osg::Image*>(object) )
+        {
+            return (double)image->getTotalSizeInBytesIncludingMipmaps();
+        }
+        else if ( const osg::HeightField* hf = dynamic_cast<const osg::HeightField*>(object) )
+        {
+            return (double)(hf->getNumColumns() * hf->getNumRows() * sizeof(float));
+        }
+        else if ( const StringObject* so = dynamic_cast<const StringObject*>(object) )
+        {
+            return (double)so->getString().size();
+        }
+        else
+        {
+            return 64.0 * 1024.0;
+        }
+    }
+
+    // Storage for a "memory" tier. Its size is managed by the tier's budget.
+    struct MemoryTierBin : public CacheBin
+    {
+        MemoryTierBin( const std::string& id ) : CacheBin( id ) { }
+
+        ReadResult readObject(const std::string& key, TimeStamp minTime)
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            EntryMap::const_iterator i = _entries.find( key );
+            if ( i == _entries.end() )
+                return ReadResult();
+
+            // clone required since the cache is in memory
+            return ReadResult(
+                osg::clone(i->second.first.get(), osg::CopyOp::DEEP_COPY_ALL),
+                i->second.second );
+        }
+
+        ReadResult readImage(const std::string& key, TimeStamp minTime)
+        {
+            return readObject( key, minTime );
+        }
+
+        ReadResult readString(const std::string& key, TimeStamp minTime)
+        {
+            return readObject( key, minTime );
+        }
+
+        bool write( const std::string& key, const osg::Object* object, const Config& meta )
+        {
+            if ( !object )
+                return false;
+
+            Threading::ScopedMutexLock lock( _mutex );
+            _entries[key] = std::make_pair( osg::ref_ptr<const osg::Object>(object), meta );
+            return true;
+        }
+
+        RecordStatus getRecordStatus( const std::string& key, TimeStamp minTime )
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            return _entries.find(key) != _entries.end() ? STATUS_OK : STATUS_NOT_FOUND;
+        }
+
+        bool remove(const std::string& key)
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            _entries.erase( key );
+            return true;
+        }
+
+        bool touch(const std::string& key)
+        {
+            // recency is tracked by the tier.
+            return true;
+        }
+
+        Config readMetadata()
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            return _metadata;
+        }
+
+        bool writeMetadata( const Config& meta )
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            _metadata = meta;
+            return true;
+        }
+
+        bool purge()
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            _entries.clear();
+            return true;
+        }
+
+    private:
+        typedef std::map<std::string, std::pair<osg::ref_ptr<const osg::Object>, Config> > EntryMap;
+        EntryMap         _entries;
+        Config           _metadata;
+        Threading::Mutex _mutex;
+    };
+
+    static Threading::Mutex s_defaultBinMutex;
+}
+
+//------------------------------------------------------------------------
+
+/**
+ * One tier of the cache: the underlying cache (NULL for a memory tier),
+ * its size budget, its write-behind queue and its statistics.
+ */
+struct TieredCache::Tier : public osg::Referenced
+{
+    Tier( const std::string& driver, Cache* cache, double maxBytes, bool writeBehind ) :
+      _cache   ( cache ),
+      _maxBytes( maxBytes ),
+      _bytes   ( 0.0 )
+    {
+        _stats._driver = driver;
+        if ( writeBehind )
+        {
+            _writer = new TaskService( "TieredCache write-behind (" + driver + ")", 1 );
+        }
+    }
+
+    ~Tier()
+    {
+        shutdown();
+    }
+
+    CacheBin* createBin( const std::string& binID, bool isDefault )
+    {
+        if ( !_cache.valid() )
+            return new MemoryTierBin( binID );
+
+        return isDefault ? _cache->getOrCreateDefaultBin() : _cache->addBin( binID );
+    }
+
+    void removeBin( CacheBin* bin )
+    {
+        untrackBin( bin );
+        if ( _cache.valid() )
+            _cache->removeBin( bin );
+    }
+
+    void recordRead( bool hit, double seconds )
+    {
+        Threading::ScopedMutexLock lock( _mutex );
+        _stats._reads++;
+        if ( hit )
+            _stats._hits++;
+        _stats._readTime += seconds;
+    }
+
+    // Writes a record now, or queues it when this is a write-behind tier.
+    void write( CacheBin* bin, const std::string& key, const osg::Object* object, const Config& meta );
+
+    // Writes a record in the calling thread.
+    void writeNow( CacheBin* bin, const std::string& key, const osg::Object* object, const Config& meta )
+    {
+        if ( bin->write(key, object, meta) )
+        {
+            {
+                Threading::ScopedMutexLock lock( _mutex );
+                _stats._writes++;
+            }
+            track( bin, key, estimateSize(object) );
+        }
+    }
+
+    // Marks a record as most recently used, evicting older records as
+    // necessary to stay within the budget.
+    void track( CacheBin* bin, const std::string& key, double size )
+    {
+        std::vector<Record> victims;
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+
+            RecordIndex::iterator i = _index.find( RecordKey(bin, key) );
+            if ( i != _index.end() )
+            {
+                _bytes -= i->second->_size;
+                _lru.erase( i->second );
+            }
+
+            Record rec;
+            rec._bin  = bin;
+            rec._key  = key;
+            rec._size = size;
+            _lru.push_front( rec );
+            _index[RecordKey(bin, key)] = _lru.begin();
+            _bytes += size;
+
+            // never evict the record just written.
+            while( _maxBytes > 0.0 && _bytes > _maxBytes && _lru.size() > 1 )
+            {
+                Record& victim = _lru.back();
+                _bytes -= victim._size;
+                _index.erase( RecordKey(victim._bin.get(), victim._key) );
+                victims.push_back( victim );
+                _lru.pop_back();
+                _stats._evictions++;
+            }
+        }
+
+        // remove outside the lock, since a slow tier may do I/O.
+        for( std::vector<Record>::iterator v = victims.begin(); v != victims.end(); ++v )
+        {
+            v->_bin->remove( v->_key );
+        }
+    }
+
+    void untrack( CacheBin* bin, const std::string& key )
+    {
+        Threading::ScopedMutexLock lock( _mutex );
+        RecordIndex::iterator i = _index.find( RecordKey(bin, key) );
+        if ( i != _index.end() )
+        {
+            _bytes -= i->second->_size;
+            _lru.erase( i->second );
+            _index.erase( i );
+        }
+    }
+
+    void untrackBin( CacheBin* bin )
+    {
+        Threading::ScopedMutexLock lock( _mutex );
+        for( RecordList::iterator i = _lru.begin(); i != _lru.end(); )
+        {
+            if ( i->_bin.get() == bin )
+            {
+                _bytes -= i->_size;
+                _index.erase( RecordKey(bin, i->_key) );
+                i = _lru.erase( i );
+            }
+            else ++i;
+        }
+    }
+
+    void flush()
+    {
+        while( (unsigned)_pending > 0u )
+        {
+            OpenThreads::Thread::microSleep( 1000 );
+        }
+    }
+
+    // Drains the write-behind queue and stops its thread. Call this from
+    // the owner's thread: the thread is joined here, which it can't do to
+    // itself. Later writes happen in the caller's thread.
+    void shutdown()
+    {
+        osg::ref_ptr<TaskService> writer;
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            writer  = _writer;
+            _writer = 0L;
+        }
+        if ( writer.valid() )
+        {
+            flush();
+            writer = 0L;
+
+            // anything queued after the drain was dropped with the queue.
+            _pending.exchange( 0u );
+        }
+    }
+
+    void getStats( TierStats& out )
+    {
+        Threading::ScopedMutexLock lock( _mutex );
+        out = _stats;
+        out._pendingWrites = (unsigned)_pending;
+        out._bytes         = _bytes;
+    }
+
+    struct Record
+    {
+        osg::ref_ptr<CacheBin> _bin;
+        std::string            _key;
+        double                 _size;
+    };
+    typedef std::list<Record>                       RecordList;
+    typedef std::pair<CacheBin*, std::string>       RecordKey;
+    typedef std::map<RecordKey, RecordList::iterator> RecordIndex;
+
+    osg::ref_ptr<Cache>       _cache;
+    double                    _maxBytes;
+    osg::ref_ptr<TaskService> _writer;
+    OpenThreads::Atomic       _pending;
+
+    RecordList                _lru;      // most recently used first
+    RecordIndex               _index;
+    double                    _bytes;
+    TierStats                 _stats;
+    Threading::Mutex          _mutex;
+};
+
+namespace
+{
+    struct WriteBehindTask : public TaskRequest
+    {
+        WriteBehindTask( TieredCache::Tier* tier, CacheBin* bin, const std::string& key, const osg::Object* object, const Config& meta )
+            : _tier(tier), _bin(bin), _key(key), _object(object), _meta(meta) { }
+
+        void operator()( ProgressCallback* progress )
+        {
+            _tier->writeNow( _bin.get(), _key, _object.get(), _meta );
+            --_tier->_pending;
+        }
+
+        TieredCache::Tier*              _tier; // not a ref; the tier drains this queue before it goes away
+        osg::ref_ptr<CacheBin>          _bin;
+        std::string                     _key;
+        osg::ref_ptr<const osg::Object> _object;
+        Config                          _meta;
+    };
+}
+
+void
+TieredCache::Tier::write( CacheBin* bin, const std::string& key, const osg::Object* object, const Config& meta )
+{
+    osg::ref_ptr<TaskService> writer;
+    {
+        Threading::ScopedMutexLock lock( _mutex );
+        writer = _writer;
+    }
+
+    if ( writer.valid() && (unsigned)_pending < MAX_PENDING_WRITES )
+    {
+        ++_pending;
+        writer->add( new WriteBehindTask(this, bin, key, object, meta) );
+    }
+    else
+    {
+        writeNow( bin, key, object, meta );
+    }
+}
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    typedef std::vector< osg::ref_ptr<TieredCache::Tier> > TierVector;
+
+    /**
+     * A bin that spans the corresponding bins of all the tiers.
+     */
+    struct TieredCacheBin : public CacheBin
+    {
+        TieredCacheBin( const std::string& id ) : CacheBin( id ) { }
+
+        void addTier( TieredCache::Tier* tier, CacheBin* bin )
+        {
+            _tiers.push_back( tier );
+            _bins.push_back( bin );
+        }
+
+        typedef ReadResult (CacheBin::*ReadFunc)(const std::string&, TimeStamp);
+
+        // Reads from each tier in turn, promoting a hit into the faster tiers.
+        ReadResult read( ReadFunc func, const std::string& key, TimeStamp minTime )
+        {
+            ReadResult r;
+            for( unsigned i=0; i<_bins.size(); ++i )
+            {
+                osg::Timer_t start = osg::Timer::instance()->tick();
+                r = (_bins[i].get()->*func)( key, minTime );
+                double seconds = osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+
+                bool hit = r.succeeded();
+                _tiers[i]->recordRead( hit, seconds );
+
+                if ( hit )
+                {
+                    _tiers[i]->track( _bins[i].get(), key, estimateSize(r.getObject()) );
+
+                    for( unsigned j=0; j<i; ++j )
+                    {
+                        _tiers[j]->write( _bins[j].get(), key, r.getObject(), r.metadata() );
+                    }
+                    return r;
+                }
+            }
+            return r;
+        }
+
+        ReadResult readObject(const std::string& key, TimeStamp minTime)
+        {
+            return read( &CacheBin::readObject, key, minTime );
+        }
+
+        ReadResult readImage(const std::string& key, TimeStamp minTime)
+        {
+            return read( &CacheBin::readImage, key, minTime );
+        }
+
+        ReadResult readString(const std::string& key, TimeStamp minTime)
+        {
+            return read( &CacheBin::readString, key, minTime );
+        }
+
+        bool write( const std::string& key, const osg::Object* object, const Config& meta )
+        {
+            if ( !object )
+                return false;
+
+            for( unsigned i=0; i<_bins.size(); ++i )
+            {
+                _tiers[i]->write( _bins[i].get(), key, object, meta );
+            }
+            return _bins.size() > 0;
+        }
+
+        RecordStatus getRecordStatus( const std::string& key, TimeStamp minTime )
+        {
+            RecordStatus result = STATUS_NOT_FOUND;
+            for( unsigned i=0; i<_bins.size(); ++i )
+            {
+                RecordStatus status = _bins[i]->getRecordStatus( key, minTime );
+                if ( status == STATUS_OK )
+                    return status;
+                else if ( status == STATUS_EXPIRED )
+                    result = status;
+            }
+            return result;
+        }
+
+        bool remove(const std::string& key)
+        {
+            bool removed = false;
+            for( unsigned i=0; i<_bins.size(); ++i )
+            {
+                _tiers[i]->untrack( _bins[i].get(), key );
+                removed = _bins[i]->remove( key ) || removed;
+            }
+            return removed;
+        }
+
+        bool touch(const std::string& key)
+        {
+            bool touched = false;
+            for( unsigned i=0; i<_bins.size(); ++i )
+            {
+                touched = _bins[i]->touch( key ) || touched;
+            }
+            return touched;
+        }
+
+        Config readMetadata()
+        {
+            // the slowest tier is the most persistent one.
+            for( int i=(int)_bins.size()-1; i>=0; --i )
+            {
+                Config meta = _bins[i]->readMetadata();
+                if ( !meta.empty() )
+                    return meta;
+            }
+            return Config();
+        }
+
+        bool writeMetadata( const Config& meta )
+        {
+            bool written = false;
+            for( unsigned i=0; i<_bins.size(); ++i )
+            {
+                written = _bins[i]->writeMetadata( meta ) || written;
+            }
+            return written;
+        }
+
+        bool purge()
+        {
+            bool purged = true;
+            for( unsigned i=0; i<_bins.size(); ++i )
+            {
+                _tiers[i]->untrackBin( _bins[i].get() );
+                purged = _bins[i]->purge() && purged;
+            }
+            return purged;
+        }
+
+        void removeFromTiers()
+        {
+            for( unsigned i=0; i<_bins.size(); ++i )
+            {
+                _tiers[i]->removeBin( _bins[i].get() );
+            }
+        }
+
+        TierVector                           _tiers;
+        std::vector< osg::ref_ptr<CacheBin> > _bins;
+    };
+}
+
+//------------------------------------------------------------------------
+
+TieredCache::TieredCache( const TieredCacheOptions& options ) :
+Cache( options )
+{
+    for( std::vector<TieredCacheTierOptions>::const_iterator i = options.tiers().begin(); i != options.tiers().end(); ++i )
+    {
+        const TieredCacheTierOptions& tierOptions = *i;
+        std::string driver = tierOptions.getDriver();
+
+        osg::ref_ptr<Cache> cache;
+        unsigned maxSizeMB = tierOptions.maxSizeMB().getOrUse( 0u );
+
+        if ( driver == "memory" )
+        {
+            if ( !tierOptions.maxSizeMB().isSet() )
+                maxSizeMB = DEFAULT_MEMORY_TIER_MB;
+        }
+        else
+        {
+            cache = CacheFactory::create( tierOptions );
+            if ( !cache.valid() || !cache->isOK() )
+            {
+                OE_WARN << LC << "Failed to initialize tier \"" << driver << "\"; skipping it" << std::endl;
+                continue;
+            }
+        }
+
+        bool writeBehind = tierOptions.writeBehind().getOrUse( false );
+
+        _tiers.push_back( new Tier(
+            driver,
+            cache.get(),
+            (double)maxSizeMB * 1048576.0,
+            writeBehind ) );
+
+        std::string maxSize = maxSizeMB > 0 ? std::string(Stringify() << maxSizeMB << " MB") : std::string("unlimited");
+        OE_INFO << LC << "Tier " << _tiers.size()-1 << ": " << driver
+            << ", max size = " << maxSize
+            << (writeBehind ? ", write-behind" : "")
+            << std::endl;
+    }
+
+    if ( _tiers.empty() )
+    {
+        OE_WARN << LC << "No valid tiers; cache disabled" << std::endl;
+        _ok = false;
+    }
+}
+
+TieredCache::TieredCache( const TieredCache& rhs, const osg::CopyOp& op ) :
+Cache( rhs, op )
+{
+    //nop
+}
+
+TieredCache::~TieredCache()
+{
+    // bins may keep the tiers alive after this, so stop the write-behind
+    // threads now, in this thread.
+    for( unsigned i=0; i<_tiers.size(); ++i )
+    {
+        _tiers[i]->shutdown();
+    }
+}
+
+void
+TieredCache::flush()
+{
+    for( unsigned i=0; i<_tiers.size(); ++i )
+    {
+        _tiers[i]->flush();
+    }
+}
+
+void
+TieredCache::getStats( std::vector<TierStats>& out ) const
+{
+    out.resize( _tiers.size() );
+    for( unsigned i=0; i<_tiers.size(); ++i )
+    {
+        _tiers[i]->getStats( out[i] );
+    }
+}
+
+CacheBin*
+TieredCache::createBin( const std::string& binID, bool isDefault )
+{
+    TieredCacheBin* bin = new TieredCacheBin( binID );
+    for( unsigned i=0; i<_tiers.size(); ++i )
+    {
+        CacheBin* tierBin = _tiers[i]->createBin( binID, isDefault );
+        if ( tierBin )
+        {
+            bin->addTier( _tiers[i].get(), tierBin );
+        }
+        else
+        {
+            OE_WARN << LC << "Tier " << i << " could not create bin [" << binID << "]" << std::endl;
+        }
+    }
+    return bin;
+}
+
+CacheBin*
+TieredCache::addBin( const std::string& binID )
+{
+    CacheBin* bin = _bins.get( binID );
+    if ( bin )
+        return bin;
+
+    return _bins.getOrCreate( binID, createBin(binID, false) );
+}
+
+CacheBin*
+TieredCache::getOrCreateDefaultBin()
+{
+    if ( !_defaultBin.valid() )
+    {
+        Threading::ScopedMutexLock lock( s_defaultBinMutex );
+        // double check
+        if ( !_defaultBin.valid() )
+        {
+            _defaultBin = createBin( "__default", true );
+        }
+    }
+
+    return _defaultBin.get();
+}
+
+void
+TieredCache::removeBin( CacheBin* bin )
+{
+    TieredCacheBin* tieredBin = dynamic_cast<TieredCacheBin*>( bin );
+    if ( tieredBin )
+    {
+        tieredBin->removeFromTiers();
+    }
+    Cache::removeBin( bin );
+}
@@ -28,6 +28,9 @@
 #include <osgDB/FileNameUtils>
 #include <osgDB/ReadFile>
 #include <osgDB/WriteFile>
+#include <cfloat>
+#include <string.h>
+#include <time.h>
 
 #define LC "[TileSource] "
 
@@ -38,47 +41,328 @@ using namespace osgEarth;
 
 //------------------------------------------------------------------------
 
-TileBlacklist::TileBlacklist()
+namespace
+{
+    // tiles per bitmap word, and the deepest level that can be encoded
+    const unsigned TILES_PER_SLOT = 32u;
+    const unsigned MAX_LEVEL      = 62u;
+    const char*    BLACKLIST_KEY  = "_blacklist";
+    const unsigned BLACKLIST_MAGIC   = 0x4c42454f; // "OEBL"
+    const unsigned BLACKLIST_VERSION = 1u;
+
+    // Encodes a tile as a bitmap word key plus a bit. Returns false for tiles
+    // that cannot be represented (which are then never blacklisted).
+    bool encode( const osgTerrain::TileID& tile, unsigned& hi, unsigned& lo, unsigned& bit )
+    {
+        if ( tile.level < 0 || tile.level > (int)MAX_LEVEL || tile.x < 0 || tile.y < 0 )
+            return false;
+
+        hi  = ((unsigned)(tile.level+1) << 26) | ((unsigned)tile.x >> 5);
+        lo  = (unsigned)tile.y | 0x80000000u;
+        bit = 1u << ((unsigned)tile.x & (TILES_PER_SLOT-1));
+        return true;
+    }
+
+    unsigned hashKey( unsigned hi, unsigned lo )
+    {
+        unsigned h = hi * 0x9E3779B1u;
+        h ^= lo + 0x7F4A7C15u + (h << 6) + (h >> 2);
+        h ^= h >> 15;
+        h *= 0x2C1B3C6Du;
+        h ^= h >> 12;
+        return h;
+    }
+
+    unsigned countBits( unsigned bits )
+    {
+        unsigned n = 0;
+        for( ; bits; bits &= bits-1 ) ++n;
+        return n;
+    }
+
+    void put32( std::string& buf, unsigned v )
+    {
+        buf.push_back( (char)(v & 0xff) );
+        buf.push_back( (char)((v >> 8) & 0xff) );
+        buf.push_back( (char)((v >> 16) & 0xff) );
+        buf.push_back( (char)((v >> 24) & 0xff) );
+    }
+
+    unsigned get32( const std::string& buf, unsigned offset )
+    {
+        const unsigned char* p = (const unsigned char*)buf.data() + offset;
+        return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned)p[3] << 24);
+    }
+}
+
+TileBlacklist::Table::Table(unsigned capacity) :
+_mask( capacity-1 ),
+_used( 0 )
+{
+    _slots = new Slot[capacity];
+}
+
+TileBlacklist::Table::~Table()
+{
+    delete [] _slots;
+}
+
+TileBlacklist::TileBlacklist() :
+_table  ( new Table(256u) ),
+_size   ( 0 ),
+_minTime( 0 ),
+_maxAge ( 0 ),
+_expires( false )
 {
     //NOP
 }
 
+TileBlacklist::~TileBlacklist()
+{
+    delete getTable();
+    for( std::vector<Table*>::iterator i = _retired.begin(); i != _retired.end(); ++i )
+        delete *i;
+}
+
+void
+TileBlacklist::setCachePolicy(const CachePolicy& policy)
+{
+    Threading::ScopedMutexLock lock(_mutex);
+    _minTime = policy.minTime().isSet() ? policy.minTime().value() : 0;
+    _maxAge  = policy.maxAge().isSet()  ? policy.maxAge().value()  : 0;
+    _expires = policy.minTime().isSet() || policy.maxAge().isSet();
+}
+
+TimeStamp
+TileBlacklist::getMinAcceptTime() const
+{
+    if ( !_expires )
+        return 0;
+    if ( _maxAge > 0 )
+        return osg::maximum( _minTime, ::time(0L) - (TimeStamp)_maxAge );
+    return _minTime;
+}
+
+TileBlacklist::Slot*
+TileBlacklist::findSlot(Table* table, unsigned hi, unsigned lo) const
+{
+    // linear probe; stops at the matching slot or the first empty one.
+    for( unsigned i = hashKey(hi, lo) & table->_mask; ; i = (i+1) & table->_mask )
+    {
+        Slot* slot = &table->_slots[i];
+        unsigned slotHi = slot->_hi;
+        if ( slotHi == 0u || (slotHi == hi && slot->_lo == lo) )
+            return slot;
+    }
+}
+
+void
+TileBlacklist::addBits(unsigned hi, unsigned lo, unsigned bits, unsigned time)
+{
+    // caller holds _mutex.
+    Table* table = getTable();
+    Slot*  slot  = findSlot(table, hi, lo);
+
+    if ( slot->_hi == 0u )
+    {
+        // keep the table at most half full, growing it before adding a word.
+        if ( (table->_used+1)*2 > table->_mask+1 )
+        {
+            Table* bigger = new Table( (table->_mask+1)*2 );
+            for( unsigned i = 0; i <= table->_mask; ++i )
+            {
+                const Slot& old = table->_slots[i];
+                if ( old._hi != 0u && old._bits != 0u )
+                {
+                    Slot* s = findSlot(bigger, old._hi, old._lo);
+                    s->_bits.exchange( old._bits );
+                    s->_time.exchange( old._time );
+                    s->_lo.exchange( old._lo );
+                    s->_hi.exchange( old._hi );
+                    bigger->_used++;
+                }
+            }
+            // the atomic swap publishes the new table's contents along with
+            // the pointer. Readers may still be probing the old table, so
+            // retire it rather than deleting it. The retired tables total
+            // less than the live one.
+            _retired.push_back( table );
+            _table.assign( bigger, table );
+            table = bigger;
+            slot = findSlot(table, hi, lo);
+        }
+
+        // publish the contents before the key.
+        slot->_bits.exchange( bits );
+        slot->_time.exchange( time );
+        slot->_lo.exchange( lo );
+        slot->_hi.exchange( hi );
+        table->_used++;
+        _size += countBits(bits);
+    }
+    else
+    {
+        // an expired word starts over.
+        unsigned current = slot->_bits;
+        if ( slot->_time < (unsigned)getMinAcceptTime() )
+        {
+            _size -= countBits(current);
+            current = 0u;
+        }
+        _size += countBits(bits & ~current);
+
+        slot->_time.exchange( osg::maximum( (unsigned)slot->_time, time ) );
+        slot->_bits.exchange( current | bits );
+    }
+}
+
 void
 TileBlacklist::add(const osgTerrain::TileID &tile)
 {
-    Threading::ScopedWriteLock lock(_mutex);
-    _tiles.insert(tile);
+    unsigned hi, lo, bit;
+    if ( !encode(tile, hi, lo, bit) )
+        return;
+
+    Threading::ScopedMutexLock lock(_mutex);
+    addBits( hi, lo, bit, (unsigned)::time(0L) );
     OE_DEBUG << "Added " << tile.level << " (" << tile.x << ", " << tile.y << ") to blacklist" << std::endl;
 }
 
 void
 TileBlacklist::remove(const osgTerrain::TileID &tile)
 {
-    Threading::ScopedWriteLock lock(_mutex);
-    _tiles.erase(tile);
+    unsigned hi, lo, bit;
+    if ( !encode(tile, hi, lo, bit) )
+        return;
+
+    Threading::ScopedMutexLock lock(_mutex);
+    Slot* slot = findSlot(getTable(), hi, lo);
+    if ( slot->_hi != 0u && (slot->_bits & bit) )
+    {
+        slot->_bits.exchange( slot->_bits & ~bit );
+        _size--;
+    }
     OE_DEBUG << "Removed " << tile.level << " (" << tile.x << ", " << tile.y << ") from blacklist" << std::endl;
 }
 
 void
 TileBlacklist::clear()
 {
-    Threading::ScopedWriteLock lock(_mutex);
-    _tiles.clear();
+    // clear in place: a reader that sees a zeroed key simply misses.
+    Threading::ScopedMutexLock lock(_mutex);
+    Table* table = getTable();
+    for( unsigned i = 0; i <= table->_mask; ++i )
+    {
+        Slot& slot = table->_slots[i];
+        slot._hi.exchange( 0u );
+        slot._lo.exchange( 0u );
+        slot._bits.exchange( 0u );
+        slot._time.exchange( 0u );
+    }
+    table->_used = 0;
+    _size = 0;
     OE_DEBUG << "Cleared blacklist" << std::endl;
 }
 
 bool
 TileBlacklist::contains(const osgTerrain::TileID &tile) const
 {
-    Threading::ScopedReadLock lock(const_cast<TileBlacklist*>(this)->_mutex);
-    return _tiles.find(tile) != _tiles.end();
+    unsigned hi, lo, bit;
+    if ( !encode(tile, hi, lo, bit) )
+        return false;
+
+    // no lock: see the notes on Slot and addBits.
+    const Slot* slot = findSlot(getTable(), hi, lo);
+    return
+        slot->_hi != 0u &&
+        (slot->_bits & bit) != 0u &&
+        (!_expires || slot->_time >= (unsigned)getMinAcceptTime());
 }
 
 unsigned int
 TileBlacklist::size() const
 {
-    Threading::ScopedReadLock lock(const_cast<TileBlacklist*>(this)->_mutex);
-    return _tiles.size();
+    Threading::ScopedMutexLock lock(const_cast<TileBlacklist*>(this)->_mutex);
+    return _size;
+}
+
+bool
+TileBlacklist::load(CacheBin* bin)
+{
+    if ( !bin )
+        return false;
+
+    ReadResult r = bin->readString( BLACKLIST_KEY, 0 );
+    if ( !r.succeeded() )
+        return false;
+
+    const std::string& buf = r.getString();
+    if ( buf.size() < 12 || get32(buf, 0) != BLACKLIST_MAGIC || get32(buf, 4) != BLACKLIST_VERSION )
+    {
+        OE_WARN << LC << "Ignoring unrecognized blacklist in cache bin [" << bin->getID() << "]" << std::endl;
+        return false;
+    }
+
+    unsigned count = get32(buf, 8);
+    if ( (buf.size()-12)/16 < count )
+    {
+        OE_WARN << LC << "Ignoring truncated blacklist in cache bin [" << bin->getID() << "]" << std::endl;
+        return false;
+    }
+
+    Threading::ScopedMutexLock lock(_mutex);
+    for( unsigned i = 0, offset = 12; i < count; ++i, offset += 16 )
+    {
+        unsigned hi = get32(buf, offset);
+        unsigned lo = get32(buf, offset+4);
+        if ( hi != 0u && (lo & 0x80000000u) )
+        {
+            addBits( hi, lo, get32(buf, offset+8), get32(buf, offset+12) );
+        }
+    }
+
+    OE_INFO << LC << "Read " << _size << " blacklisted tiles from cache bin [" << bin->getID() << "]" << std::endl;
+    return true;
+}
+
+bool
+TileBlacklist::save(CacheBin* bin) const
+{
+    if ( !bin )
+        return false;
+
+    std::string buf;
+    put32( buf, BLACKLIST_MAGIC );
+    put32( buf, BLACKLIST_VERSION );
+    put32( buf, 0 );
+
+    unsigned count = 0;
+    {
+        Threading::ScopedMutexLock lock(const_cast<TileBlacklist*>(this)->_mutex);
+        unsigned minTime = (unsigned)getMinAcceptTime();
+        const Table* table = getTable();
+        for( unsigned i = 0; i <= table->_mask; ++i )
+        {
+            const Slot& slot = table->_slots[i];
+            if ( slot._hi != 0u && slot._bits != 0u && slot._time >= minTime )
+            {
+                put32( buf, slot._hi );
+                put32( buf, slot._lo );
+                put32( buf, slot._bits );
+                put32( buf, slot._time );
+                ++count;
+            }
+        }
+    }
+
+    buf[8]  = (char)(count & 0xff);
+    buf[9]  = (char)((count >> 8) & 0xff);
+    buf[10] = (char)((count >> 16) & 0xff);
+    buf[11] = (char)((count >> 24) & 0xff);
+
+    osg::ref_ptr<StringObject> obj = new StringObject();
+    obj->setString( buf );
+    return bin->write( BLACKLIST_KEY, obj.get() );
 }
 
 TileBlacklist*
@@ -132,10 +416,25 @@ TileBlacklist::write(const std::string &filename) const
 void
 TileBlacklist::write(std::ostream &output) const
 {
-    Threading::ScopedReadLock lock(const_cast<TileBlacklist*>(this)->_mutex);
-    for (BlacklistedTiles::const_iterator itr = _tiles.begin(); itr != _tiles.end(); ++itr)
+    Threading::ScopedMutexLock lock(const_cast<TileBlacklist*>(this)->_mutex);
+    unsigned minTime = (unsigned)getMinAcceptTime();
+    const Table* table = getTable();
+    for( unsigned i = 0; i <= table->_mask; ++i )
     {
-        output << itr->level << " " << itr->x << " " << itr->y << std::endl;
+        const Slot& slot = table->_slots[i];
+        unsigned hi   = slot._hi;
+        unsigned bits = slot._bits;
+        if ( hi == 0u || slot._time < minTime )
+            continue;
+
+        int level = (int)(hi >> 26) - 1;
+        int x0    = (int)((hi & 0x03ffffffu) << 5);
+        int y     = (int)(slot._lo & 0x7fffffffu);
+        for( unsigned b = 0; b < TILES_PER_SLOT; ++b )
+        {
+            if ( bits & (1u << b) )
+                output << level << " " << (x0 + (int)b) << " " << y << std::endl;
+        }
     }
 }
 
@@ -216,8 +515,9 @@ TileSource::Status TileSource::STATUS_OK = TileSource::Status();
 
 
 TileSource::TileSource( const TileSourceOptions& options ) :
-_options( options ),
-_status ( Status::Error("Not initialized") )
+_options           ( options ),
+_status            ( Status::Error("Not initialized") ),
+_dataExtentsIndexed( 0 )
 {
     this->setThreadSafeRefUnref( true );
 
@@ -284,6 +584,7 @@ TileSource::startup(const osgDB::Options* options)
         if ( getProfile() != 0L )
         {
             _status = status;
+            indexDataExtents();
         }
         else 
         {
@@ -402,6 +703,140 @@ TileSource::getProfile() const
     return _profile.get();
 }
 
+namespace
+{
+    // with fewer extents than this, a linear scan is just as fast.
+    const unsigned MIN_EXTENTS_TO_INDEX = 16;
+
+    inline bool lodInRange( const DataExtent& de, unsigned lod )
+    {
+        return
+            lod == StaticRTree::ANY_LOD || (
+            (!de.minLevel().isSet() || de.minLevel() <= lod) &&
+            (!de.maxLevel().isSet() || de.maxLevel() >= lod) );
+    }
+
+    // exact test applied to each candidate that the index returns.
+    struct IntersectsDataExtent
+    {
+        IntersectsDataExtent( const DataExtentList& extents, const GeoExtent& extent, unsigned lod )
+            : _extents(extents), _extent(extent), _lod(lod) { }
+
+        bool operator()( unsigned i ) const
+        {
+            const DataExtent& de = _extents[i];
+            return lodInRange(de, _lod) && _extent.intersects(de);
+        }
+
+        const DataExtentList& _extents;
+        const GeoExtent&      _extent;
+        unsigned              _lod;
+    };
+
+    struct AcceptAll
+    {
+        bool operator()( unsigned ) const { return true; }
+    };
+}
+
+void
+TileSource::indexDataExtents()
+{
+    _dataExtentsIndex.clear();
+    _dataExtentsIndexSRS = 0L;
+    _unindexedDataExtents.clear();
+    _dataExtentsIndexed = 0;
+
+    if ( _dataExtents.size() < MIN_EXTENTS_TO_INDEX )
+        return;
+
+    // index in the profile's SRS, so that tile key queries need no transformation.
+    _dataExtentsIndexSRS = getProfile() ? getProfile()->getSRS() : _dataExtents.front().getSRS();
+    if ( !_dataExtentsIndexSRS.valid() )
+        return;
+
+    for( unsigned i = 0; i < _dataExtents.size(); ++i )
+    {
+        const DataExtent& de = _dataExtents[i];
+
+        unsigned minLOD = de.minLevel().isSet() ? *de.minLevel() : 0u;
+        unsigned maxLOD = de.maxLevel().isSet() ? *de.maxLevel() : ~0u;
+
+        GeoExtent extent = de;
+        if ( extent.isValid() && !extent.getSRS()->isHorizEquivalentTo(_dataExtentsIndexSRS.get()) )
+            extent = extent.transform( _dataExtentsIndexSRS.get() );
+
+        if ( !extent.isValid() )
+        {
+            // can't index this one; it gets checked every time.
+            _unindexedDataExtents.push_back( i );
+        }
+        else if ( extent.crossesAntimeridian() )
+        {
+            GeoExtent west, east;
+            extent.splitAcrossAntimeridian( west, east );
+            _dataExtentsIndex.insert( west.xMin(), west.yMin(), west.xMax(), west.yMax(), i, minLOD, maxLOD );
+            _dataExtentsIndex.insert( east.xMin(), east.yMin(), east.xMax(), east.yMax(), i, minLOD, maxLOD );
+        }
+        else
+        {
+            _dataExtentsIndex.insert( extent.xMin(), extent.yMin(), extent.xMax(), extent.yMax(), i, minLOD, maxLOD );
+        }
+    }
+
+    _dataExtentsIndex.build();
+    _dataExtentsIndexed = _dataExtents.size();
+
+    OE_DEBUG << LC << "Indexed " << _dataExtentsIndexed << " data extents" << std::endl;
+}
+
+bool
+TileSource::intersectsDataExtents( const GeoExtent& extent, unsigned lod ) const
+{
+    if ( !extent.isValid() )
+        return false;
+
+    IntersectsDataExtent test( _dataExtents, extent, lod );
+
+    // Use the index if it's current. (Extents added since it was built
+    // would be missed, so if the count changed, scan instead.)
+    if ( _dataExtentsIndexed > 0 && _dataExtentsIndexed == _dataExtents.size() )
+    {
+        GeoExtent query = extent;
+        if ( !query.getSRS()->isHorizEquivalentTo(_dataExtentsIndexSRS.get()) )
+            query = extent.transform( _dataExtentsIndexSRS.get() );
+
+        if ( query.isValid() )
+        {
+            for( std::vector<unsigned>::const_iterator i = _unindexedDataExtents.begin(); i != _unindexedDataExtents.end(); ++i )
+            {
+                if ( test(*i) )
+                    return true;
+            }
+
+            if ( query.crossesAntimeridian() )
+            {
+                GeoExtent west, east;
+                query.splitAcrossAntimeridian( west, east );
+                return
+                    _dataExtentsIndex.findFirst( west.xMin(), west.yMin(), west.xMax(), west.yMax(), lod, test ) ||
+                    _dataExtentsIndex.findFirst( east.xMin(), east.yMin(), east.xMax(), east.yMax(), lod, test );
+            }
+            else
+            {
+                return _dataExtentsIndex.findFirst( query.xMin(), query.yMin(), query.xMax(), query.yMax(), lod, test );
+            }
+        }
+    }
+
+    for( unsigned i = 0; i < _dataExtents.size(); ++i )
+    {
+        if ( test(i) )
+            return true;
+    }
+    return false;
+}
+
 bool
 TileSource::hasDataAtLOD( unsigned lod ) const
 {
@@ -411,10 +846,23 @@ TileSource::hasDataAtLOD( unsigned lod ) const
     if ( _dataExtents.size() == 0 )
         return true;
 
+    if ( _dataExtentsIndexed > 0 && _dataExtentsIndexed == _dataExtents.size() )
+    {
+        AcceptAll acceptAll;
+        if ( _dataExtentsIndex.findFirst(-DBL_MAX, -DBL_MAX, DBL_MAX, DBL_MAX, lod, acceptAll) )
+            return true;
+
+        for( std::vector<unsigned>::const_iterator i = _unindexedDataExtents.begin(); i != _unindexedDataExtents.end(); ++i )
+        {
+            if ( lodInRange(_dataExtents[*i], lod) )
+                return true;
+        }
+        return false;
+    }
+
     for (DataExtentList::const_iterator itr = _dataExtents.begin(); itr != _dataExtents.end(); ++itr)
     {
-        if ((!itr->minLevel().isSet() || itr->minLevel() <= lod) &&
-            (!itr->maxLevel().isSet() || itr->maxLevel() >= lod))
+        if ( lodInRange(*itr, lod) )
         {
             return true;
         }
@@ -435,17 +883,7 @@ TileSource::hasDataInExtent( const GeoExtent& extent ) const
     if ( _dataExtents.size() == 0 )
         return true;
 
-    bool intersects = false;
-
-    for (DataExtentList::const_iterator itr = _dataExtents.begin(); itr != _dataExtents.end(); ++itr)
-    {
-        if ( extent.intersects( *itr ) )
-        {
-            intersects = true;
-            break;
-        }
-    }
-    return intersects;
+    return intersectsDataExtents( extent, StaticRTree::ANY_LOD );
 }
 
 
@@ -458,21 +896,7 @@ TileSource::hasData(const osgEarth::TileKey& key) const
     if (_dataExtents.size() == 0) 
         return true;
 
-    const osgEarth::GeoExtent& keyExtent = key.getExtent();
-    bool intersectsData = false;
-
-    for (DataExtentList::const_iterator itr = _dataExtents.begin(); itr != _dataExtents.end(); ++itr)
-    {
-        if ((keyExtent.intersects( *itr )) && 
-            (!itr->minLevel().isSet() || itr->minLevel() <= key.getLOD()) &&
-            (!itr->maxLevel().isSet() || itr->maxLevel() >= key.getLOD()))
-        {
-            intersectsData = true;
-            break;
-        }
-    }
-
-    return intersectsData;
+    return intersectsDataExtents( key.getExtent(), key.getLOD() );
 }
 
 TileBlacklist*
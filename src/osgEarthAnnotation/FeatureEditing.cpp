@@ -123,7 +123,7 @@ public:
       virtual void onPositionChanged(const Dragger* sender, const osgEarth::GeoPoint& position)
       {
           (*_featureNode->getFeature()->getGeometry())[_point] =  osg::Vec3d(position.x(), position.y(), 0);
-          _featureNode->init();
+          _featureNode->updateGeometry();
       }
 
       osg::ref_ptr< FeatureNode > _featureNode;
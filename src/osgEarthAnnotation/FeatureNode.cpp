@@ -29,14 +29,27 @@
 
 #include <osgEarth/ClampableNode>
 #include <osgEarth/DrapeableNode>
+#include <osgEarth/ECEF>
 #include <osgEarth/NodeUtils>
 #include <osgEarth/Utils>
 #include <osgEarth/Registry>
 #include <osgEarth/ShaderGenerator>
+#include <osgEarth/StringUtils>
 
 #include <osg/BoundingSphere>
 #include <osg/Polytope>
 #include <osg/Transform>
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/LineWidth>
+#include <osg/LineStipple>
+#include <osg/Point>
+#include <osg/TriangleIndexFunctor>
+#include <osgUtil/SmoothingVisitor>
+#include <osgUtil/Tessellator>
+#include <algorithm>
+#include <map>
+#include <set>
 
 #define LC "[FeatureNode] "
 
@@ -69,12 +82,237 @@ _options      ( options )
     init();
 }
 
+namespace
+{
+    /**
+     * Collects the geodes and geometries of a compiled feature, in traversal
+     * order, along with the local-to-world matrix of each geometry. Fails on
+     * any drawable that isn't plain geometry (text, etc).
+     */
+    struct CollectGeometry : public osg::NodeVisitor
+    {
+        CollectGeometry() : osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN), _ok(true)
+        {
+            _matrixStack.push_back( osg::Matrixd::identity() );
+        }
+
+        void apply( osg::Transform& xform )
+        {
+            osg::Matrixd matrix = _matrixStack.back();
+            xform.computeLocalToWorldMatrix( matrix, this );
+            _matrixStack.push_back( matrix );
+            traverse( xform );
+            _matrixStack.pop_back();
+        }
+
+        void apply( osg::Geode& geode )
+        {
+            _geodes.push_back( &geode );
+            for( unsigned i=0; i<geode.getNumDrawables(); ++i )
+            {
+                osg::Geometry* geom = geode.getDrawable(i)->asGeometry();
+                if ( geom && dynamic_cast<osg::Vec3Array*>(geom->getVertexArray()) )
+                {
+                    _geoms.push_back( geom );
+                    _matrices.push_back( _matrixStack.back() );
+                }
+                else
+                {
+                    _ok = false;
+                }
+            }
+        }
+
+        bool                        _ok;
+        std::vector<osg::Matrixd>   _matrixStack;
+        std::vector<osg::Geode*>    _geodes;
+        std::vector<osg::Geometry*> _geoms;
+        std::vector<osg::Matrixd>   _matrices;
+    };
+
+    bool hasMode( const osg::Geometry* geom, GLenum mode1, GLenum mode2 =GL_POINTS, GLenum mode3 =GL_POINTS )
+    {
+        if ( geom->getNumPrimitiveSets() == 0 )
+            return false;
+
+        for( unsigned i=0; i<geom->getNumPrimitiveSets(); ++i )
+        {
+            GLenum mode = geom->getPrimitiveSet(i)->getMode();
+            if ( mode != mode1 && mode != mode2 && mode != mode3 )
+                return false;
+        }
+        return true;
+    }
+
+    typedef std::map< osg::StateSet*, osg::ref_ptr<osg::StateSet> > StateSetClones;
+
+    /**
+     * Copies a stateset so we can change it without touching the original,
+     * which the StateSetCache may have shared with other nodes. Objects that
+     * shared a stateset before still share the copy.
+     */
+    osg::StateSet* cloneStateSet( osg::StateSet* ss, StateSetClones& clones )
+    {
+        osg::ref_ptr<osg::StateSet>& clone = clones[ss];
+        if ( !clone.valid() )
+        {
+            clone = ss ? new osg::StateSet(*ss, osg::CopyOp::SHALLOW_COPY) : new osg::StateSet();
+            clone->setDataVariance( osg::Object::DYNAMIC );
+        }
+        return clone.get();
+    }
+
+    bool isTriangleMode( GLenum mode )
+    {
+        return
+            mode == GL_TRIANGLES || mode == GL_TRIANGLE_STRIP || mode == GL_TRIANGLE_FAN ||
+            mode == GL_QUADS     || mode == GL_QUAD_STRIP     || mode == GL_POLYGON;
+    }
+
+    struct TriangleCollector
+    {
+        std::vector<unsigned>* _indices;
+        void operator()( unsigned i0, unsigned i1, unsigned i2 )
+        {
+            _indices->push_back( i0 );
+            _indices->push_back( i1 );
+            _indices->push_back( i2 );
+        }
+    };
+
+    /** Vertex indices of all the triangles in a geometry, three per triangle */
+    void getTriangles( osg::Geometry* geom, std::vector<unsigned>& out )
+    {
+        osg::TriangleIndexFunctor<TriangleCollector> collector;
+        collector._indices = &out;
+        geom->accept( collector );
+    }
+
+    /** Whether the angle between two geocentric points exceeds maxAngle */
+    bool exceedsAngle( osg::Vec3d a, osg::Vec3d b, double maxAngle )
+    {
+        a.normalize();
+        b.normalize();
+        return acos( osg::clampBetween(a * b, -1.0, 1.0) ) > maxAngle;
+    }
+
+    /** Cell of a spatial hash of points */
+    struct HashCell
+    {
+        int _x, _y, _z;
+
+        bool operator < ( const HashCell& rhs ) const {
+            return
+                _x < rhs._x || (_x == rhs._x && (
+                _y < rhs._y || (_y == rhs._y && _z < rhs._z) ));
+        }
+    };
+    typedef std::map< HashCell, std::vector<unsigned> > PointHash;
+
+    bool toHashCell( const osg::Vec3d& p, double cellSize, HashCell& out )
+    {
+        osg::Vec3d c( floor(p.x()/cellSize), floor(p.y()/cellSize), floor(p.z()/cellSize) );
+        if ( fabs(c.x()) > 1e9 || fabs(c.y()) > 1e9 || fabs(c.z()) > 1e9 )
+            return false;
+        out._x = (int)c.x();
+        out._y = (int)c.y();
+        out._z = (int)c.z();
+        return true;
+    }
+
+    /**
+     * Picks the feature point behind a vertex from the points within the
+     * matching tolerance of it. Copies of the same point (like the closing
+     * point of a ring) resolve to the one after the previous vertex's point,
+     * or else the first one. Any other ambiguity fails (-1).
+     */
+    int pickSource( const std::vector<unsigned>& candidates, int prev, const std::vector<osg::Vec3d>& world )
+    {
+        if ( candidates.empty() )
+            return -1;
+        if ( candidates.size() == 1 )
+            return candidates[0];
+
+        unsigned first = *std::min_element( candidates.begin(), candidates.end() );
+        for( unsigned i=0; i<candidates.size(); ++i )
+        {
+            if ( world[candidates[i]] != world[first] )
+                return -1;
+        }
+        for( unsigned i=0; i<candidates.size(); ++i )
+        {
+            if ( (int)candidates[i] == prev+1 )
+                return candidates[i];
+        }
+        return first;
+    }
+
+    /**
+     * Serializes the parts of a style that determine the shape of the
+     * compiled geometry. Optionally ignores the appearance properties that
+     * end up in state and color arrays only, and the altitude properties
+     * that only move vertices up and down.
+     */
+    std::string getShapeSignature( const Style& input, bool ignoreAppearance, bool ignoreAltitude )
+    {
+        Style style( input );
+
+        if ( ignoreAppearance )
+        {
+            LineSymbol* line = style.get<LineSymbol>();
+            if ( line && line->stroke().isSet() )
+            {
+                line->stroke()->color() = Color::White;
+                if ( !line->stroke()->widthUnits().isSet() || line->stroke()->widthUnits() == Units::PIXELS )
+                {
+                    line->stroke()->width() = 1.0f;
+                    line->stroke()->stipple().unset();
+                }
+            }
+
+            PolygonSymbol* poly = style.get<PolygonSymbol>();
+            if ( poly && poly->fill().isSet() )
+            {
+                poly->fill()->color() = Color::White;
+            }
+
+            PointSymbol* point = style.get<PointSymbol>();
+            if ( point )
+            {
+                if ( point->fill().isSet() )
+                    point->fill()->color() = Color::White;
+                point->size() = 1.0f;
+            }
+        }
+
+        if ( ignoreAltitude )
+        {
+            AltitudeSymbol* alt = style.get<AltitudeSymbol>();
+            if ( alt )
+            {
+                alt->verticalOffset().unset();
+                alt->verticalScale().unset();
+            }
+        }
+
+        // blending changes the node structure (two-pass alpha), so it counts.
+        return Stringify()
+            << AnnotationUtils::styleRequiresAlphaBlending(input)
+            << style.getConfig(false).toJSON();
+    }
+}
+
 void
 FeatureNode::init()
 {
     // if there's a decoration, clear it out first.
     this->clearDecoration();
     _attachPoint = 0L;
+    _sceneClamping = false;
+    _unclamped.clear();
+    _vertexSources.clear();
+    _world2local.clear();
+    _featurePoints = FeaturePoints();
 
     // if there is existing geometry, kill it
     this->removeChildren( 0, this->getNumChildren() );
@@ -85,42 +323,14 @@ FeatureNode::init()
     if ( !_feature.valid() )
         return;
 
-    // compilation options.
-    GeometryCompilerOptions options = _options;
-    
     // figure out what kind of altitude manipulation we need to perform.
     AnnotationUtils::AltitudePolicy ap;
     AnnotationUtils::getAltitudePolicy( *_feature->style(), ap );
+    _sceneClamping = ap.sceneClamping;
 
-    // If we're doing auto-clamping on the CPU, shut off compiler map clamping
-    // clamping since it would be redundant.
-    // TODO: I think this is OBE now that we have "scene" clamping technique..
-    if ( ap.sceneClamping )
-    {
-        options.ignoreAltitudeSymbol() = true;
-    }
-
-    // prep the compiler:
-    GeometryCompiler compiler( options );
-    Session* session = new Session( getMapNode()->getMap() );
-    GeoExtent extent(_feature->getSRS(), _feature->getGeometry()->getBounds());
-    osg::ref_ptr<FeatureProfile> profile = new FeatureProfile( extent );
-    FilterContext context( session, profile.get(), extent );
-
-    // Clone the Feature before rendering as the GeometryCompiler and it's filters can change the coordinates
-    // of the geometry when performing localization or converting to geocentric.
-    osg::ref_ptr< Feature > clone = new Feature(*_feature.get(), osg::CopyOp::DEEP_COPY_ALL);
-
-    osg::Node* node = compiler.compile( clone.get(), *clone->style(), context );
+    osg::Node* node = compileFeature();
     if ( node )
     {
-        if ( _feature->style().isSet() &&
-            AnnotationUtils::styleRequiresAlphaBlending( *_feature->style() ) &&
-            _feature->style()->get<ExtrusionSymbol>() )
-        {
-            node = AnnotationUtils::installTwoPassAlpha( node );
-        }
-
         //OE_NOTICE << GeometryUtils::geometryToGeoJSON( _feature->getGeometry() ) << std::endl;
 
         _attachPoint = new osg::Group();
@@ -167,13 +377,685 @@ FeatureNode::init()
                 // set default lighting based on whether we are extruding:
                 setLightingIfNotSet( _feature->style()->has<ExtrusionSymbol>() );
 
+                // keep the unclamped vertices so we can patch and reclamp
+                // parts of the mesh later without recompiling it.
+                CollectGeometry collect;
+                _attachPoint->accept( collect );
+                for( unsigned i=0; i<collect._geoms.size(); ++i )
+                {
+                    osg::Vec3Array* verts = static_cast<osg::Vec3Array*>(collect._geoms[i]->getVertexArray());
+                    _unclamped.push_back( new osg::Vec3Array(*verts) );
+                }
+
                 // do an initial clamp to get started.
                 clampMesh( getMapNode()->getTerrain()->getGraph() );
             } 
 
             applyGeneralSymbology( *_feature->style() );
         }
+
+        initPatching();
+    }
+}
+
+osg::Node*
+FeatureNode::compileFeature()
+{
+    // compilation options.
+    GeometryCompilerOptions options = _options;
+
+    // If we're doing auto-clamping on the CPU, shut off compiler map clamping
+    // clamping since it would be redundant.
+    // TODO: I think this is OBE now that we have "scene" clamping technique..
+    if ( _sceneClamping )
+    {
+        options.ignoreAltitudeSymbol() = true;
+    }
+
+    // prep the compiler:
+    GeometryCompiler compiler( options );
+    Session* session = new Session( getMapNode()->getMap() );
+    GeoExtent extent(_feature->getSRS(), _feature->getGeometry()->getBounds());
+    osg::ref_ptr<FeatureProfile> profile = new FeatureProfile( extent );
+    FilterContext context( session, profile.get(), extent );
+
+    // Clone the Feature before rendering as the GeometryCompiler and it's filters can change the coordinates
+    // of the geometry when performing localization or converting to geocentric.
+    osg::ref_ptr< Feature > clone = new Feature(*_feature.get(), osg::CopyOp::DEEP_COPY_ALL);
+
+    osg::Node* node = compiler.compile( clone.get(), *clone->style(), context );
+    if ( node )
+    {
+        if ( _feature->style().isSet() &&
+            AnnotationUtils::styleRequiresAlphaBlending( *_feature->style() ) &&
+            _feature->style()->get<ExtrusionSymbol>() )
+        {
+            node = AnnotationUtils::installTwoPassAlpha( node );
+        }
+    }
+    return node;
+}
+
+void
+FeatureNode::updateGeometry()
+{
+    if ( !patchCoords() )
+    {
+        init();
+    }
+}
+
+bool
+FeatureNode::canPatchAppearance( const Style& style ) const
+{
+    // these build geometry whose colors and state don't come straight
+    // from the line/polygon/point symbols.
+    return
+        !style.has<ExtrusionSymbol>() &&
+        !style.has<ModelSymbol>()     &&
+        !style.has<MarkerSymbol>()    &&
+        !style.has<IconSymbol>()      &&
+        !style.has<TextSymbol>();
+}
+
+bool
+FeatureNode::canPatchCoords( const Style& style ) const
+{
+    if ( !canPatchAppearance(style) )
+        return false;
+
+    const PolygonSymbol* poly  = style.get<PolygonSymbol>();
+    const LineSymbol*    line  = style.get<LineSymbol>();
+    const PointSymbol*   point = style.get<PointSymbol>();
+    if ( !poly && !line && !point )
+        return false;
+
+    // polygonized lines, and lines the compiler tessellates or resamples,
+    // don't keep one vertex per feature point.
+    if ( line && line->stroke()->widthUnits() != Units::PIXELS )
+        return false;
+    if ( line && line->tessellation().isSet() && !line->tessellation().isSetTo(0) )
+        return false;
+    if ( _options.resampleMode().isSet() )
+        return false;
+
+    // the compiler only bakes altitude into the vertices when it does the
+    // clamping itself (as opposed to scene clamping).
+    const AltitudeSymbol* alt = style.get<AltitudeSymbol>();
+    bool altRequired =
+        !_sceneClamping &&
+        _options.ignoreAltitudeSymbol() != true &&
+        alt && (
+            alt->clamping() != AltitudeSymbol::CLAMP_NONE ||
+            alt->verticalOffset().isSet() ||
+            alt->verticalScale().isSet() );
+
+    return !altRequired;
+}
+
+bool
+FeatureNode::getFeaturePoints( FeaturePoints& out ) const
+{
+    const SpatialReference* featureSRS = _feature->getSRS();
+    const SpatialReference* mapSRS     = getMapNode()->getMapSRS();
+    bool                    geocentric = getMapNode()->isGeocentric();
+    bool                    filled     = _feature->style()->has<PolygonSymbol>();
+
+    // same traversal as the BuildGeometryFilter: each part, followed by the
+    // holes of a polygon, which it builds into the same geometry.
+    unsigned partIndex = 0;
+    ConstGeometryIterator parts( _feature->getGeometry(), false );
+    while( parts.hasMore() )
+    {
+        const Geometry* part = parts.next();
+
+        std::vector<const Geometry*> rings;
+        rings.push_back( part );
+
+        const Polygon* poly = dynamic_cast<const Polygon*>( part );
+        if ( poly )
+        {
+            for( RingCollection::const_iterator h = poly->getHoles().begin(); h != poly->getHoles().end(); ++h )
+            {
+                if ( h->get()->isValid() )
+                    rings.push_back( h->get() );
+            }
+        }
+
+        bool closed =
+            part->getType() == Geometry::TYPE_RING    ||
+            part->getType() == Geometry::TYPE_POLYGON ||
+            (filled && part->getType() != Geometry::TYPE_POINTSET && part->getTotalPointCount() >= 3);
+
+        for( unsigned r=0; r<rings.size(); ++r )
+        {
+            out._ringSizes.push_back( rings[r]->size() );
+            out._ringClosed.push_back( closed );
+            out._ringParts.push_back( partIndex );
+
+            for( Geometry::const_iterator i = rings[r]->begin(); i != rings[r]->end(); ++i )
+            {
+                osg::Vec3d world;
+                if ( geocentric )
+                {
+                    ECEF::transformAndLocalize( *i, featureSRS, world, mapSRS, osg::Matrixd::identity() );
+                }
+                else if ( featureSRS )
+                {
+                    if ( !featureSRS->transform( *i, mapSRS, world ) )
+                        return false;
+                }
+                else
+                {
+                    world = *i;
+                }
+                out._world.push_back( world );
+                out._pointParts.push_back( partIndex );
+            }
+        }
+
+        ++partIndex;
     }
+
+    return true;
+}
+
+void
+FeatureNode::initPatching()
+{
+    const Style& style = *_feature->style();
+    if ( !canPatchAppearance(style) )
+        return;
+
+    CollectGeometry collect;
+    _attachPoint->accept( collect );
+    if ( !collect._ok || (_sceneClamping && _unclamped.size() != collect._geoms.size()) )
+        return;
+
+    // patches happen outside the update traversal (dragger events, etc), so
+    // keep the draw thread from overlapping them. (Statesets are never
+    // changed in place; patchAppearance swaps in DYNAMIC copies.)
+    for( unsigned i=0; i<collect._geoms.size(); ++i )
+    {
+        collect._geoms[i]->setDataVariance( osg::Object::DYNAMIC );
+    }
+
+    if ( !canPatchCoords(style) )
+        return;
+
+    FeaturePoints points;
+    if ( !getFeaturePoints(points) || points._world.empty() )
+        return;
+
+    const std::vector<osg::Vec3d>& world = points._world;
+
+    // vertices are floats in the local frame, so match within a tolerance
+    // relative to the size of the feature.
+    osg::BoundingSphered bs;
+    for( unsigned j=0; j<world.size(); ++j )
+        bs.expandBy( world[j] );
+    double tolerance = std::max( bs.radius() * 1e-5, 1e-6 );
+    double tolerance2 = tolerance * tolerance;
+
+    // hash the points into cells twice the tolerance in size, so that each
+    // vertex only has to look at the points in its own and adjacent cells.
+    double cellSize = 2.0 * tolerance;
+
+    std::vector< std::vector<unsigned> > sources( collect._geoms.size() );
+    std::vector< osg::Matrixd >          world2local( collect._geoms.size() );
+
+    for( unsigned i=0; i<collect._geoms.size(); ++i )
+    {
+        world2local[i] = osg::Matrixd::inverse( collect._matrices[i] );
+
+        std::vector<osg::Vec3d> local( world.size() );
+        PointHash hash;
+        for( unsigned j=0; j<world.size(); ++j )
+        {
+            local[j] = world[j] * world2local[i];
+
+            HashCell cell;
+            if ( !toHashCell(local[j], cellSize, cell) )
+                return;
+            hash[cell].push_back( j );
+        }
+
+        const osg::Vec3Array* verts = _sceneClamping ?
+            _unclamped[i].get() :
+            static_cast<const osg::Vec3Array*>(collect._geoms[i]->getVertexArray());
+
+        sources[i].resize( verts->size() );
+        int prev = -1;
+        for( unsigned k=0; k<verts->size(); ++k )
+        {
+            osg::Vec3d v( (*verts)[k] );
+
+            HashCell cell;
+            if ( !toHashCell(v, cellSize, cell) )
+                return;
+
+            std::vector<unsigned> candidates;
+            for( int dx=-1; dx<=1; ++dx )
+            {
+                for( int dy=-1; dy<=1; ++dy )
+                {
+                    for( int dz=-1; dz<=1; ++dz )
+                    {
+                        HashCell n = { cell._x+dx, cell._y+dy, cell._z+dz };
+                        PointHash::const_iterator h = hash.find( n );
+                        if ( h == hash.end() )
+                            continue;
+
+                        for( unsigned c=0; c<h->second.size(); ++c )
+                        {
+                            if ( (local[h->second[c]] - v).length2() <= tolerance2 )
+                                candidates.push_back( h->second[c] );
+                        }
+                    }
+                }
+            }
+
+            // every vertex has to come from one feature point; one the
+            // compiler generated (subdivision, or a tessellator vertex at a
+            // self-intersection) means we can't patch this geometry.
+            int match = pickSource( candidates, prev, world );
+            if ( match < 0 )
+                return;
+
+            sources[i][k] = match;
+            prev = match;
+        }
+    }
+
+    _vertexSources.swap( sources );
+    _world2local.swap( world2local );
+    _featurePoints = points;
+}
+
+bool
+FeatureNode::retessellate( osg::Geometry*               geom,
+                           unsigned                     index,
+                           const FeaturePoints&         points,
+                           const std::set<unsigned>&    parts,
+                           const std::vector<unsigned>& triangles )
+{
+    const std::vector<unsigned>& sources = _vertexSources[index];
+
+    // the vertex behind each feature point.
+    std::vector<int> vertexOf( points._world.size(), -1 );
+    for( unsigned k=0; k<sources.size(); ++k )
+    {
+        if ( vertexOf[sources[k]] < 0 )
+            vertexOf[sources[k]] = k;
+    }
+
+    // keep the triangles of the other parts as they are.
+    std::vector<unsigned> newTriangles;
+    for( unsigned t=0; t+2<triangles.size(); t += 3 )
+    {
+        if ( parts.find(points._pointParts[sources[triangles[t]]]) == parts.end() )
+        {
+            newTriangles.push_back( triangles[t] );
+            newTriangles.push_back( triangles[t+1] );
+            newTriangles.push_back( triangles[t+2] );
+        }
+    }
+
+    unsigned ringStart = 0;
+    for( unsigned r=0; r<points._ringSizes.size(); )
+    {
+        // the rings of a part (its outline and its holes) are consecutive.
+        unsigned part      = points._ringParts[r];
+        unsigned partStart = ringStart;
+        unsigned lastRing  = r;
+        while( lastRing < points._ringSizes.size() && points._ringParts[lastRing] == part )
+            ringStart += points._ringSizes[lastRing++];
+
+        if ( parts.find(part) != parts.end() )
+        {
+            // same tessellation as the BuildGeometryFilter, in the same frame.
+            osg::ref_ptr<osg::Geometry> outline = new osg::Geometry();
+            osg::Vec3Array* verts = new osg::Vec3Array();
+            outline->setVertexArray( verts );
+
+            for( unsigned q = r; q < lastRing; ++q )
+            {
+                outline->addPrimitiveSet( new osg::DrawArrays(GL_LINE_LOOP, verts->size(), points._ringSizes[q]) );
+                unsigned first = partStart + verts->size();
+                for( unsigned j=0; j<points._ringSizes[q]; ++j )
+                    verts->push_back( points._world[first + j] * _world2local[index] );
+            }
+
+            unsigned numPoints = verts->size();
+
+            osgUtil::Tessellator tess;
+            tess.setTessellationType( osgUtil::Tessellator::TESS_TYPE_GEOMETRY );
+            tess.setWindingType( osgUtil::Tessellator::TESS_WINDING_POSITIVE );
+            tess.retessellatePolygons( *outline );
+
+            std::vector<unsigned> partTriangles;
+            getTriangles( outline.get(), partTriangles );
+            for( unsigned t=0; t<partTriangles.size(); ++t )
+            {
+                // a new vertex (the outline crosses itself) needs a rebuild.
+                if ( partTriangles[t] >= numPoints || vertexOf[partStart + partTriangles[t]] < 0 )
+                    return false;
+                newTriangles.push_back( vertexOf[partStart + partTriangles[t]] );
+            }
+        }
+
+        r = lastRing;
+    }
+
+    osg::DrawElements* de = sources.size() < 0x10000 ?
+        static_cast<osg::DrawElements*>(new osg::DrawElementsUShort(GL_TRIANGLES)) :
+        static_cast<osg::DrawElements*>(new osg::DrawElementsUInt(GL_TRIANGLES));
+    de->reserveElements( newTriangles.size() );
+    for( unsigned t=0; t<newTriangles.size(); ++t )
+        de->addElement( newTriangles[t] );
+
+    // replace the triangle sets, keeping any lines or points.
+    osg::Geometry::PrimitiveSetList primSets;
+    for( unsigned p=0; p<geom->getNumPrimitiveSets(); ++p )
+    {
+        osg::PrimitiveSet* pset = geom->getPrimitiveSet(p);
+        if ( !isTriangleMode(pset->getMode()) )
+            primSets.push_back( pset );
+        else if ( !de->getUserData() )
+            de->setUserData( pset->getUserData() );
+    }
+    primSets.push_back( de );
+    geom->setPrimitiveSetList( primSets );
+
+    return true;
+}
+
+bool
+FeatureNode::patchCoords()
+{
+    if ( !_attachPoint || !getMapNode() || !_feature.valid() || !_feature->getGeometry() )
+        return false;
+
+    const Style& style = *_feature->style();
+    if ( _vertexSources.empty() || !canPatchCoords(style) )
+        return false;
+
+    // a point added or removed changes the topology; that needs a rebuild.
+    FeaturePoints points;
+    if ( !getFeaturePoints(points) || !points.sameRingsAs(_featurePoints) )
+        return false;
+
+    const std::vector<osg::Vec3d>& world = points._world;
+
+    // in geocentric maps, the compiler subdivides line segments and triangle
+    // edges that span more than the max granularity; if an edit stretches
+    // one that far, the mesh needs new vertices.
+    const LineSymbol* line = style.get<LineSymbol>();
+    bool   subdivided = getMapNode()->isGeocentric() && !(line && line->tessellation().isSetTo(0));
+    double maxAngle   = osg::DegreesToRadians( _options.maxGranularity().value() );
+    if ( subdivided )
+    {
+        unsigned first = 0;
+        for( unsigned r=0; r<points._ringSizes.size(); ++r )
+        {
+            unsigned count = points._ringSizes[r];
+            unsigned numSegments = points._ringClosed[r] && count > 2 ? count : count > 0 ? count-1 : 0;
+            for( unsigned s=0; s<numSegments; ++s )
+            {
+                if ( exceedsAngle(world[first + s], world[first + (s+1) % count], maxAngle) )
+                    return false;
+            }
+            first += count;
+        }
+    }
+
+    CollectGeometry collect;
+    _attachPoint->accept( collect );
+    if ( !collect._ok || collect._geoms.size() != _vertexSources.size() )
+        return false;
+
+    for( unsigned i=0; i<collect._geoms.size(); ++i )
+    {
+        if ( collect._geoms[i]->getVertexArray()->getNumElements() != _vertexSources[i].size() )
+            return false;
+    }
+
+    // write the new points straight into the vertex arrays.
+    bool moved = false;
+
+    for( unsigned i=0; i<collect._geoms.size(); ++i )
+    {
+        osg::Geometry*  geom  = collect._geoms[i];
+        osg::Vec3Array* verts = static_cast<osg::Vec3Array*>(geom->getVertexArray());
+        osg::Vec3Array* ref   = _sceneClamping ? _unclamped[i].get() : verts;
+
+        const std::vector<unsigned>& sources = _vertexSources[i];
+
+        std::vector<unsigned> triangles;
+        getTriangles( geom, triangles );
+
+        // fills need the old positions to tell whether their triangles still fit.
+        osg::ref_ptr<osg::Vec3Array> before;
+        if ( !triangles.empty() )
+            before = new osg::Vec3Array( *ref );
+
+        std::vector<unsigned> changed;
+        for( unsigned k=0; k<sources.size(); ++k )
+        {
+            osg::Vec3 v = world[sources[k]] * _world2local[i];
+            if ( (v - (*ref)[k]).length2() > 1e-12 )
+            {
+                (*verts)[k] = v;
+                if ( _sceneClamping )
+                    (*ref)[k] = v;
+                changed.push_back( k );
+            }
+        }
+
+        if ( changed.empty() )
+            continue;
+
+        if ( !triangles.empty() )
+        {
+            // The triangulation stays valid as long as no triangle turns over:
+            // the triangles then still cover the outline exactly once. Only the
+            // parts with a flipped triangle get tessellated again.
+            std::set<unsigned> flippedParts;
+            for( unsigned t=0; t+2<triangles.size(); t += 3 )
+            {
+                unsigned a = triangles[t], b = triangles[t+1], c = triangles[t+2];
+                osg::Vec3d n0 = osg::Vec3d((*before)[b] - (*before)[a]) ^ osg::Vec3d((*before)[c] - (*before)[a]);
+                osg::Vec3d n1 = osg::Vec3d((*ref)[b] - (*ref)[a]) ^ osg::Vec3d((*ref)[c] - (*ref)[a]);
+                if ( n0.length2() > 0.0 && n0 * n1 <= 0.0 )
+                    flippedParts.insert( points._pointParts[sources[a]] );
+            }
+
+            if ( !flippedParts.empty() )
+            {
+                if ( !retessellate(geom, i, points, flippedParts, triangles) )
+                    return false;
+
+                triangles.clear();
+                getTriangles( geom, triangles );
+            }
+
+            if ( subdivided )
+            {
+                for( unsigned t=0; t+2<triangles.size(); t += 3 )
+                {
+                    const osg::Vec3d& a = world[sources[triangles[t]]];
+                    const osg::Vec3d& b = world[sources[triangles[t+1]]];
+                    const osg::Vec3d& c = world[sources[triangles[t+2]]];
+                    if ( exceedsAngle(a, b, maxAngle) || exceedsAngle(b, c, maxAngle) || exceedsAngle(c, a, maxAngle) )
+                        return false;
+                }
+            }
+
+            if ( geom->getNormalArray() )
+            {
+                osgUtil::SmoothingVisitor::smooth( *geom );
+            }
+        }
+
+        verts->dirty();
+        geom->dirtyBound();
+        geom->dirtyDisplayList();
+
+        if ( _sceneClamping )
+            MeshClamper::markDirty( geom, changed );
+
+        moved = true;
+    }
+
+    _featurePoints = points;
+
+    if ( moved )
+    {
+        if ( _sceneClamping )
+        {
+            // clamp the moved vertices only; the rest keep their clamp.
+            _feature->getWorldBoundingPolytope( getMapNode()->getMapSRS(), _featurePolytope );
+            clampMesh( getMapNode()->getTerrain()->getGraph(), true );
+        }
+        this->dirtyBound();
+    }
+
+    return true;
+}
+
+bool
+FeatureNode::patchAppearance()
+{
+    if ( !_attachPoint || !_feature.valid() )
+        return false;
+
+    const Style& style = *_feature->style();
+    if ( !canPatchAppearance(style) )
+        return false;
+
+    CollectGeometry collect;
+    _attachPoint->accept( collect );
+    if ( !collect._ok )
+        return false;
+
+    for( unsigned i=0; i<collect._geoms.size(); ++i )
+    {
+        osg::Array* colors = collect._geoms[i]->getColorArray();
+        if ( colors && !dynamic_cast<osg::Vec4Array*>(colors) )
+            return false;
+    }
+
+    const PolygonSymbol* poly  = style.get<PolygonSymbol>();
+    const LineSymbol*    line  = style.get<LineSymbol>();
+    const PointSymbol*   point = style.get<PointSymbol>();
+
+    // same color rules as the BuildGeometryFilter.
+    osg::Vec4f primaryColor =
+        poly  ? osg::Vec4f(poly->fill()->color()) :
+        line  ? osg::Vec4f(line->stroke()->color()) :
+        point ? osg::Vec4f(point->fill()->color()) :
+        osg::Vec4f(1,1,1,1);
+
+    StateSetClones clones;
+
+    for( unsigned i=0; i<collect._geoms.size(); ++i )
+    {
+        osg::Geometry* geom = collect._geoms[i];
+
+        bool isLines  = hasMode( geom, GL_LINES, GL_LINE_STRIP, GL_LINE_LOOP );
+        bool isPoints = hasMode( geom, GL_POINTS );
+
+        // polygon outlines take the stroke color.
+        osg::Vec4f color = poly && isLines && line ? osg::Vec4f(line->stroke()->color()) : primaryColor;
+
+        osg::Vec4Array* colors = static_cast<osg::Vec4Array*>(geom->getColorArray());
+        if ( colors )
+        {
+            std::fill( colors->begin(), colors->end(), color );
+            colors->dirty();
+        }
+
+        if ( isLines || isPoints )
+        {
+            osg::StateSet* ss = cloneStateSet( geom->getStateSet(), clones );
+
+            if ( line && line->stroke().isSet() )
+            {
+                float width = std::max( 1.0f, *line->stroke()->width() );
+                ss->setAttributeAndModes( new osg::LineWidth(width), 1 );
+                if ( line->stroke()->stipple().isSet() )
+                    ss->setAttributeAndModes( new osg::LineStipple(1, *line->stroke()->stipple()) );
+                else
+                    ss->removeAttribute( osg::StateAttribute::LINESTIPPLE );
+            }
+
+            if ( point && !(poly && isLines) )
+            {
+                float size = std::max( 0.1f, *point->size() );
+                ss->setAttributeAndModes( new osg::Point(size), 1 );
+            }
+
+            geom->setStateSet( ss );
+        }
+
+        geom->dirtyDisplayList();
+    }
+
+    // point sizes and line widths also live on the geodes.
+    for( unsigned i=0; i<collect._geodes.size(); ++i )
+    {
+        osg::Geode* geode = collect._geodes[i];
+        if ( !geode->getStateSet() || !geode->getStateSet()->getAttribute(osg::StateAttribute::LINEWIDTH) )
+            continue;
+
+        osg::StateSet* ss = cloneStateSet( geode->getStateSet(), clones );
+
+        float size = line ? std::max( 1.0f, line->stroke()->width().value() ) : 1.0f;
+        ss->setAttribute( new osg::Point(size), osg::StateAttribute::ON );
+        ss->setAttribute( new osg::LineWidth(size), osg::StateAttribute::ON );
+        if ( point && point->size().isSet() )
+            ss->setAttribute( new osg::Point(*point->size()), osg::StateAttribute::ON );
+
+        geode->setStateSet( ss );
+    }
+
+    return true;
+}
+
+bool
+FeatureNode::reclampAll()
+{
+    if ( !_attachPoint || !_sceneClamping || !getMapNode() )
+        return false;
+
+    CollectGeometry collect;
+    _attachPoint->accept( collect );
+    if ( collect._geoms.size() != _unclamped.size() )
+        return false;
+
+    // restore the unclamped vertices and clamp them again with the new
+    // vertical offset and scale.
+    for( unsigned i=0; i<collect._geoms.size(); ++i )
+    {
+        osg::Vec3Array* verts = static_cast<osg::Vec3Array*>(collect._geoms[i]->getVertexArray());
+        if ( verts->size() != _unclamped[i]->size() )
+            return false;
+    }
+
+    for( unsigned i=0; i<collect._geoms.size(); ++i )
+    {
+        osg::Vec3Array* verts = static_cast<osg::Vec3Array*>(collect._geoms[i]->getVertexArray());
+        std::copy( _unclamped[i]->begin(), _unclamped[i]->end(), verts->begin() );
+
+        std::vector<unsigned> all( verts->size() );
+        for( unsigned k=0; k<all.size(); ++k )
+            all[k] = k;
+        MeshClamper::markDirty( collect._geoms[i], all );
+    }
+
+    _altitude = _feature->style()->get<AltitudeSymbol>();
+    clampMesh( getMapNode()->getTerrain()->getGraph(), true );
+    return true;
 }
 
 void
@@ -205,9 +1087,44 @@ const Style& FeatureNode::getStyle() const
 void
 FeatureNode::setStyle(const Style& style)
 {
-    if ( _feature.valid() )
+    if ( !_feature.valid() )
+        return;
+
+    Style oldStyle;
+    if ( _feature->style().isSet() )
+        oldStyle = *_feature->style();
+
+    _feature->style() = style;
+
+    if ( !_attachPoint )
+    {
+        init();
+        return;
+    }
+
+    // anything that changes the shape of the geometry needs a rebuild.
+    if ( getShapeSignature(oldStyle, true, true) != getShapeSignature(style, true, true) )
+    {
+        init();
+        return;
+    }
+
+    bool ok = true;
+
+    if ( getShapeSignature(oldStyle, true, false) != getShapeSignature(style, true, false) )
+    {
+        // scene-clamped offsets are applied by the clamper; otherwise the
+        // compiler bakes them into the vertices.
+        ok = _sceneClamping ? reclampAll() : patchCoords();
+    }
+
+    if ( ok && getShapeSignature(oldStyle, false, false) != getShapeSignature(style, false, false) )
+    {
+        ok = patchAppearance();
+    }
+
+    if ( !ok )
     {
-        _feature->style() = style;
         init();
     }
 }
@@ -239,7 +1156,7 @@ FeatureNode::reclamp( const TileKey& key, osg::Node* tile, const Terrain* terrai
 }
 
 void
-FeatureNode::clampMesh( osg::Node* terrainModel )
+FeatureNode::clampMesh( osg::Node* terrainModel, bool dirtyOnly )
 {
     if ( getMapNode() )
     {
@@ -257,6 +1174,7 @@ FeatureNode::clampMesh( osg::Node* terrainModel )
         }
 
         MeshClamper clamper( terrainModel, getMapNode()->getMapSRS(), getMapNode()->isGeocentric(), relative, scale, offset );
+        clamper.setDirtyOnly( dirtyOnly );
         getAttachPoint()->accept( clamper );
 
         this->dirtyBound();
@@ -0,0 +1,818 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2013 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <osgEarthAnnotation/TrackBatchNode>
+#include <osgEarthAnnotation/AnnotationUtils>
+#include <osgEarth/MapNode>
+#include <osgEarth/Registry>
+#include <osgEarth/VirtualProgram>
+#include <osgEarth/CullingUtils>
+#include <osgEarth/NodeUtils>
+#include <osgUtil/CullVisitor>
+#include <osgText/Glyph>
+#include <osg/Depth>
+#include <osg/Geode>
+#include <osg/Texture2D>
+#include <algorithm>
+#include <limits.h>
+
+#define LC "[TrackBatchNode] "
+
+using namespace osgEarth;
+using namespace osgEarth::Annotation;
+using namespace osgEarth::Symbology;
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    enum DirtyFlags
+    {
+        DIRTY_POSITIONS = 1 << 0,   // tracks moved within the bucket
+        DIRTY_HEADINGS  = 1 << 1,   // icon rotations changed
+        DIRTY_LAYOUT    = 1 << 2    // membership or labels changed; rebuild everything
+    };
+
+    const unsigned NO_BUCKET = UINT_MAX;
+
+    // Moves each vertex (all the corners of a quad share the track's anchor
+    // point) out by a pixel offset, and drops tracks over the horizon.
+    const char* vs =
+        "#version " GLSL_VERSION_STR "\n"
+        GLSL_DEFAULT_PRECISION_FLOAT "\n"
+
+        "uniform vec2  oe_tracks_pixelSize; \n"     // 2/viewport size
+        "uniform vec3  oe_tracks_center; \n"        // earth center in the bucket frame
+        "uniform float oe_tracks_horizonRadius; \n" // 0 => no horizon culling
+        "varying vec2  oe_tracks_texcoord; \n"
+
+        "void oe_tracks_vertex( inout vec4 VertexCLIP ) \n"
+        "{ \n"
+        "    oe_tracks_texcoord = gl_MultiTexCoord0.st; \n"
+
+        "    if ( oe_tracks_horizonRadius > 0.0 ) \n"
+        "    { \n"
+        "        vec3  p   = (gl_ModelViewMatrix * gl_Vertex).xyz; \n"
+        "        vec3  c   = (gl_ModelViewMatrix * vec4(oe_tracks_center, 1.0)).xyz; \n"
+        "        float vh2 = dot(c, c) - oe_tracks_horizonRadius*oe_tracks_horizonRadius; \n"
+        "        float vtc = dot(p, c); \n"
+        "        float d   = vtc / length(p); \n"
+        "        if ( vh2 > 0.0 && vtc > vh2 && d*d > vh2 ) \n"
+        "        { \n"
+        "            VertexCLIP = vec4(0.0, 0.0, 2.0, 1.0); \n" // past the far plane
+        "            return; \n"
+        "        } \n"
+        "    } \n"
+
+        "    VertexCLIP.xy += gl_MultiTexCoord1.xy * oe_tracks_pixelSize * VertexCLIP.w; \n"
+        "} \n";
+
+    const char* fs =
+        "#version " GLSL_VERSION_STR "\n"
+        GLSL_DEFAULT_PRECISION_FLOAT "\n"
+
+        "uniform sampler2D oe_tracks_tex; \n"
+        "uniform bool      oe_tracks_isText; \n"
+        "varying vec2      oe_tracks_texcoord; \n"
+
+        "void oe_tracks_fragment( inout vec4 color ) \n"
+        "{ \n"
+        "    vec4 texel = texture2D(oe_tracks_tex, oe_tracks_texcoord); \n"
+        "    if ( oe_tracks_isText ) \n"
+        "        color.a *= texel.a; \n"
+        "    else \n"
+        "        color *= texel; \n"
+        "} \n";
+
+    osg::Geometry* createBucketGeometry( osg::StateSet* stateSet, bool perVertexColor )
+    {
+        osg::Geometry* geom = new osg::Geometry();
+        geom->setUseDisplayList( false );
+        geom->setUseVertexBufferObjects( true );
+        geom->setDataVariance( osg::Object::DYNAMIC );
+        geom->setStateSet( stateSet );
+
+        geom->setVertexArray( new osg::Vec3Array() );
+        geom->setTexCoordArray( 0, new osg::Vec2Array() );
+        geom->setTexCoordArray( 1, new osg::Vec2Array() );
+
+        osg::Vec4Array* colors = new osg::Vec4Array( perVertexColor ? 0 : 1 );
+        if ( !perVertexColor )
+            (*colors)[0].set( 1.0f, 1.0f, 1.0f, 1.0f );
+        geom->setColorArray( colors );
+        geom->setColorBinding( perVertexColor ? osg::Geometry::BIND_PER_VERTEX : osg::Geometry::BIND_OVERALL );
+
+        geom->addPrimitiveSet( new osg::DrawArrays(GL_QUADS, 0, 0) );
+        return geom;
+    }
+
+    void setQuadCount( osg::Geometry* geom, unsigned numVerts )
+    {
+        osg::DrawArrays* da = static_cast<osg::DrawArrays*>( geom->getPrimitiveSet(0) );
+        da->setCount( numVerts );
+        da->dirty();
+        geom->dirtyBound();
+    }
+}
+
+//------------------------------------------------------------------------
+
+TrackBatchNode::TrackBatchNode(MapNode*     mapNode,
+                               const Style& style,
+                               double       bucketSize ) :
+_bucketSize        ( osg::clampBetween(bucketSize, 1.0, 180.0) ),
+_geocentric        ( true ),
+_horizonRadius     ( 0.0 ),
+_style             ( style ),
+_encoding          ( osgText::String::ENCODING_UTF8 ),
+_labelSize         ( 16.0f ),
+_labelAlign        ( TextSymbol::ALIGN_CENTER_TOP ),
+_labelColor        ( 1.0f, 1.0f, 1.0f, 1.0f ),
+_warnedGlyphTexture( false )
+{
+    if ( mapNode )
+    {
+        _mapSRS     = mapNode->getMapSRS();
+        _geocentric = mapNode->isGeocentric();
+    }
+    else
+    {
+        _mapSRS     = SpatialReference::create( "wgs84" );
+    }
+    _geoSRS = _mapSRS->getGeographicSRS();
+
+    if ( _geocentric && _mapSRS->getEllipsoid() )
+        _horizonRadius = _mapSRS->getEllipsoid()->getRadiusPolar();
+
+    _cols = (unsigned)ceil( 360.0/_bucketSize );
+    _rows = (unsigned)ceil( 180.0/_bucketSize );
+    _buckets.resize( _cols*_rows );
+
+    init();
+
+    // we bring the bucket geometry up to date in the update traversal.
+    ADJUST_UPDATE_TRAV_COUNT( this, 1 );
+}
+
+void
+TrackBatchNode::init()
+{
+    osg::StateSet* stateSet = this->getOrCreateStateSet();
+
+    VirtualProgram* vp = VirtualProgram::getOrCreate( stateSet );
+    vp->setName( "TrackBatchNode" );
+    vp->setFunction( "oe_tracks_vertex",   vs, ShaderComp::LOCATION_VERTEX_CLIP );
+    vp->setFunction( "oe_tracks_fragment", fs, ShaderComp::LOCATION_FRAGMENT_COLORING );
+
+    stateSet->getOrCreateUniform( "oe_tracks_tex", osg::Uniform::SAMPLER_2D )->set( 0 );
+    stateSet->getOrCreateUniform( "oe_tracks_horizonRadius", osg::Uniform::FLOAT )->set( (float)_horizonRadius );
+
+    // screen-space overlay, like the other ortho annotations: always pass the
+    // depth test, don't write depth, draw after the terrain.
+    stateSet->setAttributeAndModes( new osg::Depth(osg::Depth::ALWAYS, 0, 1, false), 1 );
+    stateSet->setMode( GL_BLEND, 1 );
+    stateSet->setMode( GL_CULL_FACE, 0 );
+    stateSet->setMode( GL_LIGHTING, 0 | osg::StateAttribute::OVERRIDE );
+    stateSet->setRenderBinDetails( 99, "RenderBin" );
+
+    // icon:
+    IconSymbol* icon  = _style.get<IconSymbol>();
+    osg::Image* image = icon ? icon->getImage() : 0L;
+    if ( image )
+    {
+        osg::Texture2D* texture = new osg::Texture2D( image );
+        texture->setFilter( osg::Texture::MIN_FILTER, osg::Texture::LINEAR_MIPMAP_LINEAR );
+        texture->setFilter( osg::Texture::MAG_FILTER, osg::Texture::LINEAR );
+        texture->setResizeNonPowerOfTwoHint( false );
+
+        _iconStateSet = new osg::StateSet();
+        _iconStateSet->setTextureAttributeAndModes( 0, texture, 1 );
+        _iconStateSet->addUniform( new osg::Uniform("oe_tracks_isText", false) );
+
+        _iconSize.set( (float)image->s(), (float)image->t() );
+    }
+
+    // labels:
+    const TextSymbol* text = _style.get<TextSymbol>();
+    if ( text )
+    {
+        if ( text->font().isSet() )
+            _font = osgText::readFontFile( *text->font() );
+        if ( text->size().isSet() )
+            _labelSize = *text->size();
+        if ( text->pixelOffset().isSet() )
+            _labelOffset.set( text->pixelOffset()->x(), text->pixelOffset()->y() );
+        if ( text->alignment().isSet() )
+            _labelAlign = (int)*text->alignment();
+        if ( text->fill().isSet() )
+            _labelColor = text->fill()->color();
+        if ( text->halo().isSet() )
+            _haloColor = text->halo()->color();
+        if ( text->encoding().isSet() )
+            _encoding = AnnotationUtils::convertTextSymbolEncoding( *text->encoding() );
+    }
+    if ( !_font.valid() )
+        _font = Registry::instance()->getDefaultFont();
+    if ( !_font.valid() )
+        _font = osgText::Font::getDefaultFont();
+
+    _labelStateSet = new osg::StateSet();
+    _labelStateSet->addUniform( new osg::Uniform("oe_tracks_isText", true) );
+}
+
+unsigned
+TrackBatchNode::getBucketIndex( double lon, double lat ) const
+{
+    int col = (int)floor( (lon + 180.0) / _bucketSize );
+    int row = (int)floor( (lat +  90.0) / _bucketSize );
+    col = osg::clampBetween( col, 0, (int)_cols-1 );
+    row = osg::clampBetween( row, 0, (int)_rows-1 );
+    return (unsigned)row*_cols + (unsigned)col;
+}
+
+TrackBatchNode::Bucket&
+TrackBatchNode::getBucket( unsigned index )
+{
+    Bucket& bucket = _buckets[index];
+    if ( !bucket._hasOrigin )
+    {
+        // local origin at the center of the cell, on the surface
+        double lon = -180.0 + _bucketSize * ((double)(index % _cols) + 0.5);
+        double lat =  -90.0 + _bucketSize * ((double)(index / _cols) + 0.5);
+        lat = osg::clampBetween( lat, -90.0, 90.0 );
+
+        if ( _geocentric )
+        {
+            _mapSRS->getEllipsoid()->convertLatLongHeightToXYZ(
+                osg::DegreesToRadians(lat), osg::DegreesToRadians(lon), 0.0,
+                bucket._origin.x(), bucket._origin.y(), bucket._origin.z() );
+        }
+        else
+        {
+            _geoSRS->transform( osg::Vec3d(lon, lat, 0.0), _mapSRS.get(), bucket._origin );
+        }
+        bucket._hasOrigin = true;
+    }
+    return bucket;
+}
+
+void
+TrackBatchNode::markDirty( unsigned index, unsigned flags )
+{
+    Bucket& bucket = _buckets[index];
+    if ( bucket._dirty == 0 )
+        _dirtyBuckets.push_back( index );
+    bucket._dirty |= flags;
+}
+
+void
+TrackBatchNode::moveToBucket( unsigned i, unsigned index )
+{
+    unsigned old = _bucketOf[i];
+    if ( old != NO_BUCKET )
+    {
+        // swap-remove from the old bucket
+        std::vector<unsigned>& members = _buckets[old]._members;
+        unsigned slot = _slotOf[i];
+        unsigned last = members.back();
+        members[slot] = last;
+        _slotOf[last] = slot;
+        members.pop_back();
+        markDirty( old, DIRTY_LAYOUT );
+    }
+
+    Bucket& bucket = getBucket( index );
+    _bucketOf[i] = index;
+    _slotOf[i]   = bucket._members.size();
+    bucket._members.push_back( i );
+    markDirty( index, DIRTY_LAYOUT );
+}
+
+void
+TrackBatchNode::updateWorld( unsigned first, unsigned count )
+{
+    if ( _geocentric )
+    {
+        const osg::EllipsoidModel* em = _mapSRS->getEllipsoid();
+        for( unsigned i=first; i<first+count; ++i )
+        {
+            osg::Vec3d& w = _world[i];
+            em->convertLatLongHeightToXYZ(
+                osg::DegreesToRadians(_lat[i]), osg::DegreesToRadians(_lon[i]), _alt[i],
+                w.x(), w.y(), w.z() );
+        }
+    }
+    else
+    {
+        std::vector<osg::Vec3d> points( count );
+        for( unsigned i=0; i<count; ++i )
+            points[i].set( _lon[first+i], _lat[first+i], _alt[first+i] );
+
+        _geoSRS->transform( points, _mapSRS.get() );
+
+        std::copy( points.begin(), points.end(), _world.begin() + first );
+    }
+}
+
+unsigned
+TrackBatchNode::addTracks( unsigned count )
+{
+    unsigned first = _lon.size();
+    unsigned size  = first + count;
+
+    _lon.resize( size, 0.0 );
+    _lat.resize( size, 0.0 );
+    _alt.resize( size, 0.0 );
+    _heading.resize( size, 0.0f );
+    _label.resize( size );
+    _world.resize( size );
+    _bucketOf.resize( size, NO_BUCKET );
+    _slotOf.resize( size, 0 );
+
+    unsigned index = getBucketIndex( 0.0, 0.0 );
+    for( unsigned i=first; i<size; ++i )
+        moveToBucket( i, index );
+
+    updateWorld( first, count );
+    return first;
+}
+
+void
+TrackBatchNode::clear()
+{
+    for( unsigned b=0; b<_buckets.size(); ++b )
+    {
+        if ( !_buckets[b]._members.empty() )
+        {
+            _buckets[b]._members.clear();
+            markDirty( b, DIRTY_LAYOUT );
+        }
+    }
+
+    _lon.clear();
+    _lat.clear();
+    _alt.clear();
+    _heading.clear();
+    _label.clear();
+    _world.clear();
+    _bucketOf.clear();
+    _slotOf.clear();
+}
+
+void
+TrackBatchNode::setPositions(unsigned      first,
+                             unsigned      count,
+                             const double* lons,
+                             const double* lats,
+                             const double* alts )
+{
+    if ( first >= _lon.size() )
+        return;
+    count = std::min( count, (unsigned)_lon.size() - first );
+
+    for( unsigned k=0; k<count; ++k )
+    {
+        unsigned i = first + k;
+        _lon[i] = lons[k];
+        _lat[i] = lats[k];
+        if ( alts )
+            _alt[i] = alts[k];
+
+        unsigned index = getBucketIndex( _lon[i], _lat[i] );
+        if ( index != _bucketOf[i] )
+            moveToBucket( i, index );
+        else
+            markDirty( index, DIRTY_POSITIONS );
+    }
+
+    updateWorld( first, count );
+}
+
+void
+TrackBatchNode::setHeadings(unsigned     first,
+                            unsigned     count,
+                            const float* headings )
+{
+    if ( first >= _heading.size() )
+        return;
+    count = std::min( count, (unsigned)_heading.size() - first );
+
+    for( unsigned k=0; k<count; ++k )
+    {
+        unsigned i = first + k;
+        if ( _heading[i] != headings[k] )
+        {
+            _heading[i] = headings[k];
+            markDirty( _bucketOf[i], DIRTY_HEADINGS );
+        }
+    }
+}
+
+void
+TrackBatchNode::setLabels(unsigned           first,
+                          unsigned           count,
+                          const std::string* labels )
+{
+    if ( first >= _label.size() )
+        return;
+    count = std::min( count, (unsigned)_label.size() - first );
+
+    for( unsigned k=0; k<count; ++k )
+    {
+        unsigned i = first + k;
+        if ( _label[i] != labels[k] )
+        {
+            _label[i] = labels[k];
+            markDirty( _bucketOf[i], DIRTY_LAYOUT );
+        }
+    }
+}
+
+unsigned
+TrackBatchNode::getNumActiveBuckets() const
+{
+    unsigned count = 0;
+    for( unsigned b=0; b<_buckets.size(); ++b )
+        if ( !_buckets[b]._members.empty() )
+            ++count;
+    return count;
+}
+
+void
+TrackBatchNode::sync()
+{
+    for( unsigned k=0; k<_dirtyBuckets.size(); ++k )
+    {
+        Bucket& bucket = _buckets[_dirtyBuckets[k]];
+
+        if ( bucket._dirty & DIRTY_LAYOUT )
+        {
+            buildBucket( bucket );
+        }
+        else
+        {
+            if ( bucket._dirty & DIRTY_POSITIONS )
+                updateBucketPositions( bucket );
+            if ( bucket._dirty & DIRTY_HEADINGS )
+                updateBucketHeadings( bucket );
+        }
+
+        bucket._dirty = 0;
+    }
+    _dirtyBuckets.clear();
+}
+
+void
+TrackBatchNode::buildBucket( Bucket& bucket )
+{
+    if ( !bucket._xform.valid() )
+    {
+        osg::Geode* geode = new osg::Geode();
+
+        // the buckets are culled as a whole in traverse(), and the anchor
+        // points alone don't bound the screen-space quads.
+        geode->setCullingActive( false );
+
+        if ( _iconStateSet.valid() )
+        {
+            bucket._icons = createBucketGeometry( _iconStateSet.get(), false );
+            geode->addDrawable( bucket._icons.get() );
+        }
+
+        bucket._labels = createBucketGeometry( _labelStateSet.get(), true );
+        geode->addDrawable( bucket._labels.get() );
+
+        bucket._xform = new osg::MatrixTransform( osg::Matrix::translate(bucket._origin) );
+        bucket._xform->getOrCreateStateSet()->addUniform(
+            new osg::Uniform("oe_tracks_center", osg::Vec3f(-bucket._origin)) );
+        bucket._xform->addChild( geode );
+
+        this->addChild( bucket._xform.get() );
+    }
+
+    unsigned n = bucket._members.size();
+
+    if ( bucket._icons.valid() )
+    {
+        osg::Vec3Array* verts     = static_cast<osg::Vec3Array*>( bucket._icons->getVertexArray() );
+        osg::Vec2Array* texcoords = static_cast<osg::Vec2Array*>( bucket._icons->getTexCoordArray(0) );
+
+        verts->resize( 4*n );
+        texcoords->resize( 4*n );
+        for( unsigned s=0; s<n; ++s )
+        {
+            (*texcoords)[4*s+0].set( 0.0f, 0.0f );
+            (*texcoords)[4*s+1].set( 1.0f, 0.0f );
+            (*texcoords)[4*s+2].set( 1.0f, 1.0f );
+            (*texcoords)[4*s+3].set( 0.0f, 1.0f );
+        }
+        texcoords->dirty();
+        setQuadCount( bucket._icons.get(), 4*n );
+
+        updateBucketHeadings( bucket );
+    }
+
+    // labels are variable length; record where each one starts so a
+    // position update can find its vertices.
+    osg::Vec3Array* verts     = static_cast<osg::Vec3Array*>( bucket._labels->getVertexArray() );
+    osg::Vec2Array* texcoords = static_cast<osg::Vec2Array*>( bucket._labels->getTexCoordArray(0) );
+    osg::Vec2Array* offsets   = static_cast<osg::Vec2Array*>( bucket._labels->getTexCoordArray(1) );
+    osg::Vec4Array* colors    = static_cast<osg::Vec4Array*>( bucket._labels->getColorArray() );
+
+    verts->clear();
+    texcoords->clear();
+    offsets->clear();
+    colors->clear();
+    bucket._labelStart.resize( n );
+
+    for( unsigned s=0; s<n; ++s )
+    {
+        bucket._labelStart[s] = verts->size();
+        const std::string& label = _label[bucket._members[s]];
+        if ( !label.empty() )
+            appendLabel( label, verts, texcoords, offsets, colors );
+    }
+
+    texcoords->dirty();
+    offsets->dirty();
+    colors->dirty();
+    setQuadCount( bucket._labels.get(), verts->size() );
+
+    // the glyph texture isn't known until the first label is laid out.
+    if ( _glyphTexture.valid() && !_labelStateSet->getTextureAttribute(0, osg::StateAttribute::TEXTURE) )
+        _labelStateSet->setTextureAttributeAndModes( 0, _glyphTexture.get(), 1 );
+
+    updateBucketPositions( bucket );
+}
+
+void
+TrackBatchNode::updateBucketPositions( Bucket& bucket )
+{
+    unsigned n = bucket._members.size();
+
+    osg::BoundingSphere bound;
+    for( unsigned s=0; s<n; ++s )
+        bound.expandBy( _world[bucket._members[s]] );
+    bucket._bound = bound;
+
+    if ( bucket._icons.valid() )
+    {
+        osg::Vec3Array* verts = static_cast<osg::Vec3Array*>( bucket._icons->getVertexArray() );
+        for( unsigned s=0; s<n; ++s )
+        {
+            osg::Vec3f anchor( _world[bucket._members[s]] - bucket._origin );
+            std::fill( verts->begin() + 4*s, verts->begin() + 4*s + 4, anchor );
+        }
+        verts->dirty();
+        bucket._icons->dirtyBound();
+    }
+
+    osg::Vec3Array* verts = static_cast<osg::Vec3Array*>( bucket._labels->getVertexArray() );
+    for( unsigned s=0; s<n; ++s )
+    {
+        unsigned start = bucket._labelStart[s];
+        unsigned end   = s+1 < n ? bucket._labelStart[s+1] : verts->size();
+        if ( end > start )
+        {
+            osg::Vec3f anchor( _world[bucket._members[s]] - bucket._origin );
+            std::fill( verts->begin() + start, verts->begin() + end, anchor );
+        }
+    }
+    verts->dirty();
+    bucket._labels->dirtyBound();
+}
+
+void
+TrackBatchNode::updateBucketHeadings( Bucket& bucket )
+{
+    if ( !bucket._icons.valid() )
+        return;
+
+    osg::Vec2Array* offsets = static_cast<osg::Vec2Array*>( bucket._icons->getTexCoordArray(1) );
+    unsigned n = bucket._members.size();
+    offsets->resize( 4*n );
+
+    float hw = 0.5f*_iconSize.x(), hh = 0.5f*_iconSize.y();
+    for( unsigned s=0; s<n; ++s )
+    {
+        // heading is clockwise from screen-up.
+        float a = -osg::DegreesToRadians( _heading[bucket._members[s]] );
+        float c = cosf(a), t = sinf(a);
+        osg::Vec2f x(  hw*c, hw*t );
+        osg::Vec2f y( -hh*t, hh*c );
+        (*offsets)[4*s+0] = -x - y;
+        (*offsets)[4*s+1] =  x - y;
+        (*offsets)[4*s+2] =  x + y;
+        (*offsets)[4*s+3] = -x + y;
+    }
+    offsets->dirty();
+}
+
+unsigned
+TrackBatchNode::appendLabel(const std::string& text,
+                            osg::Vec3Array*    verts,
+                            osg::Vec2Array*    texcoords,
+                            osg::Vec2Array*    offsets,
+                            osg::Vec4Array*    colors )
+{
+    osgText::String str( text, _encoding );
+    osgText::FontResolution res( (unsigned)_labelSize, (unsigned)_labelSize );
+
+    // collect the glyphs and measure the line.
+    std::vector<osgText::Glyph*> glyphs;
+    glyphs.reserve( str.size() );
+    float width = 0.0f;
+    for( osgText::String::const_iterator c = str.begin(); c != str.end(); ++c )
+    {
+        osgText::Glyph* glyph = _font->getGlyph( res, *c );
+        glyphs.push_back( glyph );
+        if ( glyph )
+            width += glyph->getHorizontalAdvance() * _labelSize;
+    }
+
+    // same alignment enum as osgText; place the baseline relative to the anchor.
+    int   h = _labelAlign < 9 ? _labelAlign / 3 : (_labelAlign - 9) % 3;
+    int   v = _labelAlign < 9 ? _labelAlign % 3 : 3;
+    float x = _labelOffset.x() - 0.5f * width * (float)h;
+    float y = _labelOffset.y() + (
+        v == 0 ? -_labelSize :           // top
+        v == 1 ? -0.5f*_labelSize :      // center
+        v == 2 ?  0.2f*_labelSize :      // bottom (below the descenders)
+        0.0f );                          // baseline
+
+    // one quad per glyph, with the halo passes (four diagonal copies) first.
+    std::vector<osg::Vec4f> quads;   // x0, y0, x1, y1 in pixels
+    std::vector<osgText::Glyph*> quadGlyphs;
+    for( unsigned i=0; i<glyphs.size(); ++i )
+    {
+        osgText::Glyph* glyph = glyphs[i];
+        if ( !glyph )
+            continue;
+
+        if ( !_glyphTexture.valid() )
+            _glyphTexture = glyph->getTexture();
+
+        if ( glyph->getTexture() == _glyphTexture.get() )
+        {
+            float x0 = x + glyph->getHorizontalBearing().x() * _labelSize;
+            float y0 = y + glyph->getHorizontalBearing().y() * _labelSize;
+            quads.push_back( osg::Vec4f(x0, y0, x0 + glyph->getWidth()*_labelSize, y0 + glyph->getHeight()*_labelSize) );
+            quadGlyphs.push_back( glyph );
+        }
+        else if ( !_warnedGlyphTexture )
+        {
+            OE_WARN << LC << "Label glyphs span more than one font texture; some characters will not draw" << std::endl;
+            _warnedGlyphTexture = true;
+        }
+
+        x += glyph->getHorizontalAdvance() * _labelSize;
+    }
+
+    unsigned start = verts->size();
+    const float diag[4][2] = { {-1,-1}, {1,-1}, {1,1}, {-1,1} };
+
+    for( int pass = _haloColor.isSet() ? 0 : 4; pass <= 4; ++pass )
+    {
+        osg::Vec2f shift = pass < 4 ? osg::Vec2f(diag[pass][0], diag[pass][1]) : osg::Vec2f();
+        osg::Vec4f color = pass < 4 ? _haloColor.get() : _labelColor;
+
+        for( unsigned i=0; i<quads.size(); ++i )
+        {
+            const osg::Vec4f& q = quads[i];
+            const osg::Vec2& t0 = quadGlyphs[i]->getMinTexCoord();
+            const osg::Vec2& t1 = quadGlyphs[i]->getMaxTexCoord();
+
+            offsets->push_back( shift + osg::Vec2f(q[0], q[1]) );
+            offsets->push_back( shift + osg::Vec2f(q[2], q[1]) );
+            offsets->push_back( shift + osg::Vec2f(q[2], q[3]) );
+            offsets->push_back( shift + osg::Vec2f(q[0], q[3]) );
+
+            texcoords->push_back( osg::Vec2f(t0.x(), t0.y()) );
+            texcoords->push_back( osg::Vec2f(t1.x(), t0.y()) );
+            texcoords->push_back( osg::Vec2f(t1.x(), t1.y()) );
+            texcoords->push_back( osg::Vec2f(t0.x(), t1.y()) );
+
+            colors->insert( colors->end(), 4, color );
+        }
+    }
+
+    // the anchor is filled in by updateBucketPositions.
+    verts->resize( offsets->size() );
+    return verts->size() - start;
+}
+
+void
+TrackBatchNode::getVisibleBuckets(const osg::Polytope&   frustum,
+                                  const osg::Vec3d&      eye,
+                                  std::vector<unsigned>& out_buckets ) const
+{
+    osg::Polytope polytope( frustum ); // contains() isn't const
+
+    for( unsigned b=0; b<_buckets.size(); ++b )
+    {
+        const Bucket& bucket = _buckets[b];
+        if ( bucket._members.empty() || !bucket._bound.valid() )
+            continue;
+
+        if ( !polytope.contains(bucket._bound) )
+            continue;
+
+        // horizon: is the bucket's center hidden by the earth shrunk by the
+        // bucket's radius? (conservative; the shader culls each track)
+        if ( _horizonRadius > 0.0 )
+        {
+            double r = _horizonRadius - bucket._bound.radius();
+            if ( r > 0.0 )
+            {
+                osg::Vec3d vt  = bucket._bound.center() - eye;
+                osg::Vec3d vc  = -eye;
+                double     vh2 = vc.length2() - r*r;
+                double     vtc = vt * vc;
+                if ( vh2 > 0.0 && vtc > vh2 && (vtc*vtc)/vt.length2() > vh2 )
+                    continue;
+            }
+        }
+
+        out_buckets.push_back( b );
+    }
+}
+
+void
+TrackBatchNode::traverse( osg::NodeVisitor& nv )
+{
+    if ( nv.getVisitorType() == osg::NodeVisitor::UPDATE_VISITOR )
+    {
+        sync();
+        osg::Group::traverse( nv );
+    }
+
+    else if ( nv.getVisitorType() == osg::NodeVisitor::CULL_VISITOR )
+    {
+        osgUtil::CullVisitor* cv = Culling::asCullVisitor( nv );
+        if ( !cv )
+            return;
+
+        // frustum in local coords; skip near/far since they aren't final
+        // until the cull is done.
+        osg::Polytope frustum;
+        frustum.setToUnitFrustum( false, false );
+        frustum.transformProvidingInverse( (*cv->getModelViewMatrix()) * (*cv->getProjectionMatrix()) );
+
+        std::vector<unsigned> visible;
+        getVisibleBuckets( frustum, cv->getEyeLocal(), visible );
+
+        if ( !visible.empty() )
+        {
+            // the shader needs the viewport size to turn pixels into clip space.
+            osg::ref_ptr<osg::StateSet>& cameraStateSet = _cameraStateSets.get( cv->getCurrentCamera() );
+            if ( !cameraStateSet.valid() )
+            {
+                cameraStateSet = new osg::StateSet();
+                cameraStateSet->setDataVariance( osg::Object::DYNAMIC );
+                cameraStateSet->addUniform( new osg::Uniform("oe_tracks_pixelSize", osg::Vec2f(0.0f, 0.0f)) );
+            }
+
+            const osg::Viewport* viewport = cv->getViewport();
+            if ( viewport && viewport->width() > 0 && viewport->height() > 0 )
+            {
+                osg::Vec2f pixelSize( 2.0f/(float)viewport->width(), 2.0f/(float)viewport->height() );
+                osg::Vec2f current;
+                osg::Uniform* u = cameraStateSet->getUniform( "oe_tracks_pixelSize" );
+                if ( u->get(current) && current != pixelSize )
+                    u->set( pixelSize );
+            }
+
+            cv->pushStateSet( cameraStateSet.get() );
+
+            for( unsigned k=0; k<visible.size(); ++k )
+            {
+                osg::MatrixTransform* xform = _buckets[visible[k]]._xform.get();
+                if ( xform )
+                    xform->accept( nv );
+            }
+
+            cv->popStateSet();
+        }
+    }
+
+    else
+    {
+        osg::Group::traverse( nv );
+    }
+}
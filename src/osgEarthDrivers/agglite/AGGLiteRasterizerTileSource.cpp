@@ -18,9 +18,8 @@
  */
 
 #include <osgEarthFeatures/FeatureTileSource>
-#include <osgEarthFeatures/ResampleFilter>
 #include <osgEarthFeatures/TransformFilter>
-#include <osgEarthFeatures/BufferFilter>
+#include <osgEarthFeatures/GeometryUtils>
 #include <osgEarthSymbology/Style>
 //TODO: replace this with GeometryRasterizer
 #include <osgEarthSymbology/AGG.h>
@@ -37,6 +36,7 @@
 #include "AGGLiteOptions"
 
 #include <sstream>
+#include <map>
 #include <OpenThreads/Mutex>
 #include <OpenThreads/ScopedLock>
 
@@ -50,6 +50,153 @@ using namespace OpenThreads;
 
 /********************************************************************/
 
+namespace
+{
+    // Adds a convex polygon to the rasterizer, always wound the same way so that
+    // the overlapping pieces of a stroke merge under the non-zero filling rule.
+    void addConvex( agg::rasterizer& ras, const osg::Vec2d* pts, unsigned n )
+    {
+        double area = 0.0;
+        for( unsigned i=0; i<n; ++i )
+        {
+            const osg::Vec2d& a = pts[i];
+            const osg::Vec2d& b = pts[(i+1)%n];
+            area += a.x()*b.y() - b.x()*a.y();
+        }
+
+        if ( area > 0.0 )
+        {
+            ras.move_to_d( pts[0].x(), pts[0].y() );
+            for( unsigned i=1; i<n; ++i )
+                ras.line_to_d( pts[i].x(), pts[i].y() );
+        }
+        else if ( area < 0.0 )
+        {
+            ras.move_to_d( pts[n-1].x(), pts[n-1].y() );
+            for( int i=(int)n-2; i>=0; --i )
+                ras.line_to_d( pts[i].x(), pts[i].y() );
+        }
+    }
+
+    void addDisc( agg::rasterizer& ras, const osg::Vec2d& center, double radius )
+    {
+        unsigned n = osg::clampBetween( (unsigned)(radius*2.0) + 8u, 8u, 64u );
+        std::vector<osg::Vec2d> pts( n );
+        for( unsigned i=0; i<n; ++i )
+        {
+            double a = 2.0*osg::PI*(double)i/(double)n;
+            pts[i].set( center.x() + radius*cos(a), center.y() + radius*sin(a) );
+        }
+        addConvex( ras, &pts[0], n );
+    }
+
+    /**
+     * Strokes a line (in pixel coordinates) into the rasterizer analytically: a
+     * quad for each segment, plus the joins and end caps. Render the result with
+     * the non-zero filling rule.
+     */
+    void strokeLine(agg::rasterizer&               ras,
+                    const std::vector<osg::Vec2d>& pts,
+                    bool                           closed,
+                    double                         width,
+                    Stroke::LineCapStyle           cap,
+                    Stroke::LineJoinStyle          join )
+    {
+        unsigned n  = pts.size();
+        double   hw = 0.5*width;
+        if ( n < 2 || hw <= 0.0 )
+            return;
+
+        unsigned segments = closed ? n : n-1;
+        std::vector<osg::Vec2d> dirs( segments );
+        for( unsigned i=0; i<segments; ++i )
+        {
+            dirs[i] = pts[(i+1)%n] - pts[i];
+            dirs[i].normalize();
+        }
+
+        for( unsigned i=0; i<segments; ++i )
+        {
+            const osg::Vec2d& d = dirs[i];
+            osg::Vec2d a = pts[i];
+            osg::Vec2d b = pts[(i+1)%n];
+
+            if ( !closed && cap == Stroke::LINECAP_SQUARE )
+            {
+                if ( i == 0 )          a -= d*hw;
+                if ( i == segments-1 ) b += d*hw;
+            }
+
+            osg::Vec2d side( -d.y()*hw, d.x()*hw );
+            osg::Vec2d quad[4] = { a+side, b+side, b-side, a-side };
+            addConvex( ras, quad, 4 );
+        }
+
+        // fill the gaps between segments on the outside of each turn.
+        for( unsigned i = closed ? 0 : 1; i < (closed ? n : n-1); ++i )
+        {
+            if ( join == Stroke::LINEJOIN_ROUND )
+            {
+                addDisc( ras, pts[i], hw );
+                continue;
+            }
+
+            const osg::Vec2d& d0 = dirs[(i+segments-1) % segments];
+            const osg::Vec2d& d1 = dirs[i % segments];
+            double cross = d0.x()*d1.y() - d0.y()*d1.x();
+            if ( fabs(cross) < 1e-9 )
+                continue;
+
+            double s = cross > 0.0 ? -1.0 : 1.0;
+            osg::Vec2d o0( -d0.y()*s, d0.x()*s );
+            osg::Vec2d o1( -d1.y()*s, d1.x()*s );
+            osg::Vec2d p0 = pts[i] + o0*hw;
+            osg::Vec2d p1 = pts[i] + o1*hw;
+
+            osg::Vec2d bevel[3] = { pts[i], p0, p1 };
+            addConvex( ras, bevel, 3 );
+
+            // extend the bevel to a point, unless that's too sharp (mitre limit = 4)
+            osg::Vec2d bisector = o0 + o1;
+            double cosHalfAngle = 0.5*bisector.length();
+            if ( cosHalfAngle > 0.25 )
+            {
+                bisector.normalize();
+                osg::Vec2d mitre[3] = { p0, pts[i] + bisector*(hw/cosHalfAngle), p1 };
+                addConvex( ras, mitre, 3 );
+            }
+        }
+
+        if ( !closed && cap == Stroke::LINECAP_ROUND )
+        {
+            addDisc( ras, pts.front(), hw );
+            addDisc( ras, pts.back(), hw );
+        }
+    }
+
+    void addContour( agg::rasterizer& ras, const Geometry* g, double xmin, double ymin, double xf, double yf )
+    {
+        for( Geometry::const_iterator p = g->begin(); p != g->end(); p++ )
+        {
+            double x0 = xf*(p->x()-xmin);
+            double y0 = yf*(p->y()-ymin);
+
+            if ( p == g->begin() )
+                ras.move_to_d( x0, y0 );
+            else
+                ras.line_to_d( x0, y0 );
+        }
+    }
+
+    agg::rgba8 toColor( const osg::Vec4& c )
+    {
+        unsigned int a = (unsigned int)(127+(c.a()*255)/2); // scale alpha up
+        return agg::rgba8( (unsigned int)(c.r()*255), (unsigned int)(c.g()*255), (unsigned int)(c.b()*255), a );
+    }
+}
+
+/********************************************************************/
+
 class AGGLiteRasterizerTileSource : public FeatureTileSource
 {
 public:
@@ -99,26 +246,16 @@ public:
         const LineSymbol* masterLine = style.getSymbol<LineSymbol>();
         const PolygonSymbol* masterPoly = style.getSymbol<PolygonSymbol>();
 
-        //bool embeddedStyles = getFeatureSource()->hasEmbeddedStyles();
-
-        // if only a line symbol exists, and there are polygons in the mix, draw them
-        // as outlines (line rings).
-        //OE_INFO << LC << "Line Symbol = " << (masterLine == 0L ? "null" : masterLine->getConfig().toString()) << std::endl;
-        //OE_INFO << LC << "Poly SYmbol = " << (masterPoly == 0L ? "null" : masterPoly->getConfig().toString()) << std::endl;
-
-        //bool convertPolysToRings = poly == 0L && line != 0L;
-        //if ( convertPolysToRings )
-        //    OE_INFO << LC << "No PolygonSymbol; will draw polygons to rings" << std::endl;
-
         // initialize:
         double xmin = imageExtent.xMin();
         double ymin = imageExtent.yMin();
         double xf = (double)image->s() / imageExtent.width();
         double yf = (double)image->t() / imageExtent.height();
 
-        // strictly speaking we should iterate over the features and buffer each one that's a line,
-        // rather then checking for the existence of a LineSymbol.
-        FeatureList linesToBuffer;
+        // Lines are stroked directly into the image, so all we need is the width of
+        // each one in pixels (worked out in the feature SRS, before the transform).
+        std::map<const LineSymbol*, double> lineWidths;
+
         for(FeatureList::iterator i = features.begin(); i != features.end(); i++)
         {
             Feature* feature = i->get();
@@ -138,9 +275,8 @@ public:
                 {
                     if ( !poly && line )
                     {
-                        Feature* outline = new Feature( *feature );
                         geom = geom->cloneAs( Geometry::TYPE_RING );
-                        outline->setGeometry( geom );
+                        Feature* outline = new Feature( *feature, geom );
                         *i = outline;
                         feature = outline;
                     }
@@ -154,97 +290,11 @@ public:
                     //}
                 }
 
-                bool needsBuffering =
-                    geom->getComponentType() == Geometry::TYPE_LINESTRING || 
-                    geom->getComponentType() == Geometry::TYPE_RING;
-
-                if ( needsBuffering )
-                {
-                    linesToBuffer.push_back( feature );
-                }
-            }
-        }
-
-        if ( linesToBuffer.size() > 0 )
-        {
-            //We are buffering in the features native extent, so we need to use the transform extent to get the proper "resolution" for the image
-            const SpatialReference* featureSRS = context.profile()->getSRS();
-            GeoExtent transformedExtent = imageExtent.transform(featureSRS);
-
-            double trans_xf = (double)image->s() / transformedExtent.width();
-            double trans_yf = (double)image->t() / transformedExtent.height();
-
-            // resolution of the image (pixel extents):
-            double xres = 1.0/trans_xf;
-            double yres = 1.0/trans_yf;
-
-            // downsample the line data so that it is no higher resolution than to image to which
-            // we intend to rasterize it. If you don't do this, you run the risk of the buffer 
-            // operation taking forever on very high-res input data.
-            if ( _options.optimizeLineSampling() == true )
-            {
-                ResampleFilter resample;
-                resample.minLength() = osg::minimum( xres, yres );
-                context = resample.push( linesToBuffer, context );
-            }
-
-            // now run the buffer operation on all lines:
-            BufferFilter buffer;
-            double lineWidth = 1.0;
-            if ( masterLine )
-            {
-                buffer.capStyle() = masterLine->stroke()->lineCap().value();
-
-                if ( masterLine->stroke()->width().isSet() )
+                if ( line && lineWidths.find(line) == lineWidths.end() )
                 {
-                    lineWidth = masterLine->stroke()->width().value();
-
-                    GeoExtent imageExtentInFeatureSRS = imageExtent.transform(featureSRS);
-                    double pixelWidth = imageExtentInFeatureSRS.width() / (double)image->s();
-
-                    // if the width units are specified, process them:
-                    if (masterLine->stroke()->widthUnits().isSet() &&
-                        masterLine->stroke()->widthUnits().get() != Units::PIXELS)
-                    {
-                        const Units& featureUnits = featureSRS->getUnits();
-                        const Units& strokeUnits  = masterLine->stroke()->widthUnits().value();
-
-                        // if the units are different than those of the feature data, we need to
-                        // do a units conversion.
-                        if ( featureUnits != strokeUnits )
-                        {
-                            if ( Units::canConvert(strokeUnits, featureUnits) )
-                            {
-                                // linear to linear, no problem
-                                lineWidth = strokeUnits.convertTo( featureUnits, lineWidth );
-                            }
-                            else if ( strokeUnits.isLinear() && featureUnits.isAngular() )
-                            {
-                                // linear to angular? approximate degrees per meter at the 
-                                // latitude of the tile's centroid.
-                                lineWidth = masterLine->stroke()->widthUnits()->convertTo(Units::METERS, lineWidth);
-                                double circ = featureSRS->getEllipsoid()->getRadiusEquator() * 2.0 * osg::PI;
-                                double x, y;
-                                context.profile()->getExtent().getCentroid(x, y);
-                                double radians = (lineWidth/circ) * cos(osg::DegreesToRadians(y));
-                                lineWidth = osg::RadiansToDegrees(radians);
-                            }
-                        }
-
-                        // enfore a minimum width of one pixel.
-                        float minPixels = masterLine->stroke()->minPixels().getOrUse( 1.0f );
-                        lineWidth = osg::clampAbove(lineWidth, pixelWidth*minPixels);
-                    }
-
-                    else // pixels
-                    {
-                        lineWidth *= pixelWidth;
-                    }
+                    lineWidths[line] = getPixelWidth( line, imageExtent, image );
                 }
             }
-
-            buffer.distance() = lineWidth * 0.5;   // since the distance is for one side
-            buffer.push( linesToBuffer, context );
         }
 
         // Transform the features into the map's SRS:
@@ -261,93 +311,156 @@ public:
 
         // Setup the rasterizer
         ras.gamma(1.3);
-        ras.filling_rule(agg::fill_even_odd);
 
+        // The features arrive clipped to the tile (plus a margin) in their own SRS;
+        // clip once more in case the transform pushed anything further out.
         GeoExtent cropExtent = GeoExtent(imageExtent);
         cropExtent.scale(1.1, 1.1);
-
-        osg::ref_ptr<Symbology::Polygon> cropPoly = new Symbology::Polygon( 4 );
-        cropPoly->push_back( osg::Vec3d( cropExtent.xMin(), cropExtent.yMin(), 0 ));
-        cropPoly->push_back( osg::Vec3d( cropExtent.xMax(), cropExtent.yMin(), 0 ));
-        cropPoly->push_back( osg::Vec3d( cropExtent.xMax(), cropExtent.yMax(), 0 ));
-        cropPoly->push_back( osg::Vec3d( cropExtent.xMin(), cropExtent.yMax(), 0 ));
-
-        double lineWidth = 1.0;
-        if ( masterLine )
-            lineWidth = (double)masterLine->stroke()->width().value();
+        Bounds cropBounds = cropExtent.bounds();
 
         osg::Vec4 color = osg::Vec4(1, 1, 1, 1);
         if ( masterLine )
             color = masterLine->stroke()->color();
 
+        std::vector<osg::Vec2d> pixels;
+
         // render the features
         for(FeatureList::iterator i = features.begin(); i != features.end(); i++)
         {
             Feature* feature = i->get();
 
-            Geometry* geometry = feature->getGeometry();
-
-            osg::ref_ptr< Geometry > croppedGeometry;
-            if ( ! geometry->crop( cropPoly.get(), croppedGeometry ) )
+            osg::ref_ptr<Geometry> croppedGeometry = GeometryUtils::clipGeometry( feature->getGeometry(), cropBounds );
+            if ( !croppedGeometry.valid() )
                 continue;
 
-            // set up a default color:
-            osg::Vec4 c = color;
-            unsigned int a = (unsigned int)(127+(c.a()*255)/2); // scale alpha up
-            agg::rgba8 fgColor( (unsigned int)(c.r()*255), (unsigned int)(c.g()*255), (unsigned int)(c.b()*255), a );
+            const LineSymbol* line = feature->style().isSet() ? 
+                feature->style()->getSymbol<LineSymbol>() : masterLine;
+
+            const PolygonSymbol* poly =
+                feature->style().isSet() ? feature->style()->getSymbol<PolygonSymbol>() : masterPoly;
+
+            osg::Vec4 fillColor   = poly ? poly->fill()->color() : line ? line->stroke()->color() : color;
+            osg::Vec4 strokeColor = line ? line->stroke()->color() : poly ? poly->fill()->color() : color;
+
+            // Areas first, with the even-odd rule so holes come out:
+            bool hasArea = false;
+            ras.filling_rule( agg::fill_even_odd );
 
-            GeometryIterator gi( croppedGeometry.get() );
-            while( gi.hasMore() )
+            ConstGeometryIterator areas( croppedGeometry.get(), false );
+            while( areas.hasMore() )
             {
-                c = color;
-                Geometry* g = gi.next();
-            
-                const LineSymbol* line = feature->style().isSet() ? 
-                    feature->style()->getSymbol<LineSymbol>() : masterLine;
+                const Geometry* g = areas.next();
+                if ( g->isLinear() )
+                    continue;
 
-                const PolygonSymbol* poly =
-                    feature->style().isSet() ? feature->style()->getSymbol<PolygonSymbol>() : masterPoly;
+                addContour( ras, g, xmin, ymin, xf, yf );
 
-                if (g->getType() == Geometry::TYPE_RING || g->getType() == Geometry::TYPE_LINESTRING)
+                if ( g->getType() == Geometry::TYPE_POLYGON )
                 {
-                    if ( line )
-                        c = line->stroke()->color();
-                    else if ( poly )
-                        c = poly->fill()->color();
+                    const RingCollection& holes = static_cast<const Polygon*>(g)->getHoles();
+                    for( RingCollection::const_iterator h = holes.begin(); h != holes.end(); ++h )
+                        addContour( ras, h->get(), xmin, ymin, xf, yf );
                 }
+                hasArea = true;
+            }
 
-                else if ( g->getType() == Geometry::TYPE_POLYGON )
-                {
-                    if ( poly )
-                        c = poly->fill()->color();
-                    else if ( line )
-                        c = line->stroke()->color();
-                }
+            if ( hasArea )
+            {
+                ras.render(ren, toColor(fillColor));
+                ras.reset();
+            }
+
+            // Then lines, stroked to their width with the non-zero rule so the
+            // overlapping segments, joins and caps don't cancel each other out:
+            bool hasLine = false;
+            ras.filling_rule( agg::fill_non_zero );
+
+            double width = line ? lineWidths[line] : 1.0;
+            Stroke::LineCapStyle cap = line ? line->stroke()->lineCap().value() : Stroke::LINECAP_FLAT;
+            Stroke::LineJoinStyle join = line ? line->stroke()->lineJoin().value() : Stroke::LINEJOIN_ROUND;
 
-                a = (unsigned int)(127+(c.a()*255)/2); // scale alpha up
-                fgColor = agg::rgba8( (unsigned int)(c.r()*255), (unsigned int)(c.g()*255), (unsigned int)(c.b()*255), a );
+            ConstGeometryIterator lines( croppedGeometry.get(), false );
+            while( lines.hasMore() )
+            {
+                const Geometry* g = lines.next();
+                if ( !g->isLinear() )
+                    continue;
 
-                ras.filling_rule( agg::fill_even_odd );
-                for( Geometry::iterator p = g->begin(); p != g->end(); p++ )
+                pixels.clear();
+                for( Geometry::const_iterator p = g->begin(); p != g->end(); p++ )
                 {
-                    const osg::Vec3d& p0 = *p;
-                    double x0 = xf*(p0.x()-xmin);
-                    double y0 = yf*(p0.y()-ymin);
-
-                    if ( p == g->begin() )
-                        ras.move_to_d( x0, y0 );
-                    else
-                        ras.line_to_d( x0, y0 );
+                    osg::Vec2d pixel( xf*(p->x()-xmin), yf*(p->y()-ymin) );
+                    if ( pixels.empty() || (pixel - pixels.back()).length2() > 1e-12 )
+                        pixels.push_back( pixel );
                 }
+
+                bool closed = g->getType() == Geometry::TYPE_RING;
+                if ( closed && pixels.size() > 2 && (pixels.front() - pixels.back()).length2() <= 1e-12 )
+                    pixels.pop_back();
+
+                strokeLine( ras, pixels, closed, width, cap, join );
+                hasLine = true;
+            }
+
+            if ( hasLine )
+            {
+                ras.render(ren, toColor(strokeColor));
+                ras.reset();
             }
-            ras.render(ren, fgColor);
-            ras.reset();
         }
 
         bd->_pass++;
         return true;
     }
 
+    // Works out the width of a line symbol's stroke, in pixels, on a tile.
+    double getPixelWidth( const LineSymbol* line, const GeoExtent& imageExtent, const osg::Image* image )
+    {
+        double lineWidth = line->stroke()->width().value();
+
+        // if the width units are specified, process them:
+        if (line->stroke()->widthUnits().isSet() &&
+            line->stroke()->widthUnits().get() != Units::PIXELS)
+        {
+            const FeatureProfile*   featureProfile = getFeatureSource()->getFeatureProfile();
+            const SpatialReference* featureSRS     = featureProfile->getSRS();
+
+            GeoExtent imageExtentInFeatureSRS = imageExtent.transform(featureSRS);
+            double pixelWidth = imageExtentInFeatureSRS.width() / (double)image->s();
+
+            const Units& featureUnits = featureSRS->getUnits();
+            const Units& strokeUnits  = line->stroke()->widthUnits().value();
+
+            // if the units are different than those of the feature data, we need to
+            // do a units conversion.
+            if ( featureUnits != strokeUnits )
+            {
+                if ( Units::canConvert(strokeUnits, featureUnits) )
+                {
+                    // linear to linear, no problem
+                    lineWidth = strokeUnits.convertTo( featureUnits, lineWidth );
+                }
+                else if ( strokeUnits.isLinear() && featureUnits.isAngular() )
+                {
+                    // linear to angular? approximate degrees per meter at the 
+                    // latitude of the tile's centroid.
+                    lineWidth = strokeUnits.convertTo(Units::METERS, lineWidth);
+                    double circ = featureSRS->getEllipsoid()->getRadiusEquator() * 2.0 * osg::PI;
+                    double x, y;
+                    featureProfile->getExtent().getCentroid(x, y);
+                    double radians = (lineWidth/circ) * cos(osg::DegreesToRadians(y));
+                    lineWidth = osg::RadiansToDegrees(radians);
+                }
+            }
+
+            // enforce a minimum width of one pixel.
+            float minPixels = line->stroke()->minPixels().getOrUse( 1.0f );
+            lineWidth = osg::clampAbove(lineWidth / pixelWidth, (double)minPixels);
+        }
+
+        return lineWidth;
+    }
+
     //override
     bool postProcess( osg::Image* image, osg::Referenced* data )
     {
@@ -18,6 +18,7 @@
  */
 #include "FileSystemCache"
 #include <osgEarth/Cache>
+#include <osgEarth/CachePayload>
 #include <osgEarth/StringUtils>
 #include <osgEarth/ThreadingUtils>
 #include <osgEarth/XmlUtils>
@@ -142,6 +143,59 @@ namespace
             meta.fromJSON( bufStr );
         }
     }
+
+    // Records in the native CachePayload format get their own extension, so
+    // that osgb readers and tools never mistake them for osgb files.
+    const std::string PAYLOAD_EXT = ".oecp";
+    const std::string OSGB_EXT    = ".osgb";
+
+    /**
+     * Finds the file that holds a record, which is either a native payload
+     * or an osgb file. Returns an empty string if there is no such record.
+     */
+    std::string findRecord( const std::string& base, bool& isPayload )
+    {
+        isPayload = osgDB::fileExists( base + PAYLOAD_EXT );
+        if ( isPayload )
+            return base + PAYLOAD_EXT;
+        if ( osgDB::fileExists( base + OSGB_EXT ) )
+            return base + OSGB_EXT;
+        return std::string();
+    }
+
+    /**
+     * Reads a native payload record into a buffer. Returns false if the file
+     * can't be read or doesn't start with a payload header.
+     */
+    bool readPayload( const std::string& fullPath, std::string& buf )
+    {
+        std::ifstream in( fullPath.c_str(), std::ios::binary );
+        if ( !in.is_open() )
+            return false;
+
+        char header[16];
+        if ( !in.read(header, sizeof(header)) || !CachePayload::isPayload(header, sizeof(header)) )
+            return false;
+
+        in.seekg( 0, std::ios::end );
+        std::streamoff size = in.tellg();
+        in.seekg( 0, std::ios::beg );
+        if ( size <= 0 )
+            return false;
+
+        buf.resize( (size_t)size );
+        return in.read( &buf[0], size ).good();
+    }
+
+    bool writePayload( const std::string& fullPath, const std::string& buf )
+    {
+        std::ofstream out( fullPath.c_str(), std::ios::binary | std::ios::trunc );
+        if ( !out.is_open() )
+            return false;
+        out.write( buf.data(), buf.size() );
+        out.close();
+        return !out.fail();
+    }
 }
 
 
@@ -262,9 +316,10 @@ namespace
 
         // mangle "key" into a legal path name
         URI fileURI( toLegalFileName(key), _metaPath );
-        std::string path = fileURI.full() + ".osgb";
+        bool isPayload;
+        std::string path = findRecord( fileURI.full(), isPayload );
 
-        if ( !osgDB::fileExists(path) )
+        if ( path.empty() )
             return ReadResult( ReadResult::RESULT_NOT_FOUND );
 
         if ( osgEarth::getLastModifiedTime(path) < minTime )
@@ -273,9 +328,25 @@ namespace
         osgDB::ReaderWriter::ReadResult r;
         {
             ScopedReadLock sharedLock( _rwmutex );
-            r = _rw->readImage( path, _rwOptions.get() );
-            if ( !r.success() )
-                return ReadResult();
+
+            osg::ref_ptr<osg::Image> image;
+            std::string buf;
+            if ( isPayload )
+            {
+                if ( !readPayload(path, buf) )
+                    return ReadResult();
+
+                image = new osg::Image();
+                if ( !CachePayload::decode(buf.data(), buf.size(), image.get()) )
+                    return ReadResult();
+            }
+            else
+            {
+                r = _rw->readImage( path, _rwOptions.get() );
+                if ( !r.success() )
+                    return ReadResult();
+                image = r.getImage();
+            }
 
             // read metadata
             Config meta;
@@ -283,7 +354,7 @@ namespace
             if ( osgDB::fileExists(metafile) )
                 readMeta( metafile, meta );
 
-            return ReadResult( r.getImage(), meta );
+            return ReadResult( image.get(), meta );
         }
     }
 
@@ -295,9 +366,10 @@ namespace
 
         // mangle "key" into a legal path name
         URI fileURI( toLegalFileName(key), _metaPath );
-        std::string path = fileURI.full() + ".osgb";
+        bool isPayload;
+        std::string path = findRecord( fileURI.full(), isPayload );
 
-        if ( !osgDB::fileExists(path) )
+        if ( path.empty() )
             return ReadResult( ReadResult::RESULT_NOT_FOUND );
 
         if ( osgEarth::getLastModifiedTime(path) < minTime )
@@ -306,9 +378,25 @@ namespace
         osgDB::ReaderWriter::ReadResult r;
         {
             ScopedReadLock sharedLock( _rwmutex );
-            r = _rw->readObject( path, _rwOptions.get() );
-            if ( !r.success() )
-                return ReadResult();
+
+            osg::ref_ptr<osg::Object> object;
+            std::string buf;
+            if ( isPayload )
+            {
+                if ( !readPayload(path, buf) )
+                    return ReadResult();
+
+                object = CachePayload::decode( buf.data(), buf.size() );
+                if ( !object.valid() )
+                    return ReadResult();
+            }
+            else
+            {
+                r = _rw->readObject( path, _rwOptions.get() );
+                if ( !r.success() )
+                    return ReadResult();
+                object = r.getObject();
+            }
 
             // read metadata
             Config meta;
@@ -316,7 +404,7 @@ namespace
             if ( osgDB::fileExists(metafile) )
                 readMeta( metafile, meta );
 
-             return ReadResult( r.getObject(), meta );
+            return ReadResult( object.get(), meta );
         }
     }
 
@@ -391,23 +479,37 @@ namespace
             // write it.  
             osgDB::ReaderWriter::WriteResult r;
 
-            if ( dynamic_cast<const osg::Image*>(object) )
+            // heightfields and images go in the native payload format, under
+            // their own extension; everything else is written as osgb. Remove
+            // any copy of the record in the other format so it can't shadow
+            // the new one.
+            std::string payload;
+            if ( CachePayload::canEncode(object) && CachePayload::encode(object, payload) )
+            {
+                std::string filename = fileURI.full() + PAYLOAD_EXT;
+                objWriteOK = writePayload( filename, payload );
+                ::unlink( (fileURI.full() + OSGB_EXT).c_str() );
+            }
+            else if ( dynamic_cast<const osg::Image*>(object) )
             {
                 std::string filename = fileURI.full() + ".osgb";
                 r = _rw->writeImage( *static_cast<const osg::Image*>(object), filename, _rwOptions.get() );
                 objWriteOK = r.success();
+                ::unlink( (fileURI.full() + PAYLOAD_EXT).c_str() );
             }
             else if ( dynamic_cast<const osg::Node*>(object) )
             {
                 std::string filename = fileURI.full() + ".osgb";
                 r = _rw->writeNode( *static_cast<const osg::Node*>(object), filename, _rwOptions.get() );
                 objWriteOK = r.success();
+                ::unlink( (fileURI.full() + PAYLOAD_EXT).c_str() );
             }
             else
             {
                 std::string filename = fileURI.full() + ".osgb";
                 r = _rw->writeObject( *object, filename );
                 objWriteOK = r.success();
+                ::unlink( (fileURI.full() + PAYLOAD_EXT).c_str() );
             }
 
             // write metadata
@@ -437,8 +539,9 @@ namespace
             return STATUS_NOT_FOUND;
 
         URI fileURI( toLegalFileName(key), _metaPath );
-        std::string path( fileURI.full() + ".osgb" );
-        if ( !osgDB::fileExists(path) )
+        bool isPayload;
+        std::string path = findRecord( fileURI.full(), isPayload );
+        if ( path.empty() )
             return STATUS_NOT_FOUND;
 
         struct stat s;
@@ -451,8 +554,9 @@ namespace
     {
         if ( !binValidForReading() ) return false;
         URI fileURI( toLegalFileName(key), _metaPath );
-        std::string path( fileURI.full() + ".osgb" );
-        return ::unlink( path.c_str() ) == 0;
+        bool removedPayload = ::unlink( (fileURI.full() + PAYLOAD_EXT).c_str() ) == 0;
+        bool removedOsgb    = ::unlink( (fileURI.full() + OSGB_EXT).c_str() ) == 0;
+        return removedPayload || removedOsgb;
     }
 
     bool
@@ -460,8 +564,9 @@ namespace
     {
         if ( !binValidForReading() ) return false;
         URI fileURI( toLegalFileName(key), _metaPath );
-        std::string path( fileURI.full() + ".osgb" );
-        return osgEarth::touchFile( path );
+        bool isPayload;
+        std::string path = findRecord( fileURI.full(), isPayload );
+        return !path.empty() && osgEarth::touchFile( path );
     }
 
     bool
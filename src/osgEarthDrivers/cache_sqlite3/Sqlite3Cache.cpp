@@ -18,6 +18,7 @@
  */
 #include "Sqlite3CacheOptions"
 
+#include <osgEarth/CachePayload>
 #include <osgEarth/FileUtils>
 #include <osgEarth/TaskService>
 #include <osgDB/FileNameUtils>
@@ -54,6 +55,9 @@ using namespace OpenThreads;
 #define UPDATE_ACCESS_TIMES_POOL
 #define MAX_REQUEST_TO_RUN_PURGE 100
 
+// layer "compressor" tag for layers whose blobs are native CachePayloads
+#define PAYLOAD_TAG "oecp"
+
 #define PURGE_GENERAL
 //#define INSERT_POOL
 
@@ -361,7 +365,7 @@ struct AsyncInsertPool : public TaskRequest {
 struct LayerTable : public osg::Referenced
 {
     LayerTable( const MetadataRecord& meta, sqlite3* db )
-        : _meta(meta)
+        : _meta(meta), _usePayload(false)
     {        
         _tableName = "layer_" + _meta._layerName;
         // create the table and load the processors.
@@ -526,9 +530,13 @@ struct LayerTable : public osg::Referenced
         }
         sqlite3_bind_int( insert, 4, outBuf.length() );
 #else
-        std::stringstream outStream;
-        _rw->writeImage( *rec._image.get(), outStream, _rwOptions.get() );
-        std::string outBuf = outStream.str();
+        std::string outBuf;
+        if ( !_usePayload || !CachePayload::encode(rec._image.get(), outBuf, true) )
+        {
+            std::stringstream outStream;
+            _rw->writeImage( *rec._image.get(), outStream, _rwOptions.get() );
+            outBuf = outStream.str();
+        }
         sqlite3_bind_blob( insert, 4, outBuf.c_str(), outBuf.length(), SQLITE_STATIC );
 #endif
 
@@ -602,9 +610,13 @@ struct LayerTable : public osg::Referenced
             }
             sqlite3_bind_int( insert, 4, outBuf.length() );
 #else
-            std::stringstream outStream;
-            _rw->writeImage( * (it)->second._image.get(), outStream, _rwOptions.get() );
-            std::string outBuf = outStream.str();
+            std::string outBuf;
+            if ( !_usePayload || !CachePayload::encode((it)->second._image.get(), outBuf, true) )
+            {
+                std::stringstream outStream;
+                _rw->writeImage( * (it)->second._image.get(), outStream, _rwOptions.get() );
+                outBuf = outStream.str();
+            }
             sqlite3_bind_blob( insert, 4, outBuf.c_str(), outBuf.length(), SQLITE_STATIC );
 #endif
             rc = sqlite3_step(insert);   // executes the INSERT
@@ -724,10 +736,23 @@ struct LayerTable : public osg::Referenced
         const char* data = (const char*)sqlite3_column_blob( select, 2 );
         imageBufLen = sqlite3_column_bytes( select, 2 );
 
-        // deserialize the image from the buffer:
-        std::string imageString( data, imageBufLen );
-        std::stringstream imageBufStream( imageString );
-        osgDB::ReaderWriter::ReadResult rr = _rw->readImage( imageBufStream );
+        // deserialize the image from the buffer; layers tagged for the native
+        // payload format may still hold records in the layer's image format.
+        osgDB::ReaderWriter::ReadResult rr;
+        if ( _usePayload && CachePayload::isPayload(data, imageBufLen) )
+        {
+            osg::ref_ptr<osg::Image> image = new osg::Image();
+            if ( CachePayload::decode(data, imageBufLen, image.get()) )
+                rr = osgDB::ReaderWriter::ReadResult( image.get() );
+            else
+                rr = osgDB::ReaderWriter::ReadResult( "Corrupt cache payload" );
+        }
+        else
+        {
+            std::string imageString( data, imageBufLen );
+            std::stringstream imageBufStream( imageString );
+            rr = _rw->readImage( imageBufStream );
+        }
 #endif
         if ( rr.error() )
         {
@@ -897,7 +922,10 @@ struct LayerTable : public osg::Referenced
             return false;
         }
 
-        if ( !_meta._compressor.empty() )
+        // the payload tag marks the blob format, it is not an osgDB compressor:
+        _usePayload = _meta._compressor == PAYLOAD_TAG;
+
+        if ( !_meta._compressor.empty() && !_usePayload )
             _rwOptions = new osgDB::ReaderWriter::Options( "Compressor=" + _meta._compressor );
 
         _statsLastCheck = _statsStartTimer = osg::Timer::instance()->tick();
@@ -917,6 +945,7 @@ struct LayerTable : public osg::Referenced
 
     osg::ref_ptr<osgDB::ReaderWriter> _rw;
     osg::ref_ptr<osgDB::ReaderWriter::Options> _rwOptions;
+    bool _usePayload;
 
     osg::Timer_t _statsStartTimer;
     osg::Timer_t _statsLastCheck;
@@ -1117,7 +1146,11 @@ public: // Cache interface
         rec._format = "osgb";
         rec._compressor = "zlib";
 #else
+        // new layers store LZ-compressed native payloads (falling back on the
+        // layer format for anything the payload can't encode); the tag keeps
+        // existing layers, and readers, on the layer's own image format.
         rec._format = spec.format();
+        rec._compressor = PAYLOAD_TAG;
 #endif
 
         _metadata.store( rec, db );
@@ -97,7 +97,7 @@ _mapInfo         ( mapInfo ),
 _terrain         ( terrain ),
 _engineUID       ( engineUID )
 {
-    //nop
+    _latency = Registry::instrumentation()->getHistogram( Instrumentation::STAGE_CREATE_TILE_NODE );
 }
 
 
@@ -175,6 +175,8 @@ SerialKeyNodeFactory::createRootNode( const TileKey& key )
 osg::Node*
 SerialKeyNodeFactory::createNode( const TileKey& key, ProgressCallback* progress )
 {
+    ScopedLatency timer( _latency );
+
     osg::ref_ptr<TileModel> model;
     bool                    isReal;
 
@@ -1845,6 +1845,8 @@ _optimizeTriOrientation( optimizeTriOrientation ),
 _options               ( options ),
 _textureImageUnit      ( texImageUnit )
 {
+    _latency = Registry::instrumentation()->getHistogram( Instrumentation::STAGE_COMPILE_TILE_MODEL );
+
     _cullByTraversalMask = new CullByTraversalMask(*options.secondaryTraversalMask());
 }
 
@@ -1852,7 +1854,10 @@ _textureImageUnit      ( texImageUnit )
 TileNode*
 TileModelCompiler::compile(const TileModel* model)
 {
+    ScopedLatency timer( _latency );
+
     TileNode* tile = new TileNode( model->_tileKey, model );
+    tile->setVerticalScale( *_options.verticalScale() );
 
     // Working data for the build.
     Data d(model, _masks);
@@ -21,6 +21,7 @@
 #include <osgEarth/MapInfo>
 #include <osgEarth/ImageUtils>
 #include <osgEarth/HeightFieldUtils>
+#include <osgEarth/Registry>
 
 using namespace osgEarth_engine_mp;
 using namespace osgEarth;
@@ -258,6 +259,7 @@ _liveTiles     ( liveTiles ),
 _terrainOptions( terrainOptions )
 {
     _hfCache = new HeightFieldCache();
+    _latency = Registry::instrumentation()->getHistogram( Instrumentation::STAGE_CREATE_TILE_MODEL );
 }
 
 HeightFieldCache*
@@ -272,6 +274,8 @@ TileModelFactory::createTileModel(const TileKey&           key,
                                   osg::ref_ptr<TileModel>& out_model,
                                   bool&                    out_hasRealData)
 {
+    ScopedLatency timer( _latency );
+
     MapFrame mapf( _map, Map::MASKED_TERRAIN_LAYERS );
     
     const MapInfo& mapInfo = mapf.getMapInfo();
@@ -36,7 +36,8 @@ TileNode::TileNode( const TileKey& key, const TileModel* model ) :
 _key               ( key ),
 _model             ( model ),
 _bornTime          ( 0.0 ),
-_lastTraversalFrame( 0 )
+_lastTraversalFrame( 0 ),
+_verticalScale     ( 1.0f )
 {
     this->setName( key.str() );
 
@@ -62,6 +63,21 @@ TileNode::setLastTraversalFrame(unsigned frame)
 }
 
 
+bool
+TileNode::getElevationGrid(osg::ref_ptr<const osg::HeightField>& out_hf,
+                           GeoExtent&                            out_extent,
+                           float&                                out_verticalScale) const
+{
+    if ( !_model.valid() || !_model->hasElevation() )
+        return false;
+
+    out_hf            = _model->_elevationData.getHeightField();
+    out_extent        = _key.getExtent();
+    out_verticalScale = _verticalScale;
+    return true;
+}
+
+
 osg::BoundingSphere
 TileNode::computeBound() const
 {
@@ -17,6 +17,8 @@
 * along with this program.  If not, see <http://www.gnu.org/licenses/>
 */
 #include "TileNodeRegistry"
+#include <osg/Timer>
+#include <algorithm>
 
 using namespace osgEarth_engine_mp;
 using namespace osgEarth;
@@ -27,6 +29,52 @@ using namespace osgEarth;
 //#define OE_TEST OE_INFO
 
 
+//----------------------------------------------------------------------------
+
+namespace
+{
+    // spreads neighboring tiles across different shards.
+    inline unsigned hashKey( const TileKey& key )
+    {
+        unsigned h = key.getLevelOfDetail();
+        h = h * 0x9E3779B1u + key.getTileX();
+        h = h * 0x9E3779B1u + key.getTileY();
+        return h ^ (h >> 16);
+    }
+}
+
+/**
+ * Locks a shard, recording whether (and for how long) the caller had to wait.
+ */
+class TileNodeRegistry::ScopedShardLock
+{
+public:
+    ScopedShardLock( const Shard& shard ) : _shard(shard)
+    {
+        if ( _shard._mutex.trylock() != 0 )
+        {
+            osg::Timer_t start = osg::Timer::instance()->tick();
+            _shard._mutex.lock();
+            double wait = osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+
+            LockStats& stats = _shard._stats;
+            stats._contentions++;
+            stats._totalWaitTime += wait;
+            if ( wait > stats._maxWaitTime )
+                stats._maxWaitTime = wait;
+        }
+        _shard._stats._acquisitions++;
+    }
+
+    ~ScopedShardLock()
+    {
+        _shard._mutex.unlock();
+    }
+
+private:
+    const Shard& _shard;
+};
+
 //----------------------------------------------------------------------------
 
 TileNodeRegistry::TileNodeRegistry(const std::string& name) :
@@ -36,14 +84,22 @@ _name( name )
 }
 
 
+TileNodeRegistry::Shard&
+TileNodeRegistry::getShard( const TileKey& key )
+{
+    return _shards[ hashKey(key) % NUM_SHARDS ];
+}
+
+
 void
 TileNodeRegistry::add( TileNode* tile )
 {
     if ( tile )
     {
-        Threading::ScopedWriteLock exclusive( _tilesMutex );
-        _tiles[ tile->getKey() ] = tile;
-        OE_TEST << LC << _name << ": tiles=" << _tiles.size() << std::endl;
+        Shard& shard = getShard( tile->getKey() );
+        ScopedShardLock exclusive( shard );
+        shard._tiles[ tile->getKey() ] = tile;
+        OE_TEST << LC << _name << ": tiles=" << shard._tiles.size() << std::endl;
     }
 }
 
@@ -53,12 +109,26 @@ TileNodeRegistry::add( const TileNodeVector& tiles )
 {
     if ( tiles.size() > 0 )
     {
-        Threading::ScopedWriteLock exclusive( _tilesMutex );
+        // sort the tiles by shard so that each shard is only locked once.
+        std::vector<TileNode*> byShard[NUM_SHARDS];
         for( TileNodeVector::const_iterator i = tiles.begin(); i != tiles.end(); ++i )
         {
-            _tiles[ i->get()->getKey() ] = i->get();
+            if ( i->valid() )
+                byShard[ hashKey(i->get()->getKey()) % NUM_SHARDS ].push_back( i->get() );
+        }
+
+        for( unsigned s = 0; s < NUM_SHARDS; ++s )
+        {
+            if ( byShard[s].size() > 0 )
+            {
+                Shard& shard = _shards[s];
+                ScopedShardLock exclusive( shard );
+                for( std::vector<TileNode*>::const_iterator i = byShard[s].begin(); i != byShard[s].end(); ++i )
+                {
+                    shard._tiles[ (*i)->getKey() ] = *i;
+                }
+            }
         }
-        OE_TEST << LC << _name << ": tiles=" << _tiles.size() << std::endl;
     }
 }
 
@@ -68,9 +138,38 @@ TileNodeRegistry::remove( TileNode* tile )
 {
     if ( tile )
     {
-        Threading::ScopedWriteLock exclusive( _tilesMutex );
-        _tiles.erase( tile->getKey() );
-        OE_TEST << LC << _name << ": tiles=" << _tiles.size() << std::endl;
+        Shard& shard = getShard( tile->getKey() );
+        ScopedShardLock exclusive( shard );
+        shard._tiles.erase( tile->getKey() );
+        OE_TEST << LC << _name << ": tiles=" << shard._tiles.size() << std::endl;
+    }
+}
+
+
+void
+TileNodeRegistry::remove( const TileNodeVector& tiles )
+{
+    if ( tiles.size() > 0 )
+    {
+        std::vector<const TileKey*> byShard[NUM_SHARDS];
+        for( TileNodeVector::const_iterator i = tiles.begin(); i != tiles.end(); ++i )
+        {
+            if ( i->valid() )
+                byShard[ hashKey(i->get()->getKey()) % NUM_SHARDS ].push_back( &i->get()->getKey() );
+        }
+
+        for( unsigned s = 0; s < NUM_SHARDS; ++s )
+        {
+            if ( byShard[s].size() > 0 )
+            {
+                Shard& shard = _shards[s];
+                ScopedShardLock exclusive( shard );
+                for( std::vector<const TileKey*>::const_iterator i = byShard[s].begin(); i != byShard[s].end(); ++i )
+                {
+                    shard._tiles.erase( **i );
+                }
+            }
+        }
     }
 }
 
@@ -78,10 +177,11 @@ TileNodeRegistry::remove( TileNode* tile )
 bool
 TileNodeRegistry::get( const TileKey& key, osg::ref_ptr<TileNode>& out_tile )
 {
-    Threading::ScopedReadLock shared( _tilesMutex );
+    Shard& shard = getShard( key );
+    ScopedShardLock shared( shard );
 
-    TileNodeMap::iterator i = _tiles.find(key);
-    if ( i != _tiles.end() )
+    TileNodeMap::iterator i = shard._tiles.find(key);
+    if ( i != shard._tiles.end() )
     {
         out_tile = i->second.get();
         return true;
@@ -93,14 +193,15 @@ TileNodeRegistry::get( const TileKey& key, osg::ref_ptr<TileNode>& out_tile )
 bool
 TileNodeRegistry::take( const TileKey& key, osg::ref_ptr<TileNode>& out_tile )
 {
-    Threading::ScopedWriteLock exclusive( _tilesMutex );
+    Shard& shard = getShard( key );
+    ScopedShardLock exclusive( shard );
 
-    TileNodeMap::iterator i = _tiles.find(key);
-    if ( i != _tiles.end() )
+    TileNodeMap::iterator i = shard._tiles.find(key);
+    if ( i != shard._tiles.end() )
     {
         out_tile = i->second.get();
-        _tiles.erase( i );
-        OE_TEST << LC << _name << ": tiles=" << _tiles.size() << std::endl;
+        shard._tiles.erase( i );
+        OE_TEST << LC << _name << ": tiles=" << shard._tiles.size() << std::endl;
         return true;
     }
     return false;
@@ -110,20 +211,33 @@ TileNodeRegistry::take( const TileKey& key, osg::ref_ptr<TileNode>& out_tile )
 void
 TileNodeRegistry::run( TileNodeRegistry::Operation& op )
 {
-    Threading::ScopedWriteLock lock( _tilesMutex );
-    unsigned size = _tiles.size();
-    op.operator()( _tiles );
-    if ( size != _tiles.size() )
-        OE_TEST << LC << _name << ": tiles=" << _tiles.size() << std::endl;
+    for( unsigned s = 0; s < NUM_SHARDS; ++s )
+    {
+        Shard& shard = _shards[s];
+        ScopedShardLock lock( shard );
+        if ( !shard._tiles.empty() )
+        {
+            unsigned size = shard._tiles.size();
+            op.operator()( shard._tiles );
+            if ( size != shard._tiles.size() )
+                OE_TEST << LC << _name << ": tiles=" << shard._tiles.size() << std::endl;
+        }
+    }
 }
 
 
 void
 TileNodeRegistry::run( const TileNodeRegistry::ConstOperation& op ) const
 {
-    Threading::ScopedReadLock lock( _tilesMutex );
-    op.operator()( _tiles );
-    OE_TEST << LC << _name << ": tiles=" << _tiles.size() << std::endl;
+    for( unsigned s = 0; s < NUM_SHARDS; ++s )
+    {
+        const Shard& shard = _shards[s];
+        ScopedShardLock lock( shard );
+        if ( !shard._tiles.empty() )
+        {
+            op.operator()( shard._tiles );
+        }
+    }
 }
 
 
@@ -131,5 +245,38 @@ bool
 TileNodeRegistry::empty() const
 {
     // don't bother mutex-protecteding this.
-    return _tiles.empty();
+    for( unsigned s = 0; s < NUM_SHARDS; ++s )
+    {
+        if ( !_shards[s]._tiles.empty() )
+            return false;
+    }
+    return true;
+}
+
+
+void
+TileNodeRegistry::getLockStats( LockStats& out_stats ) const
+{
+    out_stats = LockStats();
+    for( unsigned s = 0; s < NUM_SHARDS; ++s )
+    {
+        const Shard& shard = _shards[s];
+        Threading::ScopedMutexLock lock( shard._mutex );
+        out_stats._acquisitions  += shard._stats._acquisitions;
+        out_stats._contentions   += shard._stats._contentions;
+        out_stats._totalWaitTime += shard._stats._totalWaitTime;
+        out_stats._maxWaitTime    = std::max( out_stats._maxWaitTime, shard._stats._maxWaitTime );
+    }
+}
+
+
+void
+TileNodeRegistry::resetLockStats()
+{
+    for( unsigned s = 0; s < NUM_SHARDS; ++s )
+    {
+        Shard& shard = _shards[s];
+        Threading::ScopedMutexLock lock( shard._mutex );
+        shard._stats = LockStats();
+    }
 }
@@ -18,6 +18,8 @@
 */
 #include "TilePagedLOD"
 #include "TileNodeRegistry"
+#include <osgEarth/Instrumentation>
+#include <osgEarth/Registry>
 #include <osg/Version>
 
 using namespace osgEarth_engine_mp;
@@ -42,6 +44,8 @@ _upsampling( false )
 {
     _numChildrenThatCannotBeExpired = 0;
 
+    _mergeLatency = Registry::instrumentation()->getHistogram( Instrumentation::STAGE_PAGER_MERGE );
+
     // set up the paging properties:
     _prefix = Stringify() << subkey.str() << "." << engineUID << ".";
     this->setRange   ( 0, 0.0f, FLT_MAX );
@@ -55,6 +59,8 @@ _upsampling( false )
 bool
 TilePagedLOD::addChild(osg::Node* node)
 {
+    ScopedLatency timer( _mergeLatency );
+
     // First check whether this is a new TileGroup (a group that contains a TileNode
     // and children paged LODs). If so, add it normally and inform our parent.
     TileGroup* subtilegroup = dynamic_cast<TileGroup*>(node);
@@ -130,15 +136,14 @@ TilePagedLOD::traverse(osg::NodeVisitor& nv)
 
 namespace
 {
-    // traverses a node graph and moves any TileNodes from the LIVE
-    // registry to the DEAD registry.
+    // traverses a node graph and collects any TileNodes, so they can be
+    // moved from the LIVE registry to the DEAD registry in one batch.
     struct ExpirationCollector : public osg::NodeVisitor
     {
-        TileNodeRegistry* _live;
-        TileNodeRegistry* _dead;
+        TileNodeVector _tiles;
 
-        ExpirationCollector(TileNodeRegistry* live, TileNodeRegistry* dead)
-            : osg::NodeVisitor(TRAVERSE_ALL_CHILDREN), _live(live), _dead(dead) { }
+        ExpirationCollector()
+            : osg::NodeVisitor(TRAVERSE_ALL_CHILDREN) { }
 
         void apply(osg::Node& node)
         {
@@ -147,8 +152,7 @@ namespace
             tn = tg ? tg->getTileNode() : dynamic_cast<TileNode*>(&node);
             if ( tn )
             {
-                if ( _live ) _live->remove( tn );
-                if ( _dead ) _dead->add( tn );
+                _tiles.push_back( tn );
                 //OE_NOTICE << "Expired " << tn->getKey().str() << std::endl;
             }
             traverse(node);
@@ -189,8 +193,10 @@ TilePagedLOD::removeExpiredChildren(double         expiryTime,
                 tilenode = dynamic_cast<TileGroup*>(nodeToRemove)->getTileNode();
             if ( tilenode )
             {
-                ExpirationCollector collector( _live, _dead );
+                ExpirationCollector collector;
                 nodeToRemove->accept( collector );
+                if ( _live ) _live->remove( collector._tiles );
+                if ( _dead ) _dead->add( collector._tiles );
             }
 
             OE_DEBUG << "Expired " << _prefix << std::endl;
@@ -17,6 +17,8 @@
 * along with this program.  If not, see <http://www.gnu.org/licenses/>
 */
 #include "CustomPagedLOD"
+#include <osgEarth/Instrumentation>
+#include <osgEarth/Registry>
 
 using namespace osgEarth_engine_quadtree;
 using namespace osgEarth;
@@ -31,7 +33,7 @@ CustomPagedLOD::CustomPagedLOD(TileNodeRegistry* live,
 _live( live ),
 _dead( dead )
 {
-    //nop
+    _mergeLatency = Registry::instrumentation()->getHistogram( Instrumentation::STAGE_PAGER_MERGE );
 }
 
 
@@ -57,6 +59,8 @@ CustomPagedLOD::~CustomPagedLOD()
 bool
 CustomPagedLOD::addChild( osg::Node* child )
 {
+    ScopedLatency timer( _mergeLatency );
+
     bool ok = osg::PagedLOD::addChild( child );
     if ( ok && _live.valid() )
     {
@@ -54,7 +54,7 @@ _mapInfo         ( mapInfo ),
 _terrain         ( terrain ),
 _engineUID       ( engineUID )
 {
-    //nop
+    _latency = Registry::instrumentation()->getHistogram( Instrumentation::STAGE_CREATE_TILE_NODE );
 }
 
 void
@@ -186,6 +186,8 @@ SerialKeyNodeFactory::createRootNode( const TileKey& key )
 osg::Node*
 SerialKeyNodeFactory::createNode( const TileKey& parentKey )
 {
+    ScopedLatency timer( _latency );
+
     osg::ref_ptr<TileModel> models[4];
     bool                   realData[4];
     bool                   lodBlending[4];
@@ -1821,6 +1821,8 @@ _texCompositor         ( texCompositor ),
 _optimizeTriOrientation( optimizeTriOrientation ),
 _options               ( options )
 {
+    _latency = Registry::instrumentation()->getHistogram( Instrumentation::STAGE_COMPILE_TILE_MODEL );
+
     _cullByTraversalMask = new CullByTraversalMask(*options.secondaryTraversalMask());
 }
 
@@ -1830,6 +1832,8 @@ TileModelCompiler::compile(const TileModel* model,
                            osg::Node*&      out_node,
                            osg::StateSet*&  out_stateSet)
 {
+    ScopedLatency timer( _latency );
+
     // Working data for the build.
     Data d(model, _masks);
 
@@ -21,6 +21,7 @@
 #include <osgEarth/MapInfo>
 #include <osgEarth/ImageUtils>
 #include <osgEarth/HeightFieldUtils>
+#include <osgEarth/Registry>
 
 using namespace osgEarth_engine_quadtree;
 using namespace osgEarth;
@@ -244,6 +245,7 @@ _liveTiles     ( liveTiles ),
 _terrainOptions( terrainOptions )
 {
     _hfCache = new HeightFieldCache();
+    _latency = Registry::instrumentation()->getHistogram( Instrumentation::STAGE_CREATE_TILE_MODEL );
 }
 
 HeightFieldCache*
@@ -259,6 +261,8 @@ TileModelFactory::createTileModel(const TileKey&           key,
                                   bool&                    out_hasRealData,
                                   bool&                    out_hasLodBlendedLayers )
 {
+    ScopedLatency timer( _latency );
+
     MapFrame mapf( _map, Map::MASKED_TERRAIN_LAYERS );
     
     const MapInfo& mapInfo = mapf.getMapInfo();
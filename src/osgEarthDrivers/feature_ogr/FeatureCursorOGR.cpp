@@ -21,16 +21,16 @@
 #include <osgEarthFeatures/Feature>
 #include <osgEarth/Registry>
 #include <algorithm>
+#include <vector>
 
 #define LC "[FeatureCursorOGR] "
 
-#define OGR_SCOPED_LOCK GDAL_SCOPED_LOCK
-
 using namespace osgEarth;
 using namespace osgEarth::Features;
 
 
 FeatureCursorOGR::FeatureCursorOGR(OGRDataSourceH           dsHandle,
+                                   OGRDataSourcePool*       pool,
                                    OGRLayerH                layerHandle,
                                    const FeatureSource*     source,
                                    const FeatureProfile*    profile,
@@ -38,6 +38,7 @@ FeatureCursorOGR::FeatureCursorOGR(OGRDataSourceH           dsHandle,
                                    const FeatureFilterList& filters ) :
 _source           ( source ),
 _dsHandle         ( dsHandle ),
+_pool             ( pool ),
 _layerHandle      ( layerHandle ),
 _resultSetHandle  ( 0L ),
 _spatialFilter    ( 0L ),
@@ -47,9 +48,9 @@ _nextHandleToQueue( 0L ),
 _profile          ( profile ),
 _filters          ( filters )
 {
+    // The data source handle belongs to this cursor alone, so none of the
+    // work below needs the global GDAL lock.
     {
-        OGR_SCOPED_LOCK;
-
         std::string expr;
         std::string from = OGR_FD_GetName( OGR_L_GetLayerDefn( _layerHandle ));        
         
@@ -143,8 +144,6 @@ _filters          ( filters )
 
 FeatureCursorOGR::~FeatureCursorOGR()
 {
-    OGR_SCOPED_LOCK;
-
     if ( _nextHandleToQueue )
         OGR_F_Destroy( _nextHandleToQueue );
 
@@ -155,7 +154,7 @@ FeatureCursorOGR::~FeatureCursorOGR()
         OGR_G_DestroyGeometry( _spatialFilter );
 
     if ( _dsHandle )
-        OGRReleaseDataSource( _dsHandle );
+        _pool->release( _dsHandle );
 }
 
 bool
@@ -183,49 +182,33 @@ FeatureCursorOGR::nextFeature()
 }
 
 
-// reads a chunk of features into a memory cache; do this for performance
-// and to avoid needing the OGR Mutex every time
+// reads a chunk of features into a memory cache; do this for performance.
+// The cursor owns its data source handle, so this takes no lock: it pulls
+// the raw OGR features first and converts them in a second pass.
 void
 FeatureCursorOGR::readChunk()
 {
     if ( !_resultSetHandle )
         return;
-    
-    FeatureList preProcessList;
-    
-    OGR_SCOPED_LOCK;
+
+    std::vector<OGRFeatureH> handles;
+    handles.reserve( _chunkSize + 1 );
 
     if ( _nextHandleToQueue )
     {
-        osg::ref_ptr<Feature> f = OgrUtils::createFeature( _nextHandleToQueue, _profile->getSRS() );
-        if ( f.valid() && !_source->isBlacklisted(f->getFID()) )
-        {
-            _queue.push( f );
-            
-            if ( _filters.size() > 0 )
-                preProcessList.push_back( f.release() );
-        }
-        OGR_F_Destroy( _nextHandleToQueue );
+        handles.push_back( _nextHandleToQueue );
         _nextHandleToQueue = 0L;
     }
 
-    unsigned handlesToQueue = _chunkSize - _queue.size();
+    unsigned handlesToQueue = handles.size() + _chunkSize - _queue.size();
     bool resultSetEndReached = false;
 
-    for( unsigned i=0; i<handlesToQueue; i++ )
+    while( handles.size() < handlesToQueue )
     {
         OGRFeatureH handle = OGR_L_GetNextFeature( _resultSetHandle );
         if ( handle )
         {
-            osg::ref_ptr<Feature> f = OgrUtils::createFeature( handle, _profile->getSRS() );
-            if ( f.valid() && !_source->isBlacklisted(f->getFID()) )
-            {
-                _queue.push( f );
-
-                if ( _filters.size() > 0 )
-                    preProcessList.push_back( f.release() );
-            }
-            OGR_F_Destroy( handle );
+            handles.push_back( handle );
         }
         else
         {
@@ -234,6 +217,25 @@ FeatureCursorOGR::readChunk()
         }
     }
 
+    // read one more for "more" detection:
+    if ( !resultSetEndReached )
+        _nextHandleToQueue = OGR_L_GetNextFeature( _resultSetHandle );
+
+    FeatureList preProcessList;
+
+    for( std::vector<OGRFeatureH>::iterator i = handles.begin(); i != handles.end(); ++i )
+    {
+        osg::ref_ptr<Feature> f = OgrUtils::createFeature( *i, _profile->getSRS() );
+        if ( f.valid() && !_source->isBlacklisted(f->getFID()) )
+        {
+            _queue.push( f );
+
+            if ( _filters.size() > 0 )
+                preProcessList.push_back( f.release() );
+        }
+        OGR_F_Destroy( *i );
+    }
+
     // preprocess the features using the filter list:
     if ( preProcessList.size() > 0 )
     {
@@ -247,12 +249,5 @@ FeatureCursorOGR::readChunk()
         }
     }
 
-    // read one more for "more" detection:
-    if (!resultSetEndReached)
-        _nextHandleToQueue = OGR_L_GetNextFeature( _resultSetHandle );
-    else
-        _nextHandleToQueue = 0L;
-
     //OE_NOTICE << "read " << _queue.size() << " features ... " << std::endl;
 }
-
@@ -26,6 +26,7 @@
 #include <osgEarthFeatures/GeometryUtils>
 #include "OGRFeatureOptions"
 #include "FeatureCursorOGR"
+#include "OGRDataSourcePool"
 #include <osgEarthFeatures/OgrUtils>
 #include <osg/Notify>
 #include <osgDB/FileNameUtils>
@@ -158,6 +159,9 @@ public:
             if ( _dsHandle )
             {
                 if (openMode == 1) _writable = true;
+
+                // read-only handles for the cursors, one per concurrent reader.
+                _pool = new OGRDataSourcePool( _source );
                 
                 if ( _options.layer().isSet() )
                 {
@@ -279,40 +283,49 @@ public:
                 _options.filters() );
                 //getFilters() );
         }
-        else
+        else if ( _pool.valid() )
         {
-            OGR_SCOPED_LOCK;
-
             // Each cursor requires its own DS handle so that multi-threaded access will work.
-            // The cursor impl will dispose of the new DS handle.
-
-            OGRDataSourceH dsHandle = OGROpenShared( _source.c_str(), 0, &_ogrDriverHandle );
+            // The pool hands out a handle that no other cursor is using, and the cursor
+            // returns it when it's destroyed; so a worker thread keeps reusing the same one.
+            OGRDataSourceH dsHandle = _pool->acquire();
             if ( dsHandle )
             {
                 OGRLayerH layerHandle = OGR_DS_GetLayer( dsHandle, _layerIndex );
 
                 return new FeatureCursorOGR( 
                     dsHandle,
+                    _pool.get(),
                     layerHandle, 
                     this,
                     getFeatureProfile(),
                     query, 
                     _options.filters() );
             }
-            else
-            {
-                return 0L;
-            }
         }
+
+        return 0L;
     }
 
     virtual bool deleteFeature(FeatureID fid)
     {
         if (_writable && _layerHandle)
         {
-            if (OGR_L_DeleteFeature( _layerHandle, fid ) == OGRERR_NONE)
+            OGRErr err;
+            {
+                OGR_SCOPED_LOCK;
+                err = OGR_L_DeleteFeature( _layerHandle, fid );
+
+                // flush the edit so that the pooled read handles, which
+                // reopen the file, will see it.
+                if (err == OGRERR_NONE)
+                    OGR_L_SyncToDisk( _layerHandle );
+            }
+            if (err == OGRERR_NONE)
             {
                 _needsSync = true;
+                if ( _pool.valid() )
+                    _pool->clear();
                 return true;
             }            
         }
@@ -330,8 +343,12 @@ public:
 
         if ( !isBlacklisted(fid) )
         {
-            OGR_SCOPED_LOCK;
-            OGRFeatureH handle = OGR_L_GetFeature( _layerHandle, fid);
+            // _layerHandle is shared, so only the fetch needs the lock:
+            OGRFeatureH handle = 0L;
+            {
+                OGR_SCOPED_LOCK;
+                handle = OGR_L_GetFeature( _layerHandle, fid);
+            }
             if (handle)
             {
                 const FeatureProfile* p = getFeatureProfile();
@@ -409,6 +426,9 @@ public:
 
             // clean up the feature
             OGR_F_Destroy( feature_handle );
+
+            // flush the new feature so that the pooled read handles will see it.
+            OGR_L_SyncToDisk( _layerHandle );
         }
         else
         {
@@ -417,6 +437,9 @@ public:
             return false;
         }
 
+        if ( _pool.valid() )
+            _pool->clear();
+
         dirty();
 
         return true;
@@ -470,6 +493,7 @@ private:
     OGRLayerH _layerHandle;
     unsigned int _layerIndex;
     OGRSFDriverH _ogrDriverHandle;
+    osg::ref_ptr<OGRDataSourcePool> _pool;
     osg::ref_ptr<Symbology::Geometry> _geometry; // explicit geometry.
     const OGRFeatureOptions _options;
     int _featureCount;
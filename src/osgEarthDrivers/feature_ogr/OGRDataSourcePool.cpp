@@ -0,0 +1,135 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2013 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "OGRDataSourcePool"
+#include <osgEarth/Registry>
+
+#define LC "[OGRDataSourcePool] "
+
+#define OGR_SCOPED_LOCK GDAL_SCOPED_LOCK
+
+using namespace osgEarth;
+
+
+OGRDataSourcePool::OGRDataSourcePool( const std::string& source ) :
+_source    ( source ),
+_generation( 0 ),
+_numOpened ( 0 )
+{
+    //nop
+}
+
+OGRDataSourcePool::~OGRDataSourcePool()
+{
+    // cursors hold a reference to the pool, so nothing is checked out by now.
+    for( std::vector<Entry>::iterator i = _idle.begin(); i != _idle.end(); ++i )
+        close( i->_handle );
+    _idle.clear();
+}
+
+OGRDataSourceH
+OGRDataSourcePool::acquire()
+{
+    unsigned generation;
+    {
+        Threading::ScopedMutexLock lock( _mutex );
+        if ( !_idle.empty() )
+        {
+            Entry e = _idle.back();
+            _idle.pop_back();
+            _busy.push_back( e );
+            return e._handle;
+        }
+        generation = _generation;
+    }
+
+    // open a new handle outside the pool mutex; OGROpen consults the
+    // driver registry, so it still needs the global GDAL lock.
+    OGRDataSourceH handle = 0L;
+    {
+        OGR_SCOPED_LOCK;
+        OGRSFDriverH driver = 0L;
+        handle = OGROpen( _source.c_str(), 0, &driver );
+    }
+
+    if ( !handle )
+    {
+        OE_WARN << LC << "Failed to open \"" << _source << "\"" << std::endl;
+        return 0L;
+    }
+
+    Threading::ScopedMutexLock lock( _mutex );
+    Entry e;
+    e._handle     = handle;
+    e._generation = generation;
+    _busy.push_back( e );
+    ++_numOpened;
+
+    OE_DEBUG << LC << "Opened handle " << _numOpened << " on \"" << _source << "\"" << std::endl;
+    return handle;
+}
+
+void
+OGRDataSourcePool::release( OGRDataSourceH handle )
+{
+    if ( !handle )
+        return;
+
+    bool stale = true;
+    {
+        Threading::ScopedMutexLock lock( _mutex );
+        for( std::vector<Entry>::iterator i = _busy.begin(); i != _busy.end(); ++i )
+        {
+            if ( i->_handle == handle )
+            {
+                Entry e = *i;
+                _busy.erase( i );
+                if ( e._generation == _generation )
+                {
+                    _idle.push_back( e );
+                    stale = false;
+                }
+                break;
+            }
+        }
+    }
+
+    if ( stale )
+        close( handle );
+}
+
+void
+OGRDataSourcePool::clear()
+{
+    std::vector<Entry> idle;
+    {
+        Threading::ScopedMutexLock lock( _mutex );
+        idle.swap( _idle );
+        ++_generation;
+    }
+
+    for( std::vector<Entry>::iterator i = idle.begin(); i != idle.end(); ++i )
+        close( i->_handle );
+}
+
+void
+OGRDataSourcePool::close( OGRDataSourceH handle )
+{
+    OGR_SCOPED_LOCK;
+    OGRReleaseDataSource( handle );
+}
@@ -22,6 +22,7 @@
 #include <osgEarth/XmlUtils>
 #include <osgEarth/FileUtils>
 #include <osgEarthFeatures/FeatureSource>
+#include <osgEarthFeatures/FeatureStreamReader>
 #include <osgEarthFeatures/Filter>
 #include <osgEarthFeatures/BufferFilter>
 #include <osgEarthFeatures/ScaleFilter>
@@ -271,6 +272,15 @@ public:
                 if (_options.format().value() == "json") mimeType = "json";
                 else if (_options.format().value().compare("gml") == 0) mimeType = "text/xml";
             }
+
+            // Prefer the native streaming reader, which builds features lazily as the
+            // cursor advances. Fall back on OGR for anything it does not understand.
+            osg::ref_ptr<FeatureStreamReader> reader = FeatureStreamReader::create( buffer, mimeType, _layer.getSRS() );
+            if ( reader.valid() )
+            {
+                return new FeatureStreamCursor( reader.get(), this, getFeatureProfile(), _options.filters(), url );
+            }
+
             dataOK = getFeatures( buffer, mimeType, features );
         }
 
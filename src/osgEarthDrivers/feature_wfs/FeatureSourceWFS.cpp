@@ -21,6 +21,7 @@
 #include <osgEarth/Registry>
 #include <osgEarth/FileUtils>
 #include <osgEarthFeatures/FeatureSource>
+#include <osgEarthFeatures/FeatureStreamReader>
 #include <osgEarthFeatures/Filter>
 #include <osgEarthFeatures/BufferFilter>
 #include <osgEarthFeatures/ScaleFilter>
@@ -361,6 +362,16 @@ public:
         {
             // Get the mime-type from the metadata record if possible
             const std::string& mimeType = r.metadata().value( IOMetadata::CONTENT_TYPE );
+
+            // Prefer the native streaming reader, which builds features lazily as the
+            // cursor advances. Fall back on OGR for anything it does not understand.
+            FeatureProfile* fp = getFeatureProfile();
+            osg::ref_ptr<FeatureStreamReader> reader = FeatureStreamReader::create( buffer, mimeType, fp ? fp->getSRS() : 0L );
+            if ( reader.valid() )
+            {
+                return new FeatureStreamCursor( reader.get(), this, fp, _options.filters(), url );
+            }
+
             dataOK = getFeatures( buffer, mimeType, features );
         }
 
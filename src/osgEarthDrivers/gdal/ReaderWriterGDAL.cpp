@@ -22,6 +22,7 @@
 #include <osgEarth/Registry>
 #include <osgEarth/ImageUtils>
 #include <osgEarth/URI>
+#include <osgEarth/StringUtils>
 
 #include <osgDB/FileNameUtils>
 #include <osgDB/FileUtils>
@@ -30,9 +31,16 @@
 #include <osgDB/WriteFile>
 #include <osgDB/ImageOptions>
 
+#include <OpenThreads/Thread>
+#include <OpenThreads/Atomic>
+
 #include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <map>
 #include <stdlib.h>
 #include <memory.h>
+#include <sys/stat.h>
 
 #include <gdal_priv.h>
 #include <gdalwarper.h>
@@ -95,25 +103,6 @@ typedef enum
     AVERAGE_RESOLUTION
 } ResolutionStrategy;
 
-typedef struct
-{
-    int    isFileOK;
-    int    nRasterXSize;
-    int    nRasterYSize;
-    double adfGeoTransform[6];
-    int    nBlockXSize;
-    int    nBlockYSize;
-} DatasetProperty;
-
-typedef struct
-{
-    GDALColorInterp        colorInterpretation;
-    GDALDataType           dataType;
-    GDALColorTableH        colorTable;
-    int                    bHasNoData;
-    double                 noDataValue;
-} BandProperty;
-
 static void
 getFiles(const std::string &file, const std::vector<std::string> &exts, const std::vector<std::string> &blackExts, std::vector<std::string> &files)
 {
@@ -166,6 +155,321 @@ getFiles(const std::string &file, const std::vector<std::string> &exts, const st
     }
 }
 
+// Band characteristics of one input file: what build_vrt needs to check that
+// the files are compatible and to describe the proxy bands.
+struct BandInfo
+{
+    BandInfo() :
+        colorInterpretation( GCI_Undefined ),
+        dataType           ( GDT_Unknown ),
+        hasNoData          ( FALSE ),
+        noDataValue        ( 0.0 ),
+        colorEntryCount    ( 0 ) { }
+
+    GDALColorInterp colorInterpretation;
+    GDALDataType    dataType;
+    int             hasNoData;
+    double          noDataValue;
+    int             colorEntryCount;
+};
+
+// Everything build_vrt needs to know about one input file. These are kept in
+// a catalog keyed by path, modification time and size, so that only new or
+// changed files have to be reopened the next time the source initializes.
+struct FileInfo
+{
+    FileInfo() :
+        mtime       ( 0 ),
+        size        ( 0 ),
+        isFileOK    ( false ),
+        nRasterXSize( 0 ),
+        nRasterYSize( 0 ),
+        nBlockXSize ( 0 ),
+        nBlockYSize ( 0 )
+    {
+        for(int i=0; i<6; ++i)
+            adfGeoTransform[i] = 0.0;
+    }
+
+    std::string           path;
+    long long             mtime;
+    long long             size;
+    bool                  isFileOK;
+    int                   nRasterXSize;
+    int                   nRasterYSize;
+    double                adfGeoTransform[6];
+    int                   nBlockXSize;
+    int                   nBlockYSize;
+    std::string           projection;
+    std::vector<BandInfo> bands;
+};
+
+typedef std::vector<FileInfo> FileInfoVector;
+
+static bool
+statFile(const std::string& path, long long& mtime, long long& size)
+{
+    struct stat buf;
+    if ( ::stat(path.c_str(), &buf) != 0 )
+        return false;
+
+    mtime = (long long)buf.st_mtime;
+    size  = (long long)buf.st_size;
+    return true;
+}
+
+// Opens a file and records its properties. Touches no shared state, so any
+// number of these can run at once (each on its own dataset handle).
+static void
+scanFile(FileInfo& info)
+{
+    info.isFileOK = false;
+    info.projection.clear();
+    info.bands.clear();
+
+    GDALDatasetH hDS = GDALOpen( info.path.c_str(), GA_ReadOnly );
+    if ( !hDS )
+    {
+        OE_WARN << LC << "Can't open " << info.path << ". Skipping it" << std::endl;
+        return;
+    }
+
+    const char* proj = GDALGetProjectionRef(hDS);
+    if ( proj && strlen(proj) > 0 )
+    {
+        info.projection = proj;
+    }
+    else
+    {
+        std::string prjLocation = osgDB::getNameLessExtension( info.path ) + std::string(".prj");
+        ReadResult r = URI(prjLocation).readString();
+        if ( r.succeeded() )
+        {
+            info.projection = r.getString();
+        }
+    }
+
+    // WKT doesn't care about whitespace; flatten it so it fits on one catalog
+    // line and compares the same whether or not it came from the catalog.
+    for(std::string::iterator c = info.projection.begin(); c != info.projection.end(); ++c)
+    {
+        if ( *c == '\t' || *c == '\r' || *c == '\n' )
+            *c = ' ';
+    }
+    info.projection = trim(info.projection);
+
+    GDALGetGeoTransform(hDS, info.adfGeoTransform);
+    if (info.adfGeoTransform[GEOTRSFRM_ROTATION_PARAM1] != 0 ||
+        info.adfGeoTransform[GEOTRSFRM_ROTATION_PARAM2] != 0)
+    {
+        OE_WARN << LC << "GDAL Driver does not support rotated geo transforms. Skipping " << info.path << std::endl;
+        GDALClose(hDS);
+        return;
+    }
+    if (info.adfGeoTransform[GEOTRSFRM_NS_RES] >= 0)
+    {
+        OE_WARN << LC << "GDAL Driver does not support positive NS resolution. Skipping " << info.path << std::endl;
+        GDALClose(hDS);
+        return;
+    }
+
+    int nBands = GDALGetRasterCount(hDS);
+    if (nBands == 0)
+    {
+        OE_WARN << LC << "No raster bands in " << info.path << ". Skipping it" << std::endl;
+        GDALClose(hDS);
+        return;
+    }
+
+    info.nRasterXSize = GDALGetRasterXSize(hDS);
+    info.nRasterYSize = GDALGetRasterYSize(hDS);
+
+    GDALGetBlockSize(GDALGetRasterBand( hDS, 1 ), &info.nBlockXSize, &info.nBlockYSize);
+
+    info.bands.resize(nBands);
+    for(int j=0; j<nBands; j++)
+    {
+        GDALRasterBandH hRasterBand = GDALGetRasterBand( hDS, j+1 );
+        BandInfo& band = info.bands[j];
+        band.colorInterpretation = GDALGetRasterColorInterpretation(hRasterBand);
+        band.dataType = GDALGetRasterDataType(hRasterBand);
+        band.noDataValue = GDALGetRasterNoDataValue(hRasterBand, &band.hasNoData);
+        if (band.colorInterpretation == GCI_PaletteIndex)
+        {
+            GDALColorTableH colorTable = GDALGetRasterColorTable( hRasterBand );
+            band.colorEntryCount = colorTable ? GDALGetColorEntryCount(colorTable) : 0;
+        }
+    }
+
+    info.isFileOK = true;
+    GDALClose(hDS);
+}
+
+// Scans the files whose indices are in "todo", pulling the next index from a
+// counter shared with the other scan threads.
+class ScanThread : public OpenThreads::Thread
+{
+public:
+    ScanThread(FileInfoVector& infos, const std::vector<unsigned>& todo, OpenThreads::Atomic& next) :
+      _infos( infos ),
+      _todo ( todo ),
+      _next ( next )
+    {
+        //nop
+    }
+
+    void run()
+    {
+        for( unsigned i = (++_next)-1; i < _todo.size(); i = (++_next)-1 )
+        {
+            scanFile( _infos[_todo[i]] );
+        }
+    }
+
+private:
+    FileInfoVector&              _infos;
+    const std::vector<unsigned>& _todo;
+    OpenThreads::Atomic&         _next;
+};
+
+// The catalog is plain text: a header line, then one tab-separated line per
+// file (the projection WKT comes last since it may contain spaces).
+#define GDAL_CATALOG_HEADER "osgearth-gdal-catalog 1"
+
+static void
+readCatalog(std::istream& in, std::map<std::string, FileInfo>& out)
+{
+    std::string line;
+    if ( !std::getline(in, line) || trim(line) != GDAL_CATALOG_HEADER )
+        return;
+
+    while( std::getline(in, line) )
+    {
+        if ( !line.empty() && line[line.size()-1] == '\r' )
+            line.resize( line.size()-1 );
+
+        std::vector<std::string> t;
+        for( std::string::size_type start = 0; ; )
+        {
+            std::string::size_type tab = line.find('\t', start);
+            t.push_back( line.substr(start, tab == std::string::npos ? std::string::npos : tab-start) );
+            if ( tab == std::string::npos )
+                break;
+            start = tab+1;
+        }
+
+        if ( t.size() < 16 )
+            continue;
+
+        FileInfo info;
+        info.path         = t[0];
+        info.mtime        = as<long long>(t[1], 0);
+        info.size         = as<long long>(t[2], 0);
+        info.isFileOK     = t[3] == "1";
+        info.nRasterXSize = as<int>(t[4], 0);
+        info.nRasterYSize = as<int>(t[5], 0);
+        for(int i=0; i<6; ++i)
+            info.adfGeoTransform[i] = as<double>(t[6+i], 0.0);
+        info.nBlockXSize  = as<int>(t[12], 0);
+        info.nBlockYSize  = as<int>(t[13], 0);
+
+        unsigned nBands = as<unsigned>(t[14], 0);
+        if ( t.size() != 16 + 5*nBands )
+            continue;
+
+        info.bands.resize(nBands);
+        for(unsigned j=0; j<nBands; ++j)
+        {
+            BandInfo& band = info.bands[j];
+            band.colorInterpretation = (GDALColorInterp)as<int>(t[15+5*j], 0);
+            band.dataType            = (GDALDataType)as<int>(t[16+5*j], 0);
+            band.hasNoData           = as<int>(t[17+5*j], 0);
+            band.noDataValue         = as<double>(t[18+5*j], 0.0);
+            band.colorEntryCount     = as<int>(t[19+5*j], 0);
+        }
+        info.projection = t[15+5*nBands];
+
+        out[info.path] = info;
+    }
+}
+
+static void
+writeCatalog(std::ostream& out, const FileInfoVector& infos)
+{
+    out << GDAL_CATALOG_HEADER << "\n" << std::setprecision(17);
+
+    for(FileInfoVector::const_iterator i = infos.begin(); i != infos.end(); ++i)
+    {
+        out << i->path << '\t' << i->mtime << '\t' << i->size << '\t' << (i->isFileOK ? 1 : 0)
+            << '\t' << i->nRasterXSize << '\t' << i->nRasterYSize;
+        for(int k=0; k<6; ++k)
+            out << '\t' << i->adfGeoTransform[k];
+        out << '\t' << i->nBlockXSize << '\t' << i->nBlockYSize << '\t' << i->bands.size();
+        for(std::vector<BandInfo>::const_iterator b = i->bands.begin(); b != i->bands.end(); ++b)
+        {
+            out << '\t' << (int)b->colorInterpretation << '\t' << (int)b->dataType
+                << '\t' << b->hasNoData << '\t' << b->noDataValue << '\t' << b->colorEntryCount;
+        }
+        out << '\t' << i->projection << "\n";
+    }
+}
+
+/**
+ * Fills in a FileInfo for each file. Entries from a previous catalog are
+ * reused when the file's modification time and size haven't changed; the
+ * rest are opened, in parallel on "numThreads" threads. Returns the number
+ * of files that had to be (re)scanned.
+ */
+static unsigned
+scanFiles(const std::vector<std::string>& files,
+          const std::map<std::string, FileInfo>& catalog,
+          unsigned numThreads,
+          FileInfoVector& out)
+{
+    out.resize( files.size() );
+
+    std::vector<unsigned> todo;
+    for(unsigned i=0; i<files.size(); ++i)
+    {
+        FileInfo& info = out[i];
+        info.path = files[i];
+        if ( !statFile(info.path, info.mtime, info.size) )
+        {
+            // not a plain file (a connection string or virtual path); always open it.
+            info.mtime = info.size = -1;
+            todo.push_back( i );
+            continue;
+        }
+
+        std::map<std::string, FileInfo>::const_iterator c = catalog.find( info.path );
+        if ( c != catalog.end() && c->second.mtime == info.mtime && c->second.size == info.size )
+            info = c->second;
+        else
+            todo.push_back( i );
+    }
+
+    if ( todo.empty() )
+        return 0;
+
+    numThreads = osg::clampBetween( numThreads, 1u, (unsigned)todo.size() );
+
+    OpenThreads::Atomic next;
+    std::vector<ScanThread*> threads;
+    for(unsigned i=0; i<numThreads; ++i)
+    {
+        threads.push_back( new ScanThread(out, todo, next) );
+        threads.back()->start();
+    }
+
+    for(unsigned i=0; i<threads.size(); ++i)
+    {
+        threads[i]->join();
+        delete threads[i];
+    }
+
+    return todo.size();
+}
+
 // "build_vrt()" is adapted from the gdalbuildvrt application. Following is
 // the copyright notice from the source. The original code can be found at
 // http://trac.osgeo.org/gdal/browser/trunk/gdal/apps/gdalbuildvrt.cpp
@@ -191,14 +495,16 @@ getFiles(const std::string &file, const std::vector<std::string> &exts, const st
  * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
  * DEALINGS IN THE SOFTWARE.
  ****************************************************************************/
+
+// Assembles the VRT from scanned file properties; the inputs are referenced
+// through proxy datasets, so nothing is opened here except to copy a palette.
+// Files that don't match the first usable one are marked as not OK.
 static GDALDatasetH
-build_vrt(std::vector<std::string> &files, ResolutionStrategy resolutionStrategy)
+build_vrt(FileInfoVector& infos, ResolutionStrategy resolutionStrategy)
 {
     GDAL_SCOPED_LOCK;
 
-    char* projectionRef = NULL;
-    int nBands = 0;
-    BandProperty* bandProperties = NULL;
+    const FileInfo* first = NULL;
     double minX = 0, minY = 0, maxX = 0, maxY = 0;
     int i,j;
     double we_res = 0;
@@ -206,199 +512,121 @@ build_vrt(std::vector<std::string> &files, ResolutionStrategy resolutionStrategy
     int rasterXSize;
     int rasterYSize;
     int nCount = 0;
-    int bFirst = TRUE;
+    int nBands = 0;
     VRTDatasetH hVRTDS = NULL;
+    const char* projectionRef = NULL;
 
-    int nInputFiles = files.size();
-
-    DatasetProperty* psDatasetProperties =
-            (DatasetProperty*) CPLMalloc(nInputFiles*sizeof(DatasetProperty));
+    int nInputFiles = infos.size();
 
     for(i=0;i<nInputFiles;i++)
     {
-        const char* dsFileName = files[i].c_str();
-
-        GDALTermProgress( 1.0 * (i+1) / nInputFiles, NULL, NULL);
+        FileInfo& info = infos[i];
+        if (!info.isFileOK)
+            continue;
 
-        GDALDatasetH hDS = GDALOpen(dsFileName, GA_ReadOnly );
-        psDatasetProperties[i].isFileOK = FALSE;
+        double product_minX = info.adfGeoTransform[GEOTRSFRM_TOPLEFT_X];
+        double product_maxY = info.adfGeoTransform[GEOTRSFRM_TOPLEFT_Y];
+        double product_maxX = product_minX + info.nRasterXSize * info.adfGeoTransform[GEOTRSFRM_WE_RES];
+        double product_minY = product_maxY + info.nRasterYSize * info.adfGeoTransform[GEOTRSFRM_NS_RES];
 
-        if (hDS)
+        if (!first)
         {
-            const char* proj = GDALGetProjectionRef(hDS);
-            if (!proj || strlen(proj) == 0)
-            {                
-                std::string prjLocation = osgDB::getNameLessExtension( std::string(dsFileName) ) + std::string(".prj");
-                ReadResult r = URI(prjLocation).readString();
-                if ( r.succeeded() )
-                {
-                    proj = CPLStrdup( r.getString().c_str() );
-                }                
-            }
-
-            GDALGetGeoTransform(hDS, psDatasetProperties[i].adfGeoTransform);
-            if (psDatasetProperties[i].adfGeoTransform[GEOTRSFRM_ROTATION_PARAM1] != 0 ||
-                psDatasetProperties[i].adfGeoTransform[GEOTRSFRM_ROTATION_PARAM2] != 0)
+            first = &info;
+            minX = product_minX;
+            minY = product_minY;
+            maxX = product_maxX;
+            maxY = product_maxY;
+        }
+        else
+        {
+            if (!EQUAL(info.projection.c_str(), first->projection.c_str()))
             {
-                fprintf( stderr, "GDAL Driver does not support rotated geo transforms. Skipping %s\n",
-                             dsFileName);
-                GDALClose(hDS);
+                OE_WARN << LC << "gdalbuildvrt does not support heterogenous projection. Skipping " << info.path << std::endl;
+                info.isFileOK = false;
                 continue;
             }
-            if (psDatasetProperties[i].adfGeoTransform[GEOTRSFRM_NS_RES] >= 0)
+            if (info.bands.size() != first->bands.size())
             {
-                fprintf( stderr, "GDAL Driver does not support positive NS resolution. Skipping %s\n",
-                             dsFileName);
-                GDALClose(hDS);
+                OE_WARN << LC << "gdalbuildvrt does not support heterogenous band numbers. Skipping " << info.path << std::endl;
+                info.isFileOK = false;
                 continue;
             }
-            psDatasetProperties[i].nRasterXSize = GDALGetRasterXSize(hDS);
-            psDatasetProperties[i].nRasterYSize = GDALGetRasterYSize(hDS);
-            double product_minX = psDatasetProperties[i].adfGeoTransform[GEOTRSFRM_TOPLEFT_X];
-            double product_maxY = psDatasetProperties[i].adfGeoTransform[GEOTRSFRM_TOPLEFT_Y];
-            double product_maxX = product_minX +
-                        GDALGetRasterXSize(hDS) * psDatasetProperties[i].adfGeoTransform[GEOTRSFRM_WE_RES];
-            double product_minY = product_maxY +
-                        GDALGetRasterYSize(hDS) * psDatasetProperties[i].adfGeoTransform[GEOTRSFRM_NS_RES];
-
-            GDALGetBlockSize(GDALGetRasterBand( hDS, 1 ),
-                             &psDatasetProperties[i].nBlockXSize,
-                             &psDatasetProperties[i].nBlockYSize);
-
-            if (bFirst)
+            for(j=0;j<(int)info.bands.size();j++)
             {
-                if (proj)
-                    projectionRef = CPLStrdup(proj);
-                minX = product_minX;
-                minY = product_minY;
-                maxX = product_maxX;
-                maxY = product_maxY;
-                nBands = GDALGetRasterCount(hDS);
-                bandProperties = (BandProperty*)CPLMalloc(nBands*sizeof(BandProperty));
-                for(j=0;j<nBands;j++)
+                const BandInfo& a = first->bands[j];
+                const BandInfo& b = info.bands[j];
+                if (a.colorInterpretation != b.colorInterpretation ||
+                    a.dataType != b.dataType ||
+                    a.colorEntryCount != b.colorEntryCount)
                 {
-                    GDALRasterBandH hRasterBand = GDALGetRasterBand( hDS, j+1 );
-                    bandProperties[j].colorInterpretation = GDALGetRasterColorInterpretation(hRasterBand);
-                    bandProperties[j].dataType = GDALGetRasterDataType(hRasterBand);
-                    if (bandProperties[j].colorInterpretation == GCI_PaletteIndex)
-                    {
-                        bandProperties[j].colorTable = GDALGetRasterColorTable( hRasterBand );
-                        if (bandProperties[j].colorTable)
-                        {
-                            bandProperties[j].colorTable = GDALCloneColorTable(bandProperties[j].colorTable);
-                        }
-                    }
-                    else
-                        bandProperties[j].colorTable = 0;
-                    bandProperties[j].noDataValue = GDALGetRasterNoDataValue(hRasterBand, &bandProperties[j].bHasNoData);
+                    /* We should check that the palette are the same too ! */
+                    break;
                 }
             }
-            else
+            if (j != (int)info.bands.size())
             {
-                if ((proj != NULL && projectionRef == NULL) ||
-                    (proj == NULL && projectionRef != NULL) ||
-                    (proj != NULL && projectionRef != NULL && EQUAL(proj, projectionRef) == FALSE))
-                {
-                    fprintf( stderr, "gdalbuildvrt does not support heterogenous projection. Skipping %s\n",dsFileName);
-                    GDALClose(hDS);
-                    continue;
-                }
-                int _nBands = GDALGetRasterCount(hDS);
-                if (nBands != _nBands)
-                {
-                    fprintf( stderr, "gdalbuildvrt does not support heterogenous band numbers. Skipping %s\n",
-                             dsFileName);
-                    GDALClose(hDS);
-                    continue;
-                }
-                for(j=0;j<nBands;j++)
-                {
-                    GDALRasterBandH hRasterBand = GDALGetRasterBand( hDS, j+1 );
-                    if (bandProperties[j].colorInterpretation != GDALGetRasterColorInterpretation(hRasterBand) ||
-                        bandProperties[j].dataType != GDALGetRasterDataType(hRasterBand))
-                    {
-                        fprintf( stderr, "gdalbuildvrt does not support heterogenous band characteristics. Skipping %s\n",
-                             dsFileName);
-                        GDALClose(hDS);
-                    }
-                    if (bandProperties[j].colorTable)
-                    {
-                        GDALColorTableH colorTable = GDALGetRasterColorTable( hRasterBand );
-                        if (colorTable == NULL ||
-                            GDALGetColorEntryCount(colorTable) != GDALGetColorEntryCount(bandProperties[j].colorTable))
-                        {
-                            fprintf( stderr, "gdalbuildvrt does not support heterogenous band characteristics. Skipping %s\n",
-                             dsFileName);
-                            GDALClose(hDS);
-                            break;
-                        }
-                        /* We should check that the palette are the same too ! */
-                    }
-                }
-                if (j != nBands)
-                    continue;
-                if (product_minX < minX) minX = product_minX;
-                if (product_minY < minY) minY = product_minY;
-                if (product_maxX > maxX) maxX = product_maxX;
-                if (product_maxY > maxY) maxY = product_maxY;
+                OE_WARN << LC << "gdalbuildvrt does not support heterogenous band characteristics. Skipping " << info.path << std::endl;
+                info.isFileOK = false;
+                continue;
+            }
+            if (product_minX < minX) minX = product_minX;
+            if (product_minY < minY) minY = product_minY;
+            if (product_maxX > maxX) maxX = product_maxX;
+            if (product_maxY > maxY) maxY = product_maxY;
+        }
+
+        if (resolutionStrategy == AVERAGE_RESOLUTION)
+        {
+            we_res += info.adfGeoTransform[GEOTRSFRM_WE_RES];
+            ns_res += info.adfGeoTransform[GEOTRSFRM_NS_RES];
+        }
+        else
+        {
+            if (nCount == 0)
+            {
+                we_res = info.adfGeoTransform[GEOTRSFRM_WE_RES];
+                ns_res = info.adfGeoTransform[GEOTRSFRM_NS_RES];
             }
-            if (resolutionStrategy == AVERAGE_RESOLUTION)
+            else if (resolutionStrategy == HIGHEST_RESOLUTION)
             {
-                we_res += psDatasetProperties[i].adfGeoTransform[GEOTRSFRM_WE_RES];
-                ns_res += psDatasetProperties[i].adfGeoTransform[GEOTRSFRM_NS_RES];
+                we_res = MIN(we_res, info.adfGeoTransform[GEOTRSFRM_WE_RES]);
+                /* Yes : as ns_res is negative, the highest resolution is the max value */
+                ns_res = MAX(ns_res, info.adfGeoTransform[GEOTRSFRM_NS_RES]);
             }
             else
             {
-                if (bFirst)
-                {
-                    we_res = psDatasetProperties[i].adfGeoTransform[GEOTRSFRM_WE_RES];
-                    ns_res = psDatasetProperties[i].adfGeoTransform[GEOTRSFRM_NS_RES];
-                }
-                else if (resolutionStrategy == HIGHEST_RESOLUTION)
-                {
-                    we_res = MIN(we_res, psDatasetProperties[i].adfGeoTransform[GEOTRSFRM_WE_RES]);
-                    /* Yes : as ns_res is negative, the highest resolution is the max value */
-                    ns_res = MAX(ns_res, psDatasetProperties[i].adfGeoTransform[GEOTRSFRM_NS_RES]);
-                }
-                else
-                {
-                    we_res = MAX(we_res, psDatasetProperties[i].adfGeoTransform[GEOTRSFRM_WE_RES]);
-                    /* Yes : as ns_res is negative, the lowest resolution is the min value */
-                    ns_res = MIN(ns_res, psDatasetProperties[i].adfGeoTransform[GEOTRSFRM_NS_RES]);
-                }
+                we_res = MAX(we_res, info.adfGeoTransform[GEOTRSFRM_WE_RES]);
+                /* Yes : as ns_res is negative, the lowest resolution is the min value */
+                ns_res = MIN(ns_res, info.adfGeoTransform[GEOTRSFRM_NS_RES]);
             }
-
-            psDatasetProperties[i].isFileOK = 1;
-            nCount ++;
-            bFirst = FALSE;
-            GDALClose(hDS);
-        }
-        else
-        {
-            fprintf( stderr, "Warning : can't open %s. Skipping it\n", dsFileName);
         }
+
+        nCount ++;
     }
-    
+
     if (nCount == 0)
-        goto end;
-    
+        return NULL;
+
     if (resolutionStrategy == AVERAGE_RESOLUTION)
     {
         we_res /= nCount;
         ns_res /= nCount;
     }
-    
+
+    nBands = first->bands.size();
+    if (!first->projection.empty())
+        projectionRef = first->projection.c_str();
+
     rasterXSize = (int)(0.5 + (maxX - minX) / we_res);
     rasterYSize = (int)(0.5 + (maxY - minY) / -ns_res);
-    
+
     hVRTDS = VRTCreate(rasterXSize, rasterYSize);
-    
+
     if (projectionRef)
     {
-        //OE_NOTICE << "Setting projection to " << projectionRef << std::endl;
         GDALSetProjection(hVRTDS, projectionRef);
     }
-    
+
     double adfGeoTransform[6];
     adfGeoTransform[GEOTRSFRM_TOPLEFT_X] = minX;
     adfGeoTransform[GEOTRSFRM_WE_RES] = we_res;
@@ -407,45 +635,63 @@ build_vrt(std::vector<std::string> &files, ResolutionStrategy resolutionStrategy
     adfGeoTransform[GEOTRSFRM_ROTATION_PARAM2] = 0;
     adfGeoTransform[GEOTRSFRM_NS_RES] = ns_res;
     GDALSetGeoTransform(hVRTDS, adfGeoTransform);
-    
+
+    // the catalog doesn't hold palettes, so borrow them from the first file.
+    GDALDatasetH hPaletteDS = NULL;
+    for(j=0;j<nBands && !hPaletteDS;j++)
+    {
+        if (first->bands[j].colorInterpretation == GCI_PaletteIndex && first->bands[j].colorEntryCount > 0)
+            hPaletteDS = GDALOpen(first->path.c_str(), GA_ReadOnly);
+    }
+
     for(j=0;j<nBands;j++)
     {
+        const BandInfo& band = first->bands[j];
         GDALRasterBandH hBand;
-        GDALAddBand(hVRTDS, bandProperties[j].dataType, NULL);
+        GDALAddBand(hVRTDS, band.dataType, NULL);
         hBand = GDALGetRasterBand(hVRTDS, j+1);
-        GDALSetRasterColorInterpretation(hBand, bandProperties[j].colorInterpretation);
-        if (bandProperties[j].colorInterpretation == GCI_PaletteIndex)
+        GDALSetRasterColorInterpretation(hBand, band.colorInterpretation);
+        if (band.colorInterpretation == GCI_PaletteIndex && hPaletteDS)
         {
-            GDALSetRasterColorTable(hBand, bandProperties[j].colorTable);
+            GDALColorTableH colorTable = GDALGetRasterColorTable( GDALGetRasterBand(hPaletteDS, j+1) );
+            if (colorTable)
+                GDALSetRasterColorTable(hBand, colorTable);
         }
-        if (bandProperties[j].bHasNoData)
-            GDALSetRasterNoDataValue(hBand, bandProperties[j].noDataValue);
+        if (band.hasNoData)
+            GDALSetRasterNoDataValue(hBand, band.noDataValue);
     }
 
+    if (hPaletteDS)
+        GDALClose(hPaletteDS);
+
     for(i=0;i<nInputFiles;i++)
     {
-        if (psDatasetProperties[i].isFileOK == 0)
+        const FileInfo& info = infos[i];
+        if (!info.isFileOK)
             continue;
-        const char* dsFileName = files[i].c_str();
+        const char* dsFileName = info.path.c_str();
 
         bool isProxy = true;
 
 #if GDAL_VERSION_1_6_OR_NEWER
 
         //Use a proxy dataset if possible.  This helps with huge amount of files to keep the # of handles down
+        double adfProxyGeoTransform[6];
+        memcpy(adfProxyGeoTransform, info.adfGeoTransform, sizeof(adfProxyGeoTransform));
+
         GDALProxyPoolDatasetH hDS =
                GDALProxyPoolDatasetCreate(dsFileName,
-                                         psDatasetProperties[i].nRasterXSize,
-                                         psDatasetProperties[i].nRasterYSize,
+                                         info.nRasterXSize,
+                                         info.nRasterYSize,
                                          GA_ReadOnly, TRUE, projectionRef,
-                                         psDatasetProperties[i].adfGeoTransform);
+                                         adfProxyGeoTransform);
 
         for(j=0;j<nBands;j++)
         {
             GDALProxyPoolDatasetAddSrcBandDescription(hDS,
-                                            bandProperties[j].dataType,
-                                            psDatasetProperties[i].nBlockXSize,
-                                            psDatasetProperties[i].nBlockYSize);
+                                            info.bands[j].dataType,
+                                            info.nBlockXSize,
+                                            info.nBlockYSize);
         }
         isProxy = true;
         OE_DEBUG << LC << "Using GDALProxyPoolDatasetH" << std::endl;
@@ -460,13 +706,13 @@ build_vrt(std::vector<std::string> &files, ResolutionStrategy resolutionStrategy
 #endif
 
         int xoffset = (int)
-                (0.5 + (psDatasetProperties[i].adfGeoTransform[GEOTRSFRM_TOPLEFT_X] - minX) / we_res);
+                (0.5 + (info.adfGeoTransform[GEOTRSFRM_TOPLEFT_X] - minX) / we_res);
         int yoffset = (int)
-                (0.5 + (maxY - psDatasetProperties[i].adfGeoTransform[GEOTRSFRM_TOPLEFT_Y]) / -ns_res);
+                (0.5 + (maxY - info.adfGeoTransform[GEOTRSFRM_TOPLEFT_Y]) / -ns_res);
         int dest_width = (int)
-                (0.5 + psDatasetProperties[i].nRasterXSize * psDatasetProperties[i].adfGeoTransform[GEOTRSFRM_WE_RES] / we_res);
+                (0.5 + info.nRasterXSize * info.adfGeoTransform[GEOTRSFRM_WE_RES] / we_res);
         int dest_height = (int)
-                (0.5 + psDatasetProperties[i].nRasterYSize * psDatasetProperties[i].adfGeoTransform[GEOTRSFRM_NS_RES] / ns_res);
+                (0.5 + info.nRasterYSize * info.adfGeoTransform[GEOTRSFRM_NS_RES] / ns_res);
 
         for(j=0;j<nBands;j++)
         {
@@ -475,8 +721,8 @@ build_vrt(std::vector<std::string> &files, ResolutionStrategy resolutionStrategy
             /* Place the raster band at the right position in the VRT */
             VRTAddSimpleSource(hVRTBand, GDALGetRasterBand((GDALDatasetH)hDS, j + 1),
                                0, 0,
-                               psDatasetProperties[i].nRasterXSize,
-                               psDatasetProperties[i].nRasterYSize,
+                               info.nRasterXSize,
+                               info.nRasterYSize,
                                xoffset, yoffset,
                                dest_width, dest_height, "near",
                                VRT_NODATA_UNSET);
@@ -487,14 +733,7 @@ build_vrt(std::vector<std::string> &files, ResolutionStrategy resolutionStrategy
           GDALDereferenceDataset(hDS);
         }
     }
-end:
-    CPLFree(psDatasetProperties);
-    for(j=0;j<nBands;j++)
-    {
-        GDALDestroyColorTable(bandProperties[j].colorTable);
-    }
-    CPLFree(bandProperties);
-    CPLFree(projectionRef);
+
     return hVRTDS;
 }
 
@@ -721,7 +960,10 @@ public:
             source = _options.connection().value();
 
         //URI uri = _options.url().value();
-        
+
+        // properties of the individual files, when combining several into a VRT
+        FileInfoVector fileInfos;
+
         if (useExternalDataset == false)
         {
             std::vector<std::string> files;
@@ -768,70 +1010,70 @@ public:
             //If we found more than one file, try to combine them into a single logical dataset
             if (files.size() > 1)
             {
-                std::string vrtKey = "combined.vrt";
-
-                //Get the GDAL VRT driver
-                GDALDriver* vrtDriver = (GDALDriver*)GDALGetDriverByName("VRT");
-                
-                //Try to load the VRT file from the cache so we don't have to build it each time.
-                if (_cacheBin.valid())
-                {                
-                    ReadResult result = _cacheBin->readString( vrtKey, 0 );
+                // Read the catalog of file properties from the last run, if there is one, so we
+                // only have to open the files that are new or have changed since.
+                std::map<std::string, FileInfo> catalog;
+                std::string catalogKey = "catalog";
+
+                if ( _options.catalog().isSet() )
+                {
+                    std::ifstream input( _options.catalog()->full().c_str() );
+                    if ( input.is_open() )
+                        readCatalog( input, catalog );
+                }
+                else if (_cacheBin.valid())
+                {
+                    ReadResult result = _cacheBin->readString( catalogKey, 0 );
                     if (result.succeeded())
-                    {                        
-                        _srcDS = (GDALDataset*)GDALOpen(result.getString().c_str(), GA_ReadOnly );
-                        if (_srcDS)
-                        {
-                            OE_INFO << LC << "Read VRT from cache!" << std::endl;
-                        }
+                    {
+                        std::istringstream input( result.getString() );
+                        readCatalog( input, catalog );
                     }
                 }
 
-                //Build the dataset if we didn't already load it
-                if (!_srcDS)
-                {                 
-                    //We couldn't get the VRT from the cache, so build it
-                    osg::Timer_t startTime = osg::Timer::instance()->tick();                    
-                    _srcDS = (GDALDataset*)build_vrt(files, HIGHEST_RESOLUTION);
-                    osg::Timer_t endTime = osg::Timer::instance()->tick();                                                            
-                    OE_INFO << LC << "Built VRT in " << osg::Timer::instance()->delta_s(startTime, endTime) << " s" << std::endl;
-
-                    if (_srcDS)
+                unsigned numThreads = _options.scanThreads().isSet() ?
+                    _options.scanThreads().value() :
+                    (unsigned)osg::maximum( OpenThreads::GetNumberOfProcessors(), 1 );
+
+                osg::Timer_t startTime = osg::Timer::instance()->tick();
+                unsigned numScanned = scanFiles( files, catalog, numThreads, fileInfos );
+                osg::Timer_t scanTime = osg::Timer::instance()->tick();
+
+                OE_INFO << LC << "Scanned " << numScanned << " of " << files.size() << " files ("
+                    << (files.size()-numScanned) << " from the catalog) in "
+                    << osg::Timer::instance()->delta_s(startTime, scanTime) << " s" << std::endl;
+
+                // Record the catalog for next time, if anything changed.
+                if ( numScanned > 0 || catalog.size() != fileInfos.size() )
+                {
+                    std::stringstream buf;
+                    writeCatalog( buf, fileInfos );
+
+                    if ( _options.catalog().isSet() )
                     {
-                        //Cache the VRT so we don't have to build it next time.
-                        if (_cacheBin)
-                        {
-                            std::string vrtFile = getTempName( "", ".vrt");
-                            OE_INFO << "Writing temp VRT to " << vrtFile << std::endl;
-                         
-                            if (vrtDriver)
-                            {                    
-                                vrtDriver->CreateCopy(vrtFile.c_str(), _srcDS, 0, 0, 0, 0 );                                                        
-
-
-                                //We created the temp file, now read the contents back                            
-                                std::ifstream input( vrtFile.c_str() );
-                                if ( input.is_open() )
-                                {
-                                    input >> std::noskipws;
-                                    std::stringstream buf;
-                                    buf << input.rdbuf();                                
-                                    std::string vrtContents = buf.str();                                
-                                    osg::ref_ptr< StringObject > strObject = new StringObject( vrtContents );
-                                    _cacheBin->write( vrtKey, strObject.get() );
-                                }
-                            }                                                
-                            if (osgDB::fileExists( vrtFile ) )
-                            {
-                                remove( vrtFile.c_str() );
-                            }
-                        }
+                        std::string catalogFile = _options.catalog()->full();
+                        osgDB::makeDirectoryForFile( catalogFile );
+                        std::ofstream output( catalogFile.c_str() );
+                        if ( output.is_open() )
+                            output << buf.str();
+                        else
+                            OE_WARN << LC << "Failed to write catalog to " << catalogFile << std::endl;
                     }
-                    else
+                    else if (_cacheBin.valid())
                     {
-                        return Status::Error( "Failed to build VRT from input datasets" );
+                        osg::ref_ptr< StringObject > strObject = new StringObject( buf.str() );
+                        _cacheBin->write( catalogKey, strObject.get() );
                     }
                 }
+
+                _srcDS = (GDALDataset*)build_vrt(fileInfos, HIGHEST_RESOLUTION);
+                osg::Timer_t endTime = osg::Timer::instance()->tick();
+                OE_INFO << LC << "Built VRT in " << osg::Timer::instance()->delta_s(scanTime, endTime) << " s" << std::endl;
+
+                if (!_srcDS)
+                {
+                    return Status::Error( "Failed to build VRT from input datasets" );
+                }
             }
             else
             {            
@@ -1103,7 +1345,36 @@ public:
         _extents = GeoExtent( srs, minX, minY, maxX, maxY);
         GeoExtent profile_extent = _extents.transform( profile->getSRS() );
 
-        getDataExtents().push_back( DataExtent(profile_extent, 0, _maxDataLevel) );
+        // A VRT over many files may be mostly empty, so record each file's own extent;
+        // tiles that fall between the files then never get requested. (Not possible
+        // with an override profile, which discards the files' georeferencing.)
+        bool isPolar = profile->getSRS()->isGeographic() && (src_srs->isNorthPolar() || src_srs->isSouthPolar());
+        unsigned numExtents = getDataExtents().size();
+        if ( fileInfos.size() > 1 && !getProfile() && !isPolar )
+        {
+            for(FileInfoVector::const_iterator i = fileInfos.begin(); i != fileInfos.end(); ++i)
+            {
+                if ( !i->isFileOK )
+                    continue;
+
+                double fileMinX = i->adfGeoTransform[GEOTRSFRM_TOPLEFT_X];
+                double fileMaxY = i->adfGeoTransform[GEOTRSFRM_TOPLEFT_Y];
+                double fileMaxX = fileMinX + i->nRasterXSize * i->adfGeoTransform[GEOTRSFRM_WE_RES];
+                double fileMinY = fileMaxY + i->nRasterYSize * i->adfGeoTransform[GEOTRSFRM_NS_RES];
+
+                GeoExtent fileExtent = GeoExtent( src_srs.get(), fileMinX, fileMinY, fileMaxX, fileMaxY ).transform( profile->getSRS() );
+                if ( fileExtent.isValid() )
+                {
+                    getDataExtents().push_back( DataExtent(fileExtent, 0, _maxDataLevel) );
+                }
+            }
+            OE_INFO << LC << "Recorded " << (getDataExtents().size()-numExtents) << " data extents" << std::endl;
+        }
+
+        if ( getDataExtents().size() == numExtents )
+        {
+            getDataExtents().push_back( DataExtent(profile_extent, 0, _maxDataLevel) );
+        }
 
         //Set the profile
         setProfile( profile );
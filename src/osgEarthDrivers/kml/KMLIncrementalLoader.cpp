@@ -0,0 +1,588 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2013 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "KMLIncrementalLoader"
+#include "KML_Container"
+#include "KML_Placemark"
+#include "KML_Style"
+#include "KML_StyleMap"
+#include "KML_GroundOverlay"
+#include "KML_ScreenOverlay"
+#include "KML_PhotoOverlay"
+#include "KML_NetworkLink"
+#include "KML_NetworkLinkControl"
+#include <osgEarth/Registry>
+#include <osgEarth/NodeUtils>
+#include <osgEarth/Decluttering>
+#include <osg/Timer>
+#include <OpenThreads/Thread>
+
+using namespace osgEarth_kml;
+using namespace osgEarth;
+
+//------------------------------------------------------------------------
+
+// A set of placemarks to build together on a worker thread, along with a
+// private copy of everything the build touches.
+struct KMLIncrementalLoader::Batch
+{
+    osg::ref_ptr<osg::Group> _parent;
+    std::vector<Config>      _placemarks;
+    KMLOptions               _options;
+    KMLContext               _cx;
+};
+
+// Builds one batch. Holds a raw pointer to the loader, since the loader
+// owns the task service and waits for its tasks before going away.
+struct KMLIncrementalLoader::BuildTask : public TaskRequest
+{
+    BuildTask( KMLIncrementalLoader* loader, Batch* batch ) : _loader(loader), _batch(batch) { }
+
+    void operator()( ProgressCallback* progress )
+    {
+        Batch* batch = _batch;
+        _batch = 0L;
+        _loader->build( batch );
+    }
+
+    virtual ~BuildTask()
+    {
+        // only happens if the task never ran
+        delete _batch;
+    }
+
+    KMLIncrementalLoader* _loader;
+    Batch*                _batch;
+};
+
+// Reads a local file in the background.
+class KMLIncrementalLoader::ParseThread : public OpenThreads::Thread
+{
+public:
+    ParseThread( KMLIncrementalLoader* loader, const URI& uri ) : _loader(loader), _uri(uri) { }
+
+    void run()
+    {
+        URIStream stream( _uri );
+        std::istream& in = stream;
+        if ( !in.good() )
+        {
+            OE_WARN << LC << "Failed to open \"" << _uri.full() << "\"" << std::endl;
+        }
+        _loader->parse( in );
+    }
+
+private:
+    KMLIncrementalLoader* _loader;
+    URI                   _uri;
+};
+
+//------------------------------------------------------------------------
+
+KMLIncrementalGroup::KMLIncrementalGroup( KMLIncrementalLoader* loader ) :
+_loader( loader )
+{
+    // merging happens during the update traversal.
+    ADJUST_UPDATE_TRAV_COUNT( this, 1 );
+}
+
+void
+KMLIncrementalGroup::traverse( osg::NodeVisitor& nv )
+{
+    if ( _loader.valid() && nv.getVisitorType() == osg::NodeVisitor::UPDATE_VISITOR )
+    {
+        if ( _loader->merge(this) )
+        {
+            // all done; release the loader and its worker threads.
+            _loader = 0L;
+            ADJUST_UPDATE_TRAV_COUNT( this, -1 );
+        }
+    }
+
+    osg::Group::traverse( nv );
+}
+
+//------------------------------------------------------------------------
+
+KMLIncrementalLoader::KMLIncrementalLoader(MapNode*              mapNode,
+                                           const KMLOptions*     options,
+                                           const osgDB::Options* dbOptions ) :
+_mapNode       ( mapNode ),
+_parseThread   ( 0L ),
+_batch         ( 0L ),
+_pendingBatches( 0 ),
+_numParsed     ( 0 ),
+_numBuilt      ( 0 ),
+_numLoaded     ( 0 ),
+_parsing       ( false ),
+_canceled      ( false ),
+_reported      ( false ),
+_startTime     ( 0 )
+{
+    // the options must outlive the caller's copy, so take our own.
+    if ( options )
+        _options = *options;
+
+    _batchSize = osg::maximum( 1u, _options.incrementalBatchSize().get() );
+
+    int numThreads = osg::maximum( 1, (int)OpenThreads::GetNumberOfProcessors() );
+    _service = new TaskService( "KML Loader", numThreads );
+
+    // bound the number of parsed-but-unbuilt placemarks so that memory
+    // use stays flat no matter how large the document is.
+    _maxPendingBatches = 2 * numThreads;
+
+    _referrer = URIContext(dbOptions).referrer();
+
+    _cx._mapNode = mapNode;
+    _cx._sheet   = new StyleSheet();
+    _cx._options = &_options;
+    _cx._srs     = SpatialReference::create( "wgs84", "egm96" );
+
+    // clone the dbOptions, and install a resource cache if there isn't one already:
+    if ( !URIResultCache::from(dbOptions) )
+    {
+        osgDB::Options* newOptions = Registry::instance()->cloneOrCreateOptions( dbOptions );
+        _uriCache.apply( newOptions );
+        _cx._dbOptions = newOptions;
+    }
+    else
+    {
+        _cx._dbOptions = dbOptions;
+    }
+
+    if ( _options.iconAndLabelGroup().valid() && _options.declutter() == true )
+    {
+        Decluttering::setEnabled( _options.iconAndLabelGroup()->getOrCreateStateSet(), true );
+    }
+}
+
+KMLIncrementalLoader::~KMLIncrementalLoader()
+{
+    cancel();
+
+    if ( _parseThread )
+    {
+        _parseThread->join();
+        delete _parseThread;
+    }
+
+    // waits for any running build tasks, and discards the rest.
+    _service = 0L;
+
+    delete _batch;
+}
+
+osg::Node*
+KMLIncrementalLoader::loadInBackground( const URI& uri )
+{
+    _referrer = uri.full();
+
+    KMLIncrementalGroup* root = new KMLIncrementalGroup( this );
+    root->setName( _referrer );
+
+    start();
+
+    _parseThread = new ParseThread( this, uri );
+    _parseThread->start();
+
+    return root;
+}
+
+osg::Node*
+KMLIncrementalLoader::load( std::istream& in )
+{
+    osg::ref_ptr<osg::Group> root = new osg::Group();
+    root->setName( _referrer );
+
+    start();
+    parse( in );
+
+    // wait for the builders to catch up:
+    std::deque<MergeEntry> entries;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+        while( _pendingBatches > 0 )
+            _batchCompleted.wait( &_mutex );
+        entries.swap( _mergeQueue );
+    }
+
+    // nothing is live yet, so merge everything right here.
+    mergeInto( root.get(), entries );
+    finish();
+
+    return root.release();
+}
+
+void
+KMLIncrementalLoader::start()
+{
+    _startTime = osg::Timer::instance()->tick();
+    _parsing   = true;
+
+    // a NULL parent stands for the root node, which the loader does not
+    // reference (the root owns the loader).
+    _cx._groupStack.push( osg::ref_ptr<osg::Group>() );
+
+    if ( _options.progressCallback().valid() )
+        _options.progressCallback()->onStarted();
+}
+
+void
+KMLIncrementalLoader::parse( std::istream& in )
+{
+    KMLStreamParser parser( in, _referrer );
+    if ( !parser.parse(*this) && !parser.getError().empty() )
+    {
+        OE_WARN << LC << "Error in KML document: " << parser.getError() << std::endl;
+        if ( !_referrer.empty() )
+            OE_WARN << LC << _referrer << std::endl;
+    }
+
+    // build whatever is left over:
+    dispatch();
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+    _parsing = false;
+    _batchCompleted.broadcast();
+}
+
+void
+KMLIncrementalLoader::startContainer( const Config& conf )
+{
+    // placemarks read so far belong to the enclosing container.
+    dispatch();
+
+    osg::ref_ptr<osg::Group> group = new osg::Group();
+
+    KML_Container container;
+    container.build( conf, _cx, group.get() );
+
+    enqueue( _cx._groupStack.top().get(), group.get(), 0 );
+    _cx._groupStack.push( group.get() );
+}
+
+void
+KMLIncrementalLoader::endContainer()
+{
+    dispatch();
+    _cx._groupStack.pop();
+}
+
+bool
+KMLIncrementalLoader::element( const Config& conf )
+{
+    const std::string& key = conf.key();
+
+    if ( key == "placemark" )
+    {
+        // picks up any inline styles, as the scan pass does when reading the whole document.
+        KML_Placemark placemark;
+        placemark.scan( conf, _cx );
+        placemark.scan2( conf, _cx );
+
+        if ( !_batch )
+            _batch = new Batch();
+
+        _batch->_placemarks.push_back( conf );
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+            ++_numParsed;
+        }
+
+        if ( _batch->_placemarks.size() >= _batchSize )
+            dispatch();
+    }
+
+    else if ( key == "style" )
+    {
+        KML_Style style;
+        style.scan( conf, _cx );
+    }
+
+    else if ( key == "stylemap" )
+    {
+        KML_StyleMap styleMap;
+        styleMap.scan( conf, _cx );
+        styleMap.scan2( conf, _cx );
+    }
+
+    else if ( key == "networklinkcontrol" )
+    {
+        KML_NetworkLinkControl control;
+        control.scan( conf, _cx );
+    }
+
+    else if ( key != "schema" )
+    {
+        // overlays and network links are rare and light; build them right here.
+        osg::ref_ptr<osg::Group> temp = new osg::Group();
+        _cx._groupStack.push( temp.get() );
+
+        if ( key == "groundoverlay" ) {
+            KML_GroundOverlay overlay;
+            overlay.scan( conf, _cx ); overlay.scan2( conf, _cx ); overlay.build( conf, _cx );
+        }
+        else if ( key == "screenoverlay" ) {
+            KML_ScreenOverlay overlay;
+            overlay.scan( conf, _cx ); overlay.scan2( conf, _cx ); overlay.build( conf, _cx );
+        }
+        else if ( key == "photooverlay" ) {
+            KML_PhotoOverlay overlay;
+            overlay.scan( conf, _cx ); overlay.scan2( conf, _cx ); overlay.build( conf, _cx );
+        }
+        else if ( key == "networklink" ) {
+            KML_NetworkLink link;
+            link.scan( conf, _cx ); link.scan2( conf, _cx ); link.build( conf, _cx );
+        }
+
+        _cx._groupStack.pop();
+
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+            ++_numParsed;
+        }
+
+        for( unsigned i=0; i<temp->getNumChildren(); ++i )
+        {
+            enqueue( _cx._groupStack.top().get(), temp->getChild(i), i == 0 ? 1 : 0 );
+        }
+    }
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+    return !_canceled;
+}
+
+void
+KMLIncrementalLoader::dispatch()
+{
+    if ( !_batch )
+        return;
+
+    Batch* batch = _batch;
+    _batch = 0L;
+
+    // give the batch its own copy of the context so the workers don't share
+    // any mutable state with the parser or with each other.
+    batch->_parent       = _cx._groupStack.top().get();
+    batch->_options      = _options;
+    batch->_cx._mapNode  = _cx._mapNode;
+    batch->_cx._options  = &batch->_options;
+    batch->_cx._srs      = _cx._srs.get();
+    batch->_cx._dbOptions= _cx._dbOptions.get();
+    batch->_cx._sheet    = new StyleSheet();
+
+    // copy over the shared styles the batch refers to.
+    for( std::vector<Config>::const_iterator i = batch->_placemarks.begin(); i != batch->_placemarks.end(); ++i )
+    {
+        if ( i->hasValue("styleurl") )
+        {
+            const std::string& url = i->value("styleurl");
+            const Style* style = _cx._sheet->getStyle( url, false );
+            if ( style && !batch->_cx._sheet->getStyle(url, false) )
+                batch->_cx._sheet->addStyle( *style );
+        }
+    }
+
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+
+        while( _pendingBatches >= _maxPendingBatches && !_canceled )
+            _batchCompleted.wait( &_mutex );
+
+        if ( _canceled )
+        {
+            delete batch;
+            return;
+        }
+
+        ++_pendingBatches;
+    }
+
+    _service->add( new BuildTask(this, batch) );
+}
+
+void
+KMLIncrementalLoader::build( Batch* batch )
+{
+    bool canceled;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+        canceled = _canceled;
+    }
+
+    unsigned count = 0;
+
+    osg::ref_ptr<MapNode> mapNode = _mapNode.get();
+    if ( !canceled && mapNode.valid() )
+    {
+        osg::ref_ptr<osg::Group> group = new osg::Group();
+        batch->_cx._groupStack.push( group.get() );
+
+        // screen-space items go into a group of our own, merged into the
+        // user's group later on, since that group is probably live.
+        osg::ref_ptr<osg::Group> iconsAndLabels;
+        if ( _options.iconAndLabelGroup().valid() )
+        {
+            iconsAndLabels = new osg::Group();
+            batch->_options.iconAndLabelGroup() = iconsAndLabels.get();
+        }
+
+        for( std::vector<Config>::const_iterator i = batch->_placemarks.begin(); i != batch->_placemarks.end(); ++i )
+        {
+            KML_Placemark placemark;
+            placemark.build( *i, batch->_cx );
+            ++count;
+        }
+
+        if ( iconsAndLabels.valid() && iconsAndLabels->getNumChildren() > 0 )
+            enqueue( _options.iconAndLabelGroup().get(), iconsAndLabels.get(), 0 );
+
+        enqueue( batch->_parent.get(), group.get(), count );
+    }
+
+    delete batch;
+
+    unsigned numBuilt, numParsed;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+        --_pendingBatches;
+        _numBuilt += count;
+        numBuilt  = _numBuilt;
+        numParsed = _numParsed;
+        _batchCompleted.broadcast();
+    }
+
+    ProgressCallback* progress = _options.progressCallback().get();
+    if ( progress && count > 0 )
+    {
+        if ( progress->reportProgress((double)numBuilt, (double)numParsed, 0, 1, _referrer) )
+            cancel();
+    }
+}
+
+void
+KMLIncrementalLoader::enqueue( osg::Group* parent, osg::Node* child, unsigned numFeatures )
+{
+    MergeEntry entry;
+    entry._parent      = parent;
+    entry._node        = child;
+    entry._numFeatures = numFeatures;
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+    _mergeQueue.push_back( entry );
+}
+
+bool
+KMLIncrementalLoader::merge( osg::Group* root )
+{
+    std::deque<MergeEntry> entries;
+    bool done;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+        entries.swap( _mergeQueue );
+        done = _canceled || (!_parsing && _pendingBatches == 0);
+    }
+
+    mergeInto( root, entries );
+
+    if ( done )
+        finish();
+
+    return done;
+}
+
+void
+KMLIncrementalLoader::mergeInto( osg::Group* root, std::deque<MergeEntry>& entries )
+{
+    unsigned count = 0;
+    for( std::deque<MergeEntry>::iterator i = entries.begin(); i != entries.end(); ++i )
+    {
+        osg::Group* parent = i->_parent.valid() ? i->_parent.get() : root;
+        parent->addChild( i->_node.get() );
+        count += i->_numFeatures;
+    }
+
+    if ( count > 0 )
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+        _numLoaded += count;
+    }
+}
+
+void
+KMLIncrementalLoader::finish()
+{
+    if ( _reported )
+        return;
+    _reported = true;
+
+    double t = osg::Timer::instance()->delta_s( _startTime, osg::Timer::instance()->tick() );
+
+    unsigned numLoaded, numParsed;
+    bool     canceled;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+        numLoaded = _numLoaded;
+        numParsed = _numParsed;
+        canceled  = _canceled;
+    }
+
+    OE_INFO << LC << "Loaded " << numLoaded << " of " << numParsed
+        << " features from \"" << _referrer << "\" in " << t << "s"
+        << (canceled ? " (canceled)" : "") << std::endl;
+
+    URIResultCache* cacheUsed = URIResultCache::from(_cx._dbOptions.get());
+    if ( cacheUsed )
+    {
+        CacheStats stats = cacheUsed->getStats();
+        OE_INFO << LC << "URI Cache: " << stats._queries << " reads, " << (stats._hitRatio*100.0) << "% hits" << std::endl;
+    }
+
+    if ( _options.progressCallback().valid() )
+        _options.progressCallback()->onCompleted();
+}
+
+unsigned
+KMLIncrementalLoader::getNumFeaturesParsed() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+    return _numParsed;
+}
+
+unsigned
+KMLIncrementalLoader::getNumFeaturesLoaded() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+    return _numLoaded;
+}
+
+bool
+KMLIncrementalLoader::isComplete() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+    return _canceled || (!_parsing && _pendingBatches == 0 && _mergeQueue.empty());
+}
+
+void
+KMLIncrementalLoader::cancel()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+    _canceled = true;
+    _batchCompleted.broadcast();
+}
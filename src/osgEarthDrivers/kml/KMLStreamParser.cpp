@@ -0,0 +1,533 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2013 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "KMLStreamParser"
+#include <osgEarth/StringUtils>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+using namespace osgEarth_kml;
+using namespace osgEarth;
+
+namespace
+{
+    const int END_OF_STREAM = std::char_traits<char>::eof();
+
+    bool isSpace( int c )
+    {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+    }
+
+    // Elements that open a new group in the scene graph.
+    bool isContainer( const std::string& tag )
+    {
+        return tag == "document" || tag == "folder";
+    }
+
+    // Elements beneath a container that are delivered whole to the handler.
+    // Anything else is a property of the container itself.
+    bool isDeliverable( const std::string& tag )
+    {
+        return
+            tag == "placemark"          ||
+            tag == "style"              ||
+            tag == "stylemap"           ||
+            tag == "schema"             ||
+            tag == "groundoverlay"      ||
+            tag == "screenoverlay"      ||
+            tag == "photooverlay"       ||
+            tag == "networklink"        ||
+            tag == "networklinkcontrol";
+    }
+
+    void appendUTF8( unsigned cp, std::string& out )
+    {
+        if ( cp < 0x80 ) {
+            out += (char)cp;
+        }
+        else if ( cp < 0x800 ) {
+            out += (char)(0xC0 | (cp >> 6));
+            out += (char)(0x80 | (cp & 0x3F));
+        }
+        else if ( cp < 0x10000 ) {
+            out += (char)(0xE0 | (cp >> 12));
+            out += (char)(0x80 | ((cp >> 6) & 0x3F));
+            out += (char)(0x80 | (cp & 0x3F));
+        }
+        else {
+            out += (char)(0xF0 | (cp >> 18));
+            out += (char)(0x80 | ((cp >> 12) & 0x3F));
+            out += (char)(0x80 | ((cp >> 6) & 0x3F));
+            out += (char)(0x80 | (cp & 0x3F));
+        }
+    }
+}
+
+//------------------------------------------------------------------------
+
+KMLStreamParser::KMLStreamParser( std::istream& in, const std::string& referrer ) :
+_sb      ( in.rdbuf() ),
+_referrer( referrer ),
+_stopped ( false ),
+_line    ( 1 )
+{
+    //nop
+}
+
+int
+KMLStreamParser::get()
+{
+    int c = _sb ? _sb->sbumpc() : END_OF_STREAM;
+    if ( c == '\n' )
+        ++_line;
+    return c;
+}
+
+int
+KMLStreamParser::peek()
+{
+    return _sb ? _sb->sgetc() : END_OF_STREAM;
+}
+
+void
+KMLStreamParser::setError( const std::string& msg )
+{
+    if ( _error.empty() )
+    {
+        std::stringstream buf;
+        buf << msg << " (line " << _line << ")";
+        _error = buf.str();
+    }
+}
+
+bool
+KMLStreamParser::skipPast( const char* terminator )
+{
+    // consume characters up to and including the terminator string.
+    std::string::size_type len = ::strlen(terminator);
+    std::string window;
+    for( int c = get(); c != END_OF_STREAM; c = get() )
+    {
+        window += (char)c;
+        if ( window.size() > len )
+            window.erase( 0, 1 );
+        if ( window == terminator )
+            return true;
+    }
+    setError( std::string("Unexpected end of stream looking for \"") + terminator + "\"" );
+    return false;
+}
+
+bool
+KMLStreamParser::skipDeclaration()
+{
+    // skips a <!DOCTYPE ...> or similar, which may contain nested brackets.
+    int nesting = 0;
+    for( int c = get(); c != END_OF_STREAM; c = get() )
+    {
+        if ( c == '<' || c == '[' )
+            ++nesting;
+        else if ( c == ']' )
+            --nesting;
+        else if ( c == '>' )
+        {
+            if ( nesting <= 0 )
+                return true;
+            --nesting;
+        }
+    }
+    setError( "Unexpected end of stream in declaration" );
+    return false;
+}
+
+bool
+KMLStreamParser::readName( std::string& out )
+{
+    out.clear();
+    for( int c = peek(); c != END_OF_STREAM; c = peek() )
+    {
+        if ( isSpace(c) || c == '/' || c == '>' || c == '=' )
+            break;
+        out += (char)::tolower(get());
+    }
+    return !out.empty();
+}
+
+bool
+KMLStreamParser::readEntity( std::string& out )
+{
+    // the leading '&' is already consumed.
+    std::string name;
+    for( int c = get(); c != ';'; c = get() )
+    {
+        if ( c == END_OF_STREAM || name.size() > 10 )
+        {
+            // not an entity after all; pass it through verbatim.
+            out += '&';
+            out += name;
+            if ( c != END_OF_STREAM )
+                out += (char)c;
+            return c != END_OF_STREAM;
+        }
+        name += (char)c;
+    }
+
+    if      ( name == "amp" )  out += '&';
+    else if ( name == "lt" )   out += '<';
+    else if ( name == "gt" )   out += '>';
+    else if ( name == "quot" ) out += '"';
+    else if ( name == "apos" ) out += '\'';
+    else if ( name.size() > 1 && name[0] == '#' )
+    {
+        unsigned long cp = name[1] == 'x' || name[1] == 'X' ?
+            ::strtoul( name.c_str()+2, 0L, 16 ) :
+            ::strtoul( name.c_str()+1, 0L, 10 );
+        appendUTF8( (unsigned)cp, out );
+    }
+    else
+    {
+        out += '&';
+        out += name;
+        out += ';';
+    }
+    return true;
+}
+
+bool
+KMLStreamParser::readCDATA()
+{
+    // the leading "<![CDATA[" is already consumed.
+    std::string data;
+    for( int c = get(); c != END_OF_STREAM; c = get() )
+    {
+        data += (char)c;
+        if ( data.size() >= 3 && data.compare(data.size()-3, 3, "]]>") == 0 )
+        {
+            data.resize( data.size()-3 );
+            appendText( data );
+            return true;
+        }
+    }
+    setError( "Unexpected end of stream in CDATA section" );
+    return false;
+}
+
+void
+KMLStreamParser::appendText( char c )
+{
+    // only elements destined for a Config need their text; containers ignore it.
+    if ( !_stack.empty() && _stack.back()._type >= FRAME_PROPERTY )
+        _stack.back()._text += c;
+}
+
+void
+KMLStreamParser::appendText( const std::string& s )
+{
+    if ( !_stack.empty() && _stack.back()._type >= FRAME_PROPERTY )
+        _stack.back()._text += s;
+}
+
+bool
+KMLStreamParser::readStartTag( Handler& handler )
+{
+    std::string tag;
+    if ( !readName(tag) )
+    {
+        setError( "Malformed start tag" );
+        return false;
+    }
+
+    Config attrs;
+    bool   selfClosing = false;
+
+    for( ;; )
+    {
+        int c = get();
+        while( isSpace(c) )
+            c = get();
+
+        if ( c == END_OF_STREAM )
+        {
+            setError( "Unexpected end of stream in tag <" + tag + ">" );
+            return false;
+        }
+        else if ( c == '>' )
+        {
+            break;
+        }
+        else if ( c == '/' )
+        {
+            if ( get() != '>' )
+            {
+                setError( "Malformed empty tag <" + tag + ">" );
+                return false;
+            }
+            selfClosing = true;
+            break;
+        }
+        else
+        {
+            // attribute: name = "value"
+            std::string name( 1, (char)::tolower(c) );
+            std::string rest;
+            readName( rest );
+            name += rest;
+
+            c = get();
+            while( isSpace(c) )
+                c = get();
+            if ( c != '=' )
+            {
+                setError( "Missing value for attribute \"" + name + "\"" );
+                return false;
+            }
+
+            c = get();
+            while( isSpace(c) )
+                c = get();
+            if ( c != '"' && c != '\'' )
+            {
+                setError( "Unquoted value for attribute \"" + name + "\"" );
+                return false;
+            }
+
+            int quote = c;
+            std::string value;
+            for( c = get(); c != quote; c = get() )
+            {
+                if ( c == END_OF_STREAM )
+                {
+                    setError( "Unexpected end of stream in attribute \"" + name + "\"" );
+                    return false;
+                }
+                if ( c == '&' )
+                    readEntity( value );
+                else
+                    value += (char)c;
+            }
+            attrs.set( name, value );
+        }
+    }
+
+    if ( !startElement(tag, attrs, handler) )
+        return false;
+
+    return selfClosing ? endElement(tag, handler) : true;
+}
+
+bool
+KMLStreamParser::readEndTag( Handler& handler )
+{
+    std::string tag;
+    readName( tag );
+
+    int c = get();
+    while( isSpace(c) )
+        c = get();
+    if ( c != '>' )
+    {
+        setError( "Malformed end tag </" + tag + ">" );
+        return false;
+    }
+    return endElement( tag, handler );
+}
+
+void
+KMLStreamParser::startContainer( Frame& frame, Handler& handler )
+{
+    if ( frame._type == FRAME_CONTAINER && !frame._started )
+    {
+        frame._started = true;
+        frame._conf.setReferrer( _referrer );
+        handler.startContainer( frame._conf );
+
+        // the properties have been consumed; don't hang on to them.
+        frame._conf = Config( frame._conf.key() );
+    }
+}
+
+bool
+KMLStreamParser::startElement( const std::string& tag, const Config& attrs, Handler& handler )
+{
+    FrameType type;
+
+    if ( _stack.empty() )
+    {
+        type = isContainer(tag) ? FRAME_CONTAINER : FRAME_ROOT;
+    }
+    else if ( _stack.back()._type >= FRAME_PROPERTY )
+    {
+        // nested inside something we are collecting.
+        type = _stack.back()._type;
+    }
+    else if ( isContainer(tag) )
+    {
+        startContainer( _stack.back(), handler );
+        type = FRAME_CONTAINER;
+    }
+    else if ( isDeliverable(tag) )
+    {
+        startContainer( _stack.back(), handler );
+        type = FRAME_ELEMENT;
+    }
+    else
+    {
+        type = FRAME_PROPERTY;
+    }
+
+    _stack.push_back( Frame(type, tag) );
+
+    Config& conf = _stack.back()._conf;
+    for( ConfigSet::const_iterator i = attrs.children().begin(); i != attrs.children().end(); ++i )
+        conf.set( i->key(), i->value() );
+
+    return true;
+}
+
+bool
+KMLStreamParser::endElement( const std::string& tag, Handler& handler )
+{
+    if ( _stack.empty() || _stack.back()._conf.key() != tag )
+    {
+        setError( "Mismatched end tag </" + tag + ">" );
+        return false;
+    }
+
+    Frame& frame = _stack.back();
+
+    if ( frame._type == FRAME_CONTAINER )
+    {
+        startContainer( frame, handler );
+        _stack.pop_back();
+        handler.endContainer();
+    }
+
+    else if ( frame._type == FRAME_ROOT )
+    {
+        _stack.pop_back();
+    }
+
+    else
+    {
+        frame._conf.value() = trim( frame._text );
+        Config conf = frame._conf;
+        _stack.pop_back();
+
+        if ( _stack.empty() )
+        {
+            //nop - stray top-level element
+        }
+        else if ( _stack.back()._type >= FRAME_PROPERTY )
+        {
+            // still inside a collected element; attach to the parent.
+            _stack.back()._conf.add( conf );
+        }
+        else if ( isDeliverable(tag) )
+        {
+            conf.setReferrer( _referrer );
+            if ( !handler.element(conf) )
+            {
+                _stopped = true;
+                return false;
+            }
+        }
+        else if ( !_stack.back()._started )
+        {
+            // a property (name, visibility, LookAt, ...) of the container.
+            _stack.back()._conf.add( conf );
+        }
+    }
+
+    return true;
+}
+
+bool
+KMLStreamParser::parse( Handler& handler )
+{
+    _error.clear();
+    _stopped = false;
+    _stack.clear();
+
+    for( int c = get(); c != END_OF_STREAM; c = get() )
+    {
+        if ( c == '&' )
+        {
+            std::string value;
+            readEntity( value );
+            appendText( value );
+        }
+
+        else if ( c != '<' )
+        {
+            appendText( (char)c );
+        }
+
+        else
+        {
+            bool ok = true;
+            int  n  = peek();
+
+            if ( n == '?' )
+            {
+                // processing instruction (e.g. <?xml ... ?>)
+                ok = skipPast( "?>" );
+            }
+            else if ( n == '!' )
+            {
+                get();
+                if ( peek() == '-' )
+                {
+                    ok = skipPast( "-->" );
+                }
+                else if ( peek() == '[' )
+                {
+                    std::string marker;
+                    for( int i=0; i<7 && peek() != END_OF_STREAM; ++i )
+                        marker += (char)get();
+                    ok = marker == "[CDATA[" ? readCDATA() : skipDeclaration();
+                }
+                else
+                {
+                    ok = skipDeclaration();
+                }
+            }
+            else if ( n == '/' )
+            {
+                get();
+                ok = readEndTag( handler );
+            }
+            else
+            {
+                ok = readStartTag( handler );
+            }
+
+            if ( !ok )
+                return false;
+        }
+    }
+
+    if ( !_stack.empty() )
+    {
+        setError( "Unexpected end of stream; unclosed element <" + _stack.back()._conf.key() + ">" );
+        return false;
+    }
+
+    return true;
+}
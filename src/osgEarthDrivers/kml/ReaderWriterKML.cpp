@@ -27,8 +27,10 @@
 
 #include "KMLOptions"
 #include "KMLReader"
+#include "KMLIncrementalLoader"
 #include "KMZArchive"
 
+#undef  LC
 #define LC "[ReaderWriterKML] "
 
 using namespace osgEarth;
@@ -73,6 +75,17 @@ struct ReaderWriterKML : public osgDB::ReaderWriter
             // propagate the source URI along to the stream reader
             osg::ref_ptr<osgDB::Options> myOptions = Registry::instance()->cloneOrCreateOptions(dbOptions);
             URIContext(url).apply( myOptions.get() );
+
+            // a local file loaded incrementally is read in the background, and 
+            // the node returns right away:
+            MapNode*          mapNode    = getMapNode( dbOptions );
+            const KMLOptions* kmlOptions = getKMLOptions( dbOptions );
+            if ( mapNode && kmlOptions && kmlOptions->incremental() == true && !osgDB::containsServerAddress(url) )
+            {
+                osg::ref_ptr<KMLIncrementalLoader> loader = new KMLIncrementalLoader( mapNode, kmlOptions, myOptions.get() );
+                return ReadResult( loader->loadInBackground(URI(url)) );
+            }
+
             return readNode( URIStream(url), myOptions.get() );
         }
     }
@@ -83,14 +96,19 @@ struct ReaderWriterKML : public osgDB::ReaderWriter
             return ReadResult("Missing required MapNode option");
 
         // this plugin requires that you pass in a MapNode* in options.
-        MapNode* mapNode = const_cast<MapNode*>(
-            static_cast<const MapNode*>( options->getPluginData("osgEarth::MapNode")) );
+        MapNode* mapNode = getMapNode( options );
         if ( !mapNode )
             return ReadResult("Missing required MapNode option");
 
         // grab the KMLOptions if present
-        const KMLOptions* kmlOptions =
-            static_cast<const KMLOptions*>(options->getPluginData("osgEarth::KMLOptions") );
+        const KMLOptions* kmlOptions = getKMLOptions( options );
+
+        // stream the data and build it in parallel if requested:
+        if ( kmlOptions && kmlOptions->incremental() == true )
+        {
+            osg::ref_ptr<KMLIncrementalLoader> loader = new KMLIncrementalLoader( mapNode, kmlOptions, options );
+            return ReadResult( loader->load(in) );
+        }
 
         // fire up a KML reader and parse the data.
         KMLReader reader( mapNode, kmlOptions );
@@ -98,6 +116,18 @@ struct ReaderWriterKML : public osgDB::ReaderWriter
         return ReadResult(node);
     }
 
+    static MapNode* getMapNode( const osgDB::Options* options )
+    {
+        return options ? const_cast<MapNode*>(
+            static_cast<const MapNode*>( options->getPluginData("osgEarth::MapNode")) ) : 0L;
+    }
+
+    static const KMLOptions* getKMLOptions( const osgDB::Options* options )
+    {
+        return options ? static_cast<const KMLOptions*>(
+            options->getPluginData("osgEarth::KMLOptions") ) : 0L;
+    }
+
 #ifdef SUPPORT_KMZ
 
     osgDB::ReaderWriter::ReadResult openArchive( const std::string& url, ArchiveStatus status, unsigned int dummy, const osgDB::Options* options =0L ) const
@@ -20,6 +20,8 @@
 #include <osgEarth/FileUtils>
 #include <osgEarth/Registry>
 #include <osgEarth/ImageUtils>
+#include <osgEarth/TaskService>
+#include <osgEarth/ThreadingUtils>
 #include <osgEarth/URI>
 
 #include <osgEarthUtil/TileIndex>
@@ -30,11 +32,19 @@
 #include <osgDB/Registry>
 #include <osgDB/ReadFile>
 #include <osgDB/ImageOptions>
+#include <OpenThreads/Thread>
 
 #include <sstream>
+#include <list>
+#include <map>
 #include <stdlib.h>
+#include <stdio.h>
 #include <memory.h>
 
+#ifndef _WIN32
+#   include <sys/resource.h>
+#endif
+
 #include <osgEarthDrivers/gdal/GDALOptions>
 #include "TileIndexOptions"
 
@@ -46,13 +56,173 @@ using namespace osgEarth;
 using namespace osgEarth::Drivers;
 using namespace osgEarth::Util;
 
+namespace
+{
+    // Default number of data files to keep open: a quarter of the process's
+    // file handle limit, leaving the rest to the application.
+    unsigned getDefaultMaxOpenFiles()
+    {
+        unsigned limit = 1024u;
+#ifdef _WIN32
+        limit = (unsigned)_getmaxstdio();
+#else
+        struct rlimit rl;
+        if ( getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY )
+            limit = (unsigned)osg::minimum( rl.rlim_cur, (rlim_t)65536 );
+#endif
+        return osg::clampBetween( limit/4u, 16u, 1024u );
+    }
+
+    /**
+     * Cache of the tile sources for the data files in the index. Every
+     * source holds its file open, so the cache is bounded by the number of
+     * open files rather than by entry count. Sources that are in use by a
+     * createImage call are never closed.
+     */
+    class TileSourceCache
+    {
+    public:
+        TileSourceCache( unsigned maxOpenFiles ) :
+          _maxOpenFiles( osg::maximum(maxOpenFiles, 1u) ),
+          _numOpenFiles( 0u )
+        {
+            //nop
+        }
+
+        /** Gets the tile source for a file, opening it if necessary.
+            Returns NULL if the file cannot be opened. Failures aren't
+            cached, so a file that shows up later is picked up. */
+        osg::ref_ptr<TileSource> get( const std::string& filename )
+        {
+            {
+                Threading::ScopedMutexLock lock( _mutex );
+                EntryMap::iterator i = _entries.find( filename );
+                if ( i != _entries.end() )
+                {
+                    _lru.splice( _lru.begin(), _lru, i->second._lru );
+                    return i->second._source.get();
+                }
+            }
+
+            // Open the file outside the lock so other files stay available.
+            osg::ref_ptr<TileSource> source = open( filename );
+            if ( !source.valid() )
+                return 0L;
+
+            Threading::ScopedMutexLock lock( _mutex );
+
+            // another thread may have opened the same file in the meantime.
+            EntryMap::iterator i = _entries.find( filename );
+            if ( i != _entries.end() )
+            {
+                _lru.splice( _lru.begin(), _lru, i->second._lru );
+                return i->second._source.get();
+            }
+
+            Entry& entry = _entries[filename];
+            entry._source = source.get();
+            entry._lru    = _lru.insert( _lru.begin(), filename );
+            ++_numOpenFiles;
+
+            trim();
+            return source;
+        }
+
+    private:
+        struct Entry
+        {
+            osg::ref_ptr<TileSource>         _source;
+            std::list<std::string>::iterator _lru;
+        };
+        typedef std::map<std::string, Entry> EntryMap;
+
+        unsigned               _maxOpenFiles;
+        unsigned               _numOpenFiles;
+        EntryMap               _entries;
+        std::list<std::string> _lru;        // most recently used first
+        Threading::Mutex       _mutex;
+
+        osg::ref_ptr<TileSource> open( const std::string& filename )
+        {
+            GDALOptions opt;
+            opt.url() = filename;
+            //Just force it to render so we don't have to worry about falling back
+            opt.maxDataLevel() = 23;
+            //Disable the l2 cache so that we don't run out of RAM so easily.
+            opt.L2CacheSize() = 0;
+
+            osg::ref_ptr<TileSource> source = osgEarth::TileSourceFactory::create( opt );
+            if ( source.valid() && source->startup(0).isOK() )
+            {
+                return source;
+            }
+
+            OE_WARN << LC << "Failed to open " << filename << std::endl;
+            return 0L;
+        }
+
+        // Closes the least recently used files until within budget.
+        void trim()
+        {
+            std::list<std::string>::iterator i = _lru.end();
+            while( i != _lru.begin() && _numOpenFiles > _maxOpenFiles )
+            {
+                --i;
+                EntryMap::iterator e = _entries.find( *i );
+                if ( e->second._source->referenceCount() == 1 )
+                {
+                    --_numOpenFiles;
+                    _entries.erase( e );
+                    i = _lru.erase( i );
+                }
+            }
+        }
+    };
+
+    // Reads one data file's contribution to a tile.
+    struct FetchImageTask
+    {
+        void execute()
+        {
+            osg::ref_ptr<TileSource> source = _cache->get( _filename );
+            if ( source.valid() && !(_progress && _progress->isCanceled()) )
+            {
+                *_image = source->createImage( _key, 0L, _progress );
+            }
+
+            if ( !_image->valid() )
+            {
+                OE_DEBUG << LC << "Failed to create image for " << _filename << std::endl;
+            }
+        }
+
+        TileSourceCache*          _cache;
+        std::string               _filename;
+        TileKey                   _key;
+        ProgressCallback*         _progress;
+        osg::ref_ptr<osg::Image>* _image;
+    };
+
+    // Whether an image completely hides anything composited beneath it.
+    bool isOpaque( const osg::Image* image )
+    {
+        if ( !ImageUtils::hasAlphaChannel(image) )
+            return true;
+
+        if ( ImageUtils::isCompressed(image) )
+            return false;
+
+        return !ImageUtils::hasTransparency(image);
+    }
+}
+
 class TileIndexSource : public TileSource
 {
 public:
     TileIndexSource( const TileSourceOptions& options ):
       TileSource( options ),
       _options( options ),
-	  _tileSourceCache( true )
+      _tileSourceCache( _options.maxOpenFiles().isSet() ? _options.maxOpenFiles().get() : getDefaultMaxOpenFiles() )
     {
     }
 
@@ -64,6 +234,15 @@ public:
             _index = TileIndex::load( _options.url()->full() );        
             if (_index.valid() )
             {
+                unsigned numThreads = _options.numThreads().isSet() ?
+                    _options.numThreads().get() :
+                    (unsigned)OpenThreads::GetNumberOfProcessors();
+
+                if ( numThreads > 0 )
+                {
+                    _service = new TaskService( "TileIndex", (int)numThreads );
+                }
+
                 setProfile( osgEarth::Registry::instance()->getGlobalGeodeticProfile() );
                 return STATUS_OK;
             }
@@ -76,83 +255,131 @@ public:
     {        
         osg::Timer_t start = osg::Timer::instance()->tick();
         std::vector< std::string > files;
-        _index->getFiles( key.getExtent(), files );        
+        std::vector< GeoExtent >   extents;
+        _index->getFiles( key.getExtent(), files, extents );
         osg::Timer_t end = osg::Timer::instance()->tick();
         OE_DEBUG << "Got " << files.size() << " files in " << osg::Timer::instance()->delta_m( start, end) << " ms" << std::endl;
 
-        // The result image
-        osg::Image* result = 0;
-        
-        for (unsigned int i = 0; i < files.size(); i++)
-        {            
-            osg::ref_ptr< TileSource> source;
+        if ( files.empty() )
+            return 0L;
+
+        // Files composite in index order, so the last file that covers the
+        // whole tile is the lowest one that can be visible. Fetch from there
+        // up first; if that file turns out to be opaque, nothing beneath it
+        // is needed at all.
+        int covering = 0;
+        GeoExtent tileExtent = key.getExtent().transform( extents[0].getSRS() );
+        if ( tileExtent.isValid() )
+        {
+            for (int i = (int)files.size()-1; i > 0; --i)
             {
-                //Try to get the TileSource from the cache
-                TileSourceCache::Record record;
-                if (_tileSourceCache.get( files[i], record ))
+                if ( extents[i].contains(tileExtent) )
                 {
-                    source = record.value().get();                    
+                    covering = i;
+                    break;
                 }
-                else
-                {
-                    // Couldn't get it from the cache so open it.                    
-                    GDALOptions opt;
-                    opt.url() = files[i];
-                    //Just force it to render so we don't have to worry about falling back
-                    opt.maxDataLevel() = 23;           
-                    //Disable the l2 cache so that we don't run out of RAM so easily.
-                    opt.L2CacheSize() = 0;
-
-                    start = osg::Timer::instance()->tick();
-                    source = osgEarth::TileSourceFactory::create( opt );                               
-                    TileSource::Status compStatus = source->startup( 0 );
-                    if (compStatus.isOK())
-                    {
-                        _tileSourceCache.insert( files[i], source.get() );                                                
-                    }
-                    else
-                    {
-                        OE_WARN << "Failed to open " << files[i] << std::endl;
-                    }
-                    end = osg::Timer::instance()->tick();
-                    //OE_NOTICE << "init took " << osg::Timer::instance()->delta_m( start, end) << "ms" << std::endl;
-                }               
             }
+        }
+
+        std::vector< osg::ref_ptr<osg::Image> > images( files.size() );
+
+        start = osg::Timer::instance()->tick();
+        fetch( files, covering, files.size(), key, progress, images );
+
+        if ( covering > 0 && !(images[covering].valid() && isOpaque(images[covering].get())) )
+        {
+            fetch( files, 0, covering, key, progress, images );
+        }
+        end = osg::Timer::instance()->tick();
+        OE_DEBUG << "createImage " << osg::Timer::instance()->delta_m( start, end) << "ms" << std::endl;
 
-            
-            
-            start = osg::Timer::instance()->tick();
-            osg::ref_ptr< osg::Image > image = source->createImage( key);
-            end = osg::Timer::instance()->tick();
-            OE_DEBUG << "createImage " << osg::Timer::instance()->delta_m( start, end) << "ms" << std::endl;
+        if ( progress && progress->isCanceled() )
+            return 0L;
+
+        // Composite from the top-most opaque image up; anything beneath it is hidden.
+        int bottom = (int)images.size()-1;
+        while( bottom > 0 && !(images[bottom].valid() && isOpaque(images[bottom].get())) )
+            --bottom;
+
+        // The result image
+        osg::Image* result = 0;
+
+        for (unsigned int i = bottom; i < images.size(); i++)
+        {
+            osg::Image* image = images[i].get();
             if (image)
             {                                
                 if (!result)
                 {
                     // Initialize the result
-                     result = new osg::Image( *image.get() );
+                     result = new osg::Image( *image );
                 }
                 else
                 {
                     // Composite the new image with the result
-                     ImageUtils::mix( result, image.get(), 1.0);
+                     ImageUtils::mix( result, image, 1.0);
                 }                
             }
-            else
-            {
-                OE_DEBUG << "Failed to create image for " << files[i] << std::endl;
-            }
         }
 
         return result;
     }
 
-    //std::map< std::string, osg::ref_ptr< TileSource> > _tileSourceCache;
-    typedef LRUCache< std::string, osg::ref_ptr< TileSource> > TileSourceCache;
-    TileSourceCache _tileSourceCache;
+    // Fetches the images for files [begin, end). The top-most file is read in
+    // this thread while the others run on the task service.
+    void fetch( const std::vector<std::string>&         files,
+                unsigned                                begin,
+                unsigned                                end,
+                const TileKey&                          key,
+                ProgressCallback*                       progress,
+                std::vector< osg::ref_ptr<osg::Image> >& images )
+    {
+        if ( begin >= end )
+            return;
+
+        FetchImageTask top;
+        top._cache    = &_tileSourceCache;
+        top._filename = files[end-1];
+        top._key      = key;
+        top._progress = progress;
+        top._image    = &images[end-1];
+
+        if ( _service.valid() && end-begin > 1 )
+        {
+            Threading::MultiEvent semaphore( end-begin-1 );
+
+            for( unsigned i=begin; i<end-1; ++i )
+            {
+                ParallelTask<FetchImageTask>* task = new ParallelTask<FetchImageTask>( &semaphore );
+                task->_cache    = &_tileSourceCache;
+                task->_filename = files[i];
+                task->_key      = key;
+                task->_progress = progress;
+                task->_image    = &images[i];
+                task->setPriority( -(float)key.getLevelOfDetail() );
+                _service->add( task );
+            }
+
+            top.execute();
+            semaphore.wait();
+        }
+        else
+        {
+            top.execute();
+            for( int i=(int)end-2; i>=(int)begin; --i )
+            {
+                FetchImageTask task = top;
+                task._filename = files[i];
+                task._image    = &images[i];
+                task.execute();
+            }
+        }
+    }
 
     osg::ref_ptr< TileIndex > _index;
     TileIndexOptions _options;
+    TileSourceCache _tileSourceCache;
+    osg::ref_ptr< TaskService > _service;
     osg::ref_ptr<osgDB::Options> _dbOptions;
 };
 
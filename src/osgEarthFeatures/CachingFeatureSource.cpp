@@ -0,0 +1,290 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2013 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarthFeatures/CachingFeatureSource>
+#include <osgEarthFeatures/FeatureCursor>
+#include <osgEarthFeatures/FeatureListSource>
+
+using namespace osgEarth;
+using namespace osgEarth::Features;
+using namespace osgEarth::Symbology;
+
+#define LC "[CachingFeatureSource] "
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    bool intersects2d( const Bounds& a, const Bounds& b )
+    {
+        return
+            a.isValid() && b.isValid() &&
+            a.xMin() <= b.xMax() && a.xMax() >= b.xMin() &&
+            a.yMin() <= b.yMax() && a.yMax() >= b.yMin();
+    }
+
+    // rough memory footprint of a feature
+    unsigned estimateSize( const Feature* feature )
+    {
+        unsigned bytes = sizeof(Feature) + sizeof(Bounds);
+        if ( feature->getGeometry() )
+            bytes += 64 + feature->getGeometry()->getTotalPointCount() * sizeof(osg::Vec3d);
+        bytes += feature->getAttrs().size() * 64;
+        return bytes;
+    }
+}
+
+//------------------------------------------------------------------------
+
+FeatureSource*
+CachingFeatureSource::wrap( FeatureSource* source )
+{
+    if ( !source )
+        return 0L;
+
+    // already cached, or already in memory:
+    if ( dynamic_cast<CachingFeatureSource*>(source) || dynamic_cast<FeatureListSource*>(source) )
+        return source;
+
+    unsigned maxBytes = *source->getFeatureSourceOptions().queryCacheSize();
+    if ( maxBytes == 0 )
+        return source;
+
+    return new CachingFeatureSource( source, maxBytes );
+}
+
+CachingFeatureSource::CachingFeatureSource( FeatureSource* source, unsigned maxBytes ) :
+FeatureSource( source->getFeatureSourceOptions() ),
+_source      ( source ),
+_maxBytes    ( maxBytes ),
+_bytes       ( 0 ),
+_generation  ( 0 ),
+_queries     ( 0 ),
+_hits        ( 0 )
+{
+    setName( source->getName() );
+    _source->sync( _sourceRevision );
+}
+
+unsigned
+CachingFeatureSource::getNumBytes() const
+{
+    Threading::ScopedMutexLock lock( _mutex );
+    return _bytes;
+}
+
+CacheStats
+CachingFeatureSource::getStats() const
+{
+    Threading::ScopedMutexLock lock( _mutex );
+    return CacheStats(
+        _entries.size(),
+        _entries.size(),
+        _queries,
+        _queries > 0 ? (float)_hits/(float)_queries : 0.0f );
+}
+
+void
+CachingFeatureSource::clear()
+{
+    Threading::ScopedMutexLock lock( _mutex );
+    clearWhileLocked();
+}
+
+void
+CachingFeatureSource::clearWhileLocked()
+{
+    _entries.clear();
+    _index.clear();
+    _bytes = 0;
+    ++_generation;
+}
+
+void
+CachingFeatureSource::insert( Entry& entry )
+{
+    if ( entry._bytes > _maxBytes )
+        return;
+
+    std::map<std::string, EntryList::iterator>::iterator i = _index.find( entry._key );
+    if ( i != _index.end() )
+    {
+        _bytes -= i->second->_bytes;
+        _entries.erase( i->second );
+        _index.erase( i );
+    }
+
+    _entries.push_front( Entry() );
+    Entry& e = _entries.front();
+    e._key.swap( entry._key );
+    e._signature.swap( entry._signature );
+    e._tiled   = entry._tiled;
+    e._bounded = entry._bounded;
+    e._bounds  = entry._bounds;
+    e._features.swap( entry._features );
+    e._featureBounds.swap( entry._featureBounds );
+    e._bytes   = entry._bytes;
+
+    _index[e._key] = _entries.begin();
+    _bytes += e._bytes;
+
+    // evict the least recently used queries.
+    while( _bytes > _maxBytes && !_entries.empty() )
+    {
+        _bytes -= _entries.back()._bytes;
+        _index.erase( _entries.back()._key );
+        _entries.pop_back();
+    }
+}
+
+FeatureCursor*
+CachingFeatureSource::createFeatureCursor( const Symbology::Query& query )
+{
+    // the part of the query that isn't spatial:
+    Query nonSpatial( query );
+    nonSpatial.bounds().unset();
+    nonSpatial.tileKey().unset();
+    std::string signature = nonSpatial.getConfig().toJSON();
+
+    bool tiled   = query.tileKey().isSet();
+    bool bounded = !tiled && query.bounds().isSet();
+
+    std::string key =
+        tiled   ? signature + "|key:" + query.tileKey()->str() :
+        bounded ? signature + "|bounds:" + query.bounds()->toString() :
+        signature;
+
+    FeatureList output;
+
+    // state of the cache when we miss, to detect a change to the source
+    // while the query is running.
+    Revision revision;
+    unsigned generation;
+
+    {
+        Threading::ScopedMutexLock lock( _mutex );
+
+        ++_queries;
+
+        if ( _source->outOfSyncWith(_sourceRevision) )
+        {
+            clearWhileLocked();
+            _source->sync( _sourceRevision );
+        }
+
+        // first look for the same query; failing that, for a query whose
+        // results contain this one's.
+        EntryList::iterator hit = _entries.end();
+
+        std::map<std::string, EntryList::iterator>::iterator i = _index.find( key );
+        if ( i != _index.end() )
+        {
+            hit = i->second;
+        }
+        else if ( bounded )
+        {
+            for( EntryList::iterator e = _entries.begin(); e != _entries.end(); ++e )
+            {
+                if ( !e->_tiled && e->_signature == signature && (!e->_bounded || e->_bounds.contains(*query.bounds())) )
+                {
+                    hit = e;
+                    break;
+                }
+            }
+        }
+
+        if ( hit != _entries.end() )
+        {
+            ++_hits;
+
+            bool filter = bounded && (hit->_key != key);
+            unsigned n = 0;
+            for( FeatureList::const_iterator f = hit->_features.begin(); f != hit->_features.end(); ++f, ++n )
+            {
+                Feature* feature = f->get();
+                if ( filter && !intersects2d(hit->_featureBounds[n], *query.bounds()) )
+                    continue;
+                if ( _source->isBlacklisted(feature->getFID()) )
+                    continue;
+                output.push_back( feature );
+            }
+
+            // most recently used goes to the front.
+            _entries.splice( _entries.begin(), _entries, hit );
+
+            // the caller gets copies, since filters change features in place.
+            return new FeatureListCursor( output, true );
+        }
+
+        revision   = _sourceRevision;
+        generation = _generation;
+    }
+
+    // not cached; go to the source.
+    osg::ref_ptr<FeatureCursor> cursor = _source->createFeatureCursor( query );
+    if ( !cursor.valid() )
+        return 0L;
+
+    Entry entry;
+    entry._key       = key;
+    entry._signature = signature;
+    entry._tiled     = tiled;
+    entry._bounded   = bounded;
+    if ( bounded )
+        entry._bounds = *query.bounds();
+    entry._bytes     = 0;
+
+    cursor->fill( entry._features );
+    entry._featureBounds.reserve( entry._features.size() );
+    for( FeatureList::const_iterator f = entry._features.begin(); f != entry._features.end(); ++f )
+    {
+        const Feature* feature = f->get();
+        entry._featureBounds.push_back( feature->getGeometry() ? feature->getGeometry()->getBounds() : Bounds() );
+        entry._bytes += estimateSize( feature );
+    }
+
+    output = entry._features;
+
+    {
+        // don't cache results the source may have changed under (an edit,
+        // or a clear() while we were querying).
+        Threading::ScopedMutexLock lock( _mutex );
+        if ( _generation == generation && _source->inSyncWith(revision) )
+            insert( entry );
+    }
+
+    return new FeatureListCursor( output, true );
+}
+
+bool
+CachingFeatureSource::insertFeature( Feature* feature )
+{
+    bool ok = _source->insertFeature( feature );
+    if ( ok )
+        clear();
+    return ok;
+}
+
+bool
+CachingFeatureSource::deleteFeature( FeatureID fid )
+{
+    bool ok = _source->deleteFeature( fid );
+    if ( ok )
+        clear();
+    return ok;
+}
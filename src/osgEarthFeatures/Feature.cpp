@@ -175,6 +175,17 @@ _srs      ( rhs._srs.get() )
     dirty();
 }
 
+Feature::Feature( const Feature& rhs, Geometry* geom ) :
+_fid      ( rhs._fid ),
+_geom     ( geom ),
+_srs      ( rhs._srs.get() ),
+_attrs    ( rhs._attrs ),
+_style    ( rhs._style ),
+_geoInterp( rhs._geoInterp )
+{
+    dirty();
+}
+
 FeatureID
 Feature::getFID() const 
 {
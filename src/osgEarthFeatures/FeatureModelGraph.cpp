@@ -30,6 +30,7 @@
 #include <osgEarth/NodeUtils>
 #include <osgEarth/Registry>
 #include <osgEarth/ThreadingUtils>
+#include <osgEarth/TaskService>
 
 #include <osg/CullFace>
 #include <osg/PagedLOD>
@@ -39,6 +40,8 @@
 #include <osgDB/WriteFile>
 #include <osgUtil/Optimizer>
 
+#include <climits>
+
 #define LC "[FeatureModelGraph] "
 
 using namespace osgEarth;
@@ -51,6 +54,49 @@ using namespace osgEarth::Symbology;
 
 //---------------------------------------------------------------------------
 
+namespace
+{
+    /**
+     * Crops and compiles a set of features with one style, on its own copy of
+     * the filter context so that several can run in parallel.
+     */
+    struct CompileChunk
+    {
+        CompileChunk() : _factory( 0L ), _style( 0L ), _clampExtent( 0L ), _ok( false ) { }
+
+        void execute()
+        {
+            CropFilter crop( _cropMethod );
+            _context = crop.push( _features, _context );
+
+            if ( _clampExtent )
+            {
+                _context.extent() = *_clampExtent;
+                CropFilter crop2( CropFilter::METHOD_CROPPING );
+                _context = crop2.push( _features, _context );
+            }
+
+            // finally, compile the features into a node.
+            if ( _features.size() > 0 )
+            {
+                osg::ref_ptr<FeatureCursor> cursor = new FeatureListCursor( _features );
+                _ok = _factory->createOrUpdateNode( cursor.get(), *_style, _context, _node );
+            }
+        }
+
+        FeatureNodeFactory*     _factory;
+        const Style*            _style;
+        FilterContext           _context;
+        CropFilter::Method      _cropMethod;
+        const GeoExtent*        _clampExtent;
+        FeatureList             _features;
+        osg::ref_ptr<osg::Node> _node;
+        bool                    _ok;
+    };
+}
+
+//---------------------------------------------------------------------------
+
 // pseudo-loader for paging in feature tiles for a FeatureModelGraph.
 
 namespace
@@ -311,6 +357,12 @@ _overlayChange     ( OVERLAY_NO_CHANGE )
         OE_INFO << LC << "Added fading post-merge operation" << std::endl;
     }
 
+    // threads for compiling each tile's features in parallel.
+    if ( _options.compileThreads().isSet() && *_options.compileThreads() > 1 )
+    {
+        _compileService = new TaskService( "FeatureModelGraph compiler", (int)*_options.compileThreads() );
+    }
+
     ADJUST_EVENT_TRAV_COUNT( this, 1 );
 
     redraw();
@@ -1000,7 +1052,8 @@ FeatureModelGraph::queryAndSortIntoStyleGroups(const Query&            query,
         }
     }
 
-    // next create a style group per bin.
+    // next resolve the style of each bin.
+    StyleBins bins;
     for( std::map<std::string,FeatureList>::iterator i = styleBins.begin(); i != styleBins.end(); ++i )
     {
         const std::string& styleString = i->first;
@@ -1029,15 +1082,25 @@ FeatureModelGraph::queryAndSortIntoStyleGroups(const Query&            query,
                 combinedStyle = *selectedStyle;
         }
 
-        // if there is a valid style, create the node and add it. (Otherwise we will skip
+        // if there is a valid style, compile the bin. (Otherwise we will skip
         // the feature.)
         if ( !combinedStyle.empty() )
         {
-            osg::Group* styleGroup = createStyleGroup(combinedStyle, workingSet, context);
-            if ( styleGroup )
-                parent->addChild( styleGroup );
+            bins.push_back( StyleBin() );
+            bins.back()._style = combinedStyle;
+            bins.back()._features.swap( workingSet );
         }
     }
+
+    // then create a style group per bin, and add them.
+    std::vector<osg::Group*> styleGroups;
+    createStyleGroups( bins, context, styleGroups );
+
+    for( std::vector<osg::Group*>::iterator i = styleGroups.begin(); i != styleGroups.end(); ++i )
+    {
+        if ( *i )
+            parent->addChild( *i );
+    }
 }
 
 
@@ -1046,46 +1109,107 @@ FeatureModelGraph::createStyleGroup(const Style&         style,
                                     FeatureList&         workingSet, 
                                     const FilterContext& contextPrototype)
 {
-    osg::Group* styleGroup = 0L;
+    StyleBins bins( 1 );
+    bins[0]._style = style;
+    bins[0]._features.swap( workingSet );
 
-    FilterContext context(contextPrototype);
+    std::vector<osg::Group*> styleGroups;
+    createStyleGroups( bins, contextPrototype, styleGroups );
 
+    return styleGroups[0];
+}
+
+
+/**
+ * Compiles each bin of features into a style group. With a compile service, the
+ * bins (and chunks of the large ones) compile in parallel, each on its own copy
+ * of the filter context; the results are merged into the style groups here.
+ */
+void
+FeatureModelGraph::createStyleGroups(StyleBins&                bins,
+                                     const FilterContext&      contextPrototype,
+                                     std::vector<osg::Group*>& output)
+{
     // first Crop the feature set to the working extent:
-    CropFilter crop( 
+    CropFilter::Method cropMethod =
         _options.layout().isSet() && _options.layout()->cropFeatures() == true ? 
-        CropFilter::METHOD_CROPPING : CropFilter::METHOD_CENTROID );
-
-    context = crop.push( workingSet, context );
+        CropFilter::METHOD_CROPPING : CropFilter::METHOD_CENTROID;
 
     // next, if the usable extent is less than the full extent (i.e. we had to clamp the feature
     // extent to fit on the map), calculate the extent of the features in this tile and 
     // crop to the map extent if necessary. (Note, if cropFeatures was set to true, this is
     // already done)
-    if ( _featureExtentClamped && _options.layout().isSet() && _options.layout()->cropFeatures() == false )
+    const GeoExtent* clampExtent =
+        _featureExtentClamped && _options.layout().isSet() && _options.layout()->cropFeatures() == false ?
+        &_usableFeatureExtent : 0L;
+
+    unsigned chunkSize = UINT_MAX;
+    if ( _compileService.valid() && _options.compileChunkSize().isSet() && *_options.compileChunkSize() > 0 )
+        chunkSize = *_options.compileChunkSize();
+
+    unsigned numChunks = 0;
+    for( StyleBins::const_iterator b = bins.begin(); b != bins.end(); ++b )
+    {
+        if ( b->_features.size() > 0 )
+            numChunks += 1 + (b->_features.size()-1)/chunkSize;
+    }
+
+    Threading::MultiEvent semaphore( numChunks );
+
+    typedef ParallelTask<CompileChunk> CompileTask;
+    std::vector< osg::ref_ptr<CompileTask> > chunks;
+    std::vector<unsigned>                    chunkBins;
+
+    for( unsigned b=0; b<bins.size(); ++b )
     {
-        context.extent() = _usableFeatureExtent;
-        CropFilter crop2( CropFilter::METHOD_CROPPING );
-        context = crop2.push( workingSet, context );
+        const FeatureList& features = bins[b]._features;
+        for( unsigned start=0; start < features.size(); start += chunkSize )
+        {
+            unsigned end = std::min( (unsigned)features.size(), start + std::min(chunkSize, (unsigned)features.size()) );
+
+            CompileTask* task = new CompileTask( &semaphore );
+            task->_factory     = _factory.get();
+            task->_style       = &bins[b]._style;
+            task->_context     = contextPrototype;
+            task->_cropMethod  = cropMethod;
+            task->_clampExtent = clampExtent;
+            task->_features.assign( features.begin()+start, features.begin()+end );
+            chunks.push_back( task );
+            chunkBins.push_back( b );
+        }
     }
 
-    // finally, compile the features into a node.
-    if ( workingSet.size() > 0 )
+    if ( _compileService.valid() && chunks.size() > 1 )
     {
-        osg::ref_ptr<osg::Node> node;
-        osg::ref_ptr<FeatureCursor> newCursor = new FeatureListCursor(workingSet);
+        for( unsigned c=0; c<chunks.size(); ++c )
+            _compileService->add( chunks[c].get() );
 
-        if ( _factory->createOrUpdateNode( newCursor.get(), style, context, node ) )
+        semaphore.wait();
+    }
+    else
+    {
+        for( unsigned c=0; c<chunks.size(); ++c )
+            chunks[c]->execute();
+    }
+
+    // finally, add the compiled nodes to their style groups. (Style groups come from
+    // the factory in this thread, since that can change the graph's global state.)
+    output.assign( bins.size(), 0L );
+
+    for( unsigned c=0; c<chunks.size(); ++c )
+    {
+        CompileChunk& chunk = *chunks[c].get();
+        if ( chunk._ok )
         {
+            osg::Group*& styleGroup = output[chunkBins[c]];
             if ( !styleGroup )
-                styleGroup = getOrCreateStyleGroupFromFactory( style );
+                styleGroup = getOrCreateStyleGroupFromFactory( bins[chunkBins[c]]._style );
 
             // if it returned a node, add it. (it doesn't necessarily have to)
-            if ( node.valid() )
-                styleGroup->addChild( node.get() );
+            if ( chunk._node.valid() )
+                styleGroup->addChild( chunk._node.get() );
         }
     }
-
-    return styleGroup;
 }
 
 
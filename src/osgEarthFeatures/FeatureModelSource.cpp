@@ -17,6 +17,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>
  */
 #include <osgEarthFeatures/FeatureModelSource>
+#include <osgEarthFeatures/CachingFeatureSource>
 #include <osgEarthFeatures/FeatureModelGraph>
 #include <osgEarth/SpatialReference>
 #include <osg/Notify>
@@ -36,7 +37,9 @@ _maxGranularity_deg( 1.0 ),
 _mergeGeometry     ( false ),
 _clusterCulling    ( true ),
 _backfaceCulling   ( true ),
-_alphaBlending     ( true )
+_alphaBlending     ( true ),
+_compileThreads    ( 1 ),
+_compileChunkSize  ( 1000 )
 {
     fromConfig( _conf );
 }
@@ -61,6 +64,8 @@ FeatureModelSourceOptions::fromConfig( const Config& conf )
     conf.getIfSet( "cluster_culling",  _clusterCulling );
     conf.getIfSet( "backface_culling", _backfaceCulling );
     conf.getIfSet( "alpha_blending",   _alphaBlending );
+    conf.getIfSet( "compile_threads",  _compileThreads );
+    conf.getIfSet( "compile_chunk_size", _compileChunkSize );
 
 }
 
@@ -87,6 +92,8 @@ FeatureModelSourceOptions::getConfig() const
     conf.updateIfSet( "cluster_culling",  _clusterCulling );
     conf.updateIfSet( "backface_culling", _backfaceCulling );
     conf.updateIfSet( "alpha_blending",   _alphaBlending );
+    conf.updateIfSet( "compile_threads",  _compileThreads );
+    conf.updateIfSet( "compile_chunk_size", _compileChunkSize );
 
     return conf;
 }
@@ -170,8 +177,11 @@ FeatureModelSource::createNodeImplementation(const Map*            map,
         return 0L;
     }
 
-    // Session holds data that's shared across the life of the FMG
-    Session* session = new Session( map, _options.styles().get(), _features.get(), dbOptions );
+    // Session holds data that's shared across the life of the FMG. The graph
+    // queries the source once per tile, level and style, so put a query
+    // cache in front of it.
+    osg::ref_ptr<FeatureSource> features = CachingFeatureSource::wrap( _features.get() );
+    Session* session = new Session( map, _options.styles().get(), features.get(), dbOptions );
 
     // Graph that will render feature models. May included paged data.
     FeatureModelGraph* graph = new FeatureModelGraph( session, _options, factory );
@@ -32,7 +32,8 @@ using namespace osgEarth::Symbology;
 using namespace OpenThreads;
 
 FeatureSourceOptions::FeatureSourceOptions(const ConfigOptions& options) :
-DriverConfigOptions( options )
+DriverConfigOptions( options ),
+_queryCacheSize    ( 32u * 1024u * 1024u )
 {
     fromConfig( _conf );
 }
@@ -46,6 +47,7 @@ FeatureSourceOptions::fromConfig( const Config& conf )
     conf.getIfSet   ( "name",         _name );
     conf.getObjIfSet( "profile",      _profile );
     conf.getObjIfSet( "cache_policy", _cachePolicy );
+    conf.getIfSet   ( "query_cache_size", _queryCacheSize );
 
     const ConfigSet& children = conf.children();
     for( ConfigSet::const_iterator i = children.begin(); i != children.end(); ++i )
@@ -91,6 +93,7 @@ FeatureSourceOptions::getConfig() const
     conf.updateIfSet   ( "name",         _name );
     conf.updateObjIfSet( "profile",      _profile );
     conf.updateObjIfSet( "cache_policy", _cachePolicy );
+    conf.updateIfSet   ( "query_cache_size", _queryCacheSize );
     
     for( FeatureFilterList::const_iterator i = _filters.begin(); i != _filters.end(); ++i )
     {
@@ -152,6 +152,7 @@ FeatureSourceIndexNode::tagPrimitiveSets(osg::Drawable* drawable, Feature* featu
 
         if ( _options.embedFeatures() == true )
         {
+            Threading::ScopedMutexLock lock( _featuresMutex );
             _features[feature->getFID()] = feature;
         }
     }
@@ -165,6 +166,7 @@ FeatureSourceIndexNode::tagNode( osg::Node* node, Feature* feature ) const
 
     if ( _options.embedFeatures() == true )
     {
+        Threading::ScopedMutexLock lock( _featuresMutex );
         _features[feature->getFID()] = feature;
     }
 }
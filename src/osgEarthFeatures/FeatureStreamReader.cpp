@@ -0,0 +1,1574 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2013 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarthFeatures/FeatureStreamReader>
+#include <osgEarth/Notify>
+#include <osgEarth/Registry>
+#include <osgEarth/StringUtils>
+#include <osg/Math>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <climits>
+
+#define LC "[FeatureStreamReader] "
+
+using namespace osgEarth;
+using namespace osgEarth::Features;
+using namespace osgEarth::Symbology;
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    // Builds a geometry from a vector of points (copying them).
+    Geometry* makeGeometry( Geometry::Type type, const Vec3dVector& points )
+    {
+        switch( type )
+        {
+        case Geometry::TYPE_POINTSET:   return new PointSet( &points );
+        case Geometry::TYPE_LINESTRING: return new LineString( &points );
+        case Geometry::TYPE_RING:       return new Ring( &points );
+        case Geometry::TYPE_POLYGON:    return new Polygon( &points );
+        default:                        return 0L;
+        }
+    }
+
+    // Sets a feature attribute from its text value, using the narrowest
+    // type that represents the value exactly.
+    void setInferredAttr( Feature* feature, const std::string& name, const std::string& value )
+    {
+        if ( value.empty() )
+        {
+            feature->setNull( name, ATTRTYPE_STRING );
+            return;
+        }
+
+        const char* begin = value.c_str();
+        char*       end   = 0L;
+
+        long l = strtol( begin, &end, 10 );
+        if ( end != begin && *end == '\0' && l >= INT_MIN && l <= INT_MAX )
+        {
+            feature->set( name, (int)l );
+            return;
+        }
+
+        double d = strtod( begin, &end );
+        if ( end != begin && *end == '\0' )
+        {
+            feature->set( name, d );
+            return;
+        }
+
+        feature->set( name, value );
+    }
+
+    // Appends a unicode code point to a UTF-8 string.
+    void appendUTF8( std::string& out, unsigned cp )
+    {
+        if ( cp < 0x80 ) {
+            out += (char)cp;
+        }
+        else if ( cp < 0x800 ) {
+            out += (char)(0xC0 | (cp >> 6));
+            out += (char)(0x80 | (cp & 0x3F));
+        }
+        else if ( cp < 0x10000 ) {
+            out += (char)(0xE0 | (cp >> 12));
+            out += (char)(0x80 | ((cp >> 6) & 0x3F));
+            out += (char)(0x80 | (cp & 0x3F));
+        }
+        else {
+            out += (char)(0xF0 | (cp >> 18));
+            out += (char)(0x80 | ((cp >> 12) & 0x3F));
+            out += (char)(0x80 | ((cp >> 6) & 0x3F));
+            out += (char)(0x80 | (cp & 0x3F));
+        }
+    }
+
+    std::string::size_type skipBOM( const std::string& buf )
+    {
+        return buf.compare(0, 3, "\xEF\xBB\xBF") == 0 ? 3 : 0;
+    }
+}
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    enum ListResult { LIST_NEXT, LIST_END, LIST_ERROR };
+
+    /**
+     * Minimal pull-style JSON tokenizer operating in place on a buffer.
+     */
+    struct JSONScanner
+    {
+        JSONScanner( const std::string& s, std::string::size_type& pos ) : _s(s), _p(pos) { }
+
+        const std::string&      _s;
+        std::string::size_type& _p;
+
+        void skipWS() {
+            while( _p < _s.size() && ::isspace((unsigned char)_s[_p]) ) ++_p;
+        }
+
+        char peek() {
+            skipWS();
+            return _p < _s.size() ? _s[_p] : '\0';
+        }
+
+        bool accept( char c ) {
+            if ( peek() == c ) { ++_p; return true; }
+            return false;
+        }
+
+        bool acceptLiteral( const char* lit ) {
+            skipWS();
+            std::string::size_type n = ::strlen(lit);
+            if ( _s.compare(_p, n, lit) == 0 ) { _p += n; return true; }
+            return false;
+        }
+
+        bool peekIsNumber() {
+            char c = peek();
+            return c == '-' || c == '+' || c == '.' || ::isdigit((unsigned char)c);
+        }
+
+        // Advances to the next member of an object, reading its key.
+        ListResult nextMember( std::string& key, bool& first ) {
+            if ( accept('}') ) return LIST_END;
+            if ( !first && !accept(',') ) return LIST_ERROR;
+            first = false;
+            if ( !readString(key) || !accept(':') ) return LIST_ERROR;
+            return LIST_NEXT;
+        }
+
+        // Advances to the next element of an array.
+        ListResult nextElement( bool& first ) {
+            if ( accept(']') ) return LIST_END;
+            if ( !first && !accept(',') ) return LIST_ERROR;
+            first = false;
+            return LIST_NEXT;
+        }
+
+        bool readString( std::string& out )
+        {
+            if ( !accept('"') )
+                return false;
+
+            out.clear();
+            while( _p < _s.size() )
+            {
+                char c = _s[_p++];
+                if ( c == '"' )
+                    return true;
+
+                if ( c != '\\' )
+                {
+                    out += c;
+                    continue;
+                }
+
+                if ( _p >= _s.size() )
+                    return false;
+
+                char e = _s[_p++];
+                switch( e )
+                {
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'n': out += '\n'; break;
+                case 'r': out += '\r'; break;
+                case 't': out += '\t'; break;
+                case 'u':
+                    {
+                        if ( _p + 4 > _s.size() ) return false;
+                        unsigned cp = strtoul( _s.substr(_p, 4).c_str(), 0L, 16 );
+                        _p += 4;
+                        // surrogate pair:
+                        if ( cp >= 0xD800 && cp <= 0xDBFF && _p + 6 <= _s.size() && _s[_p] == '\\' && _s[_p+1] == 'u' )
+                        {
+                            unsigned lo = strtoul( _s.substr(_p+2, 4).c_str(), 0L, 16 );
+                            if ( lo >= 0xDC00 && lo <= 0xDFFF )
+                            {
+                                cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                                _p += 6;
+                            }
+                        }
+                        appendUTF8( out, cp );
+                    }
+                    break;
+                default: out += e; break;
+                }
+            }
+            return false;
+        }
+
+        bool readNumber( double& out, bool& isInteger )
+        {
+            skipWS();
+            const char* begin = _s.c_str() + _p;
+            char*       end   = 0L;
+            out = strtod( begin, &end );
+            if ( end == begin )
+                return false;
+
+            isInteger = true;
+            for( const char* c = begin; c != end; ++c )
+            {
+                if ( *c == '.' || *c == 'e' || *c == 'E' ) {
+                    isInteger = false;
+                    break;
+                }
+            }
+            _p += (end - begin);
+            return true;
+        }
+
+        bool skipString()
+        {
+            if ( !accept('"') )
+                return false;
+            while( _p < _s.size() )
+            {
+                char c = _s[_p++];
+                if ( c == '\\' ) ++_p;
+                else if ( c == '"' ) return true;
+            }
+            return false;
+        }
+
+        bool skipValue()
+        {
+            char c = peek();
+            if ( c == '"' )
+            {
+                return skipString();
+            }
+            else if ( c == '{' || c == '[' )
+            {
+                int depth = 0;
+                while( _p < _s.size() )
+                {
+                    char d = _s[_p];
+                    if ( d == '"' )
+                    {
+                        if ( !skipString() ) return false;
+                        continue;
+                    }
+                    ++_p;
+                    if ( d == '{' || d == '[' )
+                        ++depth;
+                    else if ( (d == '}' || d == ']') && --depth == 0 )
+                        return true;
+                }
+                return false;
+            }
+            else if ( c == 't' ) return acceptLiteral("true");
+            else if ( c == 'f' ) return acceptLiteral("false");
+            else if ( c == 'n' ) return acceptLiteral("null");
+            else
+            {
+                double d; bool i;
+                return readNumber( d, i );
+            }
+        }
+
+        // skips a value and returns its raw JSON text.
+        bool readRawValue( std::string& out )
+        {
+            skipWS();
+            std::string::size_type start = _p;
+            if ( !skipValue() )
+                return false;
+            out = _s.substr( start, _p - start );
+            return true;
+        }
+    };
+
+    /**
+     * Nested GeoJSON "coordinates" array. Depth 0 is a single position,
+     * depth 1 a list of positions, depth 2 a list of lists, etc.
+     */
+    struct CoordNode
+    {
+        CoordNode() : depth(1) { }
+        int                    depth;
+        Vec3dVector            points;
+        std::vector<CoordNode> children;
+    };
+
+    bool readPosition( JSONScanner& js, osg::Vec3d& out )
+    {
+        if ( !js.accept('[') )
+            return false;
+
+        out.set( 0, 0, 0 );
+        bool first = true;
+        for( unsigned i=0; ; ++i )
+        {
+            ListResult r = js.nextElement( first );
+            if ( r == LIST_END )   return i >= 2;
+            if ( r == LIST_ERROR ) return false;
+
+            double value; bool isInt;
+            if ( !js.readNumber(value, isInt) )
+                return false;
+            if ( i < 3 )
+                out[i] = value;
+        }
+    }
+
+    bool readCoords( JSONScanner& js, CoordNode& node )
+    {
+        // a position?
+        std::string::size_type save = js._p;
+        if ( !js.accept('[') )
+            return false;
+        bool isPosition = js.peekIsNumber();
+        js._p = save;
+
+        if ( isPosition )
+        {
+            osg::Vec3d p;
+            if ( !readPosition(js, p) )
+                return false;
+            node.depth = 0;
+            node.points.push_back( p );
+            return true;
+        }
+
+        js.accept('[');
+        node.depth = 1;
+        bool first = true;
+        for( ; ; )
+        {
+            ListResult r = js.nextElement( first );
+            if ( r == LIST_END )   return true;
+            if ( r == LIST_ERROR ) return false;
+
+            // peek whether the child is a position, and if so read it
+            // straight into our point list.
+            save = js._p;
+            if ( !js.accept('[') )
+                return false;
+            isPosition = js.peekIsNumber();
+            js._p = save;
+
+            if ( isPosition )
+            {
+                osg::Vec3d p;
+                if ( !readPosition(js, p) )
+                    return false;
+                node.points.push_back( p );
+                node.depth = 1;
+            }
+            else
+            {
+                node.children.push_back( CoordNode() );
+                if ( !readCoords(js, node.children.back()) )
+                    return false;
+                node.depth = node.children.back().depth + 1;
+            }
+        }
+    }
+
+    Polygon* makePolygon( const CoordNode& node )
+    {
+        if ( node.children.empty() )
+            return 0L;
+
+        Polygon* poly = new Polygon( &node.children[0].points );
+        poly->rewind( Ring::ORIENTATION_CCW );
+
+        for( unsigned i=1; i<node.children.size(); ++i )
+        {
+            Ring* hole = new Ring( &node.children[i].points );
+            hole->rewind( Ring::ORIENTATION_CW );
+            poly->getHoles().push_back( hole );
+        }
+        return poly;
+    }
+
+    Geometry* makeGeoJSONGeometry( const std::string& type, const CoordNode& c, const GeometryCollection& parts )
+    {
+        if ( type == "Point" || type == "MultiPoint" )
+        {
+            return makeGeometry( Geometry::TYPE_POINTSET, c.points );
+        }
+        else if ( type == "LineString" )
+        {
+            return makeGeometry( Geometry::TYPE_LINESTRING, c.points );
+        }
+        else if ( type == "Polygon" )
+        {
+            return makePolygon( c );
+        }
+        else if ( type == "MultiLineString" )
+        {
+            MultiGeometry* multi = new MultiGeometry();
+            for( unsigned i=0; i<c.children.size(); ++i )
+                multi->add( makeGeometry(Geometry::TYPE_LINESTRING, c.children[i].points) );
+            return multi;
+        }
+        else if ( type == "MultiPolygon" )
+        {
+            MultiGeometry* multi = new MultiGeometry();
+            for( unsigned i=0; i<c.children.size(); ++i )
+            {
+                Polygon* poly = makePolygon( c.children[i] );
+                if ( poly )
+                    multi->add( poly );
+            }
+            return multi;
+        }
+        else if ( type == "GeometryCollection" )
+        {
+            return new MultiGeometry( parts );
+        }
+        return 0L;
+    }
+
+    /**
+     * Everything we care about in a GeoJSON object; we can't build anything
+     * until the object closes because members can appear in any order.
+     */
+    struct GeoJSONObject
+    {
+        GeoJSONObject() : fid(0L), hasFID(false) { }
+        std::string            type;
+        CoordNode              coords;
+        GeometryCollection     geometries;
+        osg::ref_ptr<Geometry> geometry;
+        AttributeTable         attrs;
+        FeatureID              fid;
+        bool                   hasFID;
+    };
+
+    bool readGeoJSONObject( JSONScanner& js, GeoJSONObject& obj );
+
+    bool readGeoJSONGeometry( JSONScanner& js, osg::ref_ptr<Geometry>& out )
+    {
+        if ( js.acceptLiteral("null") )
+            return true;
+
+        GeoJSONObject obj;
+        if ( !readGeoJSONObject(js, obj) )
+            return false;
+
+        out = makeGeoJSONGeometry( obj.type, obj.coords, obj.geometries );
+        return true;
+    }
+
+    bool readGeoJSONProperties( JSONScanner& js, AttributeTable& attrs )
+    {
+        if ( js.acceptLiteral("null") )
+            return true;
+
+        if ( !js.accept('{') )
+            return false;
+
+        std::string key;
+        bool first = true;
+        for( ; ; )
+        {
+            ListResult r = js.nextMember( key, first );
+            if ( r == LIST_END )   return true;
+            if ( r == LIST_ERROR ) return false;
+
+            // attribute names are lower-cased, same as the OGR path.
+            AttributeValue& a = attrs[ toLower(key) ];
+            a.second.set = true;
+
+            char c = js.peek();
+            if ( c == '"' )
+            {
+                a.first = ATTRTYPE_STRING;
+                if ( !js.readString(a.second.stringValue) ) return false;
+            }
+            else if ( c == 't' || c == 'f' )
+            {
+                a.first = ATTRTYPE_BOOL;
+                a.second.boolValue = (c == 't');
+                if ( !js.acceptLiteral(c == 't' ? "true" : "false") ) return false;
+            }
+            else if ( c == 'n' )
+            {
+                a.first = ATTRTYPE_UNSPECIFIED;
+                a.second.set = false;
+                if ( !js.acceptLiteral("null") ) return false;
+            }
+            else if ( c == '{' || c == '[' )
+            {
+                // nested values are kept as raw JSON text.
+                a.first = ATTRTYPE_STRING;
+                if ( !js.readRawValue(a.second.stringValue) ) return false;
+            }
+            else
+            {
+                double value; bool isInt;
+                if ( !js.readNumber(value, isInt) ) return false;
+                if ( isInt && value >= (double)INT_MIN && value <= (double)INT_MAX )
+                {
+                    a.first = ATTRTYPE_INT;
+                    a.second.intValue = (int)value;
+                }
+                else
+                {
+                    a.first = ATTRTYPE_DOUBLE;
+                    a.second.doubleValue = value;
+                }
+            }
+        }
+    }
+
+    bool readGeoJSONObject( JSONScanner& js, GeoJSONObject& obj )
+    {
+        if ( !js.accept('{') )
+            return false;
+
+        std::string key;
+        bool first = true;
+        for( ; ; )
+        {
+            ListResult r = js.nextMember( key, first );
+            if ( r == LIST_END )   return true;
+            if ( r == LIST_ERROR ) return false;
+
+            bool ok = true;
+
+            if ( key == "type" )
+            {
+                ok = js.readString( obj.type );
+            }
+            else if ( key == "id" )
+            {
+                if ( js.peek() == '"' )
+                {
+                    std::string id;
+                    ok = js.readString( id );
+                    std::string::size_type dot = id.find_last_of('.');
+                    std::string num = dot == std::string::npos ? id : id.substr(dot+1);
+                    char* end = 0L;
+                    unsigned long value = strtoul( num.c_str(), &end, 10 );
+                    if ( end != num.c_str() && *end == '\0' )
+                    {
+                        obj.fid    = value;
+                        obj.hasFID = true;
+                    }
+                }
+                else if ( js.peekIsNumber() )
+                {
+                    double value; bool isInt;
+                    ok = js.readNumber( value, isInt );
+                    obj.fid    = (FeatureID)value;
+                    obj.hasFID = true;
+                }
+                else
+                {
+                    ok = js.skipValue();
+                }
+            }
+            else if ( key == "geometry" )
+            {
+                ok = readGeoJSONGeometry( js, obj.geometry );
+            }
+            else if ( key == "properties" )
+            {
+                ok = readGeoJSONProperties( js, obj.attrs );
+            }
+            else if ( key == "coordinates" )
+            {
+                ok = readCoords( js, obj.coords );
+            }
+            else if ( key == "geometries" )
+            {
+                ok = js.accept('[');
+                bool firstGeom = true;
+                while( ok )
+                {
+                    ListResult gr = js.nextElement( firstGeom );
+                    if ( gr == LIST_END ) break;
+                    osg::ref_ptr<Geometry> part;
+                    ok = gr == LIST_NEXT && readGeoJSONGeometry( js, part );
+                    if ( ok && part.valid() )
+                        obj.geometries.push_back( part.get() );
+                }
+            }
+            else
+            {
+                ok = js.skipValue();
+            }
+
+            if ( !ok )
+                return false;
+        }
+    }
+}
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    /**
+     * Minimal pull-style XML tokenizer operating in place on a buffer.
+     * Names are reported without their namespace prefix.
+     */
+    struct XmlScanner
+    {
+        enum Token { TOKEN_START, TOKEN_END, TOKEN_TEXT, TOKEN_EOF, TOKEN_ERROR };
+
+        typedef std::vector< std::pair<std::string,std::string> > Attributes;
+
+        XmlScanner( const std::string& s, std::string::size_type& pos, int& depth ) :
+            _s(s), _p(pos), _depth(depth), _pendingEnd(false) { }
+
+        const std::string&      _s;
+        std::string::size_type& _p;
+        int&                    _depth;
+        bool                    _pendingEnd;
+        std::string             _name;
+        std::string             _prefix;
+        std::string             _text;
+        Attributes              _attrs;
+
+        const std::string& name() const { return _name; }
+        const std::string& prefix() const { return _prefix; }
+        const std::string& text() const { return _text; }
+        int depth() const { return _depth; }
+
+        std::string attr( const std::string& localName ) const
+        {
+            for( Attributes::const_iterator i = _attrs.begin(); i != _attrs.end(); ++i )
+                if ( i->first == localName )
+                    return i->second;
+            return "";
+        }
+
+        Token next()
+        {
+            if ( _pendingEnd )
+            {
+                _pendingEnd = false;
+                --_depth;
+                return TOKEN_END;
+            }
+
+            for( ; ; )
+            {
+                if ( _p >= _s.size() )
+                    return TOKEN_EOF;
+
+                if ( _s[_p] != '<' )
+                {
+                    std::string::size_type end = _s.find( '<', _p );
+                    if ( end == std::string::npos ) end = _s.size();
+                    std::string::size_type start = _p;
+                    _p = end;
+
+                    std::string::size_type first = _s.find_first_not_of( " \t\r\n", start );
+                    if ( first == std::string::npos || first >= end )
+                        continue; // whitespace only
+
+                    std::string::size_type last = _s.find_last_not_of( " \t\r\n", end-1 );
+                    decode( _s, first, last+1, _text );
+                    return TOKEN_TEXT;
+                }
+
+                if ( _s.compare(_p, 4, "<!--") == 0 )
+                {
+                    if ( !skipPast("-->") ) return TOKEN_ERROR;
+                }
+                else if ( _s.compare(_p, 9, "<![CDATA[") == 0 )
+                {
+                    std::string::size_type end = _s.find( "]]>", _p+9 );
+                    if ( end == std::string::npos ) return TOKEN_ERROR;
+                    _text = _s.substr( _p+9, end-(_p+9) );
+                    _p = end + 3;
+                    return TOKEN_TEXT;
+                }
+                else if ( _s.compare(_p, 2, "<?") == 0 )
+                {
+                    if ( !skipPast("?>") ) return TOKEN_ERROR;
+                }
+                else if ( _s.compare(_p, 2, "<!") == 0 )
+                {
+                    if ( !skipPast(">") ) return TOKEN_ERROR;
+                }
+                else if ( _s.compare(_p, 2, "</") == 0 )
+                {
+                    _p += 2;
+                    readName();
+                    if ( !skipPast(">") ) return TOKEN_ERROR;
+                    --_depth;
+                    return TOKEN_END;
+                }
+                else
+                {
+                    ++_p;
+                    readName();
+                    if ( _name.empty() )
+                        return TOKEN_ERROR;
+
+                    _attrs.clear();
+                    for( ; ; )
+                    {
+                        skipWS();
+                        if ( _p >= _s.size() )
+                            return TOKEN_ERROR;
+
+                        if ( _s[_p] == '>' )
+                        {
+                            ++_p;
+                            break;
+                        }
+                        else if ( _s.compare(_p, 2, "/>") == 0 )
+                        {
+                            _p += 2;
+                            _pendingEnd = true;
+                            break;
+                        }
+
+                        std::string::size_type eq = _s.find( '=', _p );
+                        if ( eq == std::string::npos ) return TOKEN_ERROR;
+                        std::string key = trim( _s.substr(_p, eq-_p) );
+                        std::string::size_type colon = key.find( ':' );
+                        if ( colon != std::string::npos )
+                            key = key.substr( colon+1 );
+
+                        _p = eq + 1;
+                        skipWS();
+                        if ( _p >= _s.size() ) return TOKEN_ERROR;
+                        char quote = _s[_p];
+                        if ( quote != '"' && quote != '\'' ) return TOKEN_ERROR;
+                        std::string::size_type end = _s.find( quote, _p+1 );
+                        if ( end == std::string::npos ) return TOKEN_ERROR;
+
+                        std::string value;
+                        decode( _s, _p+1, end, value );
+                        _attrs.push_back( std::make_pair(key, value) );
+                        _p = end + 1;
+                    }
+
+                    ++_depth;
+                    return TOKEN_START;
+                }
+            }
+        }
+
+        // Reads the text content of the current element, through its end tag.
+        // Text inside nested elements is ignored.
+        bool readText( std::string& out )
+        {
+            out.clear();
+            int d = _depth;
+            for( ; ; )
+            {
+                Token t = next();
+                if ( t == TOKEN_TEXT && _depth == d ) out += _text;
+                else if ( t == TOKEN_END && _depth < d ) return true;
+                else if ( t == TOKEN_EOF || t == TOKEN_ERROR ) return false;
+            }
+        }
+
+        // Skips the remainder of the current element, through its end tag.
+        bool skipElement()
+        {
+            int d = _depth;
+            for( ; ; )
+            {
+                Token t = next();
+                if ( t == TOKEN_END && _depth < d ) return true;
+                else if ( t == TOKEN_EOF || t == TOKEN_ERROR ) return false;
+            }
+        }
+
+        void skipWS() {
+            while( _p < _s.size() && ::isspace((unsigned char)_s[_p]) ) ++_p;
+        }
+
+        bool skipPast( const char* delim ) {
+            std::string::size_type end = _s.find( delim, _p );
+            if ( end == std::string::npos ) { _p = _s.size(); return false; }
+            _p = end + ::strlen(delim);
+            return true;
+        }
+
+        void readName() {
+            std::string::size_type start = _p;
+            while( _p < _s.size() && !::isspace((unsigned char)_s[_p]) && _s[_p] != '>' && _s[_p] != '/' ) ++_p;
+            std::string qname = _s.substr( start, _p-start );
+            std::string::size_type colon = qname.find( ':' );
+            if ( colon != std::string::npos ) {
+                _prefix = qname.substr( 0, colon );
+                _name   = qname.substr( colon+1 );
+            }
+            else {
+                _prefix.clear();
+                _name = qname;
+            }
+        }
+
+        // decodes the predefined and numeric character entities.
+        static void decode( const std::string& s, std::string::size_type begin, std::string::size_type end, std::string& out )
+        {
+            out.clear();
+            out.reserve( end-begin );
+            for( std::string::size_type i = begin; i < end; ++i )
+            {
+                if ( s[i] != '&' ) {
+                    out += s[i];
+                    continue;
+                }
+                std::string::size_type semi = s.find( ';', i );
+                if ( semi == std::string::npos || semi >= end ) {
+                    out += s[i];
+                    continue;
+                }
+                std::string ent = s.substr( i+1, semi-i-1 );
+                if      ( ent == "lt" )   out += '<';
+                else if ( ent == "gt" )   out += '>';
+                else if ( ent == "amp" )  out += '&';
+                else if ( ent == "quot" ) out += '"';
+                else if ( ent == "apos" ) out += '\'';
+                else if ( ent.size() > 1 && ent[0] == '#' )
+                {
+                    unsigned cp = ent[1] == 'x' || ent[1] == 'X' ?
+                        strtoul( ent.c_str()+2, 0L, 16 ) :
+                        strtoul( ent.c_str()+1, 0L, 10 );
+                    appendUTF8( out, cp );
+                }
+                else
+                {
+                    out += s.substr( i, semi-i+1 );
+                }
+                i = semi;
+            }
+        }
+    };
+
+    // GML 3 with an EPSG URN (or http URI) for a geographic SRS means the
+    // axes are in lat/long order; plain "EPSG:4326" does not.
+    bool isLatLongAxisOrder( const std::string& srsName )
+    {
+        std::string srs = toLower( srsName );
+        bool isURN =
+            srs.find("urn:ogc:def:crs:epsg") != std::string::npos ||
+            srs.find("urn:x-ogc:def:crs:epsg") != std::string::npos ||
+            srs.find("/def/crs/epsg/") != std::string::npos;
+        return isURN && endsWith( srs, "4326" );
+    }
+
+    bool isGMLGeometry( const std::string& name )
+    {
+        return
+            name == "Point"          || name == "LineString"      || name == "LinearRing"  ||
+            name == "Curve"          || name == "Polygon"         || name == "Surface"     ||
+            name == "MultiPoint"     || name == "MultiLineString" || name == "MultiCurve"  ||
+            name == "MultiPolygon"   || name == "MultiSurface"    || name == "MultiGeometry";
+    }
+
+    struct GMLContext
+    {
+        GMLContext() : dims(2), swapXY(false) { }
+        unsigned dims;
+        bool     swapXY;
+
+        void update( const XmlScanner& xml )
+        {
+            std::string srsName = xml.attr("srsName");
+            if ( !srsName.empty() )
+                swapXY = isLatLongAxisOrder( srsName );
+
+            std::string dim = xml.attr("srsDimension");
+            if ( dim.empty() ) dim = xml.attr("dimension");
+            if ( !dim.empty() )
+                dims = osg::clampBetween( as<unsigned>(dim, 2u), 1u, 3u );
+        }
+
+        void add( Geometry* geom, osg::Vec3d p ) const
+        {
+            if ( swapXY )
+                std::swap( p.x(), p.y() );
+            geom->push_back( p );
+        }
+    };
+
+    // Parses a "pos" or "posList" element's content: whitespace-separated ordinates.
+    void parsePosList( const std::string& text, const GMLContext& cx, Geometry* geom )
+    {
+        const char* c = text.c_str();
+        char* end = 0L;
+        osg::Vec3d p;
+        unsigned i = 0;
+        for( ; ; )
+        {
+            double v = strtod( c, &end );
+            if ( end == c ) break;
+            c = end;
+            p[i++] = v;
+            if ( i == cx.dims )
+            {
+                cx.add( geom, p );
+                p.set( 0, 0, 0 );
+                i = 0;
+            }
+        }
+    }
+
+    // Parses a GML2 "coordinates" element's content.
+    void parseCoordinates( const std::string& text, char cs, char ts, char decimal, const GMLContext& cx, Geometry* geom )
+    {
+        std::string s = text;
+        if ( decimal != '.' )
+            std::replace( s.begin(), s.end(), decimal, '.' );
+
+        bool tsIsSpace = ::isspace((unsigned char)ts) != 0;
+
+        osg::Vec3d p;
+        unsigned   i = 0;
+        std::string::size_type pos = 0;
+        while( pos < s.size() )
+        {
+            char c = s[pos];
+            bool tupleEnd = tsIsSpace ? (::isspace((unsigned char)c) != 0) : (c == ts);
+            if ( tupleEnd )
+            {
+                if ( i > 0 )
+                {
+                    cx.add( geom, p );
+                    p.set( 0, 0, 0 );
+                    i = 0;
+                }
+                ++pos;
+            }
+            else if ( c == cs || ::isspace((unsigned char)c) )
+            {
+                ++pos;
+            }
+            else
+            {
+                const char* begin = s.c_str() + pos;
+                char* end = 0L;
+                double v = strtod( begin, &end );
+                if ( end == begin )
+                    break;
+                if ( i < 3 )
+                    p[i++] = v;
+                pos += (end - begin);
+            }
+        }
+        if ( i > 0 )
+            cx.add( geom, p );
+    }
+
+    // Reads all coordinates under the current element into the geometry.
+    bool readGMLCoords( XmlScanner& xml, GMLContext cx, Geometry* geom )
+    {
+        int d = xml.depth();
+        std::string text;
+        for( ; ; )
+        {
+            XmlScanner::Token t = xml.next();
+            if ( t == XmlScanner::TOKEN_END && xml.depth() < d )
+                return true;
+            if ( t == XmlScanner::TOKEN_EOF || t == XmlScanner::TOKEN_ERROR )
+                return false;
+            if ( t != XmlScanner::TOKEN_START )
+                continue;
+
+            const std::string& name = xml.name();
+            if ( name == "coordinates" )
+            {
+                std::string cs  = xml.attr("cs");
+                std::string ts  = xml.attr("ts");
+                std::string dec = xml.attr("decimal");
+                if ( !xml.readText(text) ) return false;
+                parseCoordinates(
+                    text,
+                    cs.empty()  ? ',' : cs[0],
+                    ts.empty()  ? ' ' : ts[0],
+                    dec.empty() ? '.' : dec[0],
+                    cx, geom );
+            }
+            else if ( name == "pos" || name == "posList" )
+            {
+                GMLContext local = cx;
+                local.update( xml );
+                if ( !xml.readText(text) ) return false;
+                parsePosList( text, local, geom );
+            }
+            else if ( name == "coord" )
+            {
+                // GML2 <coord><X/><Y/><Z/></coord>
+                osg::Vec3d p;
+                int cd = xml.depth();
+                for( ; ; )
+                {
+                    XmlScanner::Token ct = xml.next();
+                    if ( ct == XmlScanner::TOKEN_END && xml.depth() < cd ) break;
+                    if ( ct == XmlScanner::TOKEN_EOF || ct == XmlScanner::TOKEN_ERROR ) return false;
+                    if ( ct == XmlScanner::TOKEN_START )
+                    {
+                        int axis = xml.name() == "X" ? 0 : xml.name() == "Y" ? 1 : xml.name() == "Z" ? 2 : -1;
+                        if ( !xml.readText(text) ) return false;
+                        if ( axis >= 0 ) p[axis] = as<double>(text, 0.0);
+                    }
+                }
+                cx.add( geom, p );
+            }
+            // anything else (LinearRing, segments, LineStringSegment, ...) is
+            // a container; keep descending.
+        }
+    }
+
+    Geometry* readGMLGeometry( XmlScanner& xml, GMLContext cx );
+
+    bool readGMLPolygon( XmlScanner& xml, const GMLContext& cx, Polygon* poly )
+    {
+        int d = xml.depth();
+        for( ; ; )
+        {
+            XmlScanner::Token t = xml.next();
+            if ( t == XmlScanner::TOKEN_END && xml.depth() < d )
+                break;
+            if ( t == XmlScanner::TOKEN_EOF || t == XmlScanner::TOKEN_ERROR )
+                return false;
+            if ( t != XmlScanner::TOKEN_START )
+                continue;
+
+            const std::string& name = xml.name();
+            if ( name == "outerBoundaryIs" || name == "exterior" )
+            {
+                if ( !readGMLCoords(xml, cx, poly) ) return false;
+            }
+            else if ( name == "innerBoundaryIs" || name == "interior" )
+            {
+                osg::ref_ptr<Ring> hole = new Ring();
+                if ( !readGMLCoords(xml, cx, hole.get()) ) return false;
+                hole->rewind( Ring::ORIENTATION_CW );
+                poly->getHoles().push_back( hole.get() );
+            }
+            // else: patches, PolygonPatch, etc. -- keep descending.
+        }
+
+        poly->rewind( Ring::ORIENTATION_CCW );
+        return true;
+    }
+
+    bool readGMLMulti( XmlScanner& xml, const GMLContext& cx, MultiGeometry* multi )
+    {
+        int d = xml.depth();
+        for( ; ; )
+        {
+            XmlScanner::Token t = xml.next();
+            if ( t == XmlScanner::TOKEN_END && xml.depth() < d )
+                return true;
+            if ( t == XmlScanner::TOKEN_EOF || t == XmlScanner::TOKEN_ERROR )
+                return false;
+
+            // member elements (polygonMember, surfaceMembers, ...) are just containers.
+            if ( t == XmlScanner::TOKEN_START && isGMLGeometry(xml.name()) )
+            {
+                osg::ref_ptr<Geometry> part = readGMLGeometry( xml, cx );
+                if ( !part.valid() )
+                    return false;
+                multi->add( part.get() );
+            }
+        }
+    }
+
+    // Reads the geometry whose start tag was just consumed.
+    Geometry* readGMLGeometry( XmlScanner& xml, GMLContext cx )
+    {
+        cx.update( xml );
+        std::string name = xml.name();
+
+        osg::ref_ptr<Geometry> geom;
+        bool ok = false;
+
+        if ( name == "Point" )
+        {
+            geom = new PointSet();
+            ok = readGMLCoords( xml, cx, geom.get() );
+        }
+        else if ( name == "LineString" || name == "Curve" )
+        {
+            geom = new LineString();
+            ok = readGMLCoords( xml, cx, geom.get() );
+        }
+        else if ( name == "LinearRing" )
+        {
+            geom = new Ring();
+            ok = readGMLCoords( xml, cx, geom.get() );
+        }
+        else if ( name == "Polygon" || name == "Surface" )
+        {
+            Polygon* poly = new Polygon();
+            geom = poly;
+            ok = readGMLPolygon( xml, cx, poly );
+        }
+        else
+        {
+            MultiGeometry* multi = new MultiGeometry();
+            geom = multi;
+            ok = readGMLMulti( xml, cx, multi );
+        }
+
+        return ok ? geom.release() : 0L;
+    }
+}
+
+//------------------------------------------------------------------------
+
+FeatureStreamReader::FeatureStreamReader(const std::string&      buffer,
+                                         const SpatialReference* srs ) :
+_buffer ( buffer ),
+_srs    ( srs ),
+_numRead( 0 )
+{
+    //nop
+}
+
+FeatureStreamReader*
+FeatureStreamReader::create(const std::string&      buffer,
+                            const std::string&      mimeType,
+                            const SpatialReference* srs)
+{
+    osg::ref_ptr<FeatureStreamReader> reader;
+
+    if ( isGeoJSON(mimeType) )
+    {
+        reader = new GeoJSONFeatureStreamReader( buffer, srs );
+    }
+    else if ( isGML(mimeType) )
+    {
+        reader = new GMLFeatureStreamReader( buffer, srs );
+    }
+    else
+    {
+        // no usable mime type; sniff the content.
+        std::string::size_type i = buffer.find_first_not_of( " \t\r\n", skipBOM(buffer) );
+        if ( i != std::string::npos && buffer[i] == '{' )
+            reader = new GeoJSONFeatureStreamReader( buffer, srs );
+        else if ( i != std::string::npos && buffer[i] == '<' )
+            reader = new GMLFeatureStreamReader( buffer, srs );
+    }
+
+    if ( reader.valid() && reader->open() )
+        return reader.release();
+
+    return 0L;
+}
+
+bool
+FeatureStreamReader::isGeoJSON( const std::string& mime )
+{
+    return
+        startsWith(mime, "application/json") ||
+        startsWith(mime, "application/vnd.geo+json") ||
+        startsWith(mime, "json") ||
+        startsWith(mime, "application/x-javascript") ||
+        startsWith(mime, "text/javascript") ||
+        startsWith(mime, "text/x-javascript") ||
+        startsWith(mime, "text/x-json");
+}
+
+bool
+FeatureStreamReader::isGML( const std::string& mime )
+{
+    return
+        startsWith(mime, "text/xml") ||
+        startsWith(mime, "application/xml") ||
+        startsWith(mime, "application/gml+xml");
+}
+
+void
+FeatureStreamReader::setError( const std::string& msg )
+{
+    _error = msg;
+}
+
+//------------------------------------------------------------------------
+
+GeoJSONFeatureStreamReader::GeoJSONFeatureStreamReader(const std::string&      buffer,
+                                                       const SpatialReference* srs) :
+FeatureStreamReader( buffer, srs ),
+_pos               ( 0 ),
+_inCollection      ( false ),
+_first             ( true ),
+_done              ( false )
+{
+    //nop
+}
+
+bool
+GeoJSONFeatureStreamReader::open()
+{
+    _pos = skipBOM( _buffer );
+    JSONScanner js( _buffer, _pos );
+
+    std::string::size_type objectStart = _pos;
+    if ( !js.accept('{') )
+        return false;
+
+    // Look for the "features" array in the top-level object. Members that
+    // precede it (type, crs, bbox, ...) are skipped without building anything.
+    std::string key;
+    bool first = true;
+    for( ; ; )
+    {
+        ListResult r = js.nextMember( key, first );
+        if ( r == LIST_ERROR )
+            return false;
+        if ( r == LIST_END )
+            break;
+
+        if ( key == "features" )
+        {
+            if ( !js.accept('[') )
+                return false;
+            _inCollection = true;
+            _first        = true;
+            return true;
+        }
+        else if ( !js.skipValue() )
+        {
+            return false;
+        }
+    }
+
+    // No collection; the whole document is a single Feature or Geometry.
+    _pos = objectStart;
+    _inCollection = false;
+    return true;
+}
+
+Feature*
+GeoJSONFeatureStreamReader::readFeature()
+{
+    if ( _done )
+        return 0L;
+
+    JSONScanner js( _buffer, _pos );
+
+    if ( _inCollection )
+    {
+        ListResult r = js.nextElement( _first );
+        if ( r != LIST_NEXT )
+        {
+            if ( r == LIST_ERROR )
+                setError( Stringify() << "Malformed GeoJSON feature array at offset " << _pos );
+            _done = true;
+            return 0L;
+        }
+    }
+    else
+    {
+        _done = true;
+    }
+
+    GeoJSONObject obj;
+    if ( !readGeoJSONObject(js, obj) )
+    {
+        setError( Stringify() << "Malformed GeoJSON feature at offset " << _pos );
+        _done = true;
+        return 0L;
+    }
+
+    // a bare geometry carries its coordinates directly.
+    osg::ref_ptr<Geometry> geom = obj.type == "Feature" ?
+        obj.geometry.get() :
+        makeGeoJSONGeometry( obj.type, obj.coords, obj.geometries );
+
+    Feature* feature = new Feature( geom.get(), _srs.get(), Style(), obj.hasFID ? obj.fid : (FeatureID)_numRead );
+
+    for( AttributeTable::const_iterator i = obj.attrs.begin(); i != obj.attrs.end(); ++i )
+    {
+        const AttributeValue& v = i->second;
+        if ( !v.second.set )
+        {
+            feature->setNull( i->first, v.first );
+            continue;
+        }
+        switch( v.first )
+        {
+        case ATTRTYPE_INT:    feature->set( i->first, v.second.intValue );    break;
+        case ATTRTYPE_DOUBLE: feature->set( i->first, v.second.doubleValue ); break;
+        case ATTRTYPE_BOOL:   feature->set( i->first, v.second.boolValue );   break;
+        default:              feature->set( i->first, v.second.stringValue ); break;
+        }
+    }
+
+    ++_numRead;
+    return feature;
+}
+
+//------------------------------------------------------------------------
+
+GMLFeatureStreamReader::GMLFeatureStreamReader(const std::string&      buffer,
+                                               const SpatialReference* srs) :
+FeatureStreamReader( buffer, srs ),
+_pos               ( 0 ),
+_depth             ( 0 ),
+_membersDepth      ( -1 ),
+_done              ( false )
+{
+    //nop
+}
+
+bool
+GMLFeatureStreamReader::open()
+{
+    _pos = skipBOM( _buffer );
+    XmlScanner xml( _buffer, _pos, _depth );
+
+    // Find the root element; it should be a feature collection of some kind.
+    XmlScanner::Token t;
+    while( (t = xml.next()) == XmlScanner::TOKEN_TEXT );
+
+    if ( t != XmlScanner::TOKEN_START )
+        return false;
+
+    if ( xml.name().find("Exception") != std::string::npos )
+    {
+        setError( "Response is an exception report" );
+        return false;
+    }
+
+    // a self-closing root means an empty collection; consume the pending END.
+    if ( xml._pendingEnd )
+    {
+        xml.next();
+        _done = true;
+    }
+
+    return true;
+}
+
+Feature*
+GMLFeatureStreamReader::readFeature()
+{
+    if ( _done )
+        return 0L;
+
+    XmlScanner xml( _buffer, _pos, _depth );
+
+    for( ; ; )
+    {
+        XmlScanner::Token t = xml.next();
+
+        if ( t == XmlScanner::TOKEN_EOF )
+        {
+            _done = true;
+            return 0L;
+        }
+        else if ( t == XmlScanner::TOKEN_ERROR )
+        {
+            setError( Stringify() << "Malformed GML at offset " << _pos );
+            _done = true;
+            return 0L;
+        }
+        else if ( t == XmlScanner::TOKEN_END )
+        {
+            if ( _membersDepth >= 0 && xml.depth() < _membersDepth )
+                _membersDepth = -1;
+        }
+        else if ( t == XmlScanner::TOKEN_START )
+        {
+            const std::string& name = xml.name();
+
+            // gml:featureMember (GML2), gml:featureMembers (GML3), wfs:member (WFS2)
+            if ( name == "featureMember" || name == "featureMembers" || name == "member" )
+            {
+                _membersDepth = xml.depth();
+            }
+
+            else if ( _membersDepth >= 0 && xml.depth() == _membersDepth + 1 )
+            {
+                // this is a feature element.
+                std::string id = xml.attr("fid");
+                if ( id.empty() ) id = xml.attr("id");
+                std::string::size_type dot = id.find_last_of('.');
+                FeatureID fid = as<long>( dot == std::string::npos ? id : id.substr(dot+1), (long)_numRead );
+
+                osg::ref_ptr<Geometry> geom;
+                std::vector< std::pair<std::string,std::string> > attrs;
+
+                int featureDepth = xml.depth();
+                bool ok = true;
+                while( ok )
+                {
+                    t = xml.next();
+                    if ( t == XmlScanner::TOKEN_END && xml.depth() < featureDepth )
+                        break;
+                    if ( t == XmlScanner::TOKEN_EOF || t == XmlScanner::TOKEN_ERROR )
+                        ok = false;
+                    else if ( t == XmlScanner::TOKEN_START )
+                    {
+                        // a property element.
+                        std::string propName = toLower( xml.name() );
+                        if ( xml.prefix() == "gml" && propName == "boundedby" )
+                        {
+                            ok = xml.skipElement();
+                            continue;
+                        }
+
+                        int propDepth = xml.depth();
+                        std::string text;
+                        bool isGeom = false;
+                        while( ok )
+                        {
+                            t = xml.next();
+                            if ( t == XmlScanner::TOKEN_END && xml.depth() < propDepth )
+                                break;
+                            else if ( t == XmlScanner::TOKEN_EOF || t == XmlScanner::TOKEN_ERROR )
+                                ok = false;
+                            else if ( t == XmlScanner::TOKEN_TEXT )
+                                text += xml.text();
+                            else if ( t == XmlScanner::TOKEN_START )
+                            {
+                                if ( !geom.valid() && isGMLGeometry(xml.name()) )
+                                {
+                                    geom = readGMLGeometry( xml, GMLContext() );
+                                    ok = geom.valid();
+                                    isGeom = true;
+                                }
+                                else
+                                {
+                                    ok = xml.skipElement();
+                                }
+                            }
+                        }
+
+                        if ( ok && !isGeom )
+                            attrs.push_back( std::make_pair(propName, text) );
+                    }
+                }
+
+                if ( !ok )
+                {
+                    setError( Stringify() << "Malformed GML feature at offset " << _pos );
+                    _done = true;
+                    return 0L;
+                }
+
+                Feature* feature = new Feature( geom.get(), _srs.get(), Style(), fid );
+                for( unsigned i=0; i<attrs.size(); ++i )
+                    setInferredAttr( feature, attrs[i].first, attrs[i].second );
+
+                ++_numRead;
+                return feature;
+            }
+        }
+    }
+}
+
+//------------------------------------------------------------------------
+
+FeatureStreamCursor::FeatureStreamCursor(FeatureStreamReader*     reader,
+                                         const FeatureSource*     source,
+                                         const FeatureProfile*    profile,
+                                         const FeatureFilterList& filters,
+                                         const std::string&       url,
+                                         unsigned                 chunkSize ) :
+_reader   ( reader ),
+_source   ( source ),
+_profile  ( profile ),
+_filters  ( filters ),
+_url      ( url ),
+_chunkSize( osg::maximum(chunkSize, 1u) ),
+_exhausted( reader == 0L )
+{
+    readChunk();
+}
+
+bool
+FeatureStreamCursor::hasMore() const
+{
+    return _queue.size() > 0;
+}
+
+Feature*
+FeatureStreamCursor::nextFeature()
+{
+    if ( !hasMore() )
+        return 0L;
+
+    // hold a reference to the feature we return, so the caller doesn't have to.
+    _lastFeatureReturned = _queue.front();
+    _queue.pop();
+
+    if ( _queue.empty() )
+        readChunk();
+
+    return _lastFeatureReturned.get();
+}
+
+void
+FeatureStreamCursor::readChunk()
+{
+    FeatureList chunk;
+
+    // keep reading until we have something to return, or run out; the
+    // filters and the blacklist may reject entire chunks.
+    while( !_exhausted && chunk.empty() )
+    {
+        for( unsigned i = 0; i < _chunkSize; ++i )
+        {
+            osg::ref_ptr<Feature> f = _reader->readFeature();
+            if ( !f.valid() )
+            {
+                if ( _reader->hasError() )
+                {
+                    OE_WARN << LC << _reader->getError() << std::endl;
+
+                    // same as a failed parse on the non-streaming path.
+                    if ( !_url.empty() )
+                        Registry::instance()->blacklist( _url );
+                }
+                _exhausted = true;
+                break;
+            }
+
+            if ( !_source.valid() || !_source->isBlacklisted(f->getFID()) )
+            {
+                chunk.push_back( f.get() );
+            }
+        }
+
+        if ( chunk.size() > 0 && _filters.size() > 0 )
+        {
+            FilterContext cx;
+            cx.profile() = _profile.get();
+
+            for( FeatureFilterList::const_iterator i = _filters.begin(); i != _filters.end(); ++i )
+            {
+                FeatureFilter* filter = i->get();
+                cx = filter->push( chunk, cx );
+            }
+        }
+    }
+
+    for( FeatureList::iterator i = chunk.begin(); i != chunk.end(); ++i )
+    {
+        _queue.push( i->get() );
+    }
+}
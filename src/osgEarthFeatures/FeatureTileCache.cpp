@@ -0,0 +1,140 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2013 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarthFeatures/FeatureTileCache>
+#include <osgEarthFeatures/FeatureCursor>
+#include <osgEarthFeatures/GeometryUtils>
+#include <osgEarth/StringUtils>
+
+using namespace osgEarth;
+using namespace osgEarth::Features;
+using namespace osgEarth::Symbology;
+
+#define LC "[FeatureTileCache] "
+
+//------------------------------------------------------------------------
+
+FeatureTileCache::FeatureTileCache( FeatureSource* source, unsigned maxTiles ) :
+_source  ( source ),
+_maxTiles( maxTiles ),
+_tiles   ( true, osg::maximum(maxTiles, 1u) )
+{
+    //nop
+}
+
+void
+FeatureTileCache::getFeatures(const TileKey& key,
+                              const Query&   query,
+                              const Bounds&  bounds,
+                              double         tolerance,
+                              FeatureList&   output)
+{
+    if ( !_source.valid() || !bounds.isValid() )
+        return;
+
+    // tiles are cached per query, since each style selector sees different features.
+    std::string querySig = Stringify() << std::hex << hashString( query.getConfig().toJSON() );
+
+    // find the closest tile (this one or an ancestor) whose clipped features
+    // cover the bounds, and clip from those. Otherwise go to the source.
+    osg::ref_ptr<Tile> source;
+    if ( _maxTiles > 0 )
+    {
+        for( TileKey k = key; k.valid() && !source.valid(); k = k.createParentKey() )
+        {
+            LRUCache< std::string, osg::ref_ptr<Tile> >::Record rec;
+            if ( _tiles.get(k.str() + "/" + querySig, rec) && rec.value()->_bounds.contains(bounds) )
+                source = rec.value();
+        }
+    }
+
+    osg::ref_ptr<Tile> tile;
+    if ( source.valid() && source->_bounds._min == bounds._min && source->_bounds._max == bounds._max )
+    {
+        tile = source.get();
+    }
+    else
+    {
+        tile = new Tile();
+        tile->_bounds = bounds;
+
+        if ( source.valid() )
+        {
+            clip( source->_features, bounds, tile->_features );
+        }
+        else
+        {
+            Query localQuery = query;
+            localQuery.bounds() = bounds;
+
+            FeatureList features;
+            osg::ref_ptr<FeatureCursor> cursor = _source->createFeatureCursor( localQuery );
+            while( cursor.valid() && cursor->hasMore() )
+            {
+                Feature* feature = cursor->nextFeature();
+                if ( feature && feature->getGeometry() )
+                {
+                    // apply a type override if requested:
+                    if ( _typeOverride.isSet() && *_typeOverride != feature->getGeometry()->getComponentType() )
+                    {
+                        Geometry* geom = feature->getGeometry()->cloneAs( *_typeOverride );
+                        if ( !geom )
+                            continue;
+                        feature->setGeometry( geom );
+                    }
+                    features.push_back( feature );
+                }
+            }
+
+            clip( features, bounds, tile->_features );
+        }
+
+        if ( _maxTiles > 0 )
+        {
+            _tiles.insert( key.str() + "/" + querySig, tile.get() );
+        }
+    }
+
+    // hand out simplified copies; the cached features stay at full resolution
+    // so deeper tiles can be clipped from them.
+    for( FeatureList::const_iterator i = tile->_features.begin(); i != tile->_features.end(); ++i )
+    {
+        const Feature* feature = i->get();
+
+        osg::ref_ptr<Geometry> geom = feature->getGeometry()->clone();
+        if ( GeometryUtils::simplifyGeometry(geom.get(), tolerance) )
+        {
+            output.push_back( new Feature(*feature, geom.get()) );
+        }
+    }
+}
+
+void
+FeatureTileCache::clip( const FeatureList& input, const Bounds& bounds, FeatureList& output ) const
+{
+    for( FeatureList::const_iterator i = input.begin(); i != input.end(); ++i )
+    {
+        const Feature* feature = i->get();
+
+        Geometry* geom = GeometryUtils::clipGeometry( feature->getGeometry(), bounds );
+        if ( geom )
+        {
+            output.push_back( new Feature(*feature, geom) );
+        }
+    }
+}
@@ -30,8 +30,10 @@ using namespace osgEarth::Symbology;
 /*************************************************************************/
 
 FeatureTileSourceOptions::FeatureTileSourceOptions( const ConfigOptions& options ) :
-TileSourceOptions( options ),
-_geomTypeOverride( Geometry::TYPE_UNKNOWN )
+TileSourceOptions  ( options ),
+_geomTypeOverride  ( Geometry::TYPE_UNKNOWN ),
+_tileCacheSize     ( 128 ),
+_simplifyTolerance ( 0.5f )
 {
     fromConfig( _conf );
 }
@@ -53,6 +55,9 @@ FeatureTileSourceOptions::getConfig() const
             conf.update( "geometry_type", "polygon" );
     }
 
+    conf.updateIfSet( "tile_cache_size", _tileCacheSize );
+    conf.updateIfSet( "simplify_tolerance", _simplifyTolerance );
+
     return conf;
 }
 
@@ -79,6 +84,9 @@ FeatureTileSourceOptions::fromConfig( const Config& conf )
         _geomTypeOverride = Geometry::TYPE_POINTSET;
     else if ( gt == "polygon" || gt == "polygons" )
         _geomTypeOverride = Geometry::TYPE_POLYGON;
+
+    conf.getIfSet( "tile_cache_size", _tileCacheSize );
+    conf.getIfSet( "simplify_tolerance", _simplifyTolerance );
 }
 
 /*************************************************************************/
@@ -114,6 +122,9 @@ FeatureTileSource::initialize(const osgDB::Options* dbOptions)
     {
         _features->initialize( dbOptions );
 
+        _tileCache = new FeatureTileCache( _features.get(), *_options.tileCacheSize() );
+        _tileCache->setGeometryTypeOverride( _options.geometryTypeOverride() );
+
 #if 0 // removed this as it was screwing up the rasterizer (agglite plugin).. not sure there's any reason to do this anyway
         if (_features->getFeatureProfile())
         {
@@ -149,7 +160,7 @@ FeatureTileSource::setFeatureSource( FeatureSource* source )
 osg::Image*
 FeatureTileSource::createImage( const TileKey& key, ProgressCallback* progress )
 {
-    if ( !_features.valid() || !_features->getFeatureProfile() )
+    if ( !_features.valid() || !_features->getFeatureProfile() || !_tileCache.valid() )
         return 0L;
 
     // style data
@@ -168,18 +179,16 @@ FeatureTileSource::createImage( const TileKey& key, ProgressCallback* progress )
     if ( _features->hasEmbeddedStyles() )
     {
         // Each feature has its own embedded style data, so use that:
-        osg::ref_ptr<FeatureCursor> cursor = _features->createFeatureCursor( Query() );
-        while( cursor.valid() && cursor->hasMore() )
+        FeatureList features;
+        getFeaturesForTile( Query(), key, image.get(), features );
+        for( FeatureList::iterator i = features.begin(); i != features.end(); ++i )
         {
-            Feature* feature = cursor->nextFeature();
-            if ( feature )
-            {
-                FeatureList list;
-                list.push_back( feature );
-                renderFeaturesForStyle( 
-                    *feature->style(), list, buildData.get(),
-                    key.getExtent(), image.get() );
-            }
+            Feature* feature = i->get();
+            FeatureList list;
+            list.push_back( feature );
+            renderFeaturesForStyle( 
+                *feature->style(), list, buildData.get(),
+                key.getExtent(), image.get() );
         }
     }
     else if ( styles )
@@ -190,18 +199,18 @@ FeatureTileSource::createImage( const TileKey& key, ProgressCallback* progress )
             {
                 const StyleSelector& sel = *i;
                 const Style* style = styles->getStyle( sel.getSelectedStyleName() );
-                queryAndRenderFeaturesForStyle( *style, sel.query().value(), buildData.get(), key.getExtent(), image.get() );
+                queryAndRenderFeaturesForStyle( *style, sel.query().value(), buildData.get(), key, image.get() );
             }
         }
         else
         {
             const Style* style = styles->getDefaultStyle();
-            queryAndRenderFeaturesForStyle( *style, Query(), buildData.get(), key.getExtent(), image.get() );
+            queryAndRenderFeaturesForStyle( *style, Query(), buildData.get(), key, image.get() );
         }
     }
     else
     {
-        queryAndRenderFeaturesForStyle( Style(), Query(), buildData.get(), key.getExtent(), image.get() );
+        queryAndRenderFeaturesForStyle( Style(), Query(), buildData.get(), key, image.get() );
     }
 
     // final tile processing after all styles are done
@@ -212,68 +221,60 @@ FeatureTileSource::createImage( const TileKey& key, ProgressCallback* progress )
 
 
 bool
-FeatureTileSource::queryAndRenderFeaturesForStyle(const Style&     style,
-                                                  const Query&     query,
-                                                  osg::Referenced* data,
-                                                  const GeoExtent& imageExtent,
-                                                  osg::Image*      out_image)
-{   
+FeatureTileSource::getFeaturesForTile(const Query&      query,
+                                      const TileKey&    key,
+                                      const osg::Image* image,
+                                      FeatureList&      out_features)
+{
+    const GeoExtent& imageExtent = key.getExtent();
+
     // first we need the overall extent of the layer:
     const GeoExtent& featuresExtent = getFeatureSource()->getFeatureProfile()->getExtent();
     
-    // convert them both to WGS84, intersect the extents, and convert back.
+    // convert them both to WGS84 and see whether they intersect at all.
     GeoExtent featuresExtentWGS84 = featuresExtent.transform( featuresExtent.getSRS()->getGeographicSRS() );
     GeoExtent imageExtentWGS84 = imageExtent.transform( featuresExtent.getSRS()->getGeographicSRS() );
     GeoExtent queryExtentWGS84 = featuresExtentWGS84.intersectionSameSRS( imageExtentWGS84 );
-    if ( queryExtentWGS84.isValid() )
-    {
-        GeoExtent queryExtent = queryExtentWGS84.transform( featuresExtent.getSRS() );
+    if ( !queryExtentWGS84.isValid() )
+        return false;
 
-	    // incorporate the image extent into the feature query for this style:
-        Query localQuery = query;
-        localQuery.bounds() = query.bounds().isSet()?
-		    query.bounds()->unionWith( queryExtent.bounds() ) :
-		    queryExtent.bounds();
+    // Clip the features to the tile plus a margin (so lines running just outside
+    // it still get their full width), and simplify them to the tile's resolution.
+    GeoExtent clipExtent = imageExtent.transform( featuresExtent.getSRS() );
+    if ( !clipExtent.isValid() )
+        return false;
 
-        // query the feature source:
-        osg::ref_ptr<FeatureCursor> cursor = _features->createFeatureCursor( localQuery );
+    double pixelSize = osg::minimum( clipExtent.width(), clipExtent.height() ) / (double)osg::maximum(image->s(), 1);
+    clipExtent.scale( 1.1, 1.1 );
 
-        // now copy the resulting feature set into a list, converting the data
-        // types along the way if a geometry override is in place:
-        FeatureList cellFeatures;
-        while( cursor.valid() && cursor->hasMore() )
-        {
-            Feature* feature = cursor->nextFeature();
-            Geometry* geom = feature->getGeometry();
-            if ( geom )
-            {
-                // apply a type override if requested:
-                if (_options.geometryTypeOverride().isSet() &&
-                    _options.geometryTypeOverride() != geom->getComponentType() )
-                {
-                    geom = geom->cloneAs( _options.geometryTypeOverride().value() );
-                    if ( geom )
-                        feature->setGeometry( geom );
-                }
-            }
-            if ( geom )
-            {
-                cellFeatures.push_back( feature );
-            }
-        }
+    _tileCache->getFeatures(
+        key,
+        query,
+        clipExtent.bounds(),
+        pixelSize * (double)_options.simplifyTolerance().value(),
+        out_features );
 
-        //OE_NOTICE
-        //    << "Rendering "
-        //    << cellFeatures.size()
-        //    << " features in ("
-        //    << queryExtent.toString() << ")"
-        //    << std::endl;
+    return true;
+}
 
-	    return renderFeaturesForStyle( style, cellFeatures, data, imageExtent, out_image );
-    }
-    else
-    {
+
+bool
+FeatureTileSource::queryAndRenderFeaturesForStyle(const Style&     style,
+                                                  const Query&     query,
+                                                  osg::Referenced* data,
+                                                  const TileKey&   key,
+                                                  osg::Image*      out_image)
+{   
+    FeatureList cellFeatures;
+    if ( !getFeaturesForTile(query, key, out_image, cellFeatures) )
         return false;
-    }
-}
 
+    //OE_NOTICE
+    //    << "Rendering "
+    //    << cellFeatures.size()
+    //    << " features in ("
+    //    << key.getExtent().toString() << ")"
+    //    << std::endl;
+
+    return renderFeaturesForStyle( style, cellFeatures, data, key.getExtent(), out_image );
+}
@@ -33,7 +33,10 @@ _extent      ( workingExtent, workingExtent ),
 _isGeocentric( false ),
 _index       ( index )
 {
-    _resourceCache = new ResourceCache( session ? session->getDBOptions() : 0L );
+    if ( session )
+        _resourceCache = session->getResourceCache();
+    else
+        _resourceCache = new ResourceCache( 0L );
 
     // attempt to establish a working extent if we don't have one:
 
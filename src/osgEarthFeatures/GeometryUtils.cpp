@@ -146,3 +146,362 @@ osgEarth::Features::GeometryUtils::getGeometryArea( Geometry* geometry )
     }
     return result;
 }
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    // squared 2D distance from p to the segment (a, b)
+    double distanceSquared2D( const osg::Vec3d& p, const osg::Vec3d& a, const osg::Vec3d& b )
+    {
+        osg::Vec2d ab( b.x()-a.x(), b.y()-a.y() );
+        osg::Vec2d ap( p.x()-a.x(), p.y()-a.y() );
+        double len2 = ab.length2();
+        if ( len2 <= 0.0 )
+            return ap.length2();
+        double t = osg::clampBetween( (ap*ab)/len2, 0.0, 1.0 );
+        return (ap - ab*t).length2();
+    }
+
+    // marks the points between first and last (inclusive) that Douglas-Peucker keeps.
+    void douglasPeucker( const std::vector<osg::Vec3d>& pts, unsigned first, unsigned last, double tolerance2, std::vector<char>& keep )
+    {
+        std::vector< std::pair<unsigned,unsigned> > stack;
+        stack.push_back( std::make_pair(first, last) );
+
+        while( !stack.empty() )
+        {
+            unsigned a = stack.back().first, b = stack.back().second;
+            stack.pop_back();
+
+            double   maxDist = 0.0;
+            unsigned index   = a;
+            for( unsigned i = a+1; i < b; ++i )
+            {
+                double d = distanceSquared2D( pts[i], pts[a], pts[b] );
+                if ( d > maxDist )
+                {
+                    maxDist = d;
+                    index   = i;
+                }
+            }
+
+            if ( maxDist > tolerance2 )
+            {
+                keep[index] = 1;
+                stack.push_back( std::make_pair(a, index) );
+                stack.push_back( std::make_pair(index, b) );
+            }
+        }
+    }
+
+    // simplifies a single (non-multi) part in place.
+    bool simplifyPart( Geometry* part, double tolerance )
+    {
+        unsigned n = part->size();
+        if ( part->getType() == Geometry::TYPE_POINTSET || n < 3 )
+            return part->isValid();
+
+        std::vector<osg::Vec3d> pts( part->begin(), part->end() );
+        std::vector<char>       keep( n+1, 0 );
+        double                  tolerance2 = tolerance*tolerance;
+
+        keep[0] = 1;
+        if ( part->getType() == Geometry::TYPE_LINESTRING )
+        {
+            keep[n-1] = 1;
+            douglasPeucker( pts, 0, n-1, tolerance2, keep );
+        }
+        else
+        {
+            // rings are open, so split at the point farthest from the first one
+            // and simplify the two halves (the second one closing back to the start).
+            unsigned far = 0;
+            double   maxDist = -1.0;
+            for( unsigned i = 1; i < n; ++i )
+            {
+                double d = osg::Vec2d(pts[i].x()-pts[0].x(), pts[i].y()-pts[0].y()).length2();
+                if ( d > maxDist )
+                {
+                    maxDist = d;
+                    far     = i;
+                }
+            }
+            keep[far] = 1;
+            pts.push_back( pts[0] );
+            douglasPeucker( pts, 0, far, tolerance2, keep );
+            douglasPeucker( pts, far, n, tolerance2, keep );
+        }
+
+        unsigned k = 0;
+        for( unsigned i = 0; i < n; ++i )
+        {
+            if ( keep[i] )
+                (*part)[k++] = pts[i];
+        }
+        part->resize( k );
+
+        return part->isValid();
+    }
+
+    // Liang-Barsky: clips the segment p0->p1 to the bounds, returning the
+    // parameters of the visible portion.
+    bool clipSegment( const osg::Vec3d& p0, const osg::Vec3d& p1, const Bounds& b, double& t0, double& t1 )
+    {
+        double dx = p1.x()-p0.x(), dy = p1.y()-p0.y();
+        double p[4] = { -dx, dx, -dy, dy };
+        double q[4] = { p0.x()-b.xMin(), b.xMax()-p0.x(), p0.y()-b.yMin(), b.yMax()-p0.y() };
+
+        t0 = 0.0;
+        t1 = 1.0;
+        for( int i = 0; i < 4; ++i )
+        {
+            if ( p[i] == 0.0 )
+            {
+                if ( q[i] < 0.0 )
+                    return false;
+            }
+            else
+            {
+                double t = q[i] / p[i];
+                if ( p[i] < 0.0 )
+                {
+                    if ( t > t1 ) return false;
+                    if ( t > t0 ) t0 = t;
+                }
+                else
+                {
+                    if ( t < t0 ) return false;
+                    if ( t < t1 ) t1 = t;
+                }
+            }
+        }
+        return true;
+    }
+
+    // cuts a line (or a ring, if closed) into the pieces that fall within the bounds.
+    void clipLine( const Geometry* line, bool closed, const Bounds& b, GeometryCollection& output )
+    {
+        unsigned n = line->size();
+        unsigned segments = closed ? n : n-1;
+        unsigned firstPart = output.size();
+        bool     startsAtFirstPoint = false, endsAtFirstPoint = false;
+
+        LineString* current = 0L;
+        for( unsigned i = 0; i < segments; ++i )
+        {
+            const osg::Vec3d& p0 = (*line)[i];
+            const osg::Vec3d& p1 = (*line)[(i+1) % n];
+
+            double t0, t1;
+            if ( !clipSegment(p0, p1, b, t0, t1) )
+            {
+                current = 0L;
+                continue;
+            }
+
+            if ( !current || t0 > 0.0 )
+            {
+                current = new LineString();
+                output.push_back( current );
+                current->push_back( p0 + (p1-p0)*t0 );
+                if ( i == 0 && t0 == 0.0 )
+                    startsAtFirstPoint = true;
+            }
+            current->push_back( p0 + (p1-p0)*t1 );
+
+            if ( t1 < 1.0 )
+                current = 0L;
+            else if ( i == segments-1 )
+                endsAtFirstPoint = true;
+        }
+
+        // a ring that was cut comes out with its first piece starting where its
+        // last piece ends; join them.
+        if ( closed && startsAtFirstPoint && endsAtFirstPoint && output.size() - firstPart > 1 )
+        {
+            Geometry* first = output[firstPart].get();
+            Geometry* last  = output.back().get();
+            last->insert( last->end(), first->begin()+1, first->end() );
+            output.erase( output.begin() + firstPart );
+        }
+
+        for( GeometryCollection::iterator i = output.begin() + firstPart; i != output.end(); )
+        {
+            if ( !(*i)->isValid() )
+                i = output.erase( i );
+            else
+                ++i;
+        }
+    }
+
+    // Sutherland-Hodgman: clips a ring (as a filled area) to the bounds.
+    void clipRing( const Geometry* ring, const Bounds& b, std::vector<osg::Vec3d>& output )
+    {
+        std::vector<osg::Vec3d> input( ring->begin(), ring->end() );
+
+        for( int edge = 0; edge < 4 && !input.empty(); ++edge )
+        {
+            output.clear();
+            for( unsigned i = 0; i < input.size(); ++i )
+            {
+                const osg::Vec3d& p0 = input[i];
+                const osg::Vec3d& p1 = input[(i+1) % input.size()];
+
+                // signed distance inside the edge
+                double d0, d1;
+                switch( edge ) {
+                    case 0: d0 = p0.x()-b.xMin(); d1 = p1.x()-b.xMin(); break;
+                    case 1: d0 = b.xMax()-p0.x(); d1 = b.xMax()-p1.x(); break;
+                    case 2: d0 = p0.y()-b.yMin(); d1 = p1.y()-b.yMin(); break;
+                    default:d0 = b.yMax()-p0.y(); d1 = b.yMax()-p1.y(); break;
+                }
+
+                if ( d0 >= 0.0 )
+                    output.push_back( p0 );
+                if ( (d0 >= 0.0) != (d1 >= 0.0) )
+                    output.push_back( p0 + (p1-p0)*(d0/(d0-d1)) );
+            }
+            input.swap( output );
+        }
+        output.swap( input );
+    }
+
+    bool disjoint( const Bounds& a, const Bounds& b )
+    {
+        return a.xMin() > b.xMax() || a.xMax() < b.xMin() || a.yMin() > b.yMax() || a.yMax() < b.yMin();
+    }
+
+    // clips a single (non-multi) part.
+    void clipPart( const Geometry* part, const Bounds& b, GeometryCollection& output )
+    {
+        Bounds partBounds = part->getBounds();
+        if ( !part->isValid() || disjoint(partBounds, b) )
+            return;
+
+        if ( b.contains(partBounds) )
+        {
+            output.push_back( part->clone() );
+            return;
+        }
+
+        switch( part->getType() )
+        {
+        case Geometry::TYPE_POINTSET:
+            {
+                osg::ref_ptr<PointSet> points = new PointSet();
+                for( Geometry::const_iterator i = part->begin(); i != part->end(); ++i )
+                    if ( b.contains(i->x(), i->y()) )
+                        points->push_back( *i );
+                if ( points->isValid() )
+                    output.push_back( points.get() );
+            }
+            break;
+
+        case Geometry::TYPE_LINESTRING:
+            clipLine( part, false, b, output );
+            break;
+
+        case Geometry::TYPE_RING:
+            clipLine( part, true, b, output );
+            break;
+
+        case Geometry::TYPE_POLYGON:
+            {
+                std::vector<osg::Vec3d> pts;
+                clipRing( part, b, pts );
+                if ( pts.size() < 3 )
+                    return;
+
+                osg::ref_ptr<Polygon> poly = new Polygon( &pts );
+                const RingCollection& holes = static_cast<const Polygon*>(part)->getHoles();
+                for( RingCollection::const_iterator h = holes.begin(); h != holes.end(); ++h )
+                {
+                    Bounds holeBounds = h->get()->getBounds();
+                    if ( disjoint(holeBounds, b) )
+                        continue;
+
+                    clipRing( h->get(), b, pts );
+                    if ( pts.size() >= 3 )
+                        poly->getHoles().push_back( new Ring(&pts) );
+                }
+                output.push_back( poly.get() );
+            }
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    void clipRecursive( const Geometry* geom, const Bounds& b, GeometryCollection& output )
+    {
+        if ( geom->getType() == Geometry::TYPE_MULTI )
+        {
+            const GeometryCollection& parts = static_cast<const MultiGeometry*>(geom)->getComponents();
+            for( GeometryCollection::const_iterator i = parts.begin(); i != parts.end(); ++i )
+                clipRecursive( i->get(), b, output );
+        }
+        else
+        {
+            clipPart( geom, b, output );
+        }
+    }
+}
+
+bool
+osgEarth::Features::GeometryUtils::simplifyGeometry( Geometry* geometry, double tolerance )
+{
+    if ( !geometry )
+        return false;
+
+    if ( tolerance <= 0.0 )
+        return geometry->isValid();
+
+    if ( geometry->getType() == Geometry::TYPE_MULTI )
+    {
+        GeometryCollection& parts = static_cast<MultiGeometry*>(geometry)->getComponents();
+        for( GeometryCollection::iterator i = parts.begin(); i != parts.end(); )
+        {
+            if ( !simplifyGeometry(i->get(), tolerance) )
+                i = parts.erase( i );
+            else
+                ++i;
+        }
+        return !parts.empty();
+    }
+
+    if ( !simplifyPart(geometry, tolerance) )
+        return false;
+
+    if ( geometry->getType() == Geometry::TYPE_POLYGON )
+    {
+        RingCollection& holes = static_cast<Polygon*>(geometry)->getHoles();
+        for( RingCollection::iterator h = holes.begin(); h != holes.end(); )
+        {
+            if ( !simplifyPart(h->get(), tolerance) )
+                h = holes.erase( h );
+            else
+                ++h;
+        }
+    }
+
+    return true;
+}
+
+Geometry*
+osgEarth::Features::GeometryUtils::clipGeometry( const Geometry* geometry, const Bounds& bounds )
+{
+    if ( !geometry || !bounds.isValid() )
+        return 0L;
+
+    GeometryCollection parts;
+    clipRecursive( geometry, bounds, parts );
+
+    if ( parts.empty() )
+        return 0L;
+    else if ( parts.size() == 1 )
+        return parts.front().release();
+    else
+        return new MultiGeometry( parts );
+}
@@ -34,6 +34,7 @@ using namespace osgEarth;
 using namespace osgEarth::Features;
 
 #define ZOFFSETS_NAME "MeshClamper::zOffsets"
+#define DIRTY_NAME    "MeshClamper::dirty"
 
 //-----------------------------------------------------------------------
 
@@ -50,9 +51,34 @@ _terrainSRS     ( terrainSRS ),
 _geocentric     ( geocentric ),
 _preserveZ      ( preserveZ ),
 _scale          ( scale ),
-_offset         ( offset )
+_offset         ( offset ),
+_dirtyOnly      ( false )
 {
-    //nop
+    // if the patch is a terrain tile with an elevation grid, we can
+    // sample it directly instead of intersecting its geometry.
+    _sampler.setTile( terrainPatch );
+}
+
+void
+MeshClamper::markDirty( osg::Geometry* geom, const std::vector<unsigned>& indices )
+{
+    if ( !geom || indices.empty() )
+        return;
+
+    osg::UserDataContainer* udc = geom->getOrCreateUserDataContainer();
+    osg::UIntArray* dirty = 0L;
+    unsigned n = udc->getUserObjectIndex( DIRTY_NAME );
+    if ( n < udc->getNumUserObjects() )
+    {
+        dirty = dynamic_cast<osg::UIntArray*>( udc->getUserObject(n) );
+    }
+    if ( !dirty )
+    {
+        dirty = new osg::UIntArray();
+        dirty->setName( DIRTY_NAME );
+        udc->addUserObject( dirty );
+    }
+    dirty->insert( dirty->end(), indices.begin(), indices.end() );
 }
 
 void
@@ -94,6 +120,18 @@ MeshClamper::apply( osg::Geode& geode )
             osg::Vec3Array*  verts = static_cast<osg::Vec3Array*>(geom->getVertexArray());
             osg::FloatArray* zOffsets = 0L;
 
+            // vertices rewritten since the last clamp, if any:
+            osg::UIntArray* dirty = 0L;
+            osg::UserDataContainer* dirtyUDC = geom->getUserDataContainer();
+            unsigned dirtyIndex = dirtyUDC ? dirtyUDC->getUserObjectIndex( DIRTY_NAME ) : 0;
+            if ( dirtyUDC && dirtyIndex < dirtyUDC->getNumUserObjects() )
+            {
+                dirty = dynamic_cast<osg::UIntArray*>( dirtyUDC->getUserObject(dirtyIndex) );
+            }
+
+            if ( _dirtyOnly && !dirty )
+                continue;
+
             // if preserve-Z is on, check for our elevations array. Create it if is doesn't
             // already exist.
             bool buildZOffsets = false;
@@ -116,76 +154,136 @@ MeshClamper::apply( osg::Geode& geode )
                 }
             }
 
-            for( unsigned k=0; k<verts->size(); ++k )
+            // the vertices to clamp: all of them, or just the dirty ones.
+            // (building the offsets array requires a pass over all of them.)
+            std::vector<unsigned> indices;
+            if ( _dirtyOnly && !buildZOffsets )
             {
-                osg::Vec3d vw = (*verts)[k];
-                vw = vw * local2world;
+                indices.reserve( dirty->size() );
+                for( unsigned j=0; j<dirty->size(); ++j )
+                    if ( (*dirty)[j] < verts->size() )
+                        indices.push_back( (*dirty)[j] );
+            }
+            else
+            {
+                indices.resize( verts->size() );
+                for( unsigned k=0; k<verts->size(); ++k )
+                    indices[k] = k;
+            }
 
-                if ( _geocentric )
+            if ( dirty )
+            {
+                // dirty vertices hold fresh, unclamped coordinates, so take
+                // their preserved Z offsets from them before clamping.
+                if ( zOffsets && !buildZOffsets )
                 {
-                    // normal to the ellipsoid:
-                    n_vector = em->computeLocalUpVector(vw.x(),vw.y(),vw.z());
-
-                    // if we need to build to z-offsets array, calculate the z offset now:
-                    if ( buildZOffsets || _scale != 1.0 )
+                    for( unsigned j=0; j<dirty->size(); ++j )
                     {
-                        double lat,lon,hae;
-                        em->convertXYZToLatLongHeight(vw.x(), vw.y(), vw.z(), lat, lon, hae);
+                        unsigned k = (*dirty)[j];
+                        if ( k >= verts->size() || k >= zOffsets->size() )
+                            continue;
 
-                        if ( buildZOffsets )
+                        osg::Vec3d vw = osg::Vec3d((*verts)[k]) * local2world;
+                        if ( _geocentric )
                         {
-                            zOffsets->push_back( float(hae) );
+                            double lat, lon, hae;
+                            em->convertXYZToLatLongHeight(vw.x(), vw.y(), vw.z(), lat, lon, hae);
+                            (*zOffsets)[k] = float(hae);
                         }
-
-                        if ( _scale != 1.0 )
+                        else
                         {
-                            msl = vw - n_vector*hae;
+                            (*zOffsets)[k] = float(vw.z());
                         }
                     }
                 }
 
-                else if ( buildZOffsets ) // flat map
+                dirtyUDC->removeUserObject( dirtyIndex );
+            }
+
+            if ( _sampler.valid() )
+            {
+                unsigned clamped = clampToTile(verts, indices, zOffsets, buildZOffsets, local2world, world2local);
+                if ( clamped > 0 )
                 {
-                    zOffsets->push_back( float(vw.z()) );
+                    geomDirty = true;
+                    count += clamped;
                 }
+            }
 
-#if 0
-                    // if we're scaling, we need to know the MSL coord
-                    if ( _scale != 1.0 )
+            else
+            {
+                for( unsigned j=0; j<indices.size(); ++j )
+                {
+                    unsigned k = indices[j];
+                    osg::Vec3d vw = (*verts)[k];
+                    vw = vw * local2world;
+
+                    if ( _geocentric )
                     {
-                        double lat,lon,height;
-                        em->convertXYZToLatLongHeight(vw.x(), vw.y(), vw.z(), lat, lon, height);
-                        msl = vw - n_vector*height;
-                    }
-                }
-#endif
+                        // normal to the ellipsoid:
+                        n_vector = em->computeLocalUpVector(vw.x(),vw.y(),vw.z());
 
-                lsi->reset();
-                lsi->setStart( vw + n_vector*r*_scale );
-                lsi->setEnd( vw - n_vector*r );
+                        // if we need to build to z-offsets array, calculate the z offset now:
+                        if ( buildZOffsets || _scale != 1.0 )
+                        {
+                            double lat,lon,hae;
+                            em->convertXYZToLatLongHeight(vw.x(), vw.y(), vw.z(), lat, lon, hae);
 
-                _terrainPatch->accept( iv );
+                            if ( buildZOffsets )
+                            {
+                                zOffsets->push_back( float(hae) );
+                            }
 
-                if ( lsi->containsIntersections() )
-                {
-                    osg::Vec3d fw = lsi->getFirstIntersection().getWorldIntersectPoint();
-                    if ( _scale != 1.0 )
-                    {
-                        osg::Vec3d delta = fw - msl;
-                        fw += delta*_scale;
+                            if ( _scale != 1.0 )
+                            {
+                                msl = vw - n_vector*hae;
+                            }
+                        }
                     }
-                    if ( _offset != 0.0 )
+
+                    else if ( buildZOffsets ) // flat map
                     {
-                        fw += n_vector*_offset;
+                        zOffsets->push_back( float(vw.z()) );
                     }
-                    if ( _preserveZ )
-                    {
-                        fw += n_vector * (*zOffsets)[k];
+
+#if 0
+                        // if we're scaling, we need to know the MSL coord
+                        if ( _scale != 1.0 )
+                        {
+                            double lat,lon,height;
+                            em->convertXYZToLatLongHeight(vw.x(), vw.y(), vw.z(), lat, lon, height);
+                            msl = vw - n_vector*height;
+                        }
                     }
+#endif
 
-                    (*verts)[k] = (fw * world2local);
-                    geomDirty = true;
-                    ++count;
+                    lsi->reset();
+                    lsi->setStart( vw + n_vector*r*_scale );
+                    lsi->setEnd( vw - n_vector*r );
+
+                    _terrainPatch->accept( iv );
+
+                    if ( lsi->containsIntersections() )
+                    {
+                        osg::Vec3d fw = lsi->getFirstIntersection().getWorldIntersectPoint();
+                        if ( _scale != 1.0 )
+                        {
+                            osg::Vec3d delta = fw - msl;
+                            fw += delta*_scale;
+                        }
+                        if ( _offset != 0.0 )
+                        {
+                            fw += n_vector*_offset;
+                        }
+                        if ( _preserveZ )
+                        {
+                            fw += n_vector * (*zOffsets)[k];
+                        }
+
+                        (*verts)[k] = (fw * world2local);
+                        geomDirty = true;
+                        ++count;
+                    }
                 }
             }
 
@@ -205,3 +303,83 @@ MeshClamper::apply( osg::Geode& geode )
         //OE_NOTICE << LC << "clamped " << count << " verts." << std::endl;
     }
 }
+
+unsigned
+MeshClamper::clampToTile(osg::Vec3Array*              verts,
+                         const std::vector<unsigned>& indices,
+                         osg::FloatArray*             zOffsets,
+                         bool                         buildZOffsets,
+                         const osg::Matrixd&          local2world,
+                         const osg::Matrixd&          world2local)
+{
+    const osg::EllipsoidModel* em = _terrainSRS->getEllipsoid();
+    unsigned numVerts = indices.size();
+
+    // first pass: find the world coordinates of each vertex, and its
+    // location in the terrain SRS (where we sample the tile).
+    std::vector<osg::Vec3d> world ( numVerts );
+    std::vector<osg::Vec3d> points( numVerts );
+    std::vector<osg::Vec3d> latlon;
+    if ( _geocentric )
+        latlon.resize( numVerts );
+
+    for( unsigned k=0; k<numVerts; ++k )
+    {
+        osg::Vec3d& vw = world[k];
+        vw = (*verts)[indices[k]] * local2world;
+
+        if ( _geocentric )
+        {
+            double lat, lon, hae;
+            em->convertXYZToLatLongHeight(vw.x(), vw.y(), vw.z(), lat, lon, hae);
+            latlon[k].set( lat, lon, hae );
+            points[k].set( osg::RadiansToDegrees(lon), osg::RadiansToDegrees(lat), hae );
+
+            if ( buildZOffsets )
+                zOffsets->push_back( float(hae) );
+        }
+        else
+        {
+            points[k] = vw;
+
+            if ( buildZOffsets )
+                zOffsets->push_back( float(vw.z()) );
+        }
+    }
+
+    if ( _geocentric && !_terrainSRS->isGeographic() )
+    {
+        _terrainSRS->getGeodeticSRS()->transform( points, _terrainSRS.get() );
+    }
+
+    // sample the whole array against the tile:
+    std::vector<bool> sampled;
+    if ( _sampler.getHeights(points, sampled) == 0 )
+        return 0;
+
+    // second pass: move each sampled vertex to its new height.
+    unsigned count = 0;
+    for( unsigned k=0; k<numVerts; ++k )
+    {
+        if ( !sampled[k] )
+            continue;
+
+        double h = points[k].z();
+        if ( _scale != 1.0 )
+            h += h*_scale;
+        h += _offset;
+        if ( _preserveZ )
+            h += (*zOffsets)[indices[k]];
+
+        osg::Vec3d fw;
+        if ( _geocentric )
+            em->convertLatLongHeightToXYZ( latlon[k].x(), latlon[k].y(), h, fw.x(), fw.y(), fw.z() );
+        else
+            fw.set( world[k].x(), world[k].y(), h );
+
+        (*verts)[indices[k]] = (fw * world2local);
+        ++count;
+    }
+
+    return count;
+}
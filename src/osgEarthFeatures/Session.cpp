@@ -58,6 +58,9 @@ _dbOptions     ( dbOptions )
     // a new cache to optimize state changes.
     //_stateSetCache = new StateSetCache();
     _stateSetCache = Registry::instance()->getStateSetCache();
+
+    // models and skins are loaded once per session, not once per compilation.
+    _resourceCache = new ResourceCache( _dbOptions.get(), true );
 }
 
 Session::~Session()
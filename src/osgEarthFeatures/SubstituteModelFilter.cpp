@@ -145,6 +145,11 @@ SubstituteModelFilter::process(const FeatureList&           features,
     const ModelSymbol* modelSymbol = dynamic_cast<const ModelSymbol*>(symbol);
     const IconSymbol*  iconSymbol  = dynamic_cast<const IconSymbol*> (symbol);
 
+    // with instancing, collect the transforms of each model's instances in bulk
+    // instead of building a MatrixTransform for each one.
+    bool instancing = _useDrawInstanced && Registry::capabilities().supportsDrawInstanced();
+    std::map< osg::ref_ptr<osg::Node>, std::vector<osg::Matrix> > instances;
+
     NumericExpression headingEx;
     if ( modelSymbol )
         headingEx = *modelSymbol->heading();
@@ -193,12 +198,27 @@ SubstituteModelFilter::process(const FeatureList&           features,
         {
             context.resourceCache()->getInstanceNode( instance.get(), model );
 
+            // the cached model is shared by every compile in the session, and the
+            // shader generator and stateset optimizer rewrite the graphs they get,
+            // so each compile works on its own copy. The vertex data is shared.
+            if ( model.valid() )
+            {
+                model = osg::clone(
+                    model.get(),
+                    osg::CopyOp::DEEP_COPY_NODES | osg::CopyOp::DEEP_COPY_DRAWABLES | osg::CopyOp::DEEP_COPY_STATESETS );
+            }
+
             // if icon decluttering is off, install an AutoTransform.
             if ( iconSymbol )
             {
                 if ( iconSymbol->declutter() == true )
                 {
-                    Decluttering::setEnabled( model->getOrCreateStateSet(), true );
+                    // put the decluttering state on a new parent, leaving the
+                    // model's own state alone.
+                    osg::Group* group = new osg::Group();
+                    group->addChild( model.get() );
+                    Decluttering::setEnabled( group->getOrCreateStateSet(), true );
+                    model = group;
                 }
                 else if ( dynamic_cast<osg::AutoTransform*>(model.get()) == 0L )
                 {
@@ -260,13 +280,19 @@ SubstituteModelFilter::process(const FeatureList&           features,
                         mat = rotationMatrix * scaleMatrix *  osg::Matrixd::translate( point ) * _world2local;
                     }
 
+                    if ( instancing )
+                    {
+                        instances[model.get()].push_back( mat );
+                        continue;
+                    }
+
                     osg::MatrixTransform* xform = new osg::MatrixTransform();
                     xform->setMatrix( mat );
                     xform->setDataVariance( osg::Object::STATIC );
                     xform->addChild( model.get() );
                     attachPoint->addChild( xform );
 
-                    if ( context.featureIndex() && !_useDrawInstanced )
+                    if ( context.featureIndex() )
                     {
                         context.featureIndex()->tagNode( xform, input );
                     }
@@ -299,9 +325,12 @@ SubstituteModelFilter::process(const FeatureList&           features,
     }
 
     // active DrawInstanced if required:
-    if ( _useDrawInstanced && Registry::capabilities().supportsDrawInstanced() )
+    if ( instancing )
     {
-        DrawInstanced::convertGraphToUseDrawInstanced( attachPoint );
+        for( std::map< osg::ref_ptr<osg::Node>, std::vector<osg::Matrix> >::iterator i = instances.begin(); i != instances.end(); ++i )
+        {
+            DrawInstanced::addInstances( attachPoint, i->first.get(), i->second );
+        }
 
         // install a shader program to render draw-instanced.
         DrawInstanced::install( attachPoint->getOrCreateStateSet() );
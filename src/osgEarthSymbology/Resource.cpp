@@ -18,11 +18,20 @@
  */
 #include <osgEarthSymbology/Resource>
 #include <osgEarth/StringUtils>
+#include <osgEarth/ThreadingUtils>
 
 using namespace osgEarth;
 using namespace osgEarth::Symbology;
 
-Resource::Resource( const Config& conf )
+namespace
+{
+    // guards the first computation of a cache key.
+    Threading::Mutex s_cacheKeyMutex;
+}
+
+Resource::Resource( const Config& conf ) :
+_cacheHash    ( 0 ),
+_cacheKeyValid( 0u )
 {
     mergeConfig( conf );
 }
@@ -46,3 +55,34 @@ Resource::getConfig() const
 
     return conf;
 }
+
+const std::string&
+Resource::getCacheKey() const
+{
+    computeCacheKey();
+    return _cacheKey;
+}
+
+unsigned
+Resource::getCacheHash() const
+{
+    computeCacheKey();
+    return _cacheHash;
+}
+
+void
+Resource::computeCacheKey() const
+{
+    // double-checked: the flag is set (atomically) only after the key and
+    // hash are written, so once it reads as set there's nothing to lock.
+    if ( _cacheKeyValid != 0u )
+        return;
+
+    Threading::ScopedMutexLock lock( s_cacheKeyMutex );
+    if ( _cacheKeyValid == 0u )
+    {
+        _cacheKey  = getConfig().toJSON( false );
+        _cacheHash = hashString( _cacheKey );
+        _cacheKeyValid.exchange( 1u );
+    }
+}
@@ -17,196 +17,292 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>
  */
 #include <osgEarthSymbology/ResourceCache>
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/NodeVisitor>
+#include <osg/Texture>
+#include <set>
 
 using namespace osgEarth;
 using namespace osgEarth::Symbology;
 
-ResourceCache::ResourceCache(const osgDB::Options* dbOptions,
-                             bool                  threadSafe ) :
-_dbOptions    ( dbOptions ),
-_threadSafe   ( threadSafe ),
-_skinCache    ( false ),
-_markerCache  ( false ),
-_instanceCache( false )
-{
-    //nop
-}
+#define LC "[ResourceCache] "
 
-bool
-ResourceCache::getStateSet(SkinResource*                skin,
-                           osg::ref_ptr<osg::StateSet>& output)
+//------------------------------------------------------------------------
+
+namespace
 {
-    output = 0L;
-    std::string key = skin->getConfig().toJSON(false);
+    // default budget for the cached objects.
+    const double DEFAULT_MAX_BYTES = 128.0 * 1024.0 * 1024.0;
 
-    if ( _threadSafe )
+    // Locks a mutex, if the cache is thread-safe.
+    struct OptionalLock
     {
-        // first check if it exists
+        OptionalLock( Threading::Mutex& m, bool on ) : _m( on ? &m : 0L ) { if (_m) _m->lock(); }
+        ~OptionalLock() { if (_m) _m->unlock(); }
+        Threading::Mutex* _m;
+    };
+
+    // Estimates the memory used by a scene graph's vertex data and textures.
+    struct SizeVisitor : public osg::NodeVisitor
+    {
+        SizeVisitor() : osg::NodeVisitor(TRAVERSE_ALL_CHILDREN), _bytes(0.0) { }
+
+        void apply( osg::Node& node )
         {
-            Threading::ScopedReadLock shared( _skinMutex );
+            applyStateSet( node.getStateSet() );
+            traverse( node );
+        }
 
-            SkinCache::Record rec;
-            if ( _skinCache.get(key, rec) )
+        void apply( osg::Geode& geode )
+        {
+            applyStateSet( geode.getStateSet() );
+            for( unsigned i=0; i<geode.getNumDrawables(); ++i )
             {
-                output = rec.value().get();
+                osg::Drawable* d = geode.getDrawable(i);
+                applyStateSet( d->getStateSet() );
+
+                osg::Geometry* geom = d->asGeometry();
+                if ( geom && _seen.insert(geom).second )
+                {
+                    osg::Geometry::ArrayList arrays;
+                    geom->getArrayList( arrays );
+                    for( unsigned a=0; a<arrays.size(); ++a )
+                        _bytes += arrays[a]->getTotalDataSize();
+
+                    for( unsigned p=0; p<geom->getNumPrimitiveSets(); ++p )
+                        _bytes += geom->getPrimitiveSet(p)->getTotalDataSize();
+                }
             }
         }
 
-        // no? exclusive lock and create it.
-        if ( !output.valid() )
+        void applyStateSet( osg::StateSet* ss )
         {
-            Threading::ScopedWriteLock exclusive( _skinMutex );
-            
-            // double check to avoid race condition
-            SkinCache::Record rec;
-            if ( _skinCache.get(key, rec) )
-            {
-                output = rec.value().get();
-            }
-            else
+            if ( !ss || !_seen.insert(ss).second )
+                return;
+
+            for( unsigned u=0; u<ss->getTextureAttributeList().size(); ++u )
             {
-                // still not there, make it.
-                output = skin->createStateSet( _dbOptions.get() );
-                if ( output.valid() )
-                    _skinCache.insert( key, output.get() );
+                osg::Texture* tex = dynamic_cast<osg::Texture*>(
+                    ss->getTextureAttribute(u, osg::StateAttribute::TEXTURE) );
+
+                if ( tex && _seen.insert(tex).second )
+                {
+                    for( unsigned i=0; i<tex->getNumImages(); ++i )
+                    {
+                        const osg::Image* image = tex->getImage(i);
+                        if ( image )
+                            _bytes += image->getTotalSizeInBytesIncludingMipmaps();
+                    }
+                }
             }
         }
-    }
 
-    else
+        double                         _bytes;
+        std::set<const osg::Referenced*> _seen;
+    };
+
+    double estimateSize( osg::Object* object )
     {
-        SkinCache::Record rec;
-        if ( _skinCache.get(key, rec) )
-        {
-            output = rec.value();
-        }
+        SizeVisitor sv;
+        if ( osg::Node* node = dynamic_cast<osg::Node*>(object) )
+            node->accept( sv );
         else
-        {
-            output = skin->createStateSet( _dbOptions.get() );
-            if ( output.valid() )
-                _skinCache.insert( key, output.get() );
-        }
+            sv.applyStateSet( dynamic_cast<osg::StateSet*>(object) );
+
+        // count something for the objects themselves, so that the budget
+        // still bounds a cache of empty ones.
+        return sv._bytes + 1024.0;
     }
+}
 
-    return output.valid();
+//------------------------------------------------------------------------
+
+ResourceCache::ResourceCache(const osgDB::Options* dbOptions,
+                             bool                  threadSafe ) :
+_dbOptions    ( dbOptions ),
+_threadSafe   ( threadSafe ),
+_bytes        ( 0.0 ),
+_maxBytes     ( DEFAULT_MAX_BYTES ),
+_skinQueries  ( 0 ),
+_skinHits     ( 0 )
+{
+    //nop
 }
 
+void
+ResourceCache::setMaxBytes( double value )
+{
+    OptionalLock lock( _mutex, _threadSafe );
+    _maxBytes = value;
+    evict();
+}
 
-bool
-ResourceCache::getInstanceNode(InstanceResource*        res,
-                               osg::ref_ptr<osg::Node>& output)
+const CacheStats
+ResourceCache::getSkinStats() const
 {
-    output = 0L;
-    std::string key = res->getConfig().toJSON(false);
+    OptionalLock lock( _mutex, _threadSafe );
+    return CacheStats(
+        _skins.size(),
+        0,
+        _skinQueries,
+        _skinQueries > 0 ? (float)_skinHits/(float)_skinQueries : 0.0f );
+}
 
-    if ( _threadSafe )
-    {
-        // first check if it exists
-        {
-            Threading::ScopedReadLock shared( _instanceMutex );
+osg::ref_ptr<ResourceCache::Entry>
+ResourceCache::claim( Table& table, const Resource* res, bool& create )
+{
+    const std::string& key  = res->getCacheKey();
+    unsigned           hash = res->getCacheHash();
 
-            InstanceCache::Record rec;
-            if ( _instanceCache.get(key, rec) )
-            {
-                output = rec.value().get();
-            }
-        }
+    OptionalLock lock( _mutex, _threadSafe );
 
-        // no? exclusive lock and create it.
-        if ( !output.valid() )
+    if ( &table == &_skins )
+        _skinQueries++;
+
+    std::pair<Table::iterator, Table::iterator> range = table.equal_range( hash );
+    for( Table::iterator i = range.first; i != range.second; ++i )
+    {
+        Entry* entry = i->second.get();
+        if ( entry->_key == key )
         {
-            Threading::ScopedWriteLock exclusive( _instanceMutex );
-            
-            // double check to avoid race condition
-            InstanceCache::Record rec;
-            if ( _instanceCache.get(key, rec) )
-            {
-                output = rec.value().get();
-            }
-            else
+            if ( entry->_cached )
             {
-                // still not there, make it.
-                output = res->createNode( _dbOptions.get() );
-                if ( output.valid() )
-                    _instanceCache.insert( key, output.get() );
+                _lru.splice( _lru.begin(), _lru, entry->_lru );
             }
+            if ( &table == &_skins )
+                _skinHits++;
+
+            create = false;
+            return entry;
         }
     }
 
-    else
+    osg::ref_ptr<Entry> entry = new Entry();
+    entry->_key   = key;
+    entry->_hash  = hash;
+    entry->_table = &table;
+    table.insert( std::make_pair(hash, entry) );
+    create = true;
+    return entry;
+}
+
+void
+ResourceCache::publish( Entry* entry, osg::Object* object )
+{
+    // do the estimate before taking the lock; it traverses the object.
+    double size = object ? estimateSize( object ) : 0.0;
     {
-        InstanceCache::Record rec;
-        if ( _instanceCache.get(key, rec) )
+        OptionalLock lock( _mutex, _threadSafe );
+
+        entry->_object = object;
+
+        if ( object )
         {
-            output = rec.value().get();
+            entry->_size   = size;
+            entry->_cached = true;
+            _lru.push_front( entry );
+            entry->_lru = _lru.begin();
+            _bytes += size;
+            evict();
         }
         else
         {
-            output = res->createNode( _dbOptions.get() );
-            if ( output.valid() )
-                _instanceCache.insert( key, output.get() );
+            // don't remember failures; the next request will try again.
+            remove( entry );
         }
     }
 
-    return output.valid();
+    entry->_ready.set();
 }
 
+osg::Object*
+ResourceCache::wait( Entry* entry )
+{
+    while( !entry->_ready.isSet() )
+        entry->_ready.wait();
 
-bool
-ResourceCache::getMarkerNode(MarkerResource*          marker,
-                             osg::ref_ptr<osg::Node>& output)
+    return entry->_object.get();
+}
+
+void
+ResourceCache::evict()
 {
-    output = 0L;
-    std::string key = marker->getConfig().toJSON(false);
+    // never evict the most recent entry.
+    while( _maxBytes > 0.0 && _bytes > _maxBytes && _lru.size() > 1 )
+    {
+        Entry* victim = _lru.back();
+        _lru.pop_back();
+        _bytes -= victim->_size;
+        victim->_cached = false;
+        remove( victim );
+    }
+}
 
-    if ( _threadSafe )
+void
+ResourceCache::remove( Entry* entry )
+{
+    // callers waiting on the entry hold their own references to it.
+    Table& table = *entry->_table;
+    std::pair<Table::iterator, Table::iterator> range = table.equal_range( entry->_hash );
+    for( Table::iterator i = range.first; i != range.second; ++i )
     {
-        // first check if it exists
+        if ( i->second.get() == entry )
         {
-            Threading::ScopedReadLock shared( _markerMutex );
-
-            MarkerCache::Record rec;
-            if ( _markerCache.get(key, rec) )
-            {
-                output = rec.value().get();
-            }
+            table.erase( i );
+            break;
         }
+    }
+}
 
-        // no? exclusive lock and create it.
-        if ( !output.valid() )
-        {
-            Threading::ScopedWriteLock exclusive( _markerMutex );
-            
-            // double check to avoid race condition
-            MarkerCache::Record rec;
-            if ( _markerCache.get( key, rec ) )
-            {
-                output = rec.value().get();
-            }
-            else
-            {
-                // still not there, make it.
-                output = marker->createNode( _dbOptions.get() );
-                if ( output.valid() )
-                    _markerCache.insert( key, output.get() );
-            }
-        }
+bool
+ResourceCache::getStateSet(SkinResource*                skin,
+                           osg::ref_ptr<osg::StateSet>& output)
+{
+    bool create;
+    osg::ref_ptr<Entry> entry = claim( _skins, skin, create );
+
+    if ( create )
+    {
+        // create it without holding any locks; anyone else who wants the
+        // same skin waits on the entry.
+        publish( entry.get(), skin->createStateSet(_dbOptions.get()) );
     }
 
-    else
+    output = dynamic_cast<osg::StateSet*>( wait(entry.get()) );
+    return output.valid();
+}
+
+
+bool
+ResourceCache::getInstanceNode(InstanceResource*        res,
+                               osg::ref_ptr<osg::Node>& output)
+{
+    bool create;
+    osg::ref_ptr<Entry> entry = claim( _instances, res, create );
+
+    if ( create )
     {
-        MarkerCache::Record rec;
-        if ( _markerCache.get( key, rec ) )
-        {
-            output = rec.value().get();
-        }
-        else
-        {
-            output = marker->createNode( _dbOptions.get() );
-            if ( output.valid() )
-                _markerCache.insert( key, output.get() );
-        }
+        publish( entry.get(), res->createNode(_dbOptions.get()) );
+    }
+
+    output = dynamic_cast<osg::Node*>( wait(entry.get()) );
+    return output.valid();
+}
+
+
+bool
+ResourceCache::getMarkerNode(MarkerResource*          marker,
+                             osg::ref_ptr<osg::Node>& output)
+{
+    bool create;
+    osg::ref_ptr<Entry> entry = claim( _markers, marker, create );
+
+    if ( create )
+    {
+        publish( entry.get(), marker->createNode(_dbOptions.get()) );
     }
 
+    output = dynamic_cast<osg::Node*>( wait(entry.get()) );
     return output.valid();
 }
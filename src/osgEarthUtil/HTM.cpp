@@ -87,25 +87,14 @@ HTMNode::Triangle::getMidpoints(osg::Vec3d* w) const
 
 //-----------------------------------------------------------------------
 
-HTMNode::HTMNode(HTMGroup*         root,
-                 const osg::Vec3d& v0, 
-                 const osg::Vec3d& v1, 
-                 const osg::Vec3d& v2)
+namespace
 {
-    this->setCullingActive(false);
-
-    _root = root;
-    _tri.set( v0, v1, v2 );
-    _dataCount = 0;
-
-    // init the bounding sphere
-    _bs.expandBy( _tri._v[0] * 6380000);
-    _bs.expandBy( _tri._v[1] * 6380000);
-    _bs.expandBy( _tri._v[2] * 6380000);
+    // deepest level of the mesh; keeps co-located objects from splitting forever
+    const unsigned s_maxDepth = 20;
 
-    if ( true )
+    osg::Geode* makeDebugGeode(const osg::Vec3d& v0, const osg::Vec3d& v1, const osg::Vec3d& v2)
     {
-        _debugGeode = new osg::Geode();
+        osg::Geode* geode = new osg::Geode();
         osg::Geometry* g = new osg::Geometry();
         osg::Vec3Array* v = new osg::Vec3Array();
         v->push_back( v0 * 6372000 );
@@ -118,14 +107,15 @@ HTMNode::HTMNode(HTMGroup*         root,
         g->setColorBinding( osg::Geometry::BIND_OVERALL );
         g->addPrimitiveSet( new osg::DrawArrays(GL_LINE_LOOP, 0, 3) );
         g->getOrCreateStateSet()->setMode(GL_LIGHTING, 0);
-        _debugGeode->addDrawable( g );
-        _debugGeode->getOrCreateStateSet()->setRenderBinDetails(INT_MAX, "DepthSortedBin");
-        _debugGeode->getOrCreateStateSet()->setMode(GL_DEPTH_TEST, 0);
+        geode->addDrawable( g );
+        geode->getOrCreateStateSet()->setRenderBinDetails(INT_MAX, "DepthSortedBin");
+        geode->getOrCreateStateSet()->setMode(GL_DEPTH_TEST, 0);
+        return geode;
     }
 
+    osg::Geode* makeClusterGeode(const osg::Vec3d& v0, const osg::Vec3d& v1, const osg::Vec3d& v2)
     {
         osgText::Text* text = new osgText::Text();
-        text->setText("Hi.");
         text->setCharacterSizeMode(osgText::Text::SCREEN_COORDS);
         text->setCharacterSize(48.0f);
         text->setAutoRotateToScreen(true);
@@ -138,144 +128,80 @@ HTMNode::HTMNode(HTMGroup*         root,
         geode->getOrCreateStateSet()->setRenderBinDetails(INT_MAX, "DepthSortedBin");
         geode->getOrCreateStateSet()->setMode(GL_DEPTH_TEST, 0);
         geode->setCullingActive( false );
-        _clusterNode = geode;
+        return geode;
     }
 }
 
-HTMNode*
-HTMNode::insert(osg::Node* node)
-{
-    HTMNode* leaf = this;
+//-----------------------------------------------------------------------
 
-    dirtyBound();
+HTMNode::HTMNode(HTMGroup*         root,
+                 HTMNode*          parent,
+                 const osg::Vec3d& v0, 
+                 const osg::Vec3d& v1, 
+                 const osg::Vec3d& v2)
+{
+    this->setCullingActive(false);
 
-    _data.push_back( node );
+    _root = root;
+    _parent = parent;
+    _tri.set( v0, v1, v2 );
+    _dataCount = 0;
+    _depth = parent ? parent->_depth + 1 : 0;
+    _dirty = false;
+    _clusterCount = 0;
 
-    if (_data.size() >= _root->getSplitThreshold() &&
-        getNumChildren() == 0 )
-    {
-        split();
-    }
+    // init the bounding sphere
+    _bs.expandBy( _tri._v[0] * 6380000);
+    _bs.expandBy( _tri._v[1] * 6380000);
+    _bs.expandBy( _tri._v[2] * 6380000);
+}
 
-    if ( _children.size() > 0 )
+void
+HTMNode::adjustCount(int delta)
+{
+    for(HTMNode* node = this; node; node = node->_parent)
     {
-        const osg::Vec3d& p = node->getBound().center();
-
-        for(unsigned i=0; i<_children.size(); ++i)
-        {
-            HTMNode* child = dynamic_cast<HTMNode*>(_children[i].get());
-            if ( child && child->contains(p) )
-            {
-                leaf = child->insert(node);
-                break;
-            }
-        }
+        node->_dataCount += delta;
+        node->_dirty = true;
     }
+}
 
-    _dataCount++;
-
-    dynamic_cast<osgText::Text*>(dynamic_cast<osg::Geode*>(_clusterNode.get())->getDrawable(0))
-        ->setText( Stringify() << _dataCount );
-
-    return leaf;
+void
+HTMNode::insert(osg::Node* node)
+{
+    _data.push_back( node );
+    adjustCount( 1 );
 }
 
 bool
 HTMNode::remove(osg::Node* node)
 {
-    NodeList::iterator i = std::find( _data.begin(), _data.end(), node );
-    if ( i != _data.end() )
+    for(unsigned i=0; i<_data.size(); ++i)
     {
-        dirtyBound();
-
-        _data.erase( i );
-        _dataCount--;
-
-        bool found = false;
-        for(unsigned i=0; i<_children.size() && !found; ++i)
+        if ( _data[i].get() == node )
         {
-            HTMNode* child = dynamic_cast<HTMNode*>(_children[i].get());
-            if ( child )
-            {
-                found = child->remove( node );
-            }
+            // order doesn't matter, so swap with the back.
+            _data[i] = _data.back();
+            _data.pop_back();
+            adjustCount( -1 );
+            return true;
         }
-
-        return found;
-    }
-    else
-    {
-        return false;
     }
+    return false;
 }
 
 HTMNode*
-HTMNode::findLeaf(osg::Node* node)
-{
-    HTMNode* leaf = 0L;
-
-    NodeList::iterator i = std::find( _data.begin(), _data.end(), node );
-    if ( i != _data.end() )
-    {
-        leaf = this;
-        for(unsigned i=0; i<_children.size(); ++i)
-        {
-            HTMNode* child = dynamic_cast<HTMNode*>(_children[i].get());
-            HTMNode* leaf2 = child->findLeaf( node );
-            if ( leaf2 )
-            {
-                leaf = leaf2;
-                break;
-            }
-        }
-    }
-
-    return leaf;
-}
-
-bool
-HTMNode::refresh(osg::Node* node)
+HTMNode::findChild(const osg::Vec3d& p) const
 {
-    const osg::Vec3d& p = node->getBound().center();
-
-    if ( contains(p) )
+    for(unsigned i=0; i<_children.size(); ++i)
     {
-        // already in this node; if there are children, re-insert
-        // into the new child.
-        if ( _children.size() > 0 )
-        {
-            for(unsigned i=0; i<_children.size(); ++i)
-            {
-                HTMNode* child = dynamic_cast<HTMNode*>(_children[i].get());
-                if ( child && child->contains(p) )
-                {
-                    child->insert(node);
-                    break;
-                }
-            }
-        }
-        return true; // done.
+        HTMNode* child = static_cast<HTMNode*>(_children[i].get());
+        if ( child->contains(p) )
+            return child;
     }
-    else
-    {
-        std::remove( _data.begin(), _data.end(), node );
-        _dataCount--;
-
-        HTMNode* parentNode = dynamic_cast<HTMNode*>( getParent(0) );
-        if ( parentNode )
-        {
-            return parentNode->refresh( node );
-        }
-        HTMGroup* parentGroup = dynamic_cast<HTMGroup*>( getParent(0) );
-        if ( parentGroup )
-        {
-            return parentGroup->addChild( node );
-        }
 
-        // should never get here
-        OE_WARN << LC << "trouble." << std::endl;
-        return false;
-    }
+    // numerical edge case; the center triangle is as good as any.
+    return static_cast<HTMNode*>(_children.back().get());
 }
 
 void
@@ -289,47 +215,94 @@ HTMNode::split()
 
     // split into four children, each wound CCW
     HTMNode* c[4];
-    c[0] = new HTMNode(_root, _tri._v[0], w[0], w[2]);
-    c[1] = new HTMNode(_root, _tri._v[1], w[1], w[0]);
-    c[2] = new HTMNode(_root, _tri._v[2], w[2], w[1]);
-    c[3] = new HTMNode(_root, w[0], w[1], w[2]);
-
-    // distibute the data amongst the children
-    for(NodeList::iterator i = _data.begin(); i != _data.end(); ++i)
-    {
-        osg::Node* node = i->get();
-        const osg::BoundingSphere& bs = node->getBound();
-        
-        osg::Vec3d p = node->getBound().center();
-        p.normalize(); // need?
-
-        for(unsigned j=0; j<4; ++j)
-        {
-            if ( c[j]->contains(p) )
-            {
-                c[j]->insert( node );
-                break;
-            }
-        }
-    }
+    c[0] = new HTMNode(_root, this, _tri._v[0], w[0], w[2]);
+    c[1] = new HTMNode(_root, this, _tri._v[1], w[1], w[0]);
+    c[2] = new HTMNode(_root, this, _tri._v[2], w[2], w[1]);
+    c[3] = new HTMNode(_root, this, w[0], w[1], w[2]);
 
     // add the node children
     for(unsigned i=0; i<4; ++i)
     {
         c[i]->setName( Stringify() << getName() << i );
+        c[i]->_dirty = true;
         osg::Group::addChild( c[i] );
+    }
+
+    // distibute the data amongst the children. The count of this cell
+    // doesn't change, so don't go through adjustCount.
+    NodeList data;
+    data.swap( _data );
+    for(NodeList::iterator i = data.begin(); i != data.end(); ++i)
+    {
+        osg::Node* node = i->get();
+        HTMNode* child = findChild( node->getBound().center() );
+        child->_data.push_back( node );
+        child->_dataCount++;
+        _root->_nodeTable[node] = child;
+    }
 
+    for(unsigned i=0; i<4; ++i)
+    {
         OE_DEBUG << LC << "  htmid " << c[i]->getName() << " size = " << c[i]->dataCount() << std::endl;
     }
 }
 
+void
+HTMNode::collectData(std::vector< osg::ref_ptr<osg::Node> >& output)
+{
+    output.insert( output.end(), _data.begin(), _data.end() );
+    for(unsigned i=0; i<_children.size(); ++i)
+    {
+        static_cast<HTMNode*>(_children[i].get())->collectData( output );
+    }
+}
+
 void
 HTMNode::merge()
 {
-    dirtyBound();
+    OE_DEBUG << LC << "Merging htmid:" << getName() << std::endl;
+
+    NodeList data;
+    for(unsigned i=0; i<_children.size(); ++i)
+    {
+        static_cast<HTMNode*>(_children[i].get())->collectData( data );
+    }
+
+    osg::Group::removeChildren( 0, getNumChildren() );
+
+    _data.swap( data );
+    for(NodeList::iterator i = _data.begin(); i != _data.end(); ++i)
+    {
+        _root->_nodeTable[i->get()] = this;
+    }
+}
+
+void
+HTMNode::rebalance()
+{
+    if ( !_dirty )
+        return;
+
+    _dirty = false;
 
-    OE_INFO << LC << "Merging htmid:" << getName() << std::endl;
-    //todo
+    if ( isLeaf() )
+    {
+        if ( _data.size() > _root->getSplitThreshold() && _depth < s_maxDepth )
+        {
+            split();
+            for(unsigned i=0; i<_children.size(); ++i)
+                static_cast<HTMNode*>(_children[i].get())->rebalance();
+        }
+    }
+    else if ( _dataCount < _root->getMergeThreshold() )
+    {
+        merge();
+    }
+    else
+    {
+        for(unsigned i=0; i<_children.size(); ++i)
+            static_cast<HTMNode*>(_children[i].get())->rebalance();
+    }
 }
 
 bool
@@ -422,21 +395,34 @@ HTMNode::traverse(osg::NodeVisitor& nv)
         // should we draw a clustering node instead of the data?
         if ( _root->getCluster() && (!isLeaf() || !inRange) )
         {
+            if ( !_clusterNode.valid() )
+            {
+                _clusterNode = makeClusterGeode( _tri._v[0], _tri._v[1], _tri._v[2] );
+                _clusterCount = ~0u;
+            }
+
+            if ( cull && _clusterCount != _dataCount )
+            {
+                osg::Geode* geode = static_cast<osg::Geode*>(_clusterNode.get());
+                static_cast<osgText::Text*>(geode->getDrawable(0))->setText( Stringify() << _dataCount );
+                _clusterCount = _dataCount;
+            }
+
             _clusterNode->accept(nv);
         }
 
         // draw the data itself?
         else if ( inRange )
         {
-            for(NodeList::iterator i = _data.begin(); i != _data.end(); ++i)
-            {
-                i->get()->accept( nv );
-            }
+            traverseData( nv );
         }
 
         // draw a debugging node?
-        if ( _debugGeode.valid() )
+        if ( _root->getDebug() )
         {
+            if ( !_debugGeode.valid() )
+                _debugGeode = makeDebugGeode( _tri._v[0], _tri._v[1], _tri._v[2] );
+
             _debugGeode->accept( nv );
         }
     }
@@ -464,6 +450,20 @@ HTMNode::traverse(osg::NodeVisitor& nv)
     }
 }
 
+void
+HTMNode::traverseData(osg::NodeVisitor& nv)
+{
+    for(NodeList::iterator i = _data.begin(); i != _data.end(); ++i)
+    {
+        i->get()->accept( nv );
+    }
+
+    for(unsigned i=0; i<_children.size(); ++i)
+    {
+        static_cast<HTMNode*>(_children[i].get())->traverseData( nv );
+    }
+}
+
 osg::BoundingSphere
 HTMNode::computeBound() const
 {
@@ -476,7 +476,7 @@ HTMNode::computeBound() const
 HTMGroup::HTMGroup() :
 _dataCount     ( 0 ),
 _splitThreshold( 48 ),
-_mergeThreshold( 48 ),
+_mergeThreshold( 12 ),
 _debug         ( false ),
 _cluster       ( false )
 {
@@ -492,14 +492,14 @@ _cluster       ( false )
     osg::Vec3d v5( 0, 0,-1);      // lat=-90  long=  0
 
     // CCW triangles.
-    osg::Group::addChild( new HTMNode(this, v0, v1, v2) );
-    osg::Group::addChild( new HTMNode(this, v0, v2, v3) );
-    osg::Group::addChild( new HTMNode(this, v0, v3, v4) );
-    osg::Group::addChild( new HTMNode(this, v0, v4, v1) );
-    osg::Group::addChild( new HTMNode(this, v5, v1, v4) );
-    osg::Group::addChild( new HTMNode(this, v5, v4, v3) );
-    osg::Group::addChild( new HTMNode(this, v5, v3, v2) );
-    osg::Group::addChild( new HTMNode(this, v5, v2, v1) );
+    osg::Group::addChild( new HTMNode(this, 0L, v0, v1, v2) );
+    osg::Group::addChild( new HTMNode(this, 0L, v0, v2, v3) );
+    osg::Group::addChild( new HTMNode(this, 0L, v0, v3, v4) );
+    osg::Group::addChild( new HTMNode(this, 0L, v0, v4, v1) );
+    osg::Group::addChild( new HTMNode(this, 0L, v5, v1, v4) );
+    osg::Group::addChild( new HTMNode(this, 0L, v5, v4, v3) );
+    osg::Group::addChild( new HTMNode(this, 0L, v5, v3, v2) );
+    osg::Group::addChild( new HTMNode(this, 0L, v5, v2, v1) );
 
     // HTMIDs.
     for(unsigned i=0; i<8; ++i)
@@ -508,60 +508,134 @@ _cluster       ( false )
     }
 }
 
-bool
-HTMGroup::insert(osg::Node* node)
+HTMNode*
+HTMGroup::findLeaf(const osg::Vec3d& p, HTMNode* start) const
 {
-    osg::Vec3d p = node->getBound().center();
-    p.normalize();
+    // climb to the first cell that contains the point:
+    HTMNode* cell = start;
+    while( cell && !cell->contains(p) )
+        cell = cell->_parent;
 
-    bool inserted = false;
-
-    for(unsigned i=0; i<8; ++i)
+    if ( !cell )
     {
-        HTMNode* child = static_cast<HTMNode*>(_children[i].get());
-        if ( child->contains(p) )
+        for(unsigned i=0; i<8 && !cell; ++i)
         {
-            child->insert(node);
-            inserted = true;
-            //_dataCount++;
-            break;
+            HTMNode* child = static_cast<HTMNode*>(_children[i].get());
+            if ( child->contains(p) )
+                cell = child;
         }
+        if ( !cell )
+            cell = static_cast<HTMNode*>(_children[0].get());
     }
 
-    return inserted;
+    // then descend to the leaf.
+    while( !cell->isLeaf() )
+        cell = cell->findChild( p );
+
+    return cell;
+}
+
+void
+HTMGroup::rebalance()
+{
+    for(unsigned i=0; i<8; ++i)
+    {
+        static_cast<HTMNode*>(_children[i].get())->rebalance();
+    }
 }
 
 bool
-HTMGroup::remove(osg::Node* node)
+HTMGroup::insert(osg::Node* node)
+{
+    if ( !node || _nodeTable.find(node) != _nodeTable.end() )
+        return false;
+
+    HTMNode* leaf = findLeaf( node->getBound().center(), 0L );
+    leaf->insert( node );
+    _nodeTable[node] = leaf;
+    _dataCount++;
+
+    return true;
+}
+
+bool
+HTMGroup::relocate(NodeMap::iterator i)
 {
-    bool found = false;
+    osg::Node* node = i->first;
+    HTMNode*   leaf = i->second;
+
+    const osg::Vec3d& p = node->getBound().center();
+    if ( leaf->contains(p) )
+        return false;
+
+    osg::ref_ptr<osg::Node> safeNode = node;
+    leaf->remove( node );
 
-    for(unsigned i=0; i<8 && !found; ++i)
+    HTMNode* newLeaf = findLeaf( p, leaf );
+    newLeaf->insert( node );
+    i->second = newLeaf;
+
+    return true;
+}
+
+bool
+HTMGroup::addChildren(const std::vector< osg::ref_ptr<osg::Node> >& nodes)
+{
+    // insert everything into the current leaves, then split each cell once.
+    bool ok = true;
+    for(unsigned i=0; i<nodes.size(); ++i)
     {
-        HTMNode* child = static_cast<HTMNode*>(_children[i].get());
-        found = child->remove( node );
+        ok = insert( nodes[i].get() ) && ok;
     }
+    rebalance();
+    return ok;
+}
+
+bool
+HTMGroup::remove(osg::Node* node)
+{
+    NodeMap::iterator i = _nodeTable.find( node );
+    if ( i == _nodeTable.end() )
+        return false;
+
+    osg::ref_ptr<osg::Node> safeNode = node;
+    i->second->remove( node );
+    _nodeTable.erase( i );
+    _dataCount--;
 
-    return found;
+    rebalance();
+    return true;
 }
 
 bool
 HTMGroup::refresh(osg::Node* node)
 {
-    HTMNode* leaf = 0L;
+    NodeMap::iterator i = _nodeTable.find( node );
+    if ( i == _nodeTable.end() )
+        return false;
 
-    for(unsigned i=0; i<8 && !leaf; ++i)
+    if ( relocate(i) )
+        rebalance();
+
+    return true;
+}
+
+unsigned
+HTMGroup::refresh(const std::vector<osg::Node*>& nodes)
+{
+    unsigned moved = 0;
+
+    for(unsigned n=0; n<nodes.size(); ++n)
     {
-        HTMNode* child = static_cast<HTMNode*>(_children[i].get());
-        leaf = child->findLeaf( node );
-        if ( leaf )
-        {
-            leaf->refresh( node );
-            break;
-        }
+        NodeMap::iterator i = _nodeTable.find( nodes[n] );
+        if ( i != _nodeTable.end() && relocate(i) )
+            ++moved;
     }
 
-    return leaf != 0L;
+    if ( moved > 0 )
+        rebalance();
+
+    return moved;
 }
 
 void 
@@ -573,13 +647,15 @@ HTMGroup::traverse(osg::NodeVisitor& nv)
 bool 
 HTMGroup::addChild(osg::Node* child)
 {
-    return insert( child );
+    bool inserted = insert( child );
+    rebalance();
+    return inserted;
 }
 
 bool 
 HTMGroup::insertChild(unsigned index, osg::Node* child)
 {
-    return insert( child );
+    return addChild( child );
 }
 
 bool 
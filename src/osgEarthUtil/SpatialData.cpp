@@ -24,6 +24,7 @@
 #include <osg/Geometry>
 #include <osg/Depth>
 #include <osgText/Text>
+#include <algorithm>
 #include <sstream>
 
 #define LC "[GeoGraph] "
@@ -84,21 +85,12 @@ namespace
         return geode;
     }
 
-    GeoObjectCollection::iterator
-    findObject( GeoObjectCollection& objects, GeoObject* object )
+    struct SortByPriorityDescending
     {
-        float key = object->getPriority();
-        GeoObjectCollection::iterator first = objects.find(key);
-        if ( first == objects.end() )
-            return objects.end();
-
-        GeoObjectCollection::iterator last = objects.upper_bound(key);
-        for( ; first != last; ++first )
-            if ( first->second.get() == object )
-                return first;
-
-        return objects.end();
-    }
+        bool operator()( const osg::ref_ptr<GeoObject>& lhs, const osg::ref_ptr<GeoObject>& rhs ) const {
+            return lhs->getPriority() > rhs->getPriority();
+        }
+    };
 }
 
 //------------------------------------------------------------------------
@@ -163,6 +155,21 @@ GeoGraph::insertObject( GeoObject* object )
     }
 }
 
+bool
+GeoGraph::insertObjects( const GeoObjectVector& objects )
+{
+    // highest priority first, so nothing gets bumped down after it lands.
+    GeoObjectVector sorted( objects );
+    std::stable_sort( sorted.begin(), sorted.end(), SortByPriorityDescending() );
+
+    bool ok = true;
+    for( GeoObjectVector::iterator i = sorted.begin(); i != sorted.end(); ++i )
+    {
+        ok = insertObject( i->get() ) && ok;
+    }
+    return ok;
+}
+
 //------------------------------------------------------------------------
 
 GeoCell::GeoCell(const GeoExtent& extent, float maxRange, unsigned maxObjects,
@@ -384,37 +391,72 @@ GeoCell::insertObject( GeoObject* object )
     osg::Vec3d location;
     if ( object->getLocation(location) && _extent.contains(location.x(), location.y()) )
     {
-        object->_cell = this;
-        _objects.insert( std::make_pair(object->getPriority(), object) );
+        return placeObject( object, location );
+    }
+    else
+    {
+        return false;
+    }
+}
+
+bool
+GeoCell::placeObject( GeoObject* object, const osg::Vec3d& location )
+{
+    osg::ref_ptr<GeoObject> obj = object;
+    osg::Vec3d loc = location;
+    GeoCell* cell = this;
 
-        if ( _objects.size() > _maxObjects )
+    while( cell )
+    {
+        // if the cell is full, the lowest-priority object (which may be the new
+        // one) moves down into a child cell.
+        if ( cell->_objects.size() >= cell->_maxObjects )
         {
-            GeoObjectCollection::iterator low = _objects.begin();
-            GeoObject* lowPriObject = low->second.get();
-            
-            if ( getNumChildren() == 0 )
-                split();
-
-            lowPriObject->getLocation(location);
-            unsigned index = getIndex(_extent, location, _splitDim, _splitDim);
-            bool insertedOK = static_cast<GeoCell*>(getChild(index))->insertObject( lowPriObject );
-            if ( insertedOK )
-            {
-                // remove it from this cell.
-                _objects.erase( low );
-            }
-            else
+            GeoObjectCollection::iterator low = cell->_objects.begin();
+            if ( obj->getPriority() > low->first )
             {
-                // should never ever happen..
-                OE_WARN << LC << "Object insertion failed" << std::endl;
-                return false;
+                osg::ref_ptr<GeoObject> lowPriObject = low->second.get();
+                cell->detachObject( lowPriObject.get() );
+
+                obj->_cell = cell;
+                obj->_slot = cell->_objects.insert( std::make_pair(obj->getPriority(), obj) );
+                cell->adjustCount( 1 );
+
+                obj = lowPriObject;
+                obj->getLocation( loc );
             }
+
+            if ( cell->getNumChildren() == 0 )
+                cell->split();
+
+            unsigned index = getIndex( cell->_extent, loc, cell->_splitDim, cell->_splitDim );
+            cell = static_cast<GeoCell*>( cell->getChild(index) );
+        }
+        else
+        {
+            obj->_cell = cell;
+            obj->_slot = cell->_objects.insert( std::make_pair(obj->getPriority(), obj) );
+            cell->adjustCount( 1 );
+            return true;
         }
-        return true;
     }
-    else
+
+    // should never ever happen..
+    OE_WARN << LC << "Object insertion failed" << std::endl;
+    return false;
+}
+
+void
+GeoCell::detachObject( GeoObject* object )
+{
+    // the collection holds a reference, so keep the object alive.
+    osg::ref_ptr<GeoObject> safeObject = object;
+    GeoCell* cell = object->_cell.get();
+    if ( cell )
     {
-        return false;
+        cell->_objects.erase( object->_slot );
+        object->_cell = 0L;
+        cell->adjustCount( -1 );
     }
 }
 
@@ -450,69 +492,148 @@ GeoCell::split()
 bool
 GeoCell::removeObject( GeoObject* object )
 {
-    if ( object->_cell.get() == this )
+    osg::ref_ptr<GeoCell> cell = object->getGeoCell();
+    if ( cell.valid() )
     {
-        object->_cell = 0L;
-        _objects.erase( findObject(_objects, object) );
-        adjustCount( -1 );
+        detachObject( object );
 
-        // if we just fell beneath the threshold, pull one up from below.
-        if ( _objects.size() == _minObjects-1 )
-        {
-            //TODO.
-        }
-
-        // TODO: rebalance, merge the tree, etc.
+        // if the branch got sparse enough, fold it back up.
+        cell->mergeUp();
         return true;
     }
-    else
+    return false;
+}
+
+void
+GeoCell::collectObjects( GeoObjectVector& output )
+{
+    for( GeoObjectCollection::iterator i = _objects.begin(); i != _objects.end(); ++i )
     {
-        for( unsigned i=0; i<getNumChildren(); ++i )
-        {
-            if ( static_cast<GeoCell*>(getChild(i))->removeObject( object ) )
-                return true;
-        }
+        i->second->_cell = 0L;
+        output.push_back( i->second.get() );
+    }
+    _objects.clear();
+    _count = 0;
+
+    for( unsigned i=0; i<getNumChildren(); ++i )
+    {
+        static_cast<GeoCell*>(getChild(i))->collectObjects( output );
     }
-    return false;
 }
 
 void
 GeoCell::merge()
 {
-    //NYI //TODO
+    // pull all the objects up from the child cells. The count doesn't change.
+    GeoObjectVector objects;
+    for( unsigned i=0; i<getNumChildren(); ++i )
+    {
+        static_cast<GeoCell*>(getChild(i))->collectObjects( objects );
+    }
+
+    removeChildren( 0, getNumChildren() );
+
+    for( GeoObjectVector::iterator i = objects.begin(); i != objects.end(); ++i )
+    {
+        GeoObject* object = i->get();
+        object->_cell = this;
+        object->_slot = _objects.insert( std::make_pair(object->getPriority(), object) );
+    }
 }
 
-bool
-GeoCell::reindexObject( GeoObject* object )
+void
+GeoCell::mergeUp()
 {
+    // find the topmost cell on the way to the root whose whole branch now
+    // fits comfortably in the cell itself. (_minObjects is lower than
+    // _maxObjects, so a merged cell won't split again right away.)
+    GeoCell* target = 0L;
+    for( GeoCell* cell = this; cell && cell->_depth > 0; )
+    {
+        if ( cell->getNumChildren() > 0 && cell->_count < cell->_minObjects )
+            target = cell;
+
+        cell = cell->getNumParents() > 0 ? dynamic_cast<GeoCell*>( cell->getParent(0) ) : 0L;
+    }
+
+    if ( target )
+        target->merge();
+}
+
+GeoCell*
+GeoCell::moveObject( GeoObject* object, bool& ok )
+{
+    ok = true;
+
     GeoCell* owner = object->getGeoCell();
-    if ( owner )
+    if ( !owner )
     {
-        osg::Vec3d location;
-        if ( object->getLocation(location) && !owner->_extent.contains(location.x(), location.y()) )
-        {
-            // first remove from its current cell
-            owner->removeObject( object );
+        ok = insertObject( object );
+        return 0L;
+    }
 
-            GeoCell* cell = dynamic_cast<GeoCell*>( owner->getParent(0) );
-            while( cell )
-            {
-                if ( cell->getExtent().contains(location.x(), location.y()) )
-                {
-                    if ( cell->insertObject( object ) )
-                        return true;
-                }
-                cell = dynamic_cast<GeoCell*>( cell->getParent(0) );
-            }
+    osg::Vec3d location;
+    if ( !object->getLocation(location) || owner->_extent.contains(location.x(), location.y()) )
+    {
+        // no change
+        return 0L;
+    }
+
+    // first remove from its current cell
+    GeoCell* cell = owner->getNumParents() > 0 ? dynamic_cast<GeoCell*>( owner->getParent(0) ) : 0L;
+    detachObject( object );
+
+    // then insert it into the first ancestor that contains it.
+    ok = false;
+    while( cell && !ok )
+    {
+        if ( cell->getExtent().contains(location.x(), location.y()) )
+        {
+            ok = cell->insertObject( object );
         }
+        cell = cell->getNumParents() > 0 ? dynamic_cast<GeoCell*>( cell->getParent(0) ) : 0L;
+    }
 
-        // no change
-        return true;
+    return owner;
+}
+
+bool
+GeoCell::reindexObject( GeoObject* object )
+{
+    osg::ref_ptr<GeoObject> safeObject = object;
+    bool ok;
+    osg::ref_ptr<GeoCell> vacated = moveObject( object, ok );
+    if ( vacated.valid() )
+        vacated->mergeUp();
+    return ok;
+}
+
+unsigned
+GeoCell::reindexObjects( const GeoObjectVector& objects )
+{
+    // move everything first, then merge the branches that lost objects.
+    unsigned moved = 0;
+    std::vector< osg::ref_ptr<GeoCell> > vacated;
+
+    for( GeoObjectVector::const_iterator i = objects.begin(); i != objects.end(); ++i )
+    {
+        bool ok;
+        GeoCell* cell = moveObject( i->get(), ok );
+        if ( cell )
+        {
+            vacated.push_back( cell );
+            ++moved;
+        }
     }
-    else
+
+    for( unsigned i=0; i<vacated.size(); ++i )
     {
-        return insertObject( object );
+        // skip cells that an earlier merge already removed.
+        if ( vacated[i]->getNumParents() > 0 )
+            vacated[i]->mergeUp();
     }
+
+    return moved;
 }
 
 #if 0
@@ -24,6 +24,7 @@
 #include <ogr_api.h>
 #include <osgEarthFeatures/OgrUtils>
 #include <osgDB/FileUtils>
+#include <algorithm>
 
 using namespace osgEarth;
 using namespace osgEarth::Util;
@@ -33,7 +34,8 @@ using namespace std;
 
 #define OGR_SCOPED_LOCK GDAL_SCOPED_LOCK
 
-TileIndex::TileIndex()
+TileIndex::TileIndex() :
+_rtreeDirty( 0u )
 {
 }
 
@@ -68,6 +70,21 @@ TileIndex*
     TileIndex* index = new TileIndex();
     index->_features = features.get();
     index->_filename = filename;
+
+    // read the whole index into memory, once.
+    osg::ref_ptr< FeatureCursor > cursor = features->createFeatureCursor( osgEarth::Symbology::Query() );
+    while (cursor.valid() && cursor->hasMore())
+    {
+        osg::ref_ptr< Feature > feature = cursor->nextFeature();
+        if (feature.valid())
+        {
+            index->addEntry( getFullPath(filename, feature->getString("location")), feature.get() );
+        }
+    }
+    index->buildTree();
+
+    OE_INFO << "[TileIndex] Loaded " << index->_files.size() << " files from " << filename << std::endl;
+
     return index;
 }
 
@@ -103,24 +120,98 @@ TileIndex*
 
 
 void
-    TileIndex::getFiles(const osgEarth::GeoExtent& extent, std::vector< std::string >& files)
-{            
+TileIndex::addEntry( const std::string& location, const Feature* feature )
+{
+    if ( !feature->getGeometry() )
+        return;
+
+    const SpatialReference* indexSRS = _features->getFeatureProfile()->getSRS();
+    GeoExtent extent( feature->getSRS() ? feature->getSRS() : indexSRS, feature->getGeometry()->getBounds() );
+    if ( extent.isValid() && indexSRS && !extent.getSRS()->isHorizEquivalentTo(indexSRS) )
+    {
+        extent = extent.transform( indexSRS );
+    }
+
+    if ( extent.isValid() )
+    {
+        _files.push_back( location );
+        _extents.push_back( extent );
+        _rtreeDirty.exchange( 1u );
+    }
+}
+
+void
+TileIndex::buildTree()
+{
+    _rtree.clear();
+    for (unsigned int i = 0; i < _extents.size(); i++)
+    {
+        GeoExtent west, east;
+        if ( _extents[i].crossesAntimeridian() && _extents[i].splitAcrossAntimeridian(west, east) )
+        {
+            _rtree.insert( west.xMin(), west.yMin(), west.xMax(), west.yMax(), i );
+            _rtree.insert( east.xMin(), east.yMin(), east.xMax(), east.yMax(), i );
+        }
+        else
+        {
+            _rtree.insert( _extents[i].xMin(), _extents[i].yMin(), _extents[i].xMax(), _extents[i].yMax(), i );
+        }
+    }
+    _rtree.build();
+    _rtreeDirty.exchange( 0u );
+}
+
+void
+TileIndex::getFiles(const osgEarth::GeoExtent& extent, std::vector< std::string >& files)
+{
+    std::vector< GeoExtent > extents;
+    getFiles( extent, files, extents );
+}
+
+void
+TileIndex::getFiles(const osgEarth::GeoExtent& extent, std::vector< std::string >& files, std::vector< GeoExtent >& extents)
+{
     files.clear();
-    osgEarth::Symbology::Query query;    
+    extents.clear();
+
+    // writers set the flag under the write lock; the atomic read lets the
+    // common case skip it.
+    if ( _rtreeDirty != 0u )
+    {
+        Threading::ScopedWriteLock exclusive( _mutex );
+        if ( _rtreeDirty != 0u )
+            buildTree();
+    }
 
     GeoExtent transformed = extent.transform( _features->getFeatureProfile()->getSRS() );
-    query.bounds() = transformed.bounds();
-    osg::ref_ptr< osgEarth::Features::FeatureCursor> cursor = _features->createFeatureCursor( query );
+    if ( !transformed.isValid() )
+        return;
 
-    while (cursor->hasMore())
+    std::vector< unsigned > ids;
     {
-        osg::ref_ptr< osgEarth::Features::Feature> feature = cursor->nextFeature();
-        if (feature.valid())
+        Threading::ScopedReadLock shared( _mutex );
+
+        GeoExtent west, east;
+        if ( transformed.crossesAntimeridian() && transformed.splitAcrossAntimeridian(west, east) )
         {
-            std::string location = getFullPath(_filename, feature->getString("location"));
-            files.push_back( location );
+            _rtree.query( west.xMin(), west.yMin(), west.xMax(), west.yMax(), ids );
+            _rtree.query( east.xMin(), east.yMin(), east.xMax(), east.yMax(), ids );
         }
-    }    
+        else
+        {
+            _rtree.query( transformed.xMin(), transformed.yMin(), transformed.xMax(), transformed.yMax(), ids );
+        }
+
+        // return the files in index order, without duplicates:
+        std::sort( ids.begin(), ids.end() );
+        ids.erase( std::unique(ids.begin(), ids.end()), ids.end() );
+
+        for (unsigned int i = 0; i < ids.size(); i++)
+        {
+            files.push_back( _files[ids[i]] );
+            extents.push_back( _extents[ids[i]] );
+        }
+    }
 }
 
 bool TileIndex::add( const std::string& filename, const GeoExtent& extent )
@@ -138,6 +229,10 @@ bool TileIndex::add( const std::string& filename, const GeoExtent& extent )
     const SpatialReference* wgs84 = SpatialReference::create("epsg:4326");
     feature->transform( wgs84 );
 
-    return _features->insertFeature( feature.get() );    
+    if ( !_features->insertFeature( feature.get() ) )
+        return false;
+
+    Threading::ScopedWriteLock exclusive( _mutex );
+    addEntry( getFullPath(_filename, filename), feature.get() );
     return true;
 }
@@ -0,0 +1,533 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2013 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarthUtil/TilePrefetcher>
+#include <osgEarth/Units>
+#include <osgEarth/CacheBin>
+#include <osg/View>
+#include <osg/Timer>
+#include <OpenThreads/Thread>
+#include <algorithm>
+#include <cstdlib>
+#include <float.h>
+
+#define LC "[TilePrefetcher] "
+
+using namespace osgEarth;
+using namespace osgEarth::Util;
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    // number of points to sample along the predicted path
+    const unsigned NUM_PREDICTION_STEPS = 4;
+
+    // how much camera history to use when estimating velocity (seconds)
+    const double VELOCITY_WINDOW = 0.5;
+
+    // most tiles per level around each predicted point (per axis)
+    const int MAX_TILE_SPAN = 7;
+
+    // how many recently fetched keys to remember
+    const unsigned MAX_WARM_KEYS = 4096;
+
+    // Whether the layer's cache already holds the tile.
+    bool isCachedInLayer( TerrainLayer* layer, const TileKey& key )
+    {
+        CacheBin* bin = layer->getCacheBin( key.getProfile() );
+        return
+            bin &&
+            bin->getRecordStatus( key.str(), layer->getCachePolicy().getMinAcceptTime() ) == CacheBin::STATUS_OK;
+    }
+
+    // Whether prefetching into the layer does any good.
+    bool isWarmable( TerrainLayer* layer, const TileKey& key )
+    {
+        return
+            layer &&
+            layer->getEnabled() &&
+            !layer->isCacheOnly() &&
+            layer->getCachePolicy().isCacheWriteable() &&
+            layer->getCacheBin( key.getProfile() ) != 0L &&
+            layer->isKeyValid( key );
+    }
+
+    struct SortByDistance
+    {
+        SortByDistance( int x, int y ) : _x(x), _y(y) { }
+        bool operator()( const std::pair<int,int>& a, const std::pair<int,int>& b ) const {
+            return
+                (std::abs(a.first-_x) + std::abs(a.second-_y)) <
+                (std::abs(b.first-_x) + std::abs(b.second-_y));
+        }
+        int _x, _y;
+    };
+}
+
+//------------------------------------------------------------------------
+
+struct TilePrefetcher::FetchRequest : public TaskRequest
+{
+    FetchRequest( TilePrefetcher* prefetcher, const TileKey& key, const MapFrame& mapf, float priority )
+        : TaskRequest  ( priority ),
+          _prefetcher  ( prefetcher ),
+          _key         ( key ),
+          _keyStr      ( key.str() ),
+          _imageLayers ( mapf.imageLayers() ),
+          _elevationLayers( mapf.elevationLayers() )
+    {
+        //nop
+    }
+
+    void operator()( ProgressCallback* progress )
+    {
+        for( ImageLayerVector::const_iterator i = _imageLayers.begin(); i != _imageLayers.end(); ++i )
+        {
+            if ( progress->isCanceled() )
+                break;
+
+            ImageLayer* layer = i->get();
+            if ( isWarmable(layer, _key) && !isCachedInLayer(layer, _key) )
+                layer->createImage( _key, progress );
+        }
+
+        for( ElevationLayerVector::const_iterator i = _elevationLayers.begin(); i != _elevationLayers.end(); ++i )
+        {
+            if ( progress->isCanceled() )
+                break;
+
+            ElevationLayer* layer = i->get();
+            if ( isWarmable(layer, _key) && !isCachedInLayer(layer, _key) )
+                layer->createHeightField( _key, progress );
+        }
+
+        _prefetcher->onFetchDone( this, progress->isCanceled() );
+    }
+
+    TilePrefetcher*      _prefetcher;
+    TileKey              _key;
+    std::string          _keyStr;
+    ImageLayerVector     _imageLayers;
+    ElevationLayerVector _elevationLayers;
+};
+
+//------------------------------------------------------------------------
+
+TilePrefetcher::TilePrefetcher( const Map* map ) :
+_mapf          ( map, Map::TERRAIN_LAYERS, "TilePrefetcher" ),
+_lookAhead     ( 3.0 ),
+_maxPending    ( 64 ),
+_maxLevel      ( 18 ),
+_rangeFactor   ( 6.0 ),
+_updateInterval( 0.25 ),
+_enabled       ( true ),
+_lastPrediction( -DBL_MAX )
+{
+    _service = new TaskService( "TilePrefetcher", 2 );
+}
+
+TilePrefetcher::~TilePrefetcher()
+{
+    cancel();
+
+    // joins the fetch threads, so no request calls back into a dead object.
+    _service = 0L;
+}
+
+void
+TilePrefetcher::setNumThreads( int value )
+{
+    _service->setNumThreads( osg::maximum(value, 1) );
+}
+
+int
+TilePrefetcher::getNumThreads() const
+{
+    return _service->getNumThreads();
+}
+
+void
+TilePrefetcher::setEnabled( bool value )
+{
+    _enabled = value;
+    if ( !_enabled )
+        cancel();
+}
+
+void
+TilePrefetcher::cancel()
+{
+    Threading::ScopedMutexLock lock( _mutex );
+
+    for( PendingMap::iterator i = _pending.begin(); i != _pending.end(); ++i )
+    {
+        i->second->cancel();
+        _stats._canceled++;
+    }
+    _pending.clear();
+    _samples.clear();
+    _velocity.set( 0.0, 0.0, 0.0 );
+    _lastPrediction = -DBL_MAX;
+}
+
+unsigned
+TilePrefetcher::getNumPending() const
+{
+    Threading::ScopedMutexLock lock( _mutex );
+    return _pending.size();
+}
+
+void
+TilePrefetcher::getStats( Stats& out ) const
+{
+    Threading::ScopedMutexLock lock( _mutex );
+    out = _stats;
+}
+
+void
+TilePrefetcher::resetStats()
+{
+    Threading::ScopedMutexLock lock( _mutex );
+    _stats = Stats();
+}
+
+void
+TilePrefetcher::update( const osg::Matrixd& viewMatrix, double time )
+{
+    if ( !_enabled )
+        return;
+
+    Sample sample;
+    sample._eye  = osg::Matrixd::inverse(viewMatrix).getTrans();
+    sample._time = time;
+
+    std::vector<TileKey> keys;
+    {
+        Threading::ScopedMutexLock lock( _mutex );
+
+        // time went backwards (e.g. a replay restarted); start over.
+        if ( !_samples.empty() && time < _samples.back()._time )
+        {
+            _samples.clear();
+            _lastPrediction = -DBL_MAX;
+        }
+
+        _samples.push_back( sample );
+        while( _samples.size() > 2 && time - _samples.front()._time > VELOCITY_WINDOW )
+            _samples.pop_front();
+
+        // average velocity over the window smooths out frame jitter.
+        double dt = time - _samples.front()._time;
+        if ( dt > 0.0 )
+            _velocity = (sample._eye - _samples.front()._eye) / dt;
+
+        if ( time - _lastPrediction < _updateInterval )
+            return;
+
+        _lastPrediction = time;
+    }
+
+    _mapf.sync();
+
+    predict( keys );
+    schedule( keys );
+}
+
+void
+TilePrefetcher::predict( std::vector<TileKey>& out )
+{
+    osg::Vec3d eye, velocity;
+    {
+        Threading::ScopedMutexLock lock( _mutex );
+        if ( _samples.empty() )
+            return;
+        eye      = _samples.back()._eye;
+        velocity = _velocity;
+    }
+
+    std::set<TileKey> seen;
+
+    // nearest future first, so the queue serves the most urgent tiles first.
+    for( unsigned step = 1; step <= NUM_PREDICTION_STEPS; ++step )
+    {
+        double t = _lookAhead * (double)step / (double)NUM_PREDICTION_STEPS;
+
+        std::vector<TileKey> keys;
+        getKeysForEye( eye + velocity*t, keys );
+
+        for( std::vector<TileKey>::const_iterator k = keys.begin(); k != keys.end(); ++k )
+        {
+            if ( seen.insert(*k).second )
+                out.push_back( *k );
+        }
+    }
+}
+
+void
+TilePrefetcher::getKeysForEye( const osg::Vec3d& eyeWorld, std::vector<TileKey>& out ) const
+{
+    const Profile* profile = _mapf.getProfile();
+    if ( !profile )
+        return;
+
+    const SpatialReference* srs = profile->getSRS();
+
+    osg::Vec3d eye;
+    if ( !srs->transformFromWorld(eyeWorld, eye) )
+        return;
+
+    // don't let an extrapolated path go underground.
+    double height = osg::maximum( eye.z(), 1.0 );
+
+    // meters per profile unit at the eye point.
+    double mx, my;
+    if ( srs->isGeographic() )
+    {
+        my = srs->getEllipsoid()->getRadiusEquator() * osg::PI / 180.0;
+        mx = my * cos( osg::DegreesToRadians( osg::clampBetween(eye.y(), -89.0, 89.0) ) );
+    }
+    else
+    {
+        mx = my = srs->getUnits().convertTo( Units::METERS, 1.0 );
+    }
+
+    const GeoExtent& pex = profile->getExtent();
+    double eps = 1e-9 * osg::maximum( pex.width(), pex.height() );
+    double cx  = osg::clampBetween( eye.x(), pex.xMin() + eps, pex.xMax() - eps );
+    double cy  = osg::clampBetween( eye.y(), pex.yMin() + eps, pex.yMax() - eps );
+
+    // the root tiles are always resident.
+    profile->getRootKeys( out );
+
+    for( unsigned lod = 1; lod <= _maxLevel; ++lod )
+    {
+        // a level shows up once the camera is within range of the parent tiles.
+        double tw, th;
+        profile->getTileDimensions( lod-1, tw, th );
+        double pw = tw * mx, ph = th * my;
+        double range = _rangeFactor * 0.5 * sqrt( pw*pw + ph*ph );
+        if ( height >= range )
+            break;
+
+        double reach = sqrt( range*range - height*height );
+        double rx = reach / mx, ry = reach / my;
+
+        TileKey center = profile->createTileKey( cx, cy, lod );
+        TileKey ll     = profile->createTileKey( osg::clampAbove(cx - rx, pex.xMin() + eps), osg::clampAbove(cy - ry, pex.yMin() + eps), lod );
+        TileKey ur     = profile->createTileKey( osg::clampBelow(cx + rx, pex.xMax() - eps), osg::clampBelow(cy + ry, pex.yMax() - eps), lod );
+        if ( !center.valid() || !ll.valid() || !ur.valid() )
+            continue;
+
+        unsigned x0, y0, x1, y1, xc, yc;
+        ll.getTileXY( x0, y0 );
+        ur.getTileXY( x1, y1 );
+        center.getTileXY( xc, yc );
+
+        // tile rows count down from the top, so sort the corners.
+        int xmin = (int)osg::minimum(x0, x1), xmax = (int)osg::maximum(x0, x1);
+        int ymin = (int)osg::minimum(y0, y1), ymax = (int)osg::maximum(y0, y1);
+        xmin = osg::maximum( xmin, (int)xc - MAX_TILE_SPAN/2 );
+        xmax = osg::minimum( xmax, (int)xc + MAX_TILE_SPAN/2 );
+        ymin = osg::maximum( ymin, (int)yc - MAX_TILE_SPAN/2 );
+        ymax = osg::minimum( ymax, (int)yc + MAX_TILE_SPAN/2 );
+
+        std::vector< std::pair<int,int> > tiles;
+        for( int y = ymin; y <= ymax; ++y )
+            for( int x = xmin; x <= xmax; ++x )
+                tiles.push_back( std::make_pair(x, y) );
+
+        std::stable_sort( tiles.begin(), tiles.end(), SortByDistance((int)xc, (int)yc) );
+
+        for( std::vector< std::pair<int,int> >::const_iterator t = tiles.begin(); t != tiles.end(); ++t )
+            out.push_back( TileKey(lod, t->first, t->second, profile) );
+    }
+}
+
+void
+TilePrefetcher::schedule( const std::vector<TileKey>& keys )
+{
+    Threading::ScopedMutexLock lock( _mutex );
+
+    _stats._predicted += keys.size();
+
+    std::set<std::string> wanted;
+    for( std::vector<TileKey>::const_iterator k = keys.begin(); k != keys.end(); ++k )
+        wanted.insert( k->str() );
+
+    // cancel queued fetches that fell off the predicted path. (Fetches that
+    // already started are left to finish; they'll be useful soon enough.)
+    for( PendingMap::iterator i = _pending.begin(); i != _pending.end(); )
+    {
+        if ( i->second->isPending() && wanted.find(i->first) == wanted.end() )
+        {
+            i->second->cancel();
+            _pending.erase( i++ );
+            _stats._canceled++;
+        }
+        else ++i;
+    }
+
+    // the task queue serves the lowest priority value first.
+    float priority = 0.0f;
+    for( std::vector<TileKey>::const_iterator k = keys.begin(); k != keys.end(); ++k )
+    {
+        std::string keyStr = k->str();
+        if ( _pending.find(keyStr) != _pending.end() || _warm.find(keyStr) != _warm.end() )
+            continue;
+
+        if ( _pending.size() >= _maxPending )
+        {
+            _stats._dropped++;
+            continue;
+        }
+
+        FetchRequest* request = new FetchRequest( this, *k, _mapf, priority );
+        priority += 1.0f;
+
+        _pending[keyStr] = request;
+        _service->add( request );
+        _stats._queued++;
+    }
+}
+
+void
+TilePrefetcher::onFetchDone( FetchRequest* request, bool canceled )
+{
+    Threading::ScopedMutexLock lock( _mutex );
+
+    PendingMap::iterator i = _pending.find( request->_keyStr );
+    if ( i != _pending.end() && i->second.get() == request )
+        _pending.erase( i );
+
+    if ( !canceled )
+    {
+        _stats._fetched++;
+
+        if ( _warm.insert(request->_keyStr).second )
+        {
+            _warmOrder.push_back( request->_keyStr );
+            if ( _warmOrder.size() > MAX_WARM_KEYS )
+            {
+                _warm.erase( _warmOrder.front() );
+                _warmOrder.pop_front();
+            }
+        }
+    }
+}
+
+void
+TilePrefetcher::replay( const osg::AnimationPath* path, double frameRate, bool realTime )
+{
+    if ( !path || frameRate <= 0.0 || path->empty() )
+        return;
+
+    double t0 = path->getFirstTime();
+    double t1 = path->getLastTime();
+    osg::Timer_t start = osg::Timer::instance()->tick();
+
+    OE_INFO << LC << "Replaying " << (t1-t0) << "s camera path at " << frameRate << " Hz" << std::endl;
+
+    for( double t = t0; t <= t1; t += 1.0/frameRate )
+    {
+        osg::Matrixd cameraMatrix;
+        if ( !path->getMatrix(t, cameraMatrix) )
+            continue;
+
+        _mapf.sync();
+
+        // what the terrain engine needs right now; fetch the misses in the
+        // foreground just like it would.
+        std::vector<TileKey> keys;
+        getKeysForEye( cameraMatrix.getTrans(), keys );
+
+        unsigned demanded = 0, hits = 0;
+        for( std::vector<TileKey>::const_iterator k = keys.begin(); k != keys.end(); ++k )
+        {
+            for( ImageLayerVector::const_iterator i = _mapf.imageLayers().begin(); i != _mapf.imageLayers().end(); ++i )
+            {
+                ImageLayer* layer = i->get();
+                if ( !isWarmable(layer, *k) )
+                    continue;
+
+                ++demanded;
+                if ( isCachedInLayer(layer, *k) )
+                    ++hits;
+                else
+                    layer->createImage( *k );
+            }
+
+            for( ElevationLayerVector::const_iterator i = _mapf.elevationLayers().begin(); i != _mapf.elevationLayers().end(); ++i )
+            {
+                ElevationLayer* layer = i->get();
+                if ( !isWarmable(layer, *k) )
+                    continue;
+
+                ++demanded;
+                if ( isCachedInLayer(layer, *k) )
+                    ++hits;
+                else
+                    layer->createHeightField( *k );
+            }
+        }
+
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            _stats._demanded += demanded;
+            _stats._hits     += hits;
+        }
+
+        update( osg::Matrixd::inverse(cameraMatrix), t );
+
+        if ( realTime )
+        {
+            double elapsed = osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+            double ahead   = (t - t0) - elapsed;
+            if ( ahead > 0.0 )
+                OpenThreads::Thread::microSleep( (unsigned)(ahead * 1e6) );
+        }
+    }
+
+    Stats stats;
+    getStats( stats );
+    OE_INFO << LC << "Replay done: hit rate " << (100.0*stats.getHitRate()) << "%, "
+        << stats._fetched << " prefetched, " << stats._canceled << " canceled, "
+        << stats._dropped << " dropped" << std::endl;
+}
+
+//------------------------------------------------------------------------
+
+TilePrefetchHandler::TilePrefetchHandler( TilePrefetcher* prefetcher ) :
+_prefetcher( prefetcher )
+{
+    //nop
+}
+
+bool
+TilePrefetchHandler::handle( const osgGA::GUIEventAdapter& ea, osgGA::GUIActionAdapter& aa )
+{
+    if ( ea.getEventType() == osgGA::GUIEventAdapter::FRAME && _prefetcher.valid() )
+    {
+        osg::View* view = aa.asView();
+        if ( view && view->getCamera() )
+        {
+            _prefetcher->update( view->getCamera()->getViewMatrix(), ea.getTime() );
+        }
+    }
+    return false;
+}